@@ -0,0 +1,1260 @@
+/**
+ * ========================================================================
+ *    LIBCALC BENCHMARKS - Lexer, Parser and Evaluator Throughput
+ * ========================================================================
+ *
+ * Measures ns/op and allocations/op of get_next_token(), convert_to_rpn(),
+ * RPN evaluation and the complete calc_evaluate() call over generated
+ * corpora. One "op" is one expression of the corpus. The trig corpus also
+ * measures the batch degree kernels (sin, cos and tan of one angle per op),
+ * the aggregate corpus streaming statistics (a CalcStats fed one block
+ * of BENCH_STREAM_BLOCK values per op, 8 MiB per pass), and the matrix
+ * corpus the blocked matrix product (one BENCH_PRODUCT_SIZE square product
+ * per op). The iterate corpus runs recurrences of BENCH_ITERATE_STEPS
+ * steps, so its eval ns/op over that is the cost of one step. The
+ * functions corpus is also stored in a formula library (in $TMPDIR or
+ * /tmp, removed afterwards), whose phase looks up one formula by name and
+ * takes its program per op - the cost that replaces its rpn phase.
+ *
+ * Usage:
+ *     calc_bench [--min-time SECONDS] [--repetitions N] [--output FILE]
+ *                [--filter CORPUS] [--baseline FILE] [--threshold PERCENT]
+ *     calc_bench --stress [--min-time SECONDS] [--output FILE]
+ *     calc_bench --service SOCKET [--min-time SECONDS] [--output FILE]
+ *
+ * Each phase is timed in --repetitions windows (default
+ * BENCH_DEFAULT_REPETITIONS) that together take --min-time; ns_per_op is
+ * their median and ns_min the fastest. Every round of windows visits all
+ * phases, so the windows of one phase are spread over the whole run.
+ * Results are written as JSON lines (stdout unless --output is given):
+ *     {"corpus":"short","phase":"lex","ns_per_op":41.2,"ns_min":40.8,...}
+ * With --baseline, results are compared against a previous run and the
+ * exit status is 1 if any phase allocates more than before, or if its
+ * fastest window got slower than the threshold (default 10%) plus the
+ * spread between median and fastest window of both runs, so the noise of
+ * the machine does not count as a regression.
+ *
+ * --stress instead feeds single expressions of 1 KiB up to 1 MiB (deep
+ * nesting, long chains) with the context's limits disabled, and reports
+ * parse and evaluation time per input byte:
+ *     {"stress":"nested","bytes":1024,"rpn_ns_per_byte":3.1,...}
+ * The exit status is 1 if the time per byte of the largest input exceeds
+ * the smallest one's by more than STRESS_MAX_GROWTH, i.e. if the engine
+ * stopped being linear in the input size.
+ *
+ * --service measures a running "calculator --serve SOCKET" instead: the
+ * short corpus is pipelined over one connection in rounds of
+ * SERVICE_BATCH_LINES requests, and evaluations per second are reported:
+ *     {"service":"short","requests":1048576,"evals_per_sec":2.1e6,...}
+ */
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "../libcalc/calc_internal.h"
+
+#define BENCH_CORPUS_SIZE 256       // Expressions generated per corpus
+#define BENCH_MAX_RESULTS 64        // Upper bound on corpus x phase results
+#define BENCH_DEFAULT_MIN_TIME 0.2  // Seconds spent measuring each phase
+#define BENCH_DEFAULT_REPETITIONS 7  // Timed windows per phase
+#define BENCH_MAX_REPETITIONS 101    // Upper bound on --repetitions
+#define BENCH_STREAM_BLOCK 4096     // Values streamed per op
+#define BENCH_PRODUCT_SIZE 64       // Rows and columns of product operands
+#define BENCH_ITERATE_STEPS 1000    // Steps of each iterate() expression
+#define STRESS_MIN_BYTES 1024           // Smallest stress expression
+#define STRESS_MAX_BYTES (1 << 20)      // Largest stress expression
+#define STRESS_MAX_GROWTH 4.0           // Allowed growth of ns per byte
+#define SERVICE_BATCH_LINES 65536       // Requests pipelined per round
+
+/**
+ * =======================================================================
+ *                            DATA STRUCTURES
+ * =======================================================================
+ */
+
+/**
+ * Growable character buffer used by the corpus generators
+ */
+typedef struct {
+    char *data;       // NUL-terminated contents
+    size_t length;    // Bytes used (without NUL)
+    size_t capacity;  // Bytes allocated
+} Buffer;
+
+/**
+ * Generated expressions plus their precompiled RPN for the eval phase
+ */
+typedef struct {
+    const char *name;                      // Corpus name used in reports
+    char *expressions[BENCH_CORPUS_SIZE];  // Generated expressions
+    TokenStack rpn[BENCH_CORPUS_SIZE];     // Owned copies of compiled RPN
+    int count;                             // Number of expressions
+    bool matrices;                         // RPN needs evaluate_rpn_matrix()
+    bool iteration;                        // RPN needs evaluate_rpn_iteration()
+} Corpus;
+
+/**
+ * One measured (corpus, phase) pair
+ */
+typedef struct {
+    char corpus[32];          // Corpus name
+    char phase[16];           // lex, rpn, eval or total
+    double ns_per_op;         // Median over the windows of ns/expression
+    double ns_min;            // Fastest window, in ns/expression
+    double allocs_per_op;     // Mean allocator calls per expression
+    unsigned long long ops;   // Expressions processed while measuring
+} BenchResult;
+
+/**
+ * A phase runs once over the whole corpus
+ */
+typedef void (*PhaseFunction)(CalcContext *context, Corpus *corpus);
+
+static unsigned long long allocation_count = 0;  // Allocator calls so far
+static volatile double bench_sink = 0.0;  // Keeps results observable
+
+/**
+ * =======================================================================
+ *                          UTILITY FUNCTIONS
+ * =======================================================================
+ */
+
+/**
+ * Monotonic clock in nanoseconds
+ */
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/**
+ * Deterministic xorshift generator so corpora are identical across runs
+ */
+static uint32_t random_next(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static int random_range(uint32_t *state, int low, int high) {
+    return low + (int)(random_next(state) % (uint32_t)(high - low + 1));
+}
+
+/**
+ * Append formatted text to a buffer
+ */
+static void buffer_printf(Buffer *buffer, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int needed = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    if (buffer->length + needed + 1 > buffer->capacity) {
+        buffer->capacity = (buffer->length + needed + 1) * 2;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+        if (!buffer->data) {
+            fprintf(stderr, "Out of memory\n");
+            exit(2);
+        }
+    }
+
+    va_start(args, format);
+    vsnprintf(buffer->data + buffer->length, needed + 1, format, args);
+    va_end(args);
+    buffer->length += needed;
+}
+
+/**
+ * Counting allocator hooks - every call through the context is counted
+ */
+static void *counting_malloc(size_t size, void *user_data) {
+    allocation_count++;
+    return malloc(size);
+}
+
+static void *counting_realloc(void *pointer, size_t size, void *user_data) {
+    allocation_count++;
+    return realloc(pointer, size);
+}
+
+static void counting_free(void *pointer, void *user_data) { free(pointer); }
+
+/**
+ * =======================================================================
+ *                          CORPUS GENERATORS
+ * =======================================================================
+ */
+
+static const char operators[] = {'+', '-', '*', '/'};
+
+/**
+ * Short arithmetic: "12+3.5*7-4"
+ */
+static void generate_short(Buffer *out, uint32_t *seed) {
+    int terms = random_range(seed, 3, 6);
+    for (int i = 0; i < terms; i++) {
+        if (i > 0) buffer_printf(out, "%c", operators[random_next(seed) % 4]);
+        buffer_printf(out, "%d", random_range(seed, 1, 99));
+    }
+}
+
+/**
+ * Deeply nested parentheses: "((((1+2)*3)-4)...)"
+ */
+static void generate_nested(Buffer *out, uint32_t *seed) {
+    int depth = random_range(seed, 32, 64);
+    for (int i = 0; i < depth; i++) buffer_printf(out, "(");
+    buffer_printf(out, "%d", random_range(seed, 1, 9));
+    for (int i = 0; i < depth; i++) {
+        buffer_printf(out, "%c%d)", operators[random_next(seed) % 3],
+                      random_range(seed, 1, 9));
+    }
+}
+
+/**
+ * Long operator chains: 500 terms without parentheses
+ */
+static void generate_chain(Buffer *out, uint32_t *seed) {
+    for (int i = 0; i < 500; i++) {
+        if (i > 0) buffer_printf(out, "%c", operators[random_next(seed) % 4]);
+        buffer_printf(out, "%d", random_range(seed, 1, 9));
+    }
+}
+
+/**
+ * Function-heavy: nested calls with arguments inside each domain
+ */
+static void generate_functions(Buffer *out, uint32_t *seed) {
+    static const char *functions[] = {"sin", "cos", "tan", "sqrt", "log",
+                                      "ln"};
+    int terms = random_range(seed, 4, 8);
+    for (int i = 0; i < terms; i++) {
+        if (i > 0) buffer_printf(out, "+");
+        int nesting = random_range(seed, 1, 3);
+        for (int j = 0; j < nesting; j++) {
+            buffer_printf(out, "%s(", functions[random_next(seed) % 6]);
+        }
+        // Trig outputs stay in [-1, 1]; offset keeps sqrt/log arguments
+        // positive and tan away from odd multiples of 90
+        buffer_printf(out, "%d", random_range(seed, 2, 60));
+        for (int j = 0; j < nesting; j++) buffer_printf(out, "+3)");
+    }
+}
+
+/**
+ * Trig-heavy: sums of products of sin, cos and tan of angles within ten
+ * turns (odd quarter degrees, so none of them is a special angle)
+ */
+static void generate_trig(Buffer *out, uint32_t *seed) {
+    static const char *functions[] = {"sin", "cos", "tan"};
+    int terms = random_range(seed, 2, 4);
+    for (int i = 0; i < terms; i++) {
+        if (i > 0) buffer_printf(out, "%c", operators[random_next(seed) % 2]);
+        for (int j = 0; j < 2; j++) {
+            if (j > 0) buffer_printf(out, "*");
+            // Odd quarter degrees keep tan away from odd multiples of 90
+            buffer_printf(out, "%s(%d.%s)", functions[random_next(seed) % 3],
+                          random_range(seed, -3600, 3600),
+                          random_next(seed) % 2 ? "25" : "75");
+        }
+    }
+}
+
+/**
+ * Numeric-heavy: long decimal literals, few operators
+ */
+static void generate_numeric(Buffer *out, uint32_t *seed) {
+    int terms = random_range(seed, 4, 8);
+    for (int i = 0; i < terms; i++) {
+        if (i > 0) buffer_printf(out, "%c", operators[random_next(seed) % 3]);
+        buffer_printf(out, "%d%06d.%06d%04d", random_range(seed, 1, 999),
+                      random_range(seed, 0, 999999),
+                      random_range(seed, 0, 999999),
+                      random_range(seed, 0, 9999));
+    }
+}
+
+/**
+ * Integer-heavy: sums of products of large integers, which exceed 2^53
+ * but stay within 64 bits
+ */
+static void generate_integer(Buffer *out, uint32_t *seed) {
+    int terms = random_range(seed, 2, 4);
+    for (int i = 0; i < terms; i++) {
+        if (i > 0) buffer_printf(out, "%c", operators[random_next(seed) % 2]);
+        buffer_printf(out, "%d*%d", random_range(seed, 1000000, 999999999),
+                      random_range(seed, 1000000, 999999999));
+    }
+}
+
+/**
+ * Cancellation-heavy: results whose double error bound is too large, so
+ * the default precision re-evaluates them in double-double
+ */
+static void generate_cancellation(Buffer *out, uint32_t *seed) {
+    switch (random_next(seed) % 3) {
+        case 0:  // Large operands cancel, leaving the small one
+            buffer_printf(out, "(10000000000000000+%d)-10000000000000000",
+                          random_range(seed, 1, 99));
+            break;
+        case 1: {  // Decimal fractions that sum to exactly zero
+            int a = random_range(seed, 1, 4);
+            int b = random_range(seed, 1, 5);
+            buffer_printf(out, "0.%d+0.%d-0.%d", a, b, a + b);
+            break;
+        }
+        default:  // Exact zeros of trig functions at multiples of 180
+            buffer_printf(out, "sin(%d)+%d", 180 * random_range(seed, 1, 20),
+                          random_range(seed, 1, 9));
+            break;
+    }
+}
+
+/**
+ * Aggregate-heavy: variadic statistics over short inline lists
+ */
+static void generate_aggregate(Buffer *out, uint32_t *seed) {
+    static const char *functions[] = {"mean", "var",    "stddev",
+                                      "min",  "max",    "median",
+                                      "percentile"};
+    int function = (int)(random_next(seed) % 7);
+    buffer_printf(out, "%s(", functions[function]);
+    if (function == 6) buffer_printf(out, "%d,", random_range(seed, 0, 100));
+    int arguments = random_range(seed, 4, 16);
+    for (int i = 0; i < arguments; i++) {
+        buffer_printf(out, "%s%d.%02d", i > 0 ? "," : "",
+                      random_range(seed, -999, 999), random_range(seed, 0, 99));
+    }
+    buffer_printf(out, ")");
+}
+
+/**
+ * Print a matrix literal of small integers; diagonally dominant when
+ * square, so det, inv and solve never meet a singular matrix
+ */
+static void print_matrix(Buffer *out, uint32_t *seed, int rows,
+                         int columns) {
+    buffer_printf(out, "[");
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < columns; j++) {
+            int value = rows == columns && i == j ? random_range(seed, 10, 20)
+                                                  : random_range(seed, -4, 4);
+            buffer_printf(out, "%s%d", j > 0 ? "," : i > 0 ? ";" : "", value);
+        }
+    }
+    buffer_printf(out, "]");
+}
+
+/**
+ * Matrix-heavy: small literals through the linear algebra functions, all
+ * with scalar results
+ */
+static void generate_matrix(Buffer *out, uint32_t *seed) {
+    int size = random_range(seed, 2, 4);
+    switch (random_next(seed) % 4) {
+        case 0:
+            buffer_printf(out, "det(");
+            print_matrix(out, seed, size, size);
+            break;
+        case 1:
+            buffer_printf(out, "dot(");
+            print_matrix(out, seed, 1, size);
+            buffer_printf(out, ",");
+            print_matrix(out, seed, size, size);
+            buffer_printf(out, "*");
+            print_matrix(out, seed, size, 1);
+            break;
+        case 2:
+            buffer_printf(out, "max(inv(");
+            print_matrix(out, seed, size, size);
+            buffer_printf(out, ")");
+            break;
+        default:
+            buffer_printf(out, "mean(solve(");
+            print_matrix(out, seed, size, size);
+            buffer_printf(out, ",");
+            print_matrix(out, seed, size, 1);
+            buffer_printf(out, ")");
+            break;
+    }
+    buffer_printf(out, ")");
+}
+
+/**
+ * Iteration-heavy: recurrences of ITERATE_STEPS steps and fixed points
+ * reached in a few dozen
+ */
+static void generate_iterate(Buffer *out, uint32_t *seed) {
+    switch (random_next(seed) % 4) {
+        case 0:
+            buffer_printf(out, "iterate(3.9*x*(1-x), 0.%02d, %d)",
+                          random_range(seed, 1, 99), BENCH_ITERATE_STEPS);
+            break;
+        case 1:
+            buffer_printf(out, "iterate(x*1.00%d+%d, %d, %d)",
+                          random_range(seed, 1, 9), random_range(seed, 1, 99),
+                          random_range(seed, 0, 999), BENCH_ITERATE_STEPS);
+            break;
+        case 2:
+            buffer_printf(out, "fixpoint((x+%d/x)/2, %d)",
+                          random_range(seed, 2, 9999),
+                          random_range(seed, 1, 99));
+            break;
+        default:
+            buffer_printf(out, "fixpoint(x/2+%d, 0)",
+                          random_range(seed, 1, 999));
+            break;
+    }
+}
+
+/**
+ * Build a corpus and precompile every expression to RPN
+ * Expressions that fail to parse are reported and abort the benchmark,
+ * since they would measure the error path instead of the intended one.
+ */
+static void corpus_build(Corpus *corpus, const char *name,
+                         void (*generate)(Buffer *, uint32_t *),
+                         CalcContext *context) {
+    uint32_t seed = 0x9E3779B9u;
+    corpus->name = name;
+    corpus->count = BENCH_CORPUS_SIZE;
+
+    for (int i = 0; i < corpus->count; i++) {
+        Buffer buffer = {NULL, 0, 0};
+        generate(&buffer, &seed);
+        corpus->expressions[i] = buffer.data;
+
+        double value;
+        if (!calc_evaluate(context, buffer.data, &value) &&
+            strcmp(calc_last_error(context), "Division by zero") != 0) {
+            fprintf(stderr, "Corpus %s: \"%.60s...\": %s\n", name,
+                    buffer.data, calc_last_error(context));
+            exit(2);
+        }
+
+        // Keep a private copy of the RPN for the eval phase
+        convert_to_rpn(context, buffer.data, &context->rpn);
+        corpus->matrices = uses_matrices(&context->rpn);
+        corpus->iteration = uses_iteration(&context->rpn);
+        TokenStack *copy = &corpus->rpn[i];
+        copy->top = context->rpn.top;
+        copy->capacity = context->rpn.top + 1;
+        copy->data = malloc(sizeof(Token) * (copy->capacity + 1));
+        memcpy(copy->data, context->rpn.data, sizeof(Token) * copy->capacity);
+    }
+}
+
+static void corpus_free(Corpus *corpus) {
+    for (int i = 0; i < corpus->count; i++) {
+        free(corpus->expressions[i]);
+        free(corpus->rpn[i].data);
+    }
+}
+
+/**
+ * =======================================================================
+ *                             PHASES
+ * =======================================================================
+ */
+
+/**
+ * Tokenize every expression until TOK_END
+ */
+static void phase_lex(CalcContext *context, Corpus *corpus) {
+    double checksum = 0.0;
+    for (int i = 0; i < corpus->count; i++) {
+        Lexer lexer = {corpus->expressions[i], 0};
+        Token token;
+        do {
+            token = get_next_token(&lexer);
+            checksum += token.value;
+        } while (token.type != TOK_END && token.type != TOK_INVALID);
+    }
+    bench_sink += checksum;
+}
+
+/**
+ * Convert every expression to RPN
+ */
+static void phase_rpn(CalcContext *context, Corpus *corpus) {
+    int total = 0;
+    for (int i = 0; i < corpus->count; i++) {
+        convert_to_rpn(context, corpus->expressions[i], &context->rpn);
+        total += context->rpn.top;
+    }
+    bench_sink += total;
+}
+
+/**
+ * Evaluate the precompiled RPN of every expression
+ */
+static void phase_eval(CalcContext *context, Corpus *corpus) {
+    double checksum = 0.0;
+    for (int i = 0; i < corpus->count; i++) {
+        double value = 0.0;
+        if (corpus->matrices) {
+            CalcValue result;
+            if (evaluate_rpn_matrix(context, &corpus->rpn[i], &result)) {
+                checksum += result.real;
+            }
+        } else if (corpus->iteration) {
+            if (evaluate_rpn_iteration(context, &corpus->rpn[i], &value)) {
+                checksum += value;
+            }
+        } else if (evaluate_rpn(context, &corpus->rpn[i], &value)) {
+            checksum += value;
+        }
+    }
+    bench_sink += checksum;
+}
+
+/**
+ * Batch degree kernels: sin, cos and tan of one angle per expression
+ */
+static double batch_angles[BENCH_CORPUS_SIZE];
+static double batch_results[BENCH_CORPUS_SIZE];
+
+static void phase_batch(CalcContext *context, Corpus *corpus) {
+    size_t count = (size_t)corpus->count;
+    double checksum = 0.0;
+    calc_sin_degrees_batch(batch_angles, batch_results, count);
+    checksum += batch_results[count - 1];
+    calc_cos_degrees_batch(batch_angles, batch_results, count);
+    checksum += batch_results[count - 1];
+    calc_tan_degrees_batch(batch_angles, batch_results, count);
+    checksum += batch_results[count - 1];
+    bench_sink += checksum;
+}
+
+/**
+ * Streaming statistics: one block of values per expression, mean and
+ * variance only (the percentile sketch is measured by calc --stats)
+ */
+static double stream_values[BENCH_CORPUS_SIZE * BENCH_STREAM_BLOCK];
+static CalcStats *stream_stats = NULL;
+
+static void phase_stream(CalcContext *context, Corpus *corpus) {
+    for (int i = 0; i < corpus->count; i++) {
+        calc_stats_add(stream_stats, stream_values + i * BENCH_STREAM_BLOCK,
+                       BENCH_STREAM_BLOCK);
+    }
+    CalcSummary summary;
+    calc_stats_summary(stream_stats, &summary);
+    bench_sink += summary.variance;
+}
+
+/**
+ * Blocked matrix product: one BENCH_PRODUCT_SIZE square product per
+ * expression
+ */
+#define PRODUCT_ELEMENTS (BENCH_PRODUCT_SIZE * BENCH_PRODUCT_SIZE)
+static double product_left[PRODUCT_ELEMENTS];
+static double product_right[PRODUCT_ELEMENTS];
+static double product_result[PRODUCT_ELEMENTS];
+
+static void phase_product(CalcContext *context, Corpus *corpus) {
+    double checksum = 0.0;
+    for (int i = 0; i < corpus->count; i++) {
+        matrix_multiply(product_left, product_right, product_result,
+                        BENCH_PRODUCT_SIZE, BENCH_PRODUCT_SIZE,
+                        BENCH_PRODUCT_SIZE);
+        checksum += product_result[i % PRODUCT_ELEMENTS];
+    }
+    bench_sink += checksum;
+}
+
+/**
+ * Formula library lookups: find a formula by name and take its program;
+ * the library is written and opened on the first (warm-up) pass
+ */
+static char library_path[512];
+static char library_names[BENCH_CORPUS_SIZE][8];
+static CalcLibrary *library = NULL;
+
+static void phase_library(CalcContext *context, Corpus *corpus) {
+    if (!library) {
+        CalcFormula formulas[BENCH_CORPUS_SIZE];
+        for (int i = 0; i < corpus->count; i++) {
+            snprintf(library_names[i], sizeof(library_names[i]), "f%d", i);
+            formulas[i].name = library_names[i];
+            formulas[i].expression = corpus->expressions[i];
+            formulas[i].variables = NULL;
+            formulas[i].variable_count = 0;
+        }
+        const char *directory = getenv("TMPDIR");
+        snprintf(library_path, sizeof(library_path), "%s/calc_bench.lib",
+                 directory ? directory : "/tmp");
+        if (!calc_library_write(context, library_path, formulas,
+                                (size_t)corpus->count) ||
+            !(library = calc_library_open(context, library_path))) {
+            fprintf(stderr, "Formula library: %s\n", calc_last_error(context));
+            exit(2);
+        }
+    }
+
+    size_t found = 0;
+    for (int i = 0; i < corpus->count; i++) {
+        size_t index = calc_library_find(library, library_names[i]);
+        CalcProgram *program = calc_library_program(context, library, index);
+        found += program != NULL;
+        calc_program_free(program);
+    }
+    bench_sink += (double)found;
+}
+
+/**
+ * Full calc_evaluate() call (lex + parse + evaluate)
+ */
+static void phase_total(CalcContext *context, Corpus *corpus) {
+    double checksum = 0.0;
+    for (int i = 0; i < corpus->count; i++) {
+        double value = 0.0;
+        if (calc_evaluate(context, corpus->expressions[i], &value)) {
+            checksum += value;
+        }
+    }
+    bench_sink += checksum;
+}
+
+/**
+ * qsort() order of doubles, smallest first
+ */
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Time one window of at least `seconds` of a phase over a corpus, and
+ * add its ops and allocations to `result`
+ * @return: nanoseconds per expression in the window
+ */
+static double measure_window(CalcContext *context, Corpus *corpus,
+                             PhaseFunction phase, double seconds,
+                             BenchResult *result) {
+    phase(context, corpus);  // Warm up caches and context buffers
+
+    unsigned long long passes = 0;
+    unsigned long long allocations_before = allocation_count;
+    double start = now_ns();
+    double elapsed = 0.0;
+    do {
+        phase(context, corpus);
+        passes++;
+        elapsed = now_ns() - start;
+    } while (elapsed < seconds * 1e9);
+
+    unsigned long long ops = passes * (unsigned long long)corpus->count;
+    double allocations = result->allocs_per_op * (double)result->ops +
+                         (double)(allocation_count - allocations_before);
+    result->ops += ops;
+    result->allocs_per_op = allocations / (double)result->ops;
+    return elapsed / (double)ops;
+}
+
+/**
+ * =======================================================================
+ *                         LINEAR-TIME STRESS TEST
+ * =======================================================================
+ */
+
+/**
+ * Nested parentheses around one number: "((((7))))"
+ */
+static void stress_nested(Buffer *out, size_t bytes) {
+    size_t depth = (bytes - 1) / 2;
+    for (size_t i = 0; i < depth; i++) buffer_printf(out, "(");
+    buffer_printf(out, "7");
+    for (size_t i = 0; i < depth; i++) buffer_printf(out, ")");
+}
+
+/**
+ * Left-associative chain: "1+2-3*4+5..."; the operator stack stays short
+ */
+static void stress_chain(Buffer *out, size_t bytes) {
+    buffer_printf(out, "1");
+    for (size_t i = 0; out->length + 2 <= bytes; i++) {
+        buffer_printf(out, "%c%d", operators[i % 3], (int)(i % 9) + 1);
+    }
+}
+
+/**
+ * Right-associative chain: "1^1^1^..."; every operator waits on the stack
+ */
+static void stress_power(Buffer *out, size_t bytes) {
+    buffer_printf(out, "1");
+    while (out->length + 2 <= bytes) buffer_printf(out, "^1");
+}
+
+/**
+ * Nested function calls: "sqrt(sqrt(...(2)...))"
+ */
+static void stress_functions(Buffer *out, size_t bytes) {
+    size_t depth = (bytes - 1) / 6;
+    for (size_t i = 0; i < depth; i++) buffer_printf(out, "sqrt(");
+    buffer_printf(out, "2");
+    for (size_t i = 0; i < depth; i++) buffer_printf(out, ")");
+}
+
+/**
+ * Mean nanoseconds per call of convert_to_rpn() (total = false) or
+ * calc_evaluate() (total = true), repeated for at least min_time seconds
+ */
+static double stress_time(CalcContext *context, const char *expression,
+                          bool total, double min_time) {
+    unsigned long long runs = 0;
+    double start = now_ns();
+    double elapsed = 0.0;
+    do {
+        double value = 0.0;
+        bool success = total ? calc_evaluate(context, expression, &value)
+                             : convert_to_rpn(context, expression,
+                                              &context->rpn);
+        if (!success) {
+            fprintf(stderr, "Stress input failed: %s\n",
+                    calc_last_error(context));
+            exit(2);
+        }
+        bench_sink += value;
+        runs++;
+        elapsed = now_ns() - start;
+    } while (elapsed < min_time * 1e9);
+    return elapsed / (double)runs;
+}
+
+/**
+ * Measure every stress shape at growing sizes
+ * @return: exit status (1 if any shape grew faster than linearly)
+ */
+static int run_stress(double min_time, FILE *output) {
+    static const struct {
+        const char *name;
+        void (*generate)(Buffer *, size_t);
+    } shapes[] = {
+        {"nested", stress_nested},
+        {"chain", stress_chain},
+        {"power", stress_power},
+        {"functions", stress_functions},
+    };
+
+    // No limits, so the largest inputs are measured instead of rejected
+    CalcOptions options;
+    calc_options_init(&options);
+    memset(&options.limits, 0, sizeof(options.limits));
+    CalcContext *context = calc_context_new(&options);
+    if (!context) {
+        fprintf(stderr, "Failed to create evaluation context\n");
+        return 2;
+    }
+
+    int failures = 0;
+    fprintf(stderr, "%-10s %10s %14s %14s\n", "shape", "bytes", "rpn ns/byte",
+            "total ns/byte");
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        double first = 0.0, last = 0.0;
+        for (size_t bytes = STRESS_MIN_BYTES; bytes <= STRESS_MAX_BYTES;
+             bytes *= 4) {
+            Buffer buffer = {NULL, 0, 0};
+            shapes[s].generate(&buffer, bytes);
+            double length = (double)buffer.length;
+            double rpn =
+                stress_time(context, buffer.data, false, min_time) / length;
+            double total =
+                stress_time(context, buffer.data, true, min_time) / length;
+            free(buffer.data);
+
+            if (bytes == STRESS_MIN_BYTES) first = total;
+            last = total;
+            fprintf(output,
+                    "{\"stress\":\"%s\",\"bytes\":%.0f,"
+                    "\"rpn_ns_per_byte\":%.3f,\"total_ns_per_byte\":%.3f}\n",
+                    shapes[s].name, length, rpn, total);
+            fprintf(stderr, "%-10s %10.0f %14.3f %14.3f\n", shapes[s].name,
+                    length, rpn, total);
+        }
+
+        double growth = last / first;
+        bool linear = growth <= STRESS_MAX_GROWTH;
+        if (!linear) failures++;
+        fprintf(stderr, "%-10s growth %.2fx from %d B to %d B%s\n\n",
+                shapes[s].name, growth, STRESS_MIN_BYTES, STRESS_MAX_BYTES,
+                linear ? "" : "  NOT LINEAR");
+    }
+    calc_context_free(context);
+
+    // With the default limits, oversized input is rejected without being
+    // read past the length limit
+    CalcContext *limited = calc_context_new(NULL);
+    size_t huge = (size_t)STRESS_MAX_BYTES * 16;
+    char *expression = malloc(huge + 1);
+    if (limited && expression) {
+        memset(expression, '(', huge);
+        expression[huge] = '\0';
+        double value;
+        double start = now_ns();
+        bool accepted = calc_evaluate(limited, expression, &value);
+        fprintf(stderr, "%zu byte input %s in %.1f us: %s\n", huge,
+                accepted ? "accepted" : "rejected",
+                (now_ns() - start) / 1e3, calc_last_error(limited));
+    }
+    free(expression);
+    calc_context_free(limited);
+
+    if (failures > 0) {
+        fprintf(stderr, "%d shape(s) grew more than %.1fx per byte\n",
+                failures, STRESS_MAX_GROWTH);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * =======================================================================
+ *                     EVALUATION SERVICE THROUGHPUT
+ * =======================================================================
+ */
+
+#ifndef _WIN32
+
+/**
+ * Send one round of requests and read back every answer
+ * Writes and reads are interleaved with poll(), since the service answers
+ * each read before reading again and would block once both socket buffers
+ * are full.
+ * @param errors: incremented for every "!" (error) answer
+ * @return: false if the connection failed or closed early
+ */
+static bool service_round(int fd, const Buffer *requests, int count,
+                          long long *errors) {
+    static char answers[65536];
+    size_t sent = 0;
+    int answered = 0;
+    bool line_start = true;
+
+    while (answered < count) {
+        struct pollfd poll_fd = {fd, POLLIN, 0};
+        if (sent < requests->length) poll_fd.events |= POLLOUT;
+        if (poll(&poll_fd, 1, -1) < 0) return false;
+
+        if (poll_fd.revents & POLLOUT) {
+            ssize_t written = write(fd, requests->data + sent,
+                                    requests->length - sent);
+            if (written < 0 && errno != EAGAIN) return false;
+            if (written > 0) sent += (size_t)written;
+        }
+        if (poll_fd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t received = read(fd, answers, sizeof(answers));
+            if (received == 0) return false;
+            if (received < 0) {
+                if (errno == EAGAIN) continue;
+                return false;
+            }
+            for (ssize_t i = 0; i < received; i++) {
+                if (line_start && answers[i] == '!') (*errors)++;
+                line_start = answers[i] == '\n';
+                if (line_start) answered++;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Measure the evaluations per second of a running evaluation service over
+ * a single connection
+ * @return: exit status (2 if the service cannot be used)
+ */
+static int run_service(const char *socket_path, double min_time,
+                       FILE *output) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return 2;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 ||
+        connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        fprintf(stderr, "Cannot connect to %s: %s\n", socket_path,
+                strerror(errno));
+        if (fd >= 0) close(fd);
+        return 2;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    // One round repeats the short corpus, one expression per line
+    Buffer requests = {NULL, 0, 0};
+    uint32_t seed = 0x9E3779B9u;
+    char *expressions[BENCH_CORPUS_SIZE];
+    for (int i = 0; i < BENCH_CORPUS_SIZE; i++) {
+        Buffer expression = {NULL, 0, 0};
+        generate_short(&expression, &seed);
+        expressions[i] = expression.data;
+    }
+    for (int i = 0; i < SERVICE_BATCH_LINES; i++) {
+        buffer_printf(&requests, "%s\n", expressions[i % BENCH_CORPUS_SIZE]);
+    }
+    for (int i = 0; i < BENCH_CORPUS_SIZE; i++) free(expressions[i]);
+
+    long long total = 0, errors = 0;
+    bool connected = true;
+    double start = now_ns(), elapsed;
+    do {
+        connected =
+            service_round(fd, &requests, SERVICE_BATCH_LINES, &errors);
+        if (connected) total += SERVICE_BATCH_LINES;
+        elapsed = now_ns() - start;
+    } while (connected && elapsed < min_time * 1e9);
+    close(fd);
+    free(requests.data);
+
+    if (!connected) {
+        fprintf(stderr, "The service closed the connection\n");
+        return 2;
+    }
+    double per_second = (double)total / (elapsed / 1e9);
+    fprintf(output,
+            "{\"service\":\"short\",\"requests\":%lld,"
+            "\"evals_per_sec\":%.0f,\"ns_per_op\":%.2f}\n",
+            total, per_second, elapsed / (double)total);
+    fprintf(stderr,
+            "service short %lld requests (%lld errors): %.0f evals/s, "
+            "%.1f ns/op\n",
+            total, errors, per_second, elapsed / (double)total);
+    return 0;
+}
+
+#else
+
+static int run_service(const char *socket_path, double min_time,
+                       FILE *output) {
+    fprintf(stderr, "The evaluation service requires Unix domain sockets\n");
+    return 2;
+}
+
+#endif  // _WIN32
+
+/**
+ * =======================================================================
+ *                     REPORTING AND BASELINE COMPARISON
+ * =======================================================================
+ */
+
+static void write_result(FILE *stream, const BenchResult *result) {
+    fprintf(stream,
+            "{\"corpus\":\"%s\",\"phase\":\"%s\",\"ns_per_op\":%.2f,"
+            "\"allocs_per_op\":%.4f,\"ops\":%llu,\"ns_min\":%.2f}\n",
+            result->corpus, result->phase, result->ns_per_op,
+            result->allocs_per_op, result->ops, result->ns_min);
+}
+
+/**
+ * Load results written by an earlier run (one JSON object per line); runs
+ * that predate ns_min get their ns_per_op as fastest window
+ * @return: number of results read, or -1 if the file cannot be opened
+ */
+static int read_baseline(const char *path, BenchResult *results, int limit) {
+    FILE *stream = fopen(path, "r");
+    if (!stream) return -1;
+
+    int count = 0;
+    char line[512];
+    while (count < limit && fgets(line, sizeof(line), stream)) {
+        BenchResult *result = &results[count];
+        if (sscanf(line,
+                   "{\"corpus\":\"%31[^\"]\",\"phase\":\"%15[^\"]\","
+                   "\"ns_per_op\":%lf,\"allocs_per_op\":%lf",
+                   result->corpus, result->phase, &result->ns_per_op,
+                   &result->allocs_per_op) == 4) {
+            const char *fastest = strstr(line, "\"ns_min\":");
+            if (!fastest || sscanf(fastest, "\"ns_min\":%lf",
+                                   &result->ns_min) != 1) {
+                result->ns_min = result->ns_per_op;
+            }
+            count++;
+        }
+    }
+    fclose(stream);
+    return count;
+}
+
+/**
+ * Relative spread of a result's windows: how much slower the median was
+ * than the fastest, in percent
+ */
+static double window_spread(const BenchResult *result) {
+    if (result->ns_min <= 0.0) return 0.0;
+    return (result->ns_per_op - result->ns_min) / result->ns_min * 100;
+}
+
+/**
+ * Compare the fastest windows of results with a baseline and print a
+ * table to stderr; a phase regresses when it is slower than the threshold
+ * plus the window spread of both runs, or allocates more
+ * @return: number of regressions found
+ */
+static int compare_with_baseline(const BenchResult *results, int count,
+                                 const BenchResult *baseline,
+                                 int baseline_count, double threshold) {
+    int regressions = 0;
+    fprintf(stderr, "\n%-10s %-6s %12s %12s %9s %9s\n", "corpus", "phase",
+            "base ns/op", "ns/op", "change", "allowed");
+    for (int i = 0; i < count; i++) {
+        const BenchResult *base = NULL;
+        for (int j = 0; j < baseline_count && !base; j++) {
+            if (strcmp(baseline[j].corpus, results[i].corpus) == 0 &&
+                strcmp(baseline[j].phase, results[i].phase) == 0) {
+                base = &baseline[j];
+            }
+        }
+        if (!base) {
+            fprintf(stderr, "%-10s %-6s %12s %12.1f %9s\n", results[i].corpus,
+                    results[i].phase, "-", results[i].ns_min, "new");
+            continue;
+        }
+
+        double change =
+            (results[i].ns_min - base->ns_min) / base->ns_min * 100;
+        double allowed =
+            threshold + window_spread(base) + window_spread(&results[i]);
+        bool slower = change > allowed;
+        bool allocates_more =
+            results[i].allocs_per_op > base->allocs_per_op + 0.01;
+        if (slower || allocates_more) regressions++;
+
+        fprintf(stderr, "%-10s %-6s %12.1f %12.1f %+8.1f%% %8.1f%%%s%s\n",
+                results[i].corpus, results[i].phase, base->ns_min,
+                results[i].ns_min, change, allowed, slower ? "  SLOWER" : "",
+                allocates_more ? "  MORE ALLOCATIONS" : "");
+    }
+    return regressions;
+}
+
+/**
+ * =======================================================================
+ *                                MAIN
+ * =======================================================================
+ */
+
+int main(int argc, char **argv) {
+    double min_time = BENCH_DEFAULT_MIN_TIME;
+    double threshold = 10.0;
+    int repetitions = BENCH_DEFAULT_REPETITIONS;
+    const char *output_path = NULL;
+    const char *baseline_path = NULL;
+    const char *filter = NULL;
+    const char *service_path = NULL;
+    bool stress = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stress") == 0) {
+            stress = true;
+        } else if (strcmp(argv[i], "--service") == 0 && i + 1 < argc) {
+            service_path = argv[++i];
+        } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            min_time = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc) {
+            repetitions = atoi(argv[++i]);
+            if (repetitions < 1 || repetitions > BENCH_MAX_REPETITIONS) {
+                fprintf(stderr, "--repetitions must be 1 to %d\n",
+                        BENCH_MAX_REPETITIONS);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            threshold = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else {
+            fprintf(stderr,
+                    "Usage: %s [--stress | --service SOCKET] "
+                    "[--min-time SECONDS] [--repetitions N] [--output FILE] "
+                    "[--filter CORPUS] [--baseline FILE] "
+                    "[--threshold PERCENT]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    if (stress || service_path) {
+        FILE *output = output_path ? fopen(output_path, "w") : stdout;
+        if (!output) {
+            fprintf(stderr, "Cannot write %s\n", output_path);
+            return 2;
+        }
+        int status = stress ? run_stress(min_time, output)
+                            : run_service(service_path, min_time, output);
+        if (output != stdout) fclose(output);
+        return status;
+    }
+
+    CalcOptions options;
+    calc_options_init(&options);
+    options.allocator.malloc_fn = counting_malloc;
+    options.allocator.realloc_fn = counting_realloc;
+    options.allocator.free_fn = counting_free;
+    CalcContext *context = calc_context_new(&options);
+    if (!context) {
+        fprintf(stderr, "Failed to create evaluation context\n");
+        return 2;
+    }
+
+    // A corpus may add a phase of its own after the common ones
+    static const struct {
+        const char *name;
+        void (*generate)(Buffer *, uint32_t *);
+        const char *extra_name;
+        PhaseFunction extra;
+    } corpora[] = {
+        {"short", generate_short, NULL, NULL},
+        {"nested", generate_nested, NULL, NULL},
+        {"chain", generate_chain, NULL, NULL},
+        {"functions", generate_functions, "library", phase_library},
+        {"trig", generate_trig, "batch", phase_batch},
+        {"numeric", generate_numeric, NULL, NULL},
+        {"cancel", generate_cancellation, NULL, NULL},
+        {"integer", generate_integer, NULL, NULL},
+        {"aggregate", generate_aggregate, "stream", phase_stream},
+        {"matrix", generate_matrix, "product", phase_product},
+        {"iterate", generate_iterate, NULL, NULL},
+    };
+    static const struct {
+        const char *name;
+        PhaseFunction run;
+    } phases[] = {
+        {"lex", phase_lex},
+        {"rpn", phase_rpn},
+        {"eval", phase_eval},
+        {"total", phase_total},
+    };
+
+    // Quarter degrees within ten turns, like the trig corpus
+    uint32_t angle_seed = 0x2545F491u;
+    for (int i = 0; i < BENCH_CORPUS_SIZE; i++) {
+        batch_angles[i] = random_range(&angle_seed, -14400, 14400) / 4.0;
+    }
+    for (size_t i = 0; i < BENCH_CORPUS_SIZE * BENCH_STREAM_BLOCK; i++) {
+        stream_values[i] = random_range(&angle_seed, -999999, 999999) / 1e3;
+    }
+    for (int i = 0; i < PRODUCT_ELEMENTS; i++) {
+        product_left[i] = random_range(&angle_seed, -999, 999) / 1e2;
+        product_right[i] = random_range(&angle_seed, -999, 999) / 1e2;
+    }
+    stream_stats = calc_stats_new(NULL, false);
+    if (!stream_stats) {
+        fprintf(stderr, "Failed to create statistics\n");
+        return 2;
+    }
+
+    static Corpus corpus_set[sizeof(corpora) / sizeof(corpora[0])];
+    size_t corpus_count = 0;
+    BenchResult results[BENCH_MAX_RESULTS];
+    Corpus *result_corpus[BENCH_MAX_RESULTS];
+    PhaseFunction result_phase[BENCH_MAX_RESULTS];
+    static double window_ns[BENCH_MAX_RESULTS][BENCH_MAX_REPETITIONS];
+    int result_count = 0;
+
+    for (size_t c = 0; c < sizeof(corpora) / sizeof(corpora[0]); c++) {
+        if (filter && strcmp(filter, corpora[c].name) != 0) continue;
+        Corpus *corpus = &corpus_set[corpus_count++];
+        corpus_build(corpus, corpora[c].name, corpora[c].generate, context);
+        size_t phase_count = sizeof(phases) / sizeof(phases[0]);
+        for (size_t p = 0; p <= phase_count; p++) {
+            const char *phase_name =
+                p < phase_count ? phases[p].name : corpora[c].extra_name;
+            PhaseFunction run =
+                p < phase_count ? phases[p].run : corpora[c].extra;
+            if (!run) continue;
+            BenchResult *result = &results[result_count];
+            memset(result, 0, sizeof(*result));
+            snprintf(result->corpus, sizeof(result->corpus), "%s",
+                     corpus->name);
+            snprintf(result->phase, sizeof(result->phase), "%s", phase_name);
+            result_corpus[result_count] = corpus;
+            result_phase[result_count] = run;
+            result_count++;
+        }
+    }
+
+    // Each round times one window of every phase, so a slow stretch of the
+    // machine costs each phase at most a window or two, not its minimum
+    for (int r = 0; r < repetitions; r++) {
+        for (int i = 0; i < result_count; i++) {
+            window_ns[i][r] =
+                measure_window(context, result_corpus[i], result_phase[i],
+                               min_time / repetitions, &results[i]);
+        }
+    }
+    for (int i = 0; i < result_count; i++) {
+        BenchResult *result = &results[i];
+        qsort(window_ns[i], (size_t)repetitions, sizeof(double),
+              compare_doubles);
+        result->ns_per_op = window_ns[i][repetitions / 2];
+        result->ns_min = window_ns[i][0];
+        fprintf(stderr,
+                "%-10s %-6s %10.1f ns/op (min %.1f) %8.3f allocs/op\n",
+                result->corpus, result->phase, result->ns_per_op,
+                result->ns_min, result->allocs_per_op);
+    }
+    for (size_t c = 0; c < corpus_count; c++) corpus_free(&corpus_set[c]);
+    calc_context_free(context);
+    calc_stats_free(stream_stats);
+    if (library) {
+        calc_library_close(library);
+        remove(library_path);
+    }
+
+    FILE *output = output_path ? fopen(output_path, "w") : stdout;
+    if (!output) {
+        fprintf(stderr, "Cannot write %s\n", output_path);
+        return 2;
+    }
+    for (int i = 0; i < result_count; i++) write_result(output, &results[i]);
+    if (output != stdout) fclose(output);
+
+    if (baseline_path) {
+        BenchResult baseline[BENCH_MAX_RESULTS];
+        int baseline_count =
+            read_baseline(baseline_path, baseline, BENCH_MAX_RESULTS);
+        if (baseline_count < 0) {
+            fprintf(stderr, "Cannot read baseline %s\n", baseline_path);
+            return 2;
+        }
+        int regressions = compare_with_baseline(
+            results, result_count, baseline, baseline_count, threshold);
+        if (regressions > 0) {
+            fprintf(stderr,
+                    "\n%d regression(s) beyond %.1f%% plus window spread\n",
+                    regressions, threshold);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,1585 @@
+/**
+ * ========================================================================
+ *    LIBCALC - Expression Evaluation Engine (Tokenizer, Parser, Evaluator)
+ * ========================================================================
+ */
+
+#include "calc_internal.h"
+#include "calc_perf.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CALC_VERSION_STRING "1.3.0"
+
+// Default expression limits (see calc_options_init())
+#define DEFAULT_MAX_LENGTH (1u << 20)   // 1 MiB of expression text
+#define DEFAULT_MAX_DEPTH 256           // Levels of parentheses
+#define DEFAULT_MAX_TOKENS (1u << 18)   // Tokens per expression
+#define DEFAULT_MAX_MEMORY (64u << 20)  // 64 MiB of working memory
+#define DEFAULT_MAX_STEPS 100000000u    // Iteration steps per evaluation
+
+/**
+ * =======================================================================
+ *                           MEMORY ALLOCATION
+ * =======================================================================
+ */
+
+/**
+ * Allocation helpers - route memory through an allocator
+ * A block must be resized and released by the allocator that made it, so
+ * the hooks are either all NULL (libc) or include realloc_fn and free_fn.
+ */
+bool calc_allocator_valid(const CalcAllocator *allocator) {
+    if (allocator->realloc_fn || allocator->free_fn) {
+        return allocator->realloc_fn && allocator->free_fn;
+    }
+    return !allocator->malloc_fn;
+}
+
+void *calc_allocator_malloc(const CalcAllocator *allocator, size_t size) {
+    if (allocator->malloc_fn) {
+        return allocator->malloc_fn(size, allocator->user_data);
+    }
+    if (allocator->realloc_fn) {
+        return allocator->realloc_fn(NULL, size, allocator->user_data);
+    }
+    return malloc(size);
+}
+
+void calc_allocator_free(const CalcAllocator *allocator, void *pointer) {
+    if (allocator->free_fn) {
+        allocator->free_fn(pointer, allocator->user_data);
+    } else {
+        free(pointer);
+    }
+}
+
+/**
+ * Allocation helpers - route memory through the context's allocator
+ */
+void *calc_realloc(CalcContext *context, void *pointer, size_t size) {
+    const CalcAllocator *allocator = &context->options.allocator;
+    if (!pointer) return calc_allocator_malloc(allocator, size);
+    if (allocator->realloc_fn) {
+        return allocator->realloc_fn(pointer, size, allocator->user_data);
+    }
+    return realloc(pointer, size);
+}
+
+void calc_free(CalcContext *context, void *pointer) {
+    calc_allocator_free(&context->options.allocator, pointer);
+}
+
+/**
+ * Resize a working buffer of the context from old_size to size bytes,
+ * keeping the context within its memory limit
+ * @return: the buffer, or NULL (with an error message) if the limit would
+ *          be exceeded or the allocation failed; the old buffer is kept
+ */
+static void *grow_working_memory(CalcContext *context, void *pointer,
+                                 size_t old_size, size_t size) {
+    size_t limit = context->options.limits.max_memory;
+    size_t used = context->memory_used - old_size + size;
+    if (limit && used > limit) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Expression needs more than %zu bytes of memory", limit);
+        return NULL;
+    }
+
+    void *grown = calc_realloc(context, pointer, size);
+    if (!grown) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Out of memory");
+        return NULL;
+    }
+    context->memory_used = used;
+    return grown;
+}
+
+/**
+ * Grow the context's value stack to at least `size` bytes
+ * @return: the stack, or NULL (with an error message) if out of memory
+ */
+void *reserve_value_stack(CalcContext *context, size_t size) {
+    if (context->value_stack_size < size) {
+        void *grown = grow_working_memory(context, context->value_stack,
+                                          context->value_stack_size, size);
+        if (!grown) return NULL;
+        context->value_stack = grown;
+        context->value_stack_size = size;
+    }
+    return context->value_stack;
+}
+
+/**
+ * Grow the context's number stack to hold at least `count` doubles
+ * @return: the array, or NULL (with an error message) if out of memory
+ */
+double *reserve_number_scratch(CalcContext *context, size_t count) {
+    NumberStack *numbers = &context->numbers;
+    if ((size_t)numbers->capacity < count) {
+        if (count > INT_MAX) {
+            snprintf(context->last_error, sizeof(context->last_error),
+                     "Out of memory");
+            return NULL;
+        }
+        void *grown = grow_working_memory(
+            context, numbers->data, sizeof(double) * (size_t)numbers->capacity,
+            sizeof(double) * count);
+        if (!grown) return NULL;
+        numbers->data = grown;
+        numbers->capacity = (int)count;
+    }
+    return numbers->data;
+}
+
+/**
+ * Grow the context's matrix arena to hold at least `count` doubles; the
+ * capacity doubles unless that would pass the memory limit, so a growing
+ * matrix stack copies each element a bounded number of times
+ * @return: the arena, or NULL (with an error message) if out of memory
+ */
+double *reserve_matrix_arena(CalcContext *context, size_t count) {
+    if (context->matrix_capacity < count) {
+        size_t old_size = sizeof(double) * context->matrix_capacity;
+        size_t limit = context->options.limits.max_memory;
+        size_t available = limit ? limit - (context->memory_used - old_size)
+                                 : SIZE_MAX;
+        size_t capacity = context->matrix_capacity * 2;
+        if (capacity < count || capacity > available / sizeof(double)) {
+            capacity = count;  // Exactly what is needed near the limit
+        }
+        void *grown = grow_working_memory(context, context->matrix_arena,
+                                          old_size, sizeof(double) * capacity);
+        if (!grown) return NULL;
+        context->matrix_arena = grown;
+        context->matrix_capacity = capacity;
+    }
+    return context->matrix_arena;
+}
+
+/**
+ * =======================================================================
+ *                            UTILITY FUNCTIONS
+ * =======================================================================
+ */
+
+/**
+ * Clear error buffer by setting first character to null terminator
+ */
+static void clear_error(char *error_buffer, size_t error_size) {
+    if (error_buffer && error_size > 0) {
+        error_buffer[0] = '\0';
+    }
+}
+
+/**
+ * Check if character is valid for function names (lowercase letters)
+ */
+static bool is_function_char(char c) { return (c >= 'a' && c <= 'z'); }
+
+/**
+ * Check if character may start a variable name (letters and underscore)
+ */
+static bool is_identifier_start(char c) {
+    return is_function_char(c) || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+/**
+ * Check if character may continue a variable name (also digits)
+ */
+static bool is_identifier_char(char c) {
+    return is_identifier_start(c) || (c >= '0' && c <= '9');
+}
+
+/**
+ * Check if a run of letters names a built-in function
+ */
+static bool is_function_name(const char *name, size_t length) {
+    static const char *const names[] = {"sqrt", "log", "ln",  "sin",
+                                        "cos",  "tan", "not"};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strlen(names[i]) == length &&
+            strncmp(names[i], name, length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Skip whitespace characters in input
+ */
+static void skip_whitespace(Lexer *lexer) {
+    while (lexer->input[lexer->position] != '\0' &&
+           (lexer->input[lexer->position] == ' ' ||
+            lexer->input[lexer->position] == '\t')) {
+        lexer->position++;
+    }
+}
+
+/**
+ * Radix of a 0x (hex), 0b (binary) or 0o (octal) literal prefix, or 0
+ */
+int radix_prefix(const char *text) {
+    if (text[0] != '0') return 0;
+    switch (text[1]) {
+        case 'x':
+            return 16;
+        case 'b':
+            return 2;
+        case 'o':
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Value of a digit character in a radix, or -1
+ */
+int radix_digit(char c, int radix) {
+    int value = c >= '0' && c <= '9'   ? c - '0'
+                : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                : c >= 'A' && c <= 'F' ? c - 'A' + 10
+                                       : -1;
+    return value < radix ? value : -1;
+}
+
+/**
+ * Check if operator is right-associative
+ * Only exponentiation (^) is right-associative: 2^3^2 = 2^(3^2) = 512, not
+ * (2^3)^2 = 64
+ */
+static bool is_right_associative(char op) { return op == '^'; }
+
+/**
+ * =======================================================================
+ *             MATHEMATICAL FUNCTIONS WITH DOMAIN VALIDATION
+ * =======================================================================
+ */
+
+/**
+ * Safe division - checks for division by zero
+ * @param a: dividend
+ * @param b: divisor
+ * @param out: result pointer
+ * @param err: error message buffer
+ * @param es: error buffer size
+ * @return: true if successful, false if error
+ */
+static bool safe_divide(double a, double b, double *out, char *err, size_t es) {
+    if (fabs(b) < 1e-15) {  // More precise zero check
+        snprintf(err, es, "Division by zero");
+        return false;
+    }
+    *out = a / b;
+    return true;
+}
+
+/**
+ * Safe power function - handles edge cases
+ * - 0^negative = undefined (division by zero)
+ * - negative^non-integer = complex number (not supported)
+ */
+static bool safe_power(double base, double exponent, double *out, char *err,
+                       size_t es) {
+    // Check for 0^negative
+    if (fabs(base) < 1e-15 && exponent < 0) {
+        snprintf(err, es, "Cannot raise zero to negative power");
+        return false;
+    }
+
+    // Check for negative base with non-integer exponent
+    if (base < 0 && fabs(exponent - round(exponent)) > 1e-12) {
+        snprintf(err, es, "Cannot raise negative number to non-integer power");
+        return false;
+    }
+
+    *out = pow(base, exponent);
+    return true;
+}
+
+/**
+ * Safe square root - checks for negative input
+ */
+static bool safe_sqrt(double x, double *out, char *err, size_t es) {
+    if (x < -1e-15) {  // Allow tiny negative due to floating point errors
+        snprintf(err, es, "Cannot take square root of negative number");
+        return false;
+    }
+    *out = sqrt(fabs(x));  // Use abs to handle tiny negatives
+    return true;
+}
+
+/**
+ * Safe base-10 logarithm - checks domain (x > 0)
+ */
+static bool safe_log10(double x, double *out, char *err, size_t es) {
+    if (x <= 1e-15) {
+        snprintf(err, es, "Logarithm undefined for zero or negative numbers");
+        return false;
+    }
+    *out = log10(x);
+    return true;
+}
+
+/**
+ * Safe natural logarithm - checks domain (x > 0)
+ */
+static bool safe_ln(double x, double *out, char *err, size_t es) {
+    if (x <= 1e-15) {
+        snprintf(err, es, "Natural log undefined for zero or negative numbers");
+        return false;
+    }
+    *out = log(x);
+    return true;
+}
+
+/**
+ * Safe tangent function in degrees - checks for undefined values
+ * Tangent is undefined at odd multiples of 90° (π/2 radians); the degree
+ * kernel reduces the argument exactly, so no tolerance is needed
+ */
+static bool safe_tan_degrees(double degrees, double *out, char *err,
+                             size_t es) {
+    if (!degree_tan(degrees, out)) {
+        snprintf(err, es, "Tangent undefined at 90° and odd multiples");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * =======================================================================
+ *      EXPRESSION PARSER - TOKENIZER AND SHUNTING YARD ALGORITHM
+ * =======================================================================
+ */
+
+/**
+ * Initialize a token with default values
+ */
+static void init_token(Token *token) {
+    token->type = TOK_END;
+    token->variable = 0;
+    token->value = 0.0;
+    token->operator = 0;
+    token->function[0] = '\0';
+    token->exact = true;
+    token->source = 0;
+    token->arguments = 1;
+}
+
+/**
+ * Extract next token from input string
+ * Handles numbers, operators, parentheses, and function names
+ */
+Token get_next_token(Lexer *lexer) {
+    skip_whitespace(lexer);
+    Token token;
+    init_token(&token);
+
+    char current = lexer->input[lexer->position];
+
+    // End of input
+    if (current == '\0') {
+        token.type = TOK_END;
+        return token;
+    }
+
+    // Parse 0x/0b/0o integer literals (programmer mode)
+    int radix = radix_prefix(lexer->input + lexer->position);
+    if (radix) {
+        token.type = TOK_NUMBER;
+        token.source = (unsigned int)lexer->position;
+        lexer->position += 2;
+
+        // Exact while the value fits 64 bits, then continue in double.
+        // Up to 64 bits the digits are a two's complement bit pattern, so
+        // 0xFFFFFFFFFFFFFFFF is -1, as calc_format_integer() writes it
+        unsigned long long integer = 0;
+        bool overflow = false;
+        size_t digits = 0;
+        int digit;
+        while ((digit = radix_digit(lexer->input[lexer->position], radix)) >=
+               0) {
+            if (!overflow && integer > (~0ULL - (unsigned)digit) / radix) {
+                overflow = true;
+                token.value = (double)integer;
+            }
+            if (overflow) {
+                token.value = token.value * radix + digit;
+            } else {
+                integer = integer * radix + (unsigned)digit;
+            }
+            lexer->position++;
+            digits++;
+        }
+        if (digits == 0) {
+            token.type = TOK_INVALID;
+            return token;
+        }
+        long long pattern = (long long)integer;
+        if (!overflow) token.value = (double)pattern;
+        token.exact = !overflow && pattern >= -(1LL << 53) &&
+                      pattern <= (1LL << 53);
+        return token;
+    }
+
+    // Parse numbers (including decimals and percentages)
+    if ((current >= '0' && current <= '9') || current == '.') {
+        const char *start = lexer->input + lexer->position;
+        size_t length = 0;
+        bool fraction = false;
+        unsigned long long integer = 0;
+        token.type = TOK_NUMBER;
+        token.source = (unsigned int)lexer->position;
+
+        // Extract all digits and decimal points (at most 63), accumulating
+        // integer literals of up to 19 digits on the way
+        while (length < 63 &&
+               ((start[length] >= '0' && start[length] <= '9') ||
+                start[length] == '.')) {
+            if (start[length] == '.') {
+                fraction = true;
+            } else if (length < 19) {
+                integer = integer * 10 + (unsigned)(start[length] - '0');
+            }
+            length++;
+        }
+        lexer->position += length;
+
+        // Integer literals below 10^19 convert with a single rounding, the
+        // same as strtod() but without it; anything else goes to strtod()
+        if (!fraction && length < 20) {
+            token.value = (double)integer;
+            token.exact = integer <= (1ULL << 53);
+        } else {
+            char buffer[64];
+            memcpy(buffer, start, length);
+            buffer[length] = '\0';
+            token.value = strtod(buffer, NULL);
+            token.exact = false;
+        }
+
+        // Handle percentage suffix
+        if (lexer->input[lexer->position] != '\0' &&
+            lexer->input[lexer->position] == '%') {
+            token.value /= 100.0;
+            token.exact = false;
+            lexer->position++;
+        }
+        return token;
+    }
+
+    // Parse function and variable names
+    if (is_identifier_start(current)) {
+        const char *start = lexer->input + lexer->position;
+        size_t length = 0;
+        while (is_identifier_char(start[length])) length++;
+
+        // "xor" is a binary operator spelled as a word
+        if (length == 3 && strncmp(start, "xor", 3) == 0) {
+            lexer->position += length;
+            token.type = TOK_OPERATOR;
+            token.operator = 'x';
+            return token;
+        }
+
+        // Only a whole name matches a built-in function, so "cos_theta"
+        // and "log2" stay variables; any other name is one unless called
+        if (!is_function_name(start, length)) {
+            size_t next = length;
+            while (start[next] == ' ' || start[next] == '\t') next++;
+            if (start[next] != '(') {
+                token.type = TOK_VARIABLE;
+                token.source = (unsigned int)lexer->position;
+                lexer->position += length;
+                return token;
+            }
+        }
+
+        token.type = TOK_FUNCTION;
+        size_t copied = length < sizeof(token.function) - 1
+                            ? length
+                            : sizeof(token.function) - 1;
+        memcpy(token.function, start, copied);
+        token.function[copied] = '\0';  // Ensure null termination
+        lexer->position += length;
+        return token;
+    }
+
+    // Parse operators and parentheses
+    lexer->position++;
+    switch (current) {
+        case '+':
+        case '-':
+        case '*':
+        case '/':
+        case '^':
+        case '&':
+        case '|':
+            token.type = TOK_OPERATOR;
+            token.operator = current;
+            return token;
+        case '<':
+        case '>':
+            // Shifts are written << and >>
+            if (lexer->input[lexer->position] != current) {
+                token.type = TOK_INVALID;
+                return token;
+            }
+            lexer->position++;
+            token.type = TOK_OPERATOR;
+            token.operator = current;
+            return token;
+        case '~':
+            // Bitwise not binds like a function: ~5 + 1 = (~5) + 1
+            token.type = TOK_FUNCTION;
+            strcpy(token.function, "not");
+            return token;
+        case '(':
+            token.type = TOK_LPAREN;
+            return token;
+        case ')':
+            token.type = TOK_RPAREN;
+            return token;
+        case ',':
+            token.type = TOK_COMMA;
+            return token;
+        case '[':
+            token.type = TOK_LBRACKET;
+            return token;
+        case ']':
+            token.type = TOK_RBRACKET;
+            return token;
+        case ';':
+            token.type = TOK_SEMICOLON;
+            return token;
+        default:
+            token.type = TOK_INVALID;
+            return token;
+    }
+}
+
+/**
+ * Get operator precedence for correct evaluation order
+ * Higher numbers = higher precedence
+ */
+static int get_precedence(char op) {
+    switch (op) {
+        case '^':
+            return 7;  // Exponentiation (highest)
+        case '*':
+        case '/':
+            return 6;  // Multiplication and division
+        case '+':
+        case '-':
+            return 5;  // Addition and subtraction
+        case '<':
+        case '>':
+            return 4;  // Shifts (<< and >>)
+        case '&':
+            return 3;  // Bitwise and
+        case 'x':
+            return 2;  // Bitwise exclusive or
+        case '|':
+            return 1;  // Bitwise or (lowest)
+        default:
+            return 0;  // Unknown operator
+    }
+}
+
+/**
+ * =======================================================================
+ *                 DYNAMIC STACKS FOR EXPRESSION PARSING
+ * =======================================================================
+ */
+
+/**
+ * Initialize a token stack
+ */
+static void token_stack_init(TokenStack *stack) {
+    stack->data = NULL;
+    stack->top = -1;
+    stack->capacity = 0;
+}
+
+/**
+ * Initialize a number stack
+ */
+static void number_stack_init(NumberStack *stack) {
+    stack->data = NULL;
+    stack->top = -1;
+    stack->capacity = 0;
+}
+
+/**
+ * Double the capacity of a stack's array (16 elements at first)
+ * @return: false (with an error message) if out of memory
+ */
+static bool stack_grow(CalcContext *context, void **data, int *capacity,
+                       size_t element_size) {
+    if (*capacity > INT_MAX / 2) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Out of memory");
+        return false;
+    }
+    int grown_capacity = *capacity ? *capacity * 2 : 16;
+    void *grown = grow_working_memory(context, *data,
+                                      element_size * (size_t)*capacity,
+                                      element_size * (size_t)grown_capacity);
+    if (!grown) return false;
+    *data = grown;
+    *capacity = grown_capacity;
+    return true;
+}
+
+/**
+ * Push a token onto the stack
+ * @return: false (with an error message) if the stack cannot grow
+ */
+static bool token_stack_push(CalcContext *context, TokenStack *stack,
+                             Token value) {
+    // Expand capacity if needed
+    if (stack->top + 1 == stack->capacity) {
+        void *data = stack->data;
+        if (!stack_grow(context, &data, &stack->capacity, sizeof(Token))) {
+            return false;
+        }
+        stack->data = data;
+    }
+    stack->data[++stack->top] = value;
+    return true;
+}
+
+/**
+ * Push a number onto the stack
+ * @return: false (with an error message) if the stack cannot grow
+ */
+static bool number_stack_push(CalcContext *context, NumberStack *stack,
+                              double value) {
+    // Expand capacity if needed
+    if (stack->top + 1 == stack->capacity) {
+        void *data = stack->data;
+        if (!stack_grow(context, &data, &stack->capacity, sizeof(double))) {
+            return false;
+        }
+        stack->data = data;
+    }
+    stack->data[++stack->top] = value;
+    return true;
+}
+
+/**
+ * Pop a token from the stack
+ */
+static Token token_stack_pop(TokenStack *stack) {
+    return stack->data[stack->top--];
+}
+
+/**
+ * Pop a number from the stack
+ */
+static double number_stack_pop(NumberStack *stack) {
+    return stack->data[stack->top--];
+}
+
+/**
+ * Peek at the top token of the stack without removing it
+ */
+static Token token_stack_peek(TokenStack *stack) {
+    return stack->data[stack->top];
+}
+
+/**
+ * Check if token stack is empty
+ */
+static bool token_stack_empty(TokenStack *stack) { return stack->top < 0; }
+
+/**
+ * Free memory used by stacks
+ */
+static void free_stacks(CalcContext *context, TokenStack *op_stack,
+                        TokenStack *output, NumberStack *numbers) {
+    if (op_stack && op_stack->data) calc_free(context, op_stack->data);
+    if (output && output->data) calc_free(context, output->data);
+    if (numbers && numbers->data) calc_free(context, numbers->data);
+}
+
+/**
+ * Resolve a variable token against the names bound by calc_compile()
+ * @return: false (with an error message) if the name is not bound
+ */
+static bool bind_variable(CalcContext *context, const char *expression,
+                          Token *token) {
+    const char *name = expression + token->source;
+    size_t length = 0;
+    while (is_identifier_char(name[length])) length++;
+
+    for (size_t i = 0; i < context->variable_count; i++) {
+        const char *bound = context->variable_names[i];
+        if (strlen(bound) == length && strncmp(bound, name, length) == 0) {
+            token->variable = (int)i;
+            return true;
+        }
+    }
+    snprintf(context->last_error, sizeof(context->last_error),
+             "Unknown variable: %.*s", (int)(length < 64 ? length : 64), name);
+    return false;
+}
+
+/**
+ * Move operators and functions to the output until the innermost open
+ * parenthesis or bracket (which stays on the operator stack)
+ * @return: false (with an error message) if the output cannot grow
+ */
+static bool pop_to_open(CalcContext *context, TokenStack *output) {
+    TokenStack *operator_stack = &context->operators;
+    while (!token_stack_empty(operator_stack)) {
+        TokenType type = token_stack_peek(operator_stack).type;
+        if (type == TOK_LPAREN || type == TOK_LBRACKET) break;
+        if (!token_stack_push(context, output,
+                              token_stack_pop(operator_stack))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Check that a matrix element ends before a ',', ';' or ']'
+ * @return: false (with an error message) if it is missing
+ */
+static bool matrix_element_done(CalcContext *context, Token previous) {
+    if (previous.type == TOK_LBRACKET || previous.type == TOK_COMMA ||
+        previous.type == TOK_SEMICOLON) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Missing matrix element");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Output the row of a matrix literal finished at a ';' or ']'; rows of
+ * one element need no joining
+ * @return: false (with an error message) if the output cannot grow
+ */
+static bool push_row(CalcContext *context, TokenStack *output,
+                     const Token *bracket) {
+    if (bracket->arguments == 1) return true;
+    Token row;
+    init_token(&row);
+    row.type = TOK_ROW;
+    row.arguments = bracket->arguments;
+    return token_stack_push(context, output, row);
+}
+
+/**
+ * Check the number of arguments of a function call: aggregates take any
+ * number, iterate three, fixpoint and fixsteps two or three, dot and
+ * solve two, everything else one
+ * @return: false (with an error message) if it does not fit
+ */
+bool check_arity(CalcContext *context, const Token *function) {
+    IterationFunction iteration = iteration_function(function->function);
+    if (iteration == ITERATION_ITERATE) {
+        if (function->arguments == 3) return true;
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Function '%s' takes three arguments", function->function);
+        return false;
+    }
+    if (iteration != ITERATION_NONE) {
+        if (function->arguments == 2 || function->arguments == 3) return true;
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Function '%s' takes two or three arguments",
+                 function->function);
+        return false;
+    }
+    MatrixFunction matrix = matrix_function(function->function);
+    if (matrix == MATRIX_DOT || matrix == MATRIX_SOLVE) {
+        if (function->arguments == 2) return true;
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Function '%s' takes two arguments", function->function);
+        return false;
+    }
+    // Aggregates are looked up last: most calls have one argument
+    if (function->arguments <= 1 ||
+        aggregate_function(function->function) != AGGREGATE_NONE) {
+        return true;
+    }
+    snprintf(context->last_error, sizeof(context->last_error),
+             "Function '%s' takes one argument", function->function);
+    return false;
+}
+
+/**
+ * Convert infix expression to Reverse Polish Notation (RPN) using Shunting Yard
+ * algorithm This allows proper operator precedence and parentheses handling
+ *
+ * Example: "3 + 4 * 2" becomes "3 4 2 * +" which evaluates to 11, not 14
+ *
+ * Both the output and the operator stack are emptied first but keep their
+ * capacity, so a context reuses them across evaluations. Every token is
+ * pushed and popped at most once per stack, so the conversion is linear
+ * in the length of the expression; the context's limits stop it early.
+ */
+bool convert_to_rpn(CalcContext *context, const char *expression,
+                    TokenStack *output) {
+    char *error = context->last_error;
+    size_t error_size = sizeof(context->last_error);
+    const CalcLimits *limits = &context->options.limits;
+    Lexer lexer = {expression, 0};
+    TokenStack *operator_stack = &context->operators;
+    operator_stack->top = -1;
+    output->top = -1;
+
+    // Token offsets are 32-bit, so longer input is never accepted; memchr()
+    // stops at the terminator, so this reads no more than the limit
+    size_t max_length = limits->max_length && limits->max_length < UINT_MAX
+                            ? limits->max_length
+                            : UINT_MAX - 1;
+    if (!memchr(expression, '\0', max_length + 1)) {
+        snprintf(error, error_size,
+                 "Expression too long (limit %zu characters)", max_length);
+        return false;
+    }
+
+    Token previous_token;
+    init_token(&previous_token);
+    previous_token.type = TOK_INVALID;
+
+    size_t token_count = 0;
+    size_t depth = 0;
+    size_t bodies = 0;  // Iterated expressions being read
+    bool success = true;
+    CALC_PERF_BEGIN(rpn_start);
+    CALC_PERF_COUNTER(lex_ns);
+
+    while (success) {
+        CALC_PERF_BEGIN(lex_start);
+        Token current_token = get_next_token(&lexer);
+        CALC_PERF_ACCUMULATE(lex_ns, lex_start);
+
+        // Check for invalid tokens
+        if (current_token.type == TOK_INVALID) {
+            snprintf(error, error_size, "Invalid character in expression");
+            success = false;
+            break;
+        }
+
+        // End of expression
+        if (current_token.type == TOK_END) break;
+
+        if (limits->max_tokens && ++token_count > limits->max_tokens) {
+            snprintf(error, error_size,
+                     "Expression has too many tokens (limit %zu)",
+                     limits->max_tokens);
+            success = false;
+            break;
+        }
+
+        // Numbers go directly to output
+        if (current_token.type == TOK_NUMBER) {
+            success = token_stack_push(context, output, current_token);
+            previous_token = current_token;
+            continue;
+        }
+
+        // Variables too, once bound to the index of their value; x in an
+        // iterated expression is the previous value instead
+        if (current_token.type == TOK_VARIABLE) {
+            const char *name = expression + current_token.source;
+            if (bodies > 0 && name[0] == 'x' && !is_identifier_char(name[1])) {
+                current_token.type = TOK_PREVIOUS;
+            } else {
+                success = bind_variable(context, expression, &current_token);
+            }
+            success = success &&
+                      token_stack_push(context, output, current_token);
+            previous_token = current_token;
+            continue;
+        }
+
+        // Functions go to operator stack
+        if (current_token.type == TOK_FUNCTION) {
+            success = token_stack_push(context, operator_stack, current_token);
+            previous_token = current_token;
+            continue;
+        }
+
+        // Handle operators
+        if (current_token.type == TOK_OPERATOR) {
+            // Handle unary minus: if minus appears at start or after
+            // operator/parenthesis/bracket/separator/function
+            if (current_token.operator == '-' &&
+                (previous_token.type == TOK_INVALID ||
+                 previous_token.type == TOK_OPERATOR ||
+                 previous_token.type == TOK_LPAREN ||
+                 previous_token.type == TOK_LBRACKET ||
+                 previous_token.type == TOK_COMMA ||
+                 previous_token.type == TOK_SEMICOLON ||
+                 previous_token.type == TOK_FUNCTION)) {
+                // Convert unary minus to binary subtraction: -x becomes 0-x
+                Token zero;
+                init_token(&zero);
+                zero.type = TOK_NUMBER;
+                zero.value = 0.0;
+                if (!token_stack_push(context, output, zero)) {
+                    success = false;
+                    break;
+                }
+            }
+
+            // Process operators according to precedence rules
+            while (success && !token_stack_empty(operator_stack)) {
+                Token top = token_stack_peek(operator_stack);
+                if (top.type == TOK_OPERATOR &&
+                    ((get_precedence(top.operator) >
+                      get_precedence(current_token.operator)) ||
+                     (get_precedence(top.operator) ==
+                          get_precedence(current_token.operator) &&
+                      !is_right_associative(current_token.operator)))) {
+                    success = token_stack_push(
+                        context, output, token_stack_pop(operator_stack));
+                } else if (top.type == TOK_FUNCTION) {
+                    success = token_stack_push(
+                        context, output, token_stack_pop(operator_stack));
+                } else {
+                    break;
+                }
+            }
+
+            if (success) {
+                success =
+                    token_stack_push(context, operator_stack, current_token);
+            }
+            previous_token = current_token;
+            continue;
+        }
+
+        // Left parenthesis, or the start of a matrix literal with one row
+        // of one element so far
+        if (current_token.type == TOK_LPAREN ||
+            current_token.type == TOK_LBRACKET) {
+            if (limits->max_depth && ++depth > limits->max_depth) {
+                snprintf(error, error_size,
+                         "Expression nested too deeply (limit %zu levels)",
+                         limits->max_depth);
+                success = false;
+                break;
+            }
+            // An iterated expression starts with a header that receives
+            // its length at the comma after it
+            if (previous_token.type == TOK_FUNCTION &&
+                iteration_function(previous_token.function) !=
+                    ITERATION_NONE) {
+                Token body;
+                init_token(&body);
+                body.type = TOK_BODY;
+                current_token.variable = output->top + 1;
+                bodies++;
+                success = token_stack_push(context, output, body);
+            }
+            success = success &&
+                      token_stack_push(context, operator_stack, current_token);
+            previous_token = current_token;
+            continue;
+        }
+
+        // Comma - finish one argument or matrix element; only a function
+        // call's parentheses may hold several, e.g. mean(1, 2, 3)
+        if (current_token.type == TOK_COMMA) {
+            success = pop_to_open(context, output);
+            if (!success) break;
+            int open = operator_stack->top;
+            if (open >= 0 &&
+                operator_stack->data[open].type == TOK_LBRACKET) {
+                if (!matrix_element_done(context, previous_token)) {
+                    success = false;
+                    break;
+                }
+                operator_stack->data[open].arguments++;
+                previous_token = current_token;
+                continue;
+            }
+            if (open < 1 ||
+                operator_stack->data[open - 1].type != TOK_FUNCTION) {
+                snprintf(error, error_size, "Unexpected comma");
+                success = false;
+                break;
+            }
+            if (previous_token.type == TOK_LPAREN ||
+                previous_token.type == TOK_COMMA) {
+                snprintf(error, error_size, "Missing function argument");
+                success = false;
+                break;
+            }
+            Token *left_paren = &operator_stack->data[open];
+            if (left_paren->arguments == 1 &&
+                iteration_function(operator_stack->data[open - 1].function) !=
+                    ITERATION_NONE) {
+                Token *body = &output->data[left_paren->variable];
+                body->arguments = output->top - left_paren->variable;
+                bodies--;
+            }
+            left_paren->arguments++;
+            previous_token = current_token;
+            continue;
+        }
+
+        // Semicolon - finish a row of a matrix literal
+        if (current_token.type == TOK_SEMICOLON) {
+            success = pop_to_open(context, output);
+            if (!success) break;
+            int open = operator_stack->top;
+            if (open < 0 || operator_stack->data[open].type != TOK_LBRACKET) {
+                snprintf(error, error_size, "Unexpected semicolon");
+                success = false;
+                break;
+            }
+            Token *bracket = &operator_stack->data[open];
+            success = matrix_element_done(context, previous_token) &&
+                      push_row(context, output, bracket);
+            bracket->arguments = 1;
+            bracket->variable++;
+            previous_token = current_token;
+            continue;
+        }
+
+        // Right bracket - finish the last row, then stack the rows
+        if (current_token.type == TOK_RBRACKET) {
+            success = pop_to_open(context, output);
+            if (!success) break;
+            int open = operator_stack->top;
+            if (open < 0 || operator_stack->data[open].type != TOK_LBRACKET) {
+                snprintf(error, error_size, "Mismatched brackets");
+                success = false;
+                break;
+            }
+            if (previous_token.type == TOK_LBRACKET) {
+                snprintf(error, error_size, "Empty matrix");
+                success = false;
+                break;
+            }
+            Token bracket = token_stack_pop(operator_stack);
+            success = matrix_element_done(context, previous_token) &&
+                      push_row(context, output, &bracket);
+            if (success && bracket.variable > 0) {
+                Token rows;
+                init_token(&rows);
+                rows.type = TOK_MATRIX;
+                rows.arguments = bracket.variable + 1;
+                success = token_stack_push(context, output, rows);
+            }
+            if (depth > 0) depth--;
+            previous_token = current_token;
+            continue;
+        }
+
+        // Right parenthesis - pop until matching left parenthesis
+        if (current_token.type == TOK_RPAREN) {
+            success = pop_to_open(context, output);
+            if (!success) break;
+            bool found_left_paren =
+                !token_stack_empty(operator_stack) &&
+                token_stack_peek(operator_stack).type == TOK_LPAREN;
+            Token left_paren;
+            init_token(&left_paren);
+            if (found_left_paren) left_paren = token_stack_pop(operator_stack);
+            if (!found_left_paren) {
+                snprintf(error, error_size, "Mismatched parentheses");
+                success = false;
+                break;
+            }
+            if (previous_token.type == TOK_COMMA) {
+                snprintf(error, error_size, "Missing function argument");
+                success = false;
+                break;
+            }
+            if (depth > 0) depth--;
+
+            // If there's a function on top of stack after closing parenthesis,
+            // apply it to the arguments inside ("f()" has none)
+            if (!token_stack_empty(operator_stack) &&
+                token_stack_peek(operator_stack).type == TOK_FUNCTION) {
+                Token function = token_stack_pop(operator_stack);
+                function.arguments = previous_token.type == TOK_LPAREN
+                                         ? 0
+                                         : left_paren.arguments;
+                success = check_arity(context, &function) &&
+                          token_stack_push(context, output, function);
+            }
+            previous_token = current_token;
+            continue;
+        }
+    }
+
+    // Pop remaining operators from stack
+    while (success && !token_stack_empty(operator_stack)) {
+        Token top = token_stack_pop(operator_stack);
+        if (top.type == TOK_LPAREN || top.type == TOK_RPAREN) {
+            snprintf(error, error_size, "Mismatched parentheses");
+            success = false;
+            break;
+        }
+        if (top.type == TOK_LBRACKET) {
+            snprintf(error, error_size, "Mismatched brackets");
+            success = false;
+            break;
+        }
+        success = token_stack_push(context, output, top);
+    }
+
+    // Lexing is reported separately from the rest of the conversion
+    CALC_PERF_RECORD(CALC_PERF_LEX, lex_ns);
+    CALC_PERF_RECORD(CALC_PERF_RPN, calc_perf_now() - rpn_start - lex_ns);
+    return success;
+}
+
+/**
+ * Apply a binary operator to two numbers
+ * @return: true if successful, false if error (see context->last_error)
+ */
+bool apply_scalar_operator(CalcContext *context, char op, double left,
+                           double right, double *result) {
+    char *error = context->last_error;
+    size_t error_size = sizeof(context->last_error);
+
+    switch (op) {
+        case '+':
+            *result = left + right;
+            return true;
+        case '-':
+            *result = left - right;
+            return true;
+        case '*':
+            *result = left * right;
+            return true;
+        case '/':
+            return safe_divide(left, right, result, error, error_size);
+        case '^':
+            return safe_power(left, right, result, error, error_size);
+        case '&':
+        case '|':
+        case 'x':
+        case '<':
+        case '>':
+            return apply_bitwise_operator(context, op, left, right, result);
+        default:
+            snprintf(error, error_size, "Unknown operator: %c", op);
+            return false;
+    }
+}
+
+/**
+ * Apply mathematical operator to two operands
+ * Pops two numbers from stack, applies operation, pushes result back
+ */
+static bool apply_operator(CalcContext *context, char op,
+                           NumberStack *numbers) {
+    // Need at least two operands for binary operators
+    if (numbers->top < 1) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Not enough operands for operator");
+        return false;
+    }
+
+    // Pop operands (note: order matters for non-commutative operations)
+    double right = number_stack_pop(numbers);  // Second operand
+    double left = number_stack_pop(numbers);   // First operand
+    double result = 0.0;
+    bool success = apply_scalar_operator(context, op, left, right, &result);
+
+    if (success) {
+        success = number_stack_push(context, numbers, result);
+    }
+
+    return success;
+}
+
+/**
+ * Apply a one-argument function to a number
+ * @return: true if successful, false if error (see context->last_error)
+ */
+bool apply_scalar_function(CalcContext *context, const char *name,
+                           double operand, double *result) {
+    char *error = context->last_error;
+    size_t error_size = sizeof(context->last_error);
+
+    // Apply the appropriate mathematical function
+    if (strcmp(name, "sqrt") == 0) {
+        return safe_sqrt(operand, result, error, error_size);
+    } else if (strcmp(name, "log") == 0) {
+        return safe_log10(operand, result, error, error_size);
+    } else if (strcmp(name, "ln") == 0) {
+        return safe_ln(operand, result, error, error_size);
+    } else if (strcmp(name, "sin") == 0) {
+        double cosine;
+        degree_sincos(operand, result, &cosine);  // Arguments in degrees
+        return true;
+    } else if (strcmp(name, "cos") == 0) {
+        double sine;
+        degree_sincos(operand, &sine, result);  // Arguments in degrees
+        return true;
+    } else if (strcmp(name, "tan") == 0) {
+        return safe_tan_degrees(operand, result, error, error_size);
+    } else if (strcmp(name, "not") == 0) {
+        return apply_bitwise_operator(context, '~', operand, 0.0, result);
+    }
+    snprintf(error, error_size, "Unknown function: %s", name);
+    return false;
+}
+
+/**
+ * Apply mathematical function to its operands
+ * Pops one number (`arguments` for aggregates) from stack, applies
+ * function, pushes result back
+ */
+static bool apply_function(CalcContext *context, const char *function_name,
+                           int arguments, NumberStack *numbers) {
+    char *error = context->last_error;
+    size_t error_size = sizeof(context->last_error);
+
+    // Need at least one operand for functions
+    if (numbers->top < 0) {
+        snprintf(error, error_size, "Function '%s' requires an argument",
+                 function_name);
+        return false;
+    }
+
+    // Aggregates reduce their arguments where they lie on the stack
+    AggregateFunction aggregate = aggregate_function(function_name);
+    if (aggregate != AGGREGATE_NONE) {
+        int count = arguments <= numbers->top + 1 ? arguments : 0;
+        double value;
+        if (!aggregate_values(context, aggregate,
+                              numbers->data + numbers->top + 1 - count,
+                              (size_t)count, &value)) {
+            return false;
+        }
+        numbers->top -= count;
+        return number_stack_push(context, numbers, value);
+    }
+
+    double operand = number_stack_pop(numbers);
+    double result = 0.0;
+    bool success =
+        apply_scalar_function(context, function_name, operand, &result);
+
+    if (success) {
+        success = number_stack_push(context, numbers, result);
+    }
+
+    return success;
+}
+
+/**
+ * Evaluate an RPN token sequence produced by convert_to_rpn()
+ * @param rpn_tokens: tokens in evaluation order
+ * @param result: receives the computed value
+ * @return: true if successful, false if error (see context->last_error)
+ */
+bool evaluate_rpn(CalcContext *context, const TokenStack *rpn_tokens,
+                  double *result) {
+    NumberStack *evaluation_stack = &context->numbers;
+    evaluation_stack->top = -1;
+
+    for (int i = 0; i <= rpn_tokens->top; i++) {
+        Token token = rpn_tokens->data[i];
+
+        if (token.type == TOK_NUMBER || token.type == TOK_VARIABLE) {
+            double value = token.type == TOK_NUMBER
+                               ? token.value
+                               : context->variable_values[token.variable];
+            if (!number_stack_push(context, evaluation_stack, value)) {
+                return false;
+            }
+        } else if (token.type == TOK_OPERATOR) {
+            if (!apply_operator(context, token.operator, evaluation_stack)) {
+                return false;
+            }
+        } else if (token.type == TOK_FUNCTION) {
+            if (!apply_function(context, token.function, token.arguments,
+                                evaluation_stack)) {
+                return false;
+            }
+        }
+        // Ignore other token types
+    }
+
+    // Should have exactly one number left on stack
+    if (evaluation_stack->top != 0) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Invalid expression syntax");
+        return false;
+    }
+    *result = number_stack_pop(evaluation_stack);
+    return true;
+}
+
+/**
+ * =======================================================================
+ *                         PUBLIC LIBRARY API
+ * =======================================================================
+ */
+
+void calc_options_init(CalcOptions *options) {
+    memset(options, 0, sizeof(*options));
+    options->precision = CALC_PRECISION_AUTO;
+    options->tolerance = 1e-12;
+    options->limits.max_length = DEFAULT_MAX_LENGTH;
+    options->limits.max_depth = DEFAULT_MAX_DEPTH;
+    options->limits.max_tokens = DEFAULT_MAX_TOKENS;
+    options->limits.max_memory = DEFAULT_MAX_MEMORY;
+    options->limits.max_steps = DEFAULT_MAX_STEPS;
+}
+
+CalcContext *calc_context_new(const CalcOptions *options) {
+    CalcOptions defaults;
+    if (!options) {
+        calc_options_init(&defaults);
+        options = &defaults;
+    }
+
+    if (!calc_allocator_valid(&options->allocator)) return NULL;
+    CalcContext *context =
+        calc_allocator_malloc(&options->allocator, sizeof(CalcContext));
+    if (!context) return NULL;
+
+    memset(context, 0, sizeof(*context));
+    context->options = *options;
+    clear_error(context->last_error, sizeof(context->last_error));
+    token_stack_init(&context->rpn);
+    token_stack_init(&context->operators);
+    number_stack_init(&context->numbers);
+    atomic_init(&context->cancel_requested, false);
+    return context;
+}
+
+void calc_context_free(CalcContext *context) {
+    if (!context) return;
+    free_stacks(context, &context->operators, &context->rpn,
+                &context->numbers);
+    if (context->value_stack) calc_free(context, context->value_stack);
+    if (context->matrix_arena) calc_free(context, context->matrix_arena);
+    calc_free(context, context);
+}
+
+/**
+ * Evaluate converted RPN with the configured precision
+ */
+static bool evaluate_converted(CalcContext *context, const char *expression,
+                               const TokenStack *rpn, CalcValue *result) {
+    CalcPrecision precision = context->options.precision;
+    result->type = CALC_VALUE_REAL;
+    result->numerator = 0;
+    result->denominator = 1;
+    context->matrix_rows = 0;
+    context->matrix_columns = 0;
+
+    // Iteration and matrices have their own evaluators, in double only
+    bool iteration = uses_iteration(rpn);
+    bool matrices = uses_matrices(rpn);
+    if (iteration && matrices) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Matrices cannot be iterated");
+        return false;
+    }
+    if ((iteration || matrices) && precision == CALC_PRECISION_EXACT) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "%s are not supported in exact precision",
+                 iteration ? "Iteration functions" : "Matrices");
+        return false;
+    }
+    if (iteration) {
+        context->last_precision = CALC_PRECISION_DOUBLE;
+        return evaluate_rpn_iteration(context, rpn, &result->real);
+    }
+    if (matrices) {
+        context->last_precision = CALC_PRECISION_DOUBLE;
+        return evaluate_rpn_matrix(context, rpn, result);
+    }
+
+    // Exact rational pass; anything it cannot represent falls through
+    if (precision == CALC_PRECISION_AUTO || precision == CALC_PRECISION_EXACT) {
+        Rational exact;
+        ExactResult outcome =
+            evaluate_rpn_exact(context, expression, rpn, &exact);
+        switch (outcome) {
+            case EXACT_OK:
+                context->last_precision = CALC_PRECISION_EXACT;
+                result->type = exact.denominator == 1 ? CALC_VALUE_INTEGER
+                                                      : CALC_VALUE_RATIONAL;
+                result->real = rational_to_double(exact);
+                result->numerator = exact.numerator;
+                result->denominator = exact.denominator;
+                return true;
+            case EXACT_ERROR:
+                return false;
+            default:
+                if (precision == CALC_PRECISION_EXACT) {
+                    // Prefer the floating-point evaluator's domain errors
+                    double ignored;
+                    bool trusted;
+                    if (evaluate_rpn_bounded(context, rpn, &ignored,
+                                             &trusted)) {
+                        snprintf(context->last_error,
+                                 sizeof(context->last_error),
+                                 "Result is not an exact 64-bit fraction");
+                    }
+                    return false;
+                }
+                break;
+        }
+    }
+
+    switch (precision) {
+        case CALC_PRECISION_DOUBLE:
+            context->last_precision = CALC_PRECISION_DOUBLE;
+            return evaluate_rpn(context, rpn, &result->real);
+        case CALC_PRECISION_EXTENDED:
+            context->last_precision = CALC_PRECISION_EXTENDED;
+            return evaluate_rpn_precise(context, expression, rpn,
+                                        &result->real);
+        default: {
+            // Double fast path; re-run in extended precision only when its
+            // error bound says the result cannot be trusted
+            bool trusted = true;
+            context->last_precision = CALC_PRECISION_DOUBLE;
+            if (!evaluate_rpn_bounded(context, rpn, &result->real,
+                                      &trusted)) {
+                return false;
+            }
+            if (trusted) return true;
+            context->last_precision = CALC_PRECISION_EXTENDED;
+            return evaluate_rpn_precise(context, expression, rpn,
+                                        &result->real);
+        }
+    }
+}
+
+bool calc_evaluate_value(CalcContext *context, const char *expression,
+                         CalcValue *result) {
+    clear_error(context->last_error, sizeof(context->last_error));
+    atomic_store(&context->cancel_requested, false);
+
+    // Convert infix expression to RPN, then evaluate it
+    if (!convert_to_rpn(context, expression, &context->rpn)) return false;
+
+    CALC_PERF_BEGIN(eval_start);
+    bool evaluated =
+        evaluate_converted(context, expression, &context->rpn, result);
+    CALC_PERF_END(CALC_PERF_EVAL, eval_start);
+    return evaluated;
+}
+
+bool calc_evaluate(CalcContext *context, const char *expression,
+                   double *result) {
+    CalcValue value;
+    if (!calc_evaluate_value(context, expression, &value)) return false;
+    if (value.type == CALC_VALUE_MATRIX) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Result is a matrix; use calc_evaluate_value()");
+        return false;
+    }
+    *result = value.real;
+    return true;
+}
+
+CalcProgram *calc_compile(CalcContext *context, const char *expression,
+                          const char *const *variables, size_t count) {
+    clear_error(context->last_error, sizeof(context->last_error));
+    if (count > INT_MAX) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Too many variables");
+        return NULL;
+    }
+
+    context->variable_names = variables;
+    context->variable_count = count;
+    bool converted = convert_to_rpn(context, expression, &context->rpn);
+    context->variable_names = NULL;
+    context->variable_count = 0;
+    if (!converted) return NULL;
+
+    // One block: the program, its tokens, then the expression text
+    size_t code_size = sizeof(Token) * (size_t)(context->rpn.top + 1);
+    size_t text_size = strlen(expression) + 1;
+    CalcProgram *program = calc_realloc(
+        context, NULL, sizeof(CalcProgram) + code_size + text_size);
+    if (!program) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Out of memory");
+        return NULL;
+    }
+
+    Token *code = (Token *)(program + 1);
+    char *text = (char *)code + code_size;
+    memcpy(code, context->rpn.data, code_size);
+    memcpy(text, expression, text_size);
+    program->allocator = context->options.allocator;
+    program->code.data = code;
+    program->code.top = context->rpn.top;
+    program->code.capacity = context->rpn.top + 1;
+    program->expression = text;
+    return program;
+}
+
+bool calc_program_evaluate(CalcContext *context, const CalcProgram *program,
+                           const double *values, CalcValue *result) {
+    clear_error(context->last_error, sizeof(context->last_error));
+    atomic_store(&context->cancel_requested, false);
+
+    CALC_PERF_BEGIN(eval_start);
+    context->variable_values = values;
+    bool evaluated = evaluate_converted(context, program->expression,
+                                        &program->code, result);
+    context->variable_values = NULL;
+    CALC_PERF_END(CALC_PERF_EVAL, eval_start);
+    return evaluated;
+}
+
+bool calc_program_uses(const CalcProgram *program, size_t variable) {
+    for (int i = 0; i <= program->code.top; i++) {
+        const Token *token = &program->code.data[i];
+        if (token->type == TOK_VARIABLE &&
+            (size_t)token->variable == variable) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void calc_program_free(CalcProgram *program) {
+    if (!program) return;
+    calc_allocator_free(&program->allocator, program);
+}
+
+void calc_cancel(CalcContext *context) {
+    atomic_store(&context->cancel_requested, true);
+}
+
+const char *calc_last_error(const CalcContext *context) {
+    return context->last_error;
+}
+
+CalcPrecision calc_last_precision(const CalcContext *context) {
+    return context->last_precision;
+}
+
+const double *calc_last_matrix(const CalcContext *context, size_t *rows,
+                               size_t *columns) {
+    if (rows) *rows = context->matrix_rows;
+    if (columns) *columns = context->matrix_columns;
+    return context->matrix_rows ? context->matrix_arena : NULL;
+}
+
+const char *calc_version(void) { return CALC_VERSION_STRING; }
@@ -0,0 +1,406 @@
+/**
+ * ========================================================================
+ *    LIBCALC - Embeddable Expression Evaluation Engine (Public C API)
+ * ========================================================================
+ *
+ * The tokenizer, Shunting Yard parser and RPN evaluator behind the GUI
+ * calculator, usable without GTK. All state lives in a CalcContext:
+ * contexts are independent, so any number of threads may evaluate in
+ * parallel as long as each context is used by one thread at a time.
+ *
+ * Example:
+ *     CalcContext *context = calc_context_new(NULL);
+ *     double result;
+ *     if (calc_evaluate(context, "2 * sin(30)", &result)) {
+ *         printf("%g\n", result);
+ *     } else {
+ *         printf("%s\n", calc_last_error(context));
+ *     }
+ *     calc_context_free(context);
+ */
+
+#ifndef LIBCALC_CALC_H
+#define LIBCALC_CALC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Version of this API; bumped on incompatible changes
+#define CALC_API_VERSION 1
+
+// Size of the error buffer kept by every context
+#define CALC_ERROR_SIZE 128
+
+/**
+ * Opaque evaluation context - error buffer, allocator, options and
+ * reusable working memory
+ */
+typedef struct CalcContext CalcContext;
+
+/**
+ * Opaque compiled expression - parsed once by calc_compile(), then
+ * evaluated any number of times with different variable values
+ */
+typedef struct CalcProgram CalcProgram;
+
+/**
+ * Opaque precompiled formula library - named programs in a file that is
+ * mapped into memory and used in place
+ */
+typedef struct CalcLibrary CalcLibrary;
+
+/**
+ * Opaque running statistics - count, mean, variance, extremes and an
+ * optional quantile sketch of values added in any number of pieces
+ */
+typedef struct CalcStats CalcStats;
+
+/**
+ * Memory allocation hooks - all NULL for libc
+ * Blocks are resized with realloc_fn and released with free_fn, so those
+ * two are set together. malloc_fn may be NULL, in which case new blocks
+ * come from realloc_fn(NULL, size). Contexts and statistics are not
+ * created with any other combination.
+ */
+typedef struct {
+    void *(*malloc_fn)(size_t size, void *user_data);
+    void *(*realloc_fn)(void *pointer, size_t size, void *user_data);
+    void (*free_fn)(void *pointer, void *user_data);
+    void *user_data;  // Passed unchanged to every hook
+} CalcAllocator;
+
+/**
+ * Numeric precision of calc_evaluate()
+ */
+typedef enum {
+    // double evaluation with a running error bound; expressions whose bound
+    // exceeds the tolerance are re-evaluated in extended precision
+    CALC_PRECISION_AUTO,
+    // Plain double evaluation without error tracking
+    CALC_PRECISION_DOUBLE,
+    // Always evaluate in double-double (about 31 significant digits)
+    CALC_PRECISION_EXTENDED,
+    // Exact integer/rational arithmetic only; expressions without an exact
+    // 64-bit rational result (functions, irrational powers) fail
+    CALC_PRECISION_EXACT
+} CalcPrecision;
+
+/**
+ * Kind of value produced by calc_evaluate_value()
+ */
+typedef enum {
+    CALC_VALUE_REAL,      // Only `real` is meaningful
+    CALC_VALUE_INTEGER,   // Exact integer in `numerator`
+    CALC_VALUE_RATIONAL,  // Exact fraction numerator / denominator
+    CALC_VALUE_MATRIX     // Vector or matrix, see calc_last_matrix()
+} CalcValueType;
+
+/**
+ * Typed evaluation result
+ */
+typedef struct {
+    CalcValueType type;     // Kind of value
+    double real;            // Nearest double (always set)
+    long long numerator;    // Exact value (INTEGER and RATIONAL)
+    long long denominator;  // Positive; 1 for INTEGER and REAL
+} CalcValue;
+
+/**
+ * Limits on the expressions a context accepts; 0 disables a limit
+ * Parsing and evaluation take time linear in the input plus the steps of
+ * iterate() and fixpoint(), and an input over a limit fails as soon as it
+ * is detected, so untrusted expressions cannot make a context use
+ * unbounded time or memory.
+ */
+typedef struct {
+    size_t max_length;  // Characters per expression (below 4 GiB)
+    size_t max_depth;   // Nesting depth of parentheses
+    size_t max_tokens;  // Numbers, operators, functions and parentheses
+    size_t max_memory;  // Bytes of working memory a context may hold
+    size_t max_steps;   // Iteration steps per evaluation
+} CalcLimits;
+
+/**
+ * Options used when creating a context
+ * Always initialize with calc_options_init() so new fields get defaults
+ */
+typedef struct {
+    CalcAllocator allocator;  // Memory hooks for all context allocations
+    CalcPrecision precision;  // Evaluation precision (default AUTO)
+    double tolerance;  // Largest relative error bound accepted from double
+    CalcLimits limits;        // Expression size limits
+} CalcOptions;
+
+/**
+ * Fill options with default values (libc allocator, automatic precision,
+ * tolerance 1e-12, at most 1 MiB, 256 levels of nesting and 262144 tokens
+ * per expression, 64 MiB of working memory, 100000000 iteration steps)
+ */
+void calc_options_init(CalcOptions *options);
+
+/**
+ * Create an evaluation context
+ * @param options: creation options, or NULL for defaults
+ * @return: new context, or NULL if allocation failed or the allocator
+ *          sets only some of its hooks (see CalcAllocator)
+ */
+CalcContext *calc_context_new(const CalcOptions *options);
+
+/**
+ * Release a context and all memory it owns
+ */
+void calc_context_free(CalcContext *context);
+
+/**
+ * Evaluate a mathematical expression
+ * @param context: evaluation context (not shared between threads)
+ * @param expression: NUL-terminated expression, e.g. "(5+3)*sqrt(16)"
+ * @param result: receives the value on success
+ * @return: true on success; on failure (including a matrix result) see
+ *          calc_last_error()
+ */
+bool calc_evaluate(CalcContext *context, const char *expression,
+                   double *result);
+
+/**
+ * Evaluate an expression, keeping integer and rational results exact
+ * In AUTO (and EXACT) precision, expressions made of integer and decimal
+ * literals, + - * / ^, bitwise operators and trig functions of whole
+ * degrees are first evaluated with checked 64-bit rational arithmetic;
+ * overflow, irrational function values and irrational powers fall back
+ * to floating point. Expressions with matrix literals ([1, 2; 3, 4]) or
+ * dot, det, inv, solve and transpose are evaluated in double; their
+ * vector and matrix results are CALC_VALUE_MATRIX. iterate(f, x0, n),
+ * fixpoint(f, x0[, tol]) and fixsteps(f, x0[, tol]), whose first argument
+ * is an expression in x compiled once and then applied repeatedly, are
+ * evaluated in double as well.
+ * @return: true on success; on failure see calc_last_error()
+ */
+bool calc_evaluate_value(CalcContext *context, const char *expression,
+                         CalcValue *result);
+
+/**
+ * Compile an expression whose names (letters, digits and underscores,
+ * not starting with a digit) refer to variables, e.g. "price*qty*(1+tax)"
+ * @param variables: names of the variables; a value array passed to
+ *                   calc_program_evaluate() holds their values in this order
+ * @param count: number of names
+ * @return: new program (independent of the context), or NULL on error
+ *          (see calc_last_error())
+ */
+CalcProgram *calc_compile(CalcContext *context, const char *expression,
+                          const char *const *variables, size_t count);
+
+/**
+ * Evaluate a compiled program with the context's precision
+ * Programs are read-only, so several contexts (one per thread) may
+ * evaluate the same program at the same time.
+ * @param values: one value per variable name given to calc_compile()
+ * @return: true on success; on failure see calc_last_error()
+ */
+bool calc_program_evaluate(CalcContext *context, const CalcProgram *program,
+                           const double *values, CalcValue *result);
+
+/**
+ * Check whether a program reads the variable at an index, so callers can
+ * skip preparing values that are never used
+ */
+bool calc_program_uses(const CalcProgram *program, size_t variable);
+
+/**
+ * Release a compiled program
+ */
+void calc_program_free(CalcProgram *program);
+
+/**
+ * Named formula to store in a library
+ */
+typedef struct {
+    const char *name;              // Unique, non-empty name
+    const char *expression;        // Formula text, as for calc_compile()
+    const char *const *variables;  // Variable names in value order
+    size_t variable_count;         // Number of variables
+} CalcFormula;
+
+/**
+ * Compile formulas and write them to a library file, replacing any file
+ * at `path` by renaming a complete new one over it (so processes that
+ * have the old library open keep reading it). Libraries are only read
+ * by builds of the engine with the same token layout and byte order.
+ * @return: true on success; on failure see calc_last_error(), which names
+ *          the formula that did not compile
+ */
+bool calc_library_write(CalcContext *context, const char *path,
+                        const CalcFormula *formulas, size_t count);
+
+/**
+ * Map a library file read-only; its formulas are not parsed again, and
+ * processes that open the same file share its pages. Only the header is
+ * checked here, so opening takes the same few microseconds for any size.
+ * @return: new library (independent of the context), or NULL on error
+ *          (see calc_last_error())
+ */
+CalcLibrary *calc_library_open(CalcContext *context, const char *path);
+
+/**
+ * Number of formulas in a library; they are indexed in name order
+ */
+size_t calc_library_count(const CalcLibrary *library);
+
+/**
+ * Index of the formula with a name, or calc_library_count() if there is
+ * none (a binary search over the names)
+ */
+size_t calc_library_find(const CalcLibrary *library, const char *name);
+
+/**
+ * Name of the formula at an index, or NULL past the end
+ */
+const char *calc_library_name(const CalcLibrary *library, size_t index);
+
+/**
+ * Name of a formula's variable, in value order, or NULL past the end
+ */
+const char *calc_library_variable(const CalcLibrary *library, size_t index,
+                                  size_t variable);
+
+/**
+ * Program of the formula at an index, after checking its checksum and
+ * tokens; the tokens and text stay in the library's pages, so the
+ * program must be freed (calc_program_free()) before the library is
+ * closed. Libraries are read-only, so several threads may take programs
+ * from one library at the same time.
+ * @return: new program, or NULL on error (see calc_last_error())
+ */
+CalcProgram *calc_library_program(CalcContext *context,
+                                  const CalcLibrary *library, size_t index);
+
+/**
+ * Unmap a library
+ */
+void calc_library_close(CalcLibrary *library);
+
+/**
+ * Format an integer value in base 2, 8, 10 or 16 ("0b", "0o" and "0x"
+ * prefixes, so the text parses back to the same value)
+ * Bases other than 10 show the 64-bit two's complement pattern, so -1 is
+ * 0xFFFFFFFFFFFFFFFF. REAL values qualify if they are integral and below
+ * 2^63 in magnitude.
+ * @return: false if the value is not an integer or the base is unsupported
+ */
+bool calc_format_integer(const CalcValue *value, int base, char *buffer,
+                         size_t size);
+
+/**
+ * Sine, cosine and tangent of `count` angles in degrees, as computed by
+ * sin(), cos() and tan() in expressions but vectorized; tan() stores NaN
+ * at odd multiples of 90. `degrees` and `results` may be the same array.
+ */
+void calc_sin_degrees_batch(const double *degrees, double *results,
+                            size_t count);
+void calc_cos_degrees_batch(const double *degrees, double *results,
+                            size_t count);
+void calc_tan_degrees_batch(const double *degrees, double *results,
+                            size_t count);
+
+/**
+ * Summary of the values added to a CalcStats
+ */
+typedef struct {
+    unsigned long long count;      // Values added, not counting NaN
+    unsigned long long nan_count;  // NaN values (left out of the rest)
+    double mean;                   // Arithmetic mean (NaN if count is 0)
+    double variance;               // Sample variance (NaN if count < 2)
+    double stddev;                 // Sample standard deviation
+    double min;                    // Smallest value (NaN if count is 0)
+    double max;                    // Largest value (NaN if count is 0)
+} CalcSummary;
+
+/**
+ * Create empty running statistics
+ * Adding values reads each block of them twice while it is in cache
+ * (the sum, then the deviations and extremes), about half of memory
+ * bandwidth; the quantile sketch adds a bucket increment per value and
+ * 4 MiB, allocated on first use.
+ * @param allocator: memory hooks, or NULL for libc
+ * @param quantiles: keep the sketch behind calc_stats_quantile()
+ * @return: new statistics, or NULL if out of memory or the allocator sets
+ *          only some of its hooks (see CalcAllocator)
+ */
+CalcStats *calc_stats_new(const CalcAllocator *allocator, bool quantiles);
+
+/**
+ * Release running statistics
+ */
+void calc_stats_free(CalcStats *stats);
+
+/**
+ * Add `count` values; NaNs are only counted
+ * @return: false if out of memory (the sketch is allocated on first use)
+ */
+bool calc_stats_add(CalcStats *stats, const double *values, size_t count);
+
+/**
+ * Add everything `other` has seen to `stats`, e.g. to combine the results
+ * of several threads
+ * @return: false if out of memory
+ */
+bool calc_stats_merge(CalcStats *stats, const CalcStats *other);
+
+/**
+ * Count, mean, variance and extremes of the values so far
+ */
+void calc_stats_summary(const CalcStats *stats, CalcSummary *summary);
+
+/**
+ * Approximate percentile (0-100; 50 is the median) of the values so far,
+ * within about 0.4% relative error; exact at 0 and 100
+ * @return: the estimate, or NaN without a sketch, values or valid range
+ */
+double calc_stats_quantile(const CalcStats *stats, double percentile);
+
+/**
+ * Make the evaluation running on a context fail with "Evaluation
+ * cancelled" at its next check (iteration loops check every 1024 steps);
+ * evaluations started later are not affected. This is the one function
+ * that may be called from another thread, or a signal handler, while the
+ * context is in use.
+ */
+void calc_cancel(CalcContext *context);
+
+/**
+ * Message describing the last failed evaluation ("" after a success)
+ */
+const char *calc_last_error(const CalcContext *context);
+
+/**
+ * Precision that produced the last successful result; in AUTO mode this
+ * tells whether the result is exact (CALC_PRECISION_EXACT), the double
+ * fast path was trusted (CALC_PRECISION_DOUBLE) or the expression was
+ * re-evaluated (CALC_PRECISION_EXTENDED)
+ */
+CalcPrecision calc_last_precision(const CalcContext *context);
+
+/**
+ * Elements of the last result if it was a vector or matrix (type
+ * CALC_VALUE_MATRIX), row by row; valid until the next evaluation
+ * @param rows, columns: receive the shape (0 if the result was a number)
+ * @return: the elements, or NULL if the result was a number
+ */
+const double *calc_last_matrix(const CalcContext *context, size_t *rows,
+                               size_t *columns);
+
+/**
+ * Library version string, e.g. "1.3.0"
+ */
+const char *calc_version(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // LIBCALC_CALC_H
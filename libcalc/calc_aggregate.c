@@ -0,0 +1,640 @@
+/**
+ * ========================================================================
+ *    LIBCALC - Aggregates and Streaming Statistics
+ * ========================================================================
+ *
+ * mean, var, stddev, min, max, median and percentile take any number of
+ * arguments: mean(2, 4, 9) or percentile(90, x1, x2, x3). The kernels
+ * below work on the contiguous run of values the evaluator leaves on its
+ * stack, in place.
+ *
+ * Sums are pairwise: blocks of PAIRWISE_BLOCK values are added in
+ * AGGREGATE_LANES independent partial sums, which the compiler turns into
+ * SIMD adds (gcc -O3), and blocks are combined as a binary tree, so the
+ * rounding error grows with log2(n) rather than n. The variance makes a
+ * second pass over the squared deviations from the mean. Medians and
+ * percentiles select the order statistics they need in linear time.
+ *
+ * CalcStats applies the same kernels to data that arrives in pieces and
+ * need not fit in memory: every block is reduced with two passes while it
+ * is in cache, then merged into the running count, mean and sum of
+ * squared deviations (Chan et al.), so a file is read exactly once. Its
+ * quantiles come from a log-linear histogram sketch with about 0.4%
+ * relative error in fixed memory.
+ */
+
+#include "calc_internal.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define AGGREGATE_LANES 32      // Independent partial sums (SIMD lanes)
+#define PAIRWISE_BLOCK 1024     // Values summed directly, in lanes
+#define SELECT_CUTOFF 16        // Ranges finished by insertion sort
+#define STATS_BLOCK 4096        // Values reduced per CalcStats block
+#define SKETCH_MANTISSA_BITS 7  // Buckets per power of two: 2^7
+#define SKETCH_SHIFT (52 - SKETCH_MANTISSA_BITS)
+#define SKETCH_BUCKETS ((size_t)0x800 << SKETCH_MANTISSA_BITS)  // Per sign
+
+/**
+ * =======================================================================
+ *                           ARRAY KERNELS
+ * =======================================================================
+ */
+
+AggregateFunction aggregate_function(const char *name) {
+    if (strcmp(name, "mean") == 0) return AGGREGATE_MEAN;
+    if (strcmp(name, "var") == 0) return AGGREGATE_VAR;
+    if (strcmp(name, "stddev") == 0) return AGGREGATE_STDDEV;
+    if (strcmp(name, "min") == 0) return AGGREGATE_MIN;
+    if (strcmp(name, "max") == 0) return AGGREGATE_MAX;
+    if (strcmp(name, "median") == 0) return AGGREGATE_MEDIAN;
+    if (strcmp(name, "percentile") == 0) return AGGREGATE_PERCENTILE;
+    return AGGREGATE_NONE;
+}
+
+bool aggregate_check(CalcContext *context, AggregateFunction function,
+                     size_t count, double percentile) {
+    char *error = context->last_error;
+    size_t error_size = sizeof(context->last_error);
+    static const char *const names[] = {"",       "mean", "var",
+                                        "stddev", "min",  "max",
+                                        "median", "percentile"};
+
+    // percentile(p, values...) needs p and at least one value
+    size_t minimum = function == AGGREGATE_VAR ||
+                             function == AGGREGATE_STDDEV ||
+                             function == AGGREGATE_PERCENTILE
+                         ? 2
+                         : 1;
+    if (count < minimum) {
+        if (minimum == 1) {
+            snprintf(error, error_size, "Function '%s' requires an argument",
+                     names[function]);
+        } else {
+            snprintf(error, error_size,
+                     "Function '%s' requires at least two arguments",
+                     names[function]);
+        }
+        return false;
+    }
+    if (function == AGGREGATE_PERCENTILE &&
+        !(percentile >= 0.0 && percentile <= 100.0)) {
+        snprintf(error, error_size, "Percentile must be between 0 and 100");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Pairwise sum of values[0..count)
+ * The error is at most (log2(count) + PAIRWISE_BLOCK / AGGREGATE_LANES)
+ * roundings of the sum of the magnitudes.
+ */
+static double pairwise_sum(const double *values, size_t count) {
+    if (count > PAIRWISE_BLOCK) {
+        // Split on a block boundary so every leaf is a full block
+        size_t half = (count / 2 + PAIRWISE_BLOCK - 1) / PAIRWISE_BLOCK *
+                      PAIRWISE_BLOCK;
+        return pairwise_sum(values, half) +
+               pairwise_sum(values + half, count - half);
+    }
+
+    double lanes[AGGREGATE_LANES] = {0.0};
+    size_t i = 0;
+    for (; i + AGGREGATE_LANES <= count; i += AGGREGATE_LANES) {
+        for (size_t lane = 0; lane < AGGREGATE_LANES; lane++) {
+            lanes[lane] += values[i + lane];
+        }
+    }
+    for (; i < count; i++) lanes[i % AGGREGATE_LANES] += values[i];
+
+    // Lanes pairwise too: (0+16 + 8+24) + ...
+    for (size_t width = AGGREGATE_LANES / 2; width > 0; width /= 2) {
+        for (size_t lane = 0; lane < width; lane++) {
+            lanes[lane] += lanes[lane + width];
+        }
+    }
+    return lanes[0];
+}
+
+/**
+ * Pairwise sum of the squared deviations from `center`
+ * Kept apart from pairwise_sum(): gcc vectorizes a loop with a single
+ * accumulator array far better than one with two.
+ */
+static double pairwise_squares(const double *values, size_t count,
+                               double center) {
+    if (count > PAIRWISE_BLOCK) {
+        size_t half = (count / 2 + PAIRWISE_BLOCK - 1) / PAIRWISE_BLOCK *
+                      PAIRWISE_BLOCK;
+        return pairwise_squares(values, half, center) +
+               pairwise_squares(values + half, count - half, center);
+    }
+
+    double lanes[AGGREGATE_LANES] = {0.0};
+    size_t i = 0;
+    for (; i + AGGREGATE_LANES <= count; i += AGGREGATE_LANES) {
+        for (size_t lane = 0; lane < AGGREGATE_LANES; lane++) {
+            double d = values[i + lane] - center;
+            lanes[lane] += d * d;
+        }
+    }
+    for (; i < count; i++) {
+        double d = values[i] - center;
+        lanes[i % AGGREGATE_LANES] += d * d;
+    }
+    for (size_t width = AGGREGATE_LANES / 2; width > 0; width /= 2) {
+        for (size_t lane = 0; lane < width; lane++) {
+            lanes[lane] += lanes[lane + width];
+        }
+    }
+    return lanes[0];
+}
+
+/**
+ * Mean and sum of squared deviations M2 of values[0..count), two passes
+ * The sum about the computed mean exceeds the one about the exact mean
+ * by n times the mean's error squared, so that error barely matters.
+ */
+static void two_pass_moments(const double *values, size_t count,
+                             double *mean, double *m2) {
+    *mean = pairwise_sum(values, count) / (double)count;
+    *m2 = pairwise_squares(values, count, *mean);
+}
+
+/**
+ * Minimum and maximum of a non-empty array without NaN
+ * Comparisons as selects vectorize (minpd/maxpd); 32 lanes are enough
+ * independent chains to hide their latency.
+ */
+static void extremes(const double *values, size_t count, double *minimum,
+                     double *maximum) {
+    double low[AGGREGATE_LANES], high[AGGREGATE_LANES];
+    for (size_t lane = 0; lane < AGGREGATE_LANES; lane++) {
+        low[lane] = high[lane] = values[0];
+    }
+
+    size_t i = 0;
+    for (; i + AGGREGATE_LANES <= count; i += AGGREGATE_LANES) {
+        for (size_t lane = 0; lane < AGGREGATE_LANES; lane++) {
+            double x = values[i + lane];
+            low[lane] = x < low[lane] ? x : low[lane];
+            high[lane] = x > high[lane] ? x : high[lane];
+        }
+    }
+    for (; i < count; i++) {
+        double x = values[i];
+        low[0] = x < low[0] ? x : low[0];
+        high[0] = x > high[0] ? x : high[0];
+    }
+
+    *minimum = low[0];
+    *maximum = high[0];
+    for (size_t lane = 1; lane < AGGREGATE_LANES; lane++) {
+        if (low[lane] < *minimum) *minimum = low[lane];
+        if (high[lane] > *maximum) *maximum = high[lane];
+    }
+}
+
+/**
+ * pairwise_squares() and extremes() in one pass, for streaming
+ * statistics: the block is read twice in all instead of three times
+ */
+static double squares_and_extremes(const double *values, size_t count,
+                                   double center, double *minimum,
+                                   double *maximum) {
+    if (count > PAIRWISE_BLOCK) {
+        size_t half = (count / 2 + PAIRWISE_BLOCK - 1) / PAIRWISE_BLOCK *
+                      PAIRWISE_BLOCK;
+        double low, high;
+        double m2 = squares_and_extremes(values, half, center, minimum,
+                                         maximum) +
+                    squares_and_extremes(values + half, count - half,
+                                         center, &low, &high);
+        if (low < *minimum) *minimum = low;
+        if (high > *maximum) *maximum = high;
+        return m2;
+    }
+
+    double lanes[AGGREGATE_LANES] = {0.0};
+    double low[AGGREGATE_LANES], high[AGGREGATE_LANES];
+    for (size_t lane = 0; lane < AGGREGATE_LANES; lane++) {
+        low[lane] = high[lane] = values[0];
+    }
+    size_t i = 0;
+    for (; i + AGGREGATE_LANES <= count; i += AGGREGATE_LANES) {
+        for (size_t lane = 0; lane < AGGREGATE_LANES; lane++) {
+            double x = values[i + lane];
+            double d = x - center;
+            lanes[lane] += d * d;
+            low[lane] = x < low[lane] ? x : low[lane];
+            high[lane] = x > high[lane] ? x : high[lane];
+        }
+    }
+    for (; i < count; i++) {
+        double x = values[i];
+        double d = x - center;
+        lanes[i % AGGREGATE_LANES] += d * d;
+        low[0] = x < low[0] ? x : low[0];
+        high[0] = x > high[0] ? x : high[0];
+    }
+    for (size_t width = AGGREGATE_LANES / 2; width > 0; width /= 2) {
+        for (size_t lane = 0; lane < width; lane++) {
+            lanes[lane] += lanes[lane + width];
+            low[lane] = low[lane + width] < low[lane] ? low[lane + width]
+                                                      : low[lane];
+            high[lane] = high[lane + width] > high[lane] ? high[lane + width]
+                                                         : high[lane];
+        }
+    }
+    *minimum = low[0];
+    *maximum = high[0];
+    return lanes[0];
+}
+
+/**
+ * Whether any value is NaN
+ */
+static bool contains_nan(const double *values, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (isnan(values[i])) return true;
+    }
+    return false;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static inline void swap_doubles(double *a, double *b) {
+    double swap = *a;
+    *a = *b;
+    *b = swap;
+}
+
+/**
+ * Move the k-th smallest value (0-based) to values[k], with no larger
+ * value before it and no smaller one after it; values must not be NaN
+ * Quickselect with a median-of-three pivot; a range that shrinks too
+ * slowly is sorted instead, so the worst case is O(n log n).
+ */
+static void select_order_statistic(double *values, size_t count, size_t k) {
+    size_t low = 0, high = count - 1;
+    size_t budget = 2;
+    for (size_t n = count; n > 1; n /= 2) budget += 2;
+
+    while (high - low >= SELECT_CUTOFF) {
+        if (budget-- == 0) {
+            qsort(values + low, high - low + 1, sizeof(double),
+                  compare_doubles);
+            return;
+        }
+
+        // Order low, middle and high; the median becomes the pivot and
+        // the outer two act as sentinels for the partition scans
+        size_t middle = low + (high - low) / 2;
+        if (values[middle] < values[low]) {
+            swap_doubles(&values[middle], &values[low]);
+        }
+        if (values[high] < values[low]) {
+            swap_doubles(&values[high], &values[low]);
+        }
+        if (values[high] < values[middle]) {
+            swap_doubles(&values[high], &values[middle]);
+        }
+        double pivot = values[middle];
+
+        // Hoare partition of (low, high)
+        size_t i = low, j = high;
+        for (;;) {
+            do i++; while (values[i] < pivot);
+            do j--; while (values[j] > pivot);
+            if (i >= j) break;
+            swap_doubles(&values[i], &values[j]);
+        }
+
+        // values[low..j] <= pivot <= values[j+1..high]
+        if (k <= j) {
+            high = j;
+        } else {
+            low = j + 1;
+        }
+    }
+
+    // Insertion sort of the last few
+    for (size_t i = low + 1; i <= high; i++) {
+        double x = values[i];
+        size_t j = i;
+        for (; j > low && values[j - 1] > x; j--) values[j] = values[j - 1];
+        values[j] = x;
+    }
+}
+
+/**
+ * Interpolated order statistic at fractional rank h in [0, count - 1]:
+ * x(floor h) + (h - floor h) * (x(floor h + 1) - x(floor h))
+ * Values are reordered; they must not be NaN.
+ */
+static double interpolated_rank(double *values, size_t count, double rank) {
+    size_t below = (size_t)rank;
+    if (below >= count - 1) below = count - 1;
+    select_order_statistic(values, count, below);
+    double fraction = rank - (double)below;
+    if (fraction == 0.0) return values[below];
+
+    // The next order statistic is the smallest value after `below`
+    double next = values[below + 1];
+    for (size_t i = below + 2; i < count; i++) {
+        next = values[i] < next ? values[i] : next;
+    }
+    return values[below] + fraction * (next - values[below]);
+}
+
+bool aggregate_values(CalcContext *context, AggregateFunction function,
+                      double *values, size_t count, double *result) {
+    double percentile = function == AGGREGATE_PERCENTILE && count > 0
+                            ? values[0]
+                            : 0.0;
+    if (!aggregate_check(context, function, count, percentile)) return false;
+    if (function == AGGREGATE_PERCENTILE) {
+        values++;
+        count--;
+    }
+
+    double mean, m2, minimum, maximum;
+    switch (function) {
+        case AGGREGATE_MEAN:
+            *result = pairwise_sum(values, count) / (double)count;
+            return true;
+
+        case AGGREGATE_VAR:
+        case AGGREGATE_STDDEV:
+            // Sample statistics, divided by n - 1
+            two_pass_moments(values, count, &mean, &m2);
+            *result = m2 / (double)(count - 1);
+            if (function == AGGREGATE_STDDEV) *result = sqrt(*result);
+            return true;
+
+        case AGGREGATE_MIN:
+        case AGGREGATE_MAX:
+            if (contains_nan(values, count)) {
+                *result = NAN;
+                return true;
+            }
+            extremes(values, count, &minimum, &maximum);
+            *result = function == AGGREGATE_MIN ? minimum : maximum;
+            return true;
+
+        case AGGREGATE_MEDIAN:
+        case AGGREGATE_PERCENTILE: {
+            // Selection needs a total order, which NaN breaks
+            if (contains_nan(values, count)) {
+                *result = NAN;
+                return true;
+            }
+            double rank = function == AGGREGATE_MEDIAN
+                              ? (double)(count - 1) / 2.0
+                              : (double)(count - 1) * percentile / 100.0;
+            *result = interpolated_rank(values, count, rank);
+            return true;
+        }
+
+        default:
+            snprintf(context->last_error, sizeof(context->last_error),
+                     "Unknown function");
+            return false;
+    }
+}
+
+/**
+ * =======================================================================
+ *                       STREAMING STATISTICS
+ * =======================================================================
+ */
+
+/**
+ * Running statistics of a stream of values
+ */
+struct CalcStats {
+    CalcAllocator allocator;          // Hooks that allocated the stats
+    unsigned long long count;         // Values seen, NaN excluded
+    unsigned long long nan_count;     // NaN values seen
+    double mean;                      // Mean of the values so far
+    double m2;                        // Sum of squared deviations from it
+    double minimum;                   // Smallest value so far
+    double maximum;                   // Largest value so far
+    bool quantiles;                   // Whether the sketch is kept
+    unsigned long long *sketch;       // Bucket counts of x >= 0, then x < 0
+};
+
+/**
+ * Allocate the empty sketch of both signs
+ * @return: false if out of memory
+ */
+static bool sketch_allocate(CalcStats *stats) {
+    size_t size = 2 * SKETCH_BUCKETS * sizeof(*stats->sketch);
+    stats->sketch = calc_allocator_malloc(&stats->allocator, size);
+    if (!stats->sketch) return false;
+    memset(stats->sketch, 0, size);
+    return true;
+}
+
+/**
+ * Sketch bucket of a value: the sign, the exponent and the leading
+ * SKETCH_MANTISSA_BITS mantissa bits, so buckets are 2^-7 wide relative
+ * to their lower edge and negative values (sign bit set) follow all
+ * SKETCH_BUCKETS positive ones; no branch on the sign
+ */
+static inline size_t sketch_bucket(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (size_t)(bits >> SKETCH_SHIFT);
+}
+
+/**
+ * Midpoint of a sketch bucket's magnitudes; the lowest bucket holds the
+ * zeros (and the tiniest subnormals), so it stands for zero
+ */
+static double sketch_value(size_t bucket) {
+    if (bucket == 0) return 0.0;
+    uint64_t low_bits = (uint64_t)bucket << SKETCH_SHIFT;
+    uint64_t high_bits = (uint64_t)(bucket + 1) << SKETCH_SHIFT;
+    double low, high;
+    memcpy(&low, &low_bits, sizeof(low));
+    memcpy(&high, &high_bits, sizeof(high));
+    return isfinite(high) ? low + (high - low) / 2.0 : low;
+}
+
+/**
+ * Merge a block's count, mean and M2 into the running totals
+ */
+static void stats_merge_moments(CalcStats *stats, unsigned long long count,
+                                double mean, double m2) {
+    if (count == 0) return;
+    if (stats->count == 0) {
+        stats->count = count;
+        stats->mean = mean;
+        stats->m2 = m2;
+        return;
+    }
+    double total = (double)(stats->count + count);
+    double delta = mean - stats->mean;
+    double weight = (double)count / total;
+    stats->mean += delta * weight;
+    stats->m2 += m2 + delta * delta * (double)stats->count * weight;
+    stats->count += count;
+}
+
+/**
+ * Reduce one block of at most STATS_BLOCK values, which stays in cache
+ * for the second pass and the extremes
+ */
+static bool stats_add_block(CalcStats *stats, const double *values,
+                            size_t count) {
+    // A NaN makes the sum NaN (as do infinities of both signs), so only
+    // then are NaNs looked for; the runs between them are reduced apart
+    double sum = pairwise_sum(values, count);
+    if (isnan(sum) && contains_nan(values, count)) {
+        size_t run = 0;
+        for (size_t i = 0; i <= count; i++) {
+            if (i < count && !isnan(values[i])) continue;
+            if (i > run && !stats_add_block(stats, values + run, i - run)) {
+                return false;
+            }
+            if (i < count) stats->nan_count++;
+            run = i + 1;
+        }
+        return true;
+    }
+
+    double mean = sum / (double)count;
+    double minimum, maximum;
+    double m2 = squares_and_extremes(values, count, mean, &minimum, &maximum);
+    if (stats->count == 0 || minimum < stats->minimum) {
+        stats->minimum = minimum;
+    }
+    if (stats->count == 0 || maximum > stats->maximum) {
+        stats->maximum = maximum;
+    }
+    stats_merge_moments(stats, count, mean, m2);
+
+    if (stats->quantiles) {
+        if (!stats->sketch && !sketch_allocate(stats)) return false;
+        unsigned long long *sketch = stats->sketch;
+        for (size_t i = 0; i < count; i++) sketch[sketch_bucket(values[i])]++;
+    }
+    return true;
+}
+
+/**
+ * =======================================================================
+ *                         PUBLIC LIBRARY API
+ * =======================================================================
+ */
+
+CalcStats *calc_stats_new(const CalcAllocator *allocator, bool quantiles) {
+    CalcAllocator hooks = {0};
+    if (allocator) hooks = *allocator;
+    if (!calc_allocator_valid(&hooks)) return NULL;
+    CalcStats *stats = calc_allocator_malloc(&hooks, sizeof(CalcStats));
+    if (!stats) return NULL;
+    memset(stats, 0, sizeof(*stats));
+    stats->allocator = hooks;
+    stats->quantiles = quantiles;
+    return stats;
+}
+
+void calc_stats_free(CalcStats *stats) {
+    if (!stats) return;
+    CalcAllocator allocator = stats->allocator;
+    if (stats->sketch) calc_allocator_free(&allocator, stats->sketch);
+    calc_allocator_free(&allocator, stats);
+}
+
+bool calc_stats_add(CalcStats *stats, const double *values, size_t count) {
+    for (size_t start = 0; start < count; start += STATS_BLOCK) {
+        size_t length = count - start < STATS_BLOCK ? count - start
+                                                    : STATS_BLOCK;
+        if (!stats_add_block(stats, values + start, length)) return false;
+    }
+    return true;
+}
+
+bool calc_stats_merge(CalcStats *stats, const CalcStats *other) {
+    if (stats->quantiles && other->sketch) {
+        if (!stats->sketch && !sketch_allocate(stats)) return false;
+        for (size_t i = 0; i < 2 * SKETCH_BUCKETS; i++) {
+            stats->sketch[i] += other->sketch[i];
+        }
+    }
+
+    if (other->count > 0) {
+        if (stats->count == 0 || other->minimum < stats->minimum) {
+            stats->minimum = other->minimum;
+        }
+        if (stats->count == 0 || other->maximum > stats->maximum) {
+            stats->maximum = other->maximum;
+        }
+    }
+    stats_merge_moments(stats, other->count, other->mean, other->m2);
+    stats->nan_count += other->nan_count;
+    return true;
+}
+
+void calc_stats_summary(const CalcStats *stats, CalcSummary *summary) {
+    summary->count = stats->count;
+    summary->nan_count = stats->nan_count;
+    bool any = stats->count > 0;
+    summary->mean = any ? stats->mean : NAN;
+    summary->variance =
+        stats->count > 1 ? stats->m2 / (double)(stats->count - 1) : NAN;
+    summary->stddev = sqrt(summary->variance);
+    summary->min = any ? stats->minimum : NAN;
+    summary->max = any ? stats->maximum : NAN;
+}
+
+double calc_stats_quantile(const CalcStats *stats, double percentile) {
+    if (!stats->quantiles || stats->count == 0 ||
+        !(percentile >= 0.0 && percentile <= 100.0)) {
+        return NAN;
+    }
+    if (percentile == 0.0) return stats->minimum;
+    if (percentile == 100.0) return stats->maximum;
+
+    // Rank of the value below the interpolated one, counted from the
+    // most negative: negative buckets by falling magnitude, then positive
+    // ones by rising magnitude
+    double rank = floor((double)(stats->count - 1) * percentile / 100.0);
+    unsigned long long target = (unsigned long long)rank;
+    unsigned long long seen = 0;
+    double value = stats->maximum;
+    bool found = false;
+
+    const unsigned long long *positive = stats->sketch;
+    const unsigned long long *negative =
+        positive ? positive + SKETCH_BUCKETS : NULL;
+    for (size_t i = SKETCH_BUCKETS; negative && !found && i-- > 0;) {
+        seen += negative[i];
+        if (seen > target) {
+            value = -sketch_value(i);
+            found = true;
+        }
+    }
+    for (size_t i = 0; positive && !found && i < SKETCH_BUCKETS; i++) {
+        seen += positive[i];
+        if (seen > target) {
+            value = sketch_value(i);
+            found = true;
+        }
+    }
+
+    // Bucket midpoints may lie just beyond the data
+    if (value < stats->minimum) value = stats->minimum;
+    if (value > stats->maximum) value = stats->maximum;
+    return value;
+}
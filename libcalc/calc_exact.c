@@ -0,0 +1,789 @@
+/**
+ * ========================================================================
+ *    LIBCALC - Exact Arithmetic (Checked 64-bit Integers and Rationals)
+ * ========================================================================
+ *
+ * Integer and decimal literals are exact rationals: 0.1 is 1/10, not the
+ * double nearest to it. CALC_PRECISION_AUTO first evaluates an expression
+ * with checked 64-bit rational arithmetic, so integer expressions such as
+ * 123456789 * 987654321 keep every digit. Values stay in lowest terms;
+ * operands are cross-reduced before multiplying, which keeps intermediate
+ * products small, and every step that would still overflow 64 bits, or
+ * has no rational result (most functions, fractional powers), hands the
+ * expression back to the floating-point evaluators.
+ *
+ * The integer-only operators of programmer mode (&, |, xor, <<, >>, ~)
+ * live here too, for both exact and floating-point operands.
+ */
+
+#include "calc_internal.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TWO_POW_53 9007199254740992.0  // Integers up to here are exact
+#define TWO_POW_63 9223372036854775808.0
+
+/**
+ * =======================================================================
+ *                        CHECKED RATIONAL ARITHMETIC
+ * =======================================================================
+ */
+
+/**
+ * Greatest common divisor of two magnitudes
+ * One division first brings operands of very different sizes (typically a
+ * numerator against a power-of-ten denominator) to the same size, then the
+ * binary algorithm finishes without further divisions.
+ */
+static unsigned long long gcd(unsigned long long a, unsigned long long b) {
+    if (a > b) {
+        unsigned long long swap = a;
+        a = b;
+        b = swap;
+    }
+    if (a == 0) return b;
+    b %= a;
+    if (b == 0) return a;
+
+    int shift = __builtin_ctzll(a | b);
+    a >>= __builtin_ctzll(a);
+    do {
+        b >>= __builtin_ctzll(b);
+        if (a > b) {
+            unsigned long long swap = a;
+            a = b;
+            b = swap;
+        }
+        b -= a;
+    } while (b != 0);
+    return a << shift;
+}
+
+/**
+ * Magnitude of a 64-bit integer (also correct for LLONG_MIN)
+ */
+static inline unsigned long long magnitude(long long value) {
+    return value < 0 ? 0 - (unsigned long long)value
+                     : (unsigned long long)value;
+}
+
+static inline Rational rational_integer(long long value) {
+    Rational result = {value, 1};
+    return result;
+}
+
+/**
+ * a + b (or a - b when `subtract`); false on overflow
+ */
+static bool rational_add(Rational a, Rational b, bool subtract,
+                         Rational *result) {
+    if (subtract) {
+        if (b.numerator == LLONG_MIN) return false;
+        b.numerator = -b.numerator;
+    }
+
+    // Integer fast path
+    if (a.denominator == 1 && b.denominator == 1) {
+        result->denominator = 1;
+        return !__builtin_add_overflow(a.numerator, b.numerator,
+                                       &result->numerator);
+    }
+
+    // Knuth's algorithm: with g = gcd(a.den, b.den) the result is
+    // (a.num * b.den/g + b.num * a.den/g) / (a.den * b.den/g), and only
+    // a factor of g can be shared between that numerator and denominator
+    long long g = (long long)gcd((unsigned long long)a.denominator,
+                                 (unsigned long long)b.denominator);
+    long long left, right, numerator;
+    if (__builtin_mul_overflow(a.numerator, b.denominator / g, &left) ||
+        __builtin_mul_overflow(b.numerator, a.denominator / g, &right) ||
+        __builtin_add_overflow(left, right, &numerator)) {
+        return false;
+    }
+    if (numerator == 0) {
+        *result = rational_integer(0);
+        return true;
+    }
+    long long common =
+        (long long)gcd(magnitude(numerator), (unsigned long long)g);
+    long long denominator;
+    if (__builtin_mul_overflow(a.denominator / g, b.denominator / common,
+                               &denominator)) {
+        return false;
+    }
+    result->numerator = numerator / common;
+    result->denominator = denominator;
+    return true;
+}
+
+/**
+ * a * b; false on overflow
+ */
+static bool rational_multiply(Rational a, Rational b, Rational *result) {
+    if (a.denominator == 1 && b.denominator == 1) {
+        result->denominator = 1;
+        return !__builtin_mul_overflow(a.numerator, b.numerator,
+                                       &result->numerator);
+    }
+
+    if (a.numerator == 0 || b.numerator == 0) {
+        *result = rational_integer(0);
+        return true;
+    }
+
+    // Cross-reduce first; the product of reduced factors is reduced
+    long long g1 = (long long)gcd(magnitude(a.numerator),
+                                  (unsigned long long)b.denominator);
+    long long g2 = (long long)gcd(magnitude(b.numerator),
+                                  (unsigned long long)a.denominator);
+    return !__builtin_mul_overflow(a.numerator / g1, b.numerator / g2,
+                                   &result->numerator) &&
+           !__builtin_mul_overflow(a.denominator / g2, b.denominator / g1,
+                                   &result->denominator);
+}
+
+/**
+ * 1 / a for a != 0; false on overflow
+ */
+static bool rational_reciprocal(Rational a, Rational *result) {
+    if (a.numerator == LLONG_MIN) return false;
+    result->numerator = a.numerator < 0 ? -a.denominator : a.denominator;
+    result->denominator = a.numerator < 0 ? -a.numerator : a.numerator;
+    return true;
+}
+
+/**
+ * base^exponent for exponent >= 0 by repeated squaring; false on overflow
+ */
+static bool integer_power(long long base, long long exponent,
+                          long long *result) {
+    long long power = 1;
+    while (exponent > 0) {
+        if (exponent & 1) {
+            if (__builtin_mul_overflow(power, base, &power)) return false;
+        }
+        exponent >>= 1;
+        if (exponent > 0 && __builtin_mul_overflow(base, base, &base)) {
+            return false;
+        }
+    }
+    *result = power;
+    return true;
+}
+
+/**
+ * Report a definite error and return EXACT_ERROR
+ */
+static ExactResult exact_error(CalcContext *context, const char *message) {
+    snprintf(context->last_error, sizeof(context->last_error), "%s",
+             message);
+    return EXACT_ERROR;
+}
+
+/**
+ * base^exponent; only integer exponents have (in general) rational results
+ */
+static ExactResult rational_power(CalcContext *context, Rational base,
+                                  Rational exponent, Rational *result) {
+    if (base.numerator == 0) {
+        if (exponent.numerator < 0) {
+            return exact_error(context, "Cannot raise zero to negative power");
+        }
+        *result = rational_integer(exponent.numerator == 0 ? 1 : 0);
+        return EXACT_OK;
+    }
+    if (exponent.denominator != 1) return EXACT_INEXACT;
+
+    long long n = exponent.numerator;
+    if (n < 0) {
+        if (n == LLONG_MIN || !rational_reciprocal(base, &base)) {
+            return EXACT_INEXACT;
+        }
+        n = -n;
+    }
+
+    // Powers of coprime numbers are coprime, so the result stays reduced
+    Rational power;
+    if (!integer_power(base.numerator, n, &power.numerator) ||
+        !integer_power(base.denominator, n, &power.denominator)) {
+        return EXACT_INEXACT;
+    }
+    *result = power;
+    return EXACT_OK;
+}
+
+/**
+ * =======================================================================
+ *                     PROGRAMMER MODE (BITWISE) OPERATORS
+ * =======================================================================
+ */
+
+bool is_bitwise_operator(char op) {
+    return op == '&' || op == '|' || op == 'x' || op == '<' || op == '>';
+}
+
+/**
+ * Right shift rounding toward negative infinity (arithmetic shift), which
+ * matches floor(value / 2^count) for every sign
+ */
+static long long shift_right(long long value, long long count) {
+    if (count >= 63) return value < 0 ? -1 : 0;
+    return value < 0 ? ~(~value >> count) : value >> count;
+}
+
+/**
+ * Apply a bitwise operator to exact integers
+ */
+static ExactResult integer_bitwise(CalcContext *context, char op,
+                                   Rational left, Rational right,
+                                   Rational *result) {
+    if (left.denominator != 1 || right.denominator != 1) {
+        return exact_error(context, "Bitwise operators need integer operands");
+    }
+    long long a = left.numerator, b = right.numerator;
+
+    switch (op) {
+        case '&':
+            *result = rational_integer(a & b);
+            return EXACT_OK;
+        case '|':
+            *result = rational_integer(a | b);
+            return EXACT_OK;
+        case 'x':
+            *result = rational_integer(a ^ b);
+            return EXACT_OK;
+        case '~':
+            *result = rational_integer(~a);
+            return EXACT_OK;
+        case '<': {
+            if (b < 0) {
+                return exact_error(context,
+                                   "Shift count must be a non-negative "
+                                   "integer");
+            }
+            if (a == 0) {
+                *result = rational_integer(0);
+                return EXACT_OK;
+            }
+            // Bits shifted into or past the sign bit need floating point
+            if (b >= 63) return EXACT_INEXACT;
+            long long shifted = (long long)((unsigned long long)a << b);
+            if (shift_right(shifted, b) != a) return EXACT_INEXACT;
+            *result = rational_integer(shifted);
+            return EXACT_OK;
+        }
+        case '>':
+            if (b < 0) {
+                return exact_error(context,
+                                   "Shift count must be a non-negative "
+                                   "integer");
+            }
+            *result = rational_integer(shift_right(a, b));
+            return EXACT_OK;
+        default:
+            snprintf(context->last_error, sizeof(context->last_error),
+                     "Unknown operator: %c", op);
+            return EXACT_ERROR;
+    }
+}
+
+/**
+ * 64-bit pattern of an integral double: two's complement below zero, the
+ * plain binary value from 2^63 up to 2^64
+ * @return: false if the value does not fit 64 bits
+ */
+static bool bit_pattern(double value, unsigned long long *pattern) {
+    if (value >= -TWO_POW_63 && value < TWO_POW_63) {
+        *pattern = (unsigned long long)(long long)value;
+        return true;
+    }
+    if (value >= TWO_POW_63 && value < 2.0 * TWO_POW_63) {
+        *pattern = (unsigned long long)value;
+        return true;
+    }
+    return false;
+}
+
+bool apply_bitwise_operator(CalcContext *context, char op, double left,
+                            double right, double *result) {
+    char *error = context->last_error;
+    size_t error_size = sizeof(context->last_error);
+
+    if (left != nearbyint(left) || (op != '~' && right != nearbyint(right))) {
+        snprintf(error, error_size, "Bitwise operators need integer operands");
+        return false;
+    }
+
+    // Shifts scale by powers of two, which double does exactly at any size
+    if (op == '<' || op == '>') {
+        if (right < 0.0) {
+            snprintf(error, error_size,
+                     "Shift count must be a non-negative integer");
+            return false;
+        }
+        int count = right > 4096.0 ? 4096 : (int)right;
+        *result = op == '<' ? ldexp(left, count) : floor(ldexp(left, -count));
+        return true;
+    }
+
+    // Operands from -2^63 up to 2^64 are 64-bit patterns; the result is
+    // read back as two's complement, like the exact evaluator's integers
+    unsigned long long a, b = 0;
+    if (!bit_pattern(left, &a) || (op != '~' && !bit_pattern(right, &b))) {
+        snprintf(error, error_size, "Bitwise operand exceeds 64 bits");
+        return false;
+    }
+    switch (op) {
+        case '&':
+            *result = (double)(long long)(a & b);
+            return true;
+        case '|':
+            *result = (double)(long long)(a | b);
+            return true;
+        case 'x':
+            *result = (double)(long long)(a ^ b);
+            return true;
+        case '~':
+            *result = (double)(long long)~a;
+            return true;
+        default:
+            snprintf(error, error_size, "Unknown operator: %c", op);
+            return false;
+    }
+}
+
+/**
+ * =======================================================================
+ *                            EXACT EVALUATION
+ * =======================================================================
+ */
+
+/**
+ * Convert a number literal to an exact rational, reading the same
+ * characters as get_next_token()
+ * @return: EXACT_INEXACT if the value does not fit 64-bit integers
+ */
+static ExactResult rational_parse_literal(const char *text, Rational *value) {
+    // 0x, 0b and 0o literals are integers, read as 64-bit two's complement
+    // like get_next_token()
+    int radix = radix_prefix(text);
+    if (radix) {
+        unsigned long long integer = 0;
+        int digit;
+        for (const char *c = text + 2; (digit = radix_digit(*c, radix)) >= 0;
+             c++) {
+            if (__builtin_mul_overflow(integer, (unsigned)radix, &integer) ||
+                __builtin_add_overflow(integer, (unsigned)digit, &integer)) {
+                return EXACT_INEXACT;
+            }
+        }
+        *value = rational_integer((long long)integer);
+        return EXACT_OK;
+    }
+
+    // Accumulate all digits as an integer, then divide by 10^decimals.
+    // Only a numerator or denominator that overflows 64 bits leaves the
+    // literal to the floating-point evaluators
+    long long numerator = 0, denominator = 1;
+    bool fraction = false;
+    size_t length = 0;
+    for (; length < 63 && ((text[length] >= '0' && text[length] <= '9') ||
+                           text[length] == '.');
+         length++) {
+        if (text[length] == '.') {
+            if (fraction) break;  // strtod() stops at a second dot too
+            fraction = true;
+            continue;
+        }
+        if (__builtin_mul_overflow(numerator, 10, &numerator) ||
+            __builtin_add_overflow(numerator, text[length] - '0',
+                                   &numerator) ||
+            (fraction &&
+             __builtin_mul_overflow(denominator, 10, &denominator))) {
+            return EXACT_INEXACT;
+        }
+    }
+    while (length < 63 && ((text[length] >= '0' && text[length] <= '9') ||
+                           text[length] == '.')) {
+        length++;  // Characters after a second dot are consumed, not read
+    }
+    if (text[length] == '%' &&
+        __builtin_mul_overflow(denominator, 100, &denominator)) {
+        return EXACT_INEXACT;
+    }
+
+    // Decimal denominators only have the prime factors 2 and 5, so the
+    // fraction reduces with constant divisions instead of a full GCD
+    while (denominator > 1 && numerator % 10 == 0) {
+        numerator /= 10;
+        denominator /= 10;
+    }
+    while (denominator % 2 == 0 && numerator % 2 == 0) {
+        numerator /= 2;
+        denominator /= 2;
+    }
+    while (denominator % 5 == 0 && numerator % 5 == 0) {
+        numerator /= 5;
+        denominator /= 5;
+    }
+    value->numerator = numerator;
+    value->denominator = denominator;
+    return EXACT_OK;
+}
+
+/**
+ * Apply a binary operator to two rationals (result replaces left)
+ */
+static ExactResult exact_operator(CalcContext *context, char op,
+                                  Rational *left, Rational right) {
+    switch (op) {
+        case '+':
+        case '-':
+            return rational_add(*left, right, op == '-', left) ? EXACT_OK
+                                                               : EXACT_INEXACT;
+        case '*':
+            return rational_multiply(*left, right, left) ? EXACT_OK
+                                                         : EXACT_INEXACT;
+        case '/':
+            if (right.numerator == 0) {
+                return exact_error(context, "Division by zero");
+            }
+            return rational_reciprocal(right, &right) &&
+                           rational_multiply(*left, right, left)
+                       ? EXACT_OK
+                       : EXACT_INEXACT;
+        case '^':
+            return rational_power(context, *left, right, left);
+        default:
+            return integer_bitwise(context, op, *left, right, left);
+    }
+}
+
+/**
+ * Apply a function to a rational (result replaces the operand)
+ * By Niven's theorem the only rational values of sin and cos at rational
+ * angles in degrees are 0, +-1/2 and +-1, all at multiples of 30, and of
+ * tan 0 and +-1, at multiples of 45; every other angle is irrational.
+ */
+static ExactResult exact_function(CalcContext *context, const char *name,
+                                  Rational *operand) {
+    // Sine at 0, 30, ..., 330 degrees in halves; 3 marks +-sqrt(3)/2
+    static const signed char sine_halves[12] = {0, 1,  3, 2,  3, 1,
+                                                0, -1, 3, -2, 3, -1};
+
+    if (strcmp(name, "not") == 0) {
+        return integer_bitwise(context, '~', *operand, *operand, operand);
+    }
+    bool tangent = strcmp(name, "tan") == 0;
+    if (!tangent && strcmp(name, "sin") != 0 && strcmp(name, "cos") != 0) {
+        return EXACT_INEXACT;
+    }
+    if (operand->denominator != 1) return EXACT_INEXACT;
+
+    long long degrees = operand->numerator % 360;
+    if (degrees < 0) degrees += 360;
+    if (tangent) {
+        if (degrees % 45 != 0) return EXACT_INEXACT;
+        if (degrees % 180 == 90) {
+            return exact_error(context,
+                               "Tangent undefined at 90° and odd multiples");
+        }
+        *operand = rational_integer(degrees % 180 == 0    ? 0
+                                    : degrees % 180 == 45 ? 1
+                                                          : -1);
+        return EXACT_OK;
+    }
+
+    if (name[0] == 'c') degrees = (degrees + 90) % 360;  // cos x = sin(x+90)
+    if (degrees % 30 != 0) return EXACT_INEXACT;
+    int halves = sine_halves[degrees / 30];
+    if (halves == 3) return EXACT_INEXACT;
+    operand->numerator = halves % 2 == 0 ? halves / 2 : halves;
+    operand->denominator = halves % 2 == 0 ? 1 : 2;
+    return EXACT_OK;
+}
+
+/**
+ * Sign of a - b; false on overflow
+ */
+static bool rational_compare(Rational a, Rational b, int *sign) {
+    Rational difference;
+    if (!rational_add(a, b, true, &difference)) return false;
+    *sign = (difference.numerator > 0) - (difference.numerator < 0);
+    return true;
+}
+
+/**
+ * Order of rationals by their nearest doubles, which may tie
+ */
+static int compare_nearest(const void *a, const void *b) {
+    double x = rational_to_double(*(const Rational *)a);
+    double y = rational_to_double(*(const Rational *)b);
+    return (x > y) - (x < y);
+}
+
+/**
+ * Apply an aggregate to `count` rationals (result replaces the first)
+ * Means, variances, extremes, medians and percentiles of rationals are
+ * rational; standard deviations are left to floating point.
+ */
+static ExactResult exact_aggregate(CalcContext *context,
+                                   AggregateFunction function,
+                                   Rational *values, size_t count) {
+    static const Rational half = {1, 2};
+    static const Rational hundredth = {1, 100};
+    Rational p = count > 0 ? values[0] : rational_integer(0);
+    double percentile =
+        function == AGGREGATE_PERCENTILE ? rational_to_double(p) : 0.0;
+    if (!aggregate_check(context, function, count, percentile)) {
+        return EXACT_ERROR;
+    }
+    if (function == AGGREGATE_STDDEV) return EXACT_INEXACT;
+
+    // Percentile's data follows p, which may round into the range
+    Rational *data = values;
+    if (function == AGGREGATE_PERCENTILE) {
+        long long limit;
+        if (p.numerator < 0 ||
+            __builtin_mul_overflow(p.denominator, 100LL, &limit) ||
+            p.numerator > limit) {
+            return EXACT_INEXACT;
+        }
+        data++;
+        count--;
+    }
+    Rational result = data[0];
+
+    switch (function) {
+        case AGGREGATE_MEAN:
+        case AGGREGATE_VAR: {
+            Rational sum = rational_integer(0), mean, inverse;
+            for (size_t i = 0; i < count; i++) {
+                if (!rational_add(sum, data[i], false, &sum)) {
+                    return EXACT_INEXACT;
+                }
+            }
+            if (!rational_reciprocal(rational_integer((long long)count),
+                                     &inverse) ||
+                !rational_multiply(sum, inverse, &mean)) {
+                return EXACT_INEXACT;
+            }
+            if (function == AGGREGATE_MEAN) {
+                result = mean;
+                break;
+            }
+
+            // Sample variance: sum of squared deviations / (n - 1)
+            Rational squares = rational_integer(0);
+            for (size_t i = 0; i < count; i++) {
+                Rational d;
+                if (!rational_add(data[i], mean, true, &d) ||
+                    !rational_multiply(d, d, &d) ||
+                    !rational_add(squares, d, false, &squares)) {
+                    return EXACT_INEXACT;
+                }
+            }
+            if (!rational_reciprocal(rational_integer((long long)count - 1),
+                                     &inverse) ||
+                !rational_multiply(squares, inverse, &result)) {
+                return EXACT_INEXACT;
+            }
+            break;
+        }
+
+        case AGGREGATE_MIN:
+        case AGGREGATE_MAX:
+            for (size_t i = 1; i < count; i++) {
+                int sign;
+                if (!rational_compare(data[i], result, &sign)) {
+                    return EXACT_INEXACT;
+                }
+                if (function == AGGREGATE_MIN ? sign < 0 : sign > 0) {
+                    result = data[i];
+                }
+            }
+            break;
+
+        default: {
+            // Rounding to double keeps the order but may tie neighbours,
+            // so the sorted order is checked exactly
+            qsort(data, count, sizeof(Rational), compare_nearest);
+            for (size_t i = 1; i < count; i++) {
+                int sign;
+                if (!rational_compare(data[i], data[i - 1], &sign) ||
+                    sign < 0) {
+                    return EXACT_INEXACT;
+                }
+            }
+
+            // rank = (n - 1) p / 100 = below + fraction
+            Rational rank, fraction, gap;
+            Rational last = rational_integer((long long)count - 1);
+            if (function == AGGREGATE_MEDIAN
+                    ? !rational_multiply(last, half, &rank)
+                    : !rational_multiply(last, p, &rank) ||
+                          !rational_multiply(rank, hundredth, &rank)) {
+                return EXACT_INEXACT;
+            }
+            long long below = rank.numerator / rank.denominator;
+            if (!rational_add(rank, rational_integer(below), true,
+                              &fraction)) {
+                return EXACT_INEXACT;
+            }
+            result = data[below];
+            if (fraction.numerator != 0 &&
+                (!rational_add(data[below + 1], data[below], true, &gap) ||
+                 !rational_multiply(fraction, gap, &gap) ||
+                 !rational_add(result, gap, false, &result))) {
+                return EXACT_INEXACT;
+            }
+            break;
+        }
+    }
+
+    values[0] = result;
+    return EXACT_OK;
+}
+
+ExactResult evaluate_rpn_exact(CalcContext *context, const char *expression,
+                               const TokenStack *rpn_tokens, Rational *result) {
+    char *error = context->last_error;
+    size_t error_size = sizeof(context->last_error);
+
+    Rational *stack = reserve_value_stack(
+        context, sizeof(Rational) * (size_t)(rpn_tokens->top + 2));
+    if (!stack) return EXACT_ERROR;
+    int top = -1;
+
+    for (int i = 0; i <= rpn_tokens->top; i++) {
+        const Token *token = &rpn_tokens->data[i];
+        ExactResult step = EXACT_OK;
+
+        if (token->type == TOK_NUMBER) {
+            if (token->exact) {
+                // Integer literals below 2^53 are already held exactly
+                stack[++top] = rational_integer((long long)token->value);
+            } else {
+                step = rational_parse_literal(expression + token->source,
+                                              &stack[++top]);
+            }
+        } else if (token->type == TOK_VARIABLE) {
+            // Integral values below 2^53 are exact; other doubles are left
+            // to the floating-point evaluators
+            double value = context->variable_values[token->variable];
+            if (value != trunc(value) || fabs(value) > 0x1p53) {
+                step = EXACT_INEXACT;
+            } else {
+                stack[++top] = rational_integer((long long)value);
+            }
+        } else if (token->type == TOK_OPERATOR) {
+            if (top < 1) {
+                snprintf(error, error_size, "Not enough operands for operator");
+                return EXACT_ERROR;
+            }
+            top--;
+            step = exact_operator(context, token->operator, &stack[top],
+                                  stack[top + 1]);
+        } else if (token->type == TOK_FUNCTION) {
+            if (top < 0) {
+                snprintf(error, error_size, "Function '%s' requires an argument",
+                         token->function);
+                return EXACT_ERROR;
+            }
+            AggregateFunction aggregate = aggregate_function(token->function);
+            if (aggregate != AGGREGATE_NONE) {
+                int count =
+                    token->arguments <= top + 1 ? token->arguments : 0;
+                top += 1 - count;
+                step = exact_aggregate(context, aggregate, &stack[top],
+                                       (size_t)count);
+            } else {
+                step = exact_function(context, token->function, &stack[top]);
+            }
+        }
+
+        if (step != EXACT_OK) return step;
+    }
+
+    // Should have exactly one number left on stack
+    if (top != 0) {
+        snprintf(error, error_size, "Invalid expression syntax");
+        return EXACT_ERROR;
+    }
+    *result = stack[0];
+    return EXACT_OK;
+}
+
+double rational_to_double(Rational value) {
+    if (value.denominator == 1) return (double)value.numerator;
+
+    // Both conversions are exact below 2^53, leaving one correctly rounded
+    // division; beyond that, long double limits the error to a double
+    // rounding
+    if (fabs((double)value.numerator) <= TWO_POW_53 &&
+        (double)value.denominator <= TWO_POW_53) {
+        return (double)value.numerator / (double)value.denominator;
+    }
+    return (double)((long double)value.numerator /
+                    (long double)value.denominator);
+}
+
+/**
+ * =======================================================================
+ *                         PUBLIC LIBRARY API
+ * =======================================================================
+ */
+
+bool calc_format_integer(const CalcValue *value, int base, char *buffer,
+                         size_t size) {
+    long long integer;
+    if (value->type == CALC_VALUE_INTEGER) {
+        integer = value->numerator;
+    } else if (value->type == CALC_VALUE_REAL && isfinite(value->real) &&
+               value->real == nearbyint(value->real) &&
+               fabs(value->real) < TWO_POW_63) {
+        integer = (long long)value->real;
+    } else {
+        return false;
+    }
+
+    const char *prefix;
+    switch (base) {
+        case 2:
+            prefix = "0b";
+            break;
+        case 8:
+            prefix = "0o";
+            break;
+        case 10:
+            return snprintf(buffer, size, "%lld", integer) < (int)size;
+        case 16:
+            prefix = "0x";
+            break;
+        default:
+            return false;
+    }
+
+    // Other bases show the 64-bit two's complement pattern, which parses
+    // back to the same value. Digits are produced least significant first
+    char digits[64];
+    int count = 0;
+    unsigned long long remaining = (unsigned long long)integer;
+    do {
+        digits[count++] = "0123456789ABCDEF"[remaining % (unsigned)base];
+        remaining /= (unsigned)base;
+    } while (remaining > 0);
+
+    size_t needed = strlen(prefix) + (size_t)count + 1;
+    if (needed > size) return false;
+    char *out = buffer;
+    memcpy(out, prefix, 2);
+    out += 2;
+    while (count > 0) *out++ = digits[--count];
+    *out = '\0';
+    return true;
+}
@@ -0,0 +1,419 @@
+/**
+ * ========================================================================
+ *    LIBCALC - Internal Declarations (not part of the public API)
+ * ========================================================================
+ *
+ * Shared between the library's translation units and the benchmark
+ * harness. Nothing here is stable; embedders should use calc.h only.
+ */
+
+#ifndef LIBCALC_CALC_INTERNAL_H
+#define LIBCALC_CALC_INTERNAL_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "calc.h"
+
+/**
+ * =======================================================================
+ *                            DATA STRUCTURES
+ * =======================================================================
+ */
+
+/**
+ * Token types for mathematical expressions
+ * Formula libraries store tokens as they are: a new type or a new Token
+ * field makes older libraries fail to open, and any other change to what
+ * the tokens mean needs LIBRARY_VERSION in calc_library.c to be bumped.
+ */
+typedef enum {
+    TOK_NUMBER,     // Numeric values (integers, decimals, percentages)
+    TOK_OPERATOR,   // Mathematical and bitwise operators (+, -, *, /, ^, &...)
+    TOK_LPAREN,     // Left parenthesis (
+    TOK_RPAREN,     // Right parenthesis )
+    TOK_COMMA,      // Argument or matrix element separator ,
+    TOK_LBRACKET,   // Start of a matrix literal [
+    TOK_RBRACKET,   // End of a matrix literal ]
+    TOK_SEMICOLON,  // Matrix row separator ;
+    TOK_ROW,        // Joins `arguments` values side by side (RPN only)
+    TOK_MATRIX,     // Stacks `arguments` rows (RPN only)
+    TOK_BODY,       // Starts the `arguments` tokens of an iterated
+                    // expression, the first argument of iterate() (RPN only)
+    TOK_PREVIOUS,   // x in an iterated expression: the previous value
+    TOK_FUNCTION,   // Mathematical functions (sin, cos, sqrt, etc.)
+    TOK_VARIABLE,   // Variable names bound by calc_compile()
+    TOK_END,        // End of expression
+    TOK_INVALID     // Invalid/unrecognized token
+} TokenType;
+
+/**
+ * Individual token in a mathematical expression
+ */
+typedef struct {
+    TokenType type;       // Type of this token
+    int variable;         // Index of the variable (for TOK_VARIABLE);
+                          // rows so far while a TOK_LBRACKET is open;
+                          // output index of the TOK_BODY of an iteration
+                          // function's open TOK_LPAREN
+    double value;         // Numeric value (for TOK_NUMBER)
+    char operator;        // Operator character (for TOK_OPERATOR)
+    char function[12];    // Function name (for TOK_FUNCTION)
+    bool exact;           // Number is an integer literal held exactly
+    unsigned int source;  // Offset of a number's or variable's text
+    int arguments;        // Values a TOK_FUNCTION, TOK_ROW or TOK_MATRIX
+                          // takes; while a TOK_LPAREN or TOK_LBRACKET is
+                          // open, the arguments (or row elements) so far
+} Token;
+
+/**
+ * Lexical analyzer state - tracks position in input string
+ */
+typedef struct {
+    const char *input;  // Input expression string
+    size_t position;    // Current parsing position
+} Lexer;
+
+/**
+ * Dynamic stack for Token objects
+ */
+typedef struct {
+    Token *data;   // Array of tokens
+    int top;       // Index of top element (-1 if empty)
+    int capacity;  // Current capacity of array
+} TokenStack;
+
+/**
+ * Dynamic stack for numeric values
+ */
+typedef struct {
+    double *data;  // Array of doubles
+    int top;       // Index of top element (-1 if empty)
+    int capacity;  // Current capacity of array
+} NumberStack;
+
+/**
+ * Double-double number: the unevaluated sum hi + lo with |lo| at most half
+ * an ulp of hi, about 106 significant bits
+ */
+typedef struct {
+    double hi;  // Leading part (the value rounded to double)
+    double lo;  // Rounding error of hi
+} DoubleDouble;
+
+/**
+ * double value with a bound on its absolute error
+ */
+typedef struct {
+    double value;  // Computed value
+    double error;  // Bound on |value - exact value|
+} BoundedValue;
+
+/**
+ * Double-double value with a bound on its absolute error
+ */
+typedef struct {
+    DoubleDouble value;  // Computed value
+    double error;        // Bound on |value - exact value|
+} PreciseValue;
+
+/**
+ * Exact rational number, always in lowest terms
+ */
+typedef struct {
+    long long numerator;    // Carries the sign
+    long long denominator;  // Always positive
+} Rational;
+
+/**
+ * Outcome of the exact evaluator
+ */
+typedef enum {
+    EXACT_OK,      // Exact result computed
+    EXACT_ERROR,   // Definite error, message in context->last_error
+    EXACT_INEXACT  // No exact 64-bit result; use floating point instead
+} ExactResult;
+
+/**
+ * Functions taking any number of arguments (see calc_aggregate.c)
+ */
+typedef enum {
+    AGGREGATE_NONE,       // Not an aggregate
+    AGGREGATE_MEAN,       // Arithmetic mean
+    AGGREGATE_VAR,        // Sample variance (divided by n - 1)
+    AGGREGATE_STDDEV,     // Sample standard deviation
+    AGGREGATE_MIN,        // Smallest value
+    AGGREGATE_MAX,        // Largest value
+    AGGREGATE_MEDIAN,     // Middle value (mean of the middle two)
+    AGGREGATE_PERCENTILE  // percentile(p, ...): linear interpolation
+} AggregateFunction;
+
+/**
+ * Linear algebra functions (see calc_matrix.c)
+ */
+typedef enum {
+    MATRIX_NONE,      // Not a linear algebra function
+    MATRIX_DOT,       // dot(u, v): dot product of two vectors
+    MATRIX_DET,       // det(A): determinant
+    MATRIX_INV,       // inv(A): inverse
+    MATRIX_SOLVE,     // solve(A, B): X with A X = B
+    MATRIX_TRANSPOSE  // transpose(A)
+} MatrixFunction;
+
+/**
+ * Functions that iterate their first argument (see calc_iterate.c)
+ */
+typedef enum {
+    ITERATION_NONE,      // Not an iteration function
+    ITERATION_ITERATE,   // iterate(f, x0, n): n steps
+    ITERATION_FIXPOINT,  // fixpoint(f, x0[, tol]): value at convergence
+    ITERATION_FIXSTEPS   // fixsteps(f, x0[, tol]): steps to convergence
+} IterationFunction;
+
+/**
+ * Evaluation context - everything one evaluation needs, so that separate
+ * contexts never share mutable state
+ */
+struct CalcContext {
+    CalcOptions options;                // Options given at creation
+    char last_error[CALC_ERROR_SIZE];   // Message of the last failure
+    CalcPrecision last_precision;       // Precision of the last result
+    TokenStack rpn;                     // Reusable RPN output buffer
+    TokenStack operators;               // Reusable operator stack
+    NumberStack numbers;                // Reusable evaluation stack
+    void *value_stack;                  // Reusable stack of the exact, bounded
+    size_t value_stack_size;            // and extended evaluators (bytes)
+    double *matrix_arena;               // Elements of matrix values
+    size_t matrix_capacity;             // Elements the arena holds
+    size_t memory_used;                 // Bytes held by the buffers above
+    const char *const *variable_names;  // Names bound while compiling
+    size_t variable_count;              // Number of variable_names
+    const double *variable_values;      // Values while running a program
+    size_t matrix_rows;                 // Shape of a matrix result, whose
+    size_t matrix_columns;              // elements start matrix_arena
+    atomic_bool cancel_requested;       // Set by calc_cancel()
+};
+
+/**
+ * Compiled expression - the RPN tokens plus a copy of the source text,
+ * whose number literals the exact and extended evaluators re-read
+ */
+struct CalcProgram {
+    CalcAllocator allocator;  // Hooks that allocated the program
+    TokenStack code;          // RPN tokens; variables refer to value indexes
+    const char *expression;   // Copy of the compiled expression
+};
+
+/**
+ * =======================================================================
+ *                       INTERNAL ENGINE FUNCTIONS
+ * =======================================================================
+ */
+
+/**
+ * Allocation helpers - route memory through an allocator (libc when all
+ * its hooks are NULL)
+ */
+bool calc_allocator_valid(const CalcAllocator *allocator);
+void *calc_allocator_malloc(const CalcAllocator *allocator, size_t size);
+void calc_allocator_free(const CalcAllocator *allocator, void *pointer);
+
+/**
+ * Allocation helpers - route memory through the context's allocator
+ */
+void *calc_realloc(CalcContext *context, void *pointer, size_t size);
+void calc_free(CalcContext *context, void *pointer);
+
+/**
+ * Grow the context's value stack to at least `size` bytes
+ * @return: the stack, or NULL (with an error message) if out of memory
+ */
+void *reserve_value_stack(CalcContext *context, size_t size);
+
+/**
+ * Grow the context's number stack to hold at least `count` doubles, for
+ * use as scratch space by evaluators that keep their values elsewhere
+ * @return: the array, or NULL (with an error message) if out of memory
+ */
+double *reserve_number_scratch(CalcContext *context, size_t count);
+
+/**
+ * Grow the context's matrix arena to hold at least `count` doubles,
+ * keeping its contents
+ * @return: the arena, or NULL (with an error message) if out of memory
+ */
+double *reserve_matrix_arena(CalcContext *context, size_t count);
+
+/**
+ * Radix of a 0x (hex), 0b (binary) or 0o (octal) literal prefix, or 0
+ */
+int radix_prefix(const char *text);
+
+/**
+ * Value of a digit character in a radix, or -1
+ */
+int radix_digit(char c, int radix);
+
+/**
+ * Extract next token from input string
+ */
+Token get_next_token(Lexer *lexer);
+
+/**
+ * Convert an infix expression to RPN (Shunting Yard algorithm)
+ * @return: true if successful, false if error (see context->last_error)
+ */
+bool convert_to_rpn(CalcContext *context, const char *expression,
+                    TokenStack *output);
+
+/**
+ * Check the number of arguments of a TOK_FUNCTION against its function
+ * @return: false (with an error message) if it does not fit
+ */
+bool check_arity(CalcContext *context, const Token *function);
+
+/**
+ * Evaluate an RPN token sequence produced by convert_to_rpn()
+ * @return: true if successful, false if error (see context->last_error)
+ */
+bool evaluate_rpn(CalcContext *context, const TokenStack *rpn_tokens,
+                  double *result);
+
+/**
+ * Evaluate RPN in double while bounding the accumulated rounding error
+ * @param trusted: set to false when the error bound exceeds the context's
+ *                 tolerance or a domain check cannot be decided in double
+ * @return: false only for definite errors (see context->last_error)
+ */
+bool evaluate_rpn_bounded(CalcContext *context, const TokenStack *rpn_tokens,
+                          double *result, bool *trusted);
+
+/**
+ * Evaluate RPN in double-double; number literals are re-read from the
+ * expression text so they carry more than double precision
+ * @return: true if successful, false if error (see context->last_error)
+ */
+bool evaluate_rpn_precise(CalcContext *context, const char *expression,
+                          const TokenStack *rpn_tokens, double *result);
+
+/**
+ * Evaluate RPN with checked 64-bit rational arithmetic; literals that are
+ * not held exactly are re-read from the expression text
+ * @return: EXACT_INEXACT as soon as a step has no exact 64-bit result
+ */
+ExactResult evaluate_rpn_exact(CalcContext *context, const char *expression,
+                               const TokenStack *rpn_tokens, Rational *result);
+
+/**
+ * Check whether RPN needs the matrix evaluator: it builds a matrix
+ * literal or calls a linear algebra function
+ */
+bool uses_matrices(const TokenStack *rpn_tokens);
+
+/**
+ * Evaluate RPN with vector and matrix values in double; a matrix result
+ * is left at the start of the context's arena
+ * @return: true if successful, false if error (see context->last_error)
+ */
+bool evaluate_rpn_matrix(CalcContext *context, const TokenStack *rpn_tokens,
+                         CalcValue *result);
+
+/**
+ * Check whether RPN calls an iteration function (contains a TOK_BODY)
+ */
+bool uses_iteration(const TokenStack *rpn_tokens);
+
+/**
+ * Evaluate RPN with iteration functions in double
+ * @return: true if successful, false if error (see context->last_error)
+ */
+bool evaluate_rpn_iteration(CalcContext *context, const TokenStack *rpn_tokens,
+                            double *result);
+
+/**
+ * Iteration function implemented by a function name, or ITERATION_NONE
+ */
+IterationFunction iteration_function(const char *name);
+
+/**
+ * Linear algebra function implemented by a function name, or MATRIX_NONE
+ */
+MatrixFunction matrix_function(const char *name);
+
+/**
+ * Row-major product result = left * right of a rows x inner and an
+ * inner x columns matrix; result must not overlap the operands
+ */
+void matrix_multiply(const double *left, const double *right, double *result,
+                     size_t rows, size_t inner, size_t columns);
+
+/**
+ * Apply a binary operator (+ - * / ^ and the bitwise operators) to two
+ * numbers
+ * @return: true if successful, false if error (see context->last_error)
+ */
+bool apply_scalar_operator(CalcContext *context, char op, double left,
+                           double right, double *result);
+
+/**
+ * Apply a one-argument function (sqrt, log, ln, sin, cos, tan, not)
+ * @return: true if successful, false if error (see context->last_error)
+ */
+bool apply_scalar_function(CalcContext *context, const char *name,
+                           double operand, double *result);
+
+/**
+ * Nearest double to a rational
+ */
+double rational_to_double(Rational value);
+
+/**
+ * Check whether an operator is one of the integer-only operators
+ * (&, |, x = xor, < = shift left, > = shift right)
+ */
+bool is_bitwise_operator(char op);
+
+/**
+ * Apply a bitwise operator to floating-point operands, which must be
+ * integers; '~' (bitwise not) ignores `right`
+ * @return: true if successful, false if error (see context->last_error)
+ */
+bool apply_bitwise_operator(CalcContext *context, char op, double left,
+                            double right, double *result);
+
+/**
+ * Sine and cosine of an angle in degrees, reduced exactly in degrees
+ * (see calc_trig.c); exact at multiples of 90 and correctly rounded at
+ * multiples of 30 and 45
+ */
+void degree_sincos(double degrees, double *sine, double *cosine);
+
+/**
+ * Tangent of an angle in degrees
+ * @return: false at odd multiples of 90, where the tangent is undefined
+ */
+bool degree_tan(double degrees, double *result);
+
+/**
+ * Aggregate implemented by a function name, or AGGREGATE_NONE
+ */
+AggregateFunction aggregate_function(const char *name);
+
+/**
+ * Check an aggregate's argument count (for percentile, including p) and
+ * the percentile, which must be in [0, 100]
+ * @return: true if valid, false if error (see context->last_error)
+ */
+bool aggregate_check(CalcContext *context, AggregateFunction function,
+                     size_t count, double percentile);
+
+/**
+ * Apply an aggregate to its arguments; percentile's first value is p
+ * Values are reordered by median and percentile; NaN propagates.
+ * @return: true if successful, false if error (see context->last_error)
+ */
+bool aggregate_values(CalcContext *context, AggregateFunction function,
+                      double *values, size_t count, double *result);
+
+#endif  // LIBCALC_CALC_INTERNAL_H
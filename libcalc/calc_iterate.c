@@ -0,0 +1,445 @@
+/**
+ * ========================================================================
+ *    LIBCALC - Iteration and Recurrences
+ * ========================================================================
+ *
+ * iterate(f, x0, n) applies the expression f to x0 n times, where x in f
+ * is the previous value: iterate(x * 1.05, 100, 10) compounds 5% ten
+ * times. fixpoint(f, x0[, tol]) iterates until two successive values
+ * differ by at most tol (default 1e-12) relative to the larger of 1 and
+ * the new value, and returns that value; fixsteps() takes the same
+ * arguments and returns the number of steps instead. The parser puts f
+ * in the RPN after a TOK_BODY header holding its length, so the whole
+ * expression is evaluated in one pass and f is jumped over, then run by
+ * the function once per step. Iterations may nest; other variables of a
+ * compiled program stay visible inside f.
+ *
+ * The RPN is translated once per evaluation into an array of steps, one
+ * per token, with variables resolved to their values and + - * executed
+ * inline, so a step of a small recurrence costs a few nanoseconds and a
+ * million steps take milliseconds. iterate() stops early at an exact
+ * fixed point, whose later steps would all repeat it. Every iteration
+ * function counts its steps against CalcLimits.max_steps and checks for
+ * calc_cancel() every STEP_CHECK_INTERVAL steps.
+ */
+
+#include "calc_internal.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define STEP_CHECK_INTERVAL 1024  // Steps between cancellation checks
+#define FIXPOINT_TOLERANCE 1e-12  // Default tolerance of fixpoint()
+
+/**
+ * =======================================================================
+ *                            DATA STRUCTURES
+ * =======================================================================
+ */
+
+/**
+ * Operation of one step, translated from one RPN token
+ */
+typedef enum {
+    STEP_NUMBER,     // Push `value` (numbers and bound variables)
+    STEP_PREVIOUS,   // Push the previous value of the innermost iteration
+    STEP_ADD,        // + - * executed inline
+    STEP_SUBTRACT,
+    STEP_MULTIPLY,
+    STEP_OPERATOR,   // Any other binary operator
+    STEP_FUNCTION,   // One-argument function
+    STEP_AGGREGATE,  // Aggregate of `count` arguments
+    STEP_BODY,       // Push this step's index and skip the `count` steps
+                     // of the iterated expression
+    STEP_ITERATE,    // Iteration function of `count` arguments
+    STEP_NONE        // Token without an effect
+} StepKind;
+
+/**
+ * One step of a translated expression
+ */
+typedef struct {
+    StepKind kind;                // Operation
+    int count;                    // Arguments, or the length of a body
+    double value;                 // Value pushed by STEP_NUMBER
+    AggregateFunction aggregate;  // Function of STEP_AGGREGATE
+    IterationFunction iteration;  // Function of STEP_ITERATE
+    const Token *token;           // Token the step was translated from
+} Step;
+
+/**
+ * State shared by all iterations of one evaluation
+ */
+typedef struct {
+    CalcContext *context;            // Owner of the error buffer
+    const Step *steps;               // Translated expression
+    int step_count;                  // Number of steps
+    unsigned long long steps_left;   // Iteration steps still allowed
+    unsigned long long steps_taken;  // Iteration steps so far
+} IterationState;
+
+/**
+ * =======================================================================
+ *                              TRANSLATION
+ * =======================================================================
+ */
+
+IterationFunction iteration_function(const char *name) {
+    if (strcmp(name, "iterate") == 0) return ITERATION_ITERATE;
+    if (strcmp(name, "fixpoint") == 0) return ITERATION_FIXPOINT;
+    if (strcmp(name, "fixsteps") == 0) return ITERATION_FIXSTEPS;
+    return ITERATION_NONE;
+}
+
+bool uses_iteration(const TokenStack *rpn_tokens) {
+    for (int i = 0; i <= rpn_tokens->top; i++) {
+        if (rpn_tokens->data[i].type == TOK_BODY) return true;
+    }
+    return false;
+}
+
+/**
+ * Translate one RPN token into a step
+ */
+static Step translate(const CalcContext *context, const Token *token) {
+    Step step = {STEP_NONE, 0, 0.0, AGGREGATE_NONE, ITERATION_NONE, token};
+    switch (token->type) {
+        case TOK_NUMBER:
+            step.kind = STEP_NUMBER;
+            step.value = token->value;
+            break;
+        case TOK_VARIABLE:
+            step.kind = STEP_NUMBER;
+            step.value = context->variable_values[token->variable];
+            break;
+        case TOK_PREVIOUS:
+            step.kind = STEP_PREVIOUS;
+            break;
+        case TOK_OPERATOR:
+            if (token->operator == '+') {
+                step.kind = STEP_ADD;
+            } else if (token->operator == '-') {
+                step.kind = STEP_SUBTRACT;
+            } else if (token->operator == '*') {
+                step.kind = STEP_MULTIPLY;
+            } else {
+                step.kind = STEP_OPERATOR;
+            }
+            break;
+        case TOK_FUNCTION:
+            step.count = token->arguments;
+            step.iteration = iteration_function(token->function);
+            step.aggregate = aggregate_function(token->function);
+            if (step.iteration != ITERATION_NONE) {
+                step.kind = STEP_ITERATE;
+            } else if (step.aggregate != AGGREGATE_NONE) {
+                step.kind = STEP_AGGREGATE;
+            } else {
+                step.kind = STEP_FUNCTION;
+            }
+            break;
+        case TOK_BODY:
+            step.kind = STEP_BODY;
+            step.count = token->arguments;
+            break;
+        default:
+            break;  // Ignore other token types
+    }
+    return step;
+}
+
+/**
+ * =======================================================================
+ *                              EVALUATION
+ * =======================================================================
+ */
+
+static bool run_steps(IterationState *state, int begin, int end,
+                      double previous, double *stack, double *result);
+
+/**
+ * Count one iteration step against the limit and check for cancellation
+ * @return: false (with an error message) if the iteration must stop
+ */
+static bool take_step(IterationState *state, IterationFunction function) {
+    CalcContext *context = state->context;
+    if (state->steps_left == 0) {
+        size_t limit = context->options.limits.max_steps;
+        if (function == ITERATION_ITERATE) {
+            snprintf(context->last_error, sizeof(context->last_error),
+                     "Iteration takes too many steps (limit %zu)", limit);
+        } else {
+            snprintf(context->last_error, sizeof(context->last_error),
+                     "Iteration did not converge in %zu steps", limit);
+        }
+        return false;
+    }
+    state->steps_left--;
+    if ((++state->steps_taken & (STEP_CHECK_INTERVAL - 1)) == 0 &&
+        atomic_load_explicit(&context->cancel_requested,
+                             memory_order_relaxed)) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Evaluation cancelled");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Run an iteration function on its arguments, the first of which is the
+ * index of the iterated expression's STEP_BODY
+ * @param scratch: stack space above the arguments for the expression
+ * @return: true if successful, false if error (see context->last_error)
+ */
+static bool run_iteration(IterationState *state, const Step *call,
+                          const double *arguments, double *scratch,
+                          double *result) {
+    CalcContext *context = state->context;
+    char *error = context->last_error;
+    size_t error_size = sizeof(context->last_error);
+
+    double marker = arguments[0];
+    if (!(marker >= 0.0 && marker < state->step_count) ||
+        marker != floor(marker) ||
+        state->steps[(int)marker].kind != STEP_BODY) {
+        snprintf(error, error_size, "Invalid expression syntax");
+        return false;
+    }
+    int begin = (int)marker + 1;
+    int end = begin + state->steps[(int)marker].count;
+    double x = arguments[1];
+
+    if (call->iteration == ITERATION_ITERATE) {
+        double n = arguments[2];
+        if (!(n >= 0.0) || n != floor(n)) {
+            snprintf(error, error_size,
+                     "Iteration count must be a non-negative integer");
+            return false;
+        }
+        if (n >= 0x1p64 || n > (double)state->steps_left) {
+            snprintf(error, error_size,
+                     "Iteration takes too many steps (limit %zu)",
+                     context->options.limits.max_steps);
+            return false;
+        }
+        for (unsigned long long i = 0; i < (unsigned long long)n; i++) {
+            double next;
+            if (!take_step(state, call->iteration) ||
+                !run_steps(state, begin, end, x, scratch, &next)) {
+                return false;
+            }
+            if (next == x) break;  // Every later step would repeat it
+            x = next;
+        }
+        *result = x;
+        return true;
+    }
+
+    double tolerance = call->count == 3 ? arguments[2] : FIXPOINT_TOLERANCE;
+    if (!(tolerance >= 0.0) || isinf(tolerance)) {
+        snprintf(error, error_size, "Tolerance must be a non-negative number");
+        return false;
+    }
+    for (unsigned long long steps = 1;; steps++) {
+        double next;
+        if (!take_step(state, call->iteration) ||
+            !run_steps(state, begin, end, x, scratch, &next)) {
+            return false;
+        }
+        if (!isfinite(next)) {
+            snprintf(error, error_size, "Iteration diverged after %llu steps",
+                     steps);
+            return false;
+        }
+        if (fabs(next - x) <= tolerance * fmax(1.0, fabs(next))) {
+            *result =
+                call->iteration == ITERATION_FIXSTEPS ? (double)steps : next;
+            return true;
+        }
+        x = next;
+    }
+}
+
+/**
+ * Evaluate the steps [begin, end), checked by check_steps(), to a single
+ * value
+ * @param previous: value of x in the innermost iterated expression
+ * @param stack: space for the values; iterations nested in the steps use
+ *               the space above their arguments
+ * @return: true if successful, false if error (see context->last_error)
+ */
+static bool run_steps(IterationState *state, int begin, int end,
+                      double previous, double *stack, double *result) {
+    CalcContext *context = state->context;
+    const Step *steps = state->steps;
+    double *top = stack - 1;
+
+    for (int i = begin; i < end; i++) {
+        const Step *step = &steps[i];
+        switch (step->kind) {
+            case STEP_NUMBER:
+                *++top = step->value;
+                break;
+            case STEP_PREVIOUS:
+                *++top = previous;
+                break;
+            case STEP_ADD:
+                top--;
+                top[0] += top[1];
+                break;
+            case STEP_SUBTRACT:
+                top--;
+                top[0] -= top[1];
+                break;
+            case STEP_MULTIPLY:
+                top--;
+                top[0] *= top[1];
+                break;
+            case STEP_OPERATOR:
+                top--;
+                if (!apply_scalar_operator(context, step->token->operator,
+                                           top[0], top[1], top)) {
+                    return false;
+                }
+                break;
+            case STEP_FUNCTION:
+                if (!apply_scalar_function(context, step->token->function,
+                                           top[0], top)) {
+                    return false;
+                }
+                break;
+            case STEP_AGGREGATE: {
+                int depth = (int)(top - stack) + 1;
+                int count = step->count <= depth ? step->count : 0;
+                double value;
+                if (!aggregate_values(context, step->aggregate,
+                                      top + 1 - count, (size_t)count,
+                                      &value)) {
+                    return false;
+                }
+                top -= count;
+                *++top = value;
+                break;
+            }
+            case STEP_BODY:
+                *++top = (double)i;
+                i += step->count;
+                break;
+            case STEP_ITERATE: {
+                // Arguments are the top values; the body runs above them
+                double value;
+                top -= step->count;
+                if (!run_iteration(state, step, top + 1, top + 1 + step->count,
+                                   &value)) {
+                    return false;
+                }
+                *++top = value;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    *result = *top;
+    return true;
+}
+
+/**
+ * Check the stack effect of the steps [begin, end), including those of
+ * the iterated expressions among them, so run_steps() need not check
+ * operands
+ * @return: true if they leave exactly one value, false (with an error
+ *          message) otherwise
+ */
+static bool check_steps(CalcContext *context, const Step *steps, int begin,
+                        int end) {
+    char *error = context->last_error;
+    size_t error_size = sizeof(context->last_error);
+    int depth = 0;
+
+    for (int i = begin; i < end; i++) {
+        const Step *step = &steps[i];
+        switch (step->kind) {
+            case STEP_NUMBER:
+            case STEP_PREVIOUS:
+                depth++;
+                break;
+            case STEP_ADD:
+            case STEP_SUBTRACT:
+            case STEP_MULTIPLY:
+            case STEP_OPERATOR:
+                if (depth < 2) {
+                    snprintf(error, error_size,
+                             "Not enough operands for operator");
+                    return false;
+                }
+                depth--;
+                break;
+            case STEP_FUNCTION:
+            case STEP_AGGREGATE:
+                if (depth < 1) {
+                    snprintf(error, error_size,
+                             "Function '%s' requires an argument",
+                             step->token->function);
+                    return false;
+                }
+                // Aggregates reduce their arguments to one value
+                if (step->kind == STEP_AGGREGATE && step->count <= depth) {
+                    depth -= step->count - 1;
+                }
+                break;
+            case STEP_BODY:
+                if (step->count < 1 || step->count >= end - i ||
+                    !check_steps(context, steps, i + 1,
+                                 i + 1 + step->count)) {
+                    snprintf(error, error_size, "Invalid expression syntax");
+                    return false;
+                }
+                depth++;
+                i += step->count;
+                break;
+            case STEP_ITERATE:
+                if (step->count < 2 || step->count > depth) {
+                    snprintf(error, error_size, "Invalid expression syntax");
+                    return false;
+                }
+                depth -= step->count - 1;
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Should have exactly one value left on stack
+    if (depth != 1) {
+        snprintf(error, error_size, "Invalid expression syntax");
+        return false;
+    }
+    return true;
+}
+
+bool evaluate_rpn_iteration(CalcContext *context, const TokenStack *rpn_tokens,
+                            double *result) {
+    // Steps, then room for one value per step; the values of an iterated
+    // expression are stacked above the arguments of its function, which
+    // never leaves more values than steps (see run_steps)
+    size_t count = (size_t)(rpn_tokens->top + 1);
+    Step *steps = reserve_value_stack(
+        context, sizeof(Step) * count + sizeof(double) * (count + 1));
+    if (!steps) return false;
+    for (size_t i = 0; i < count; i++) {
+        steps[i] = translate(context, &rpn_tokens->data[i]);
+    }
+    if (!check_steps(context, steps, 0, (int)count)) return false;
+
+    size_t max_steps = context->options.limits.max_steps;
+    IterationState state;
+    state.context = context;
+    state.steps = steps;
+    state.step_count = (int)count;
+    state.steps_left = max_steps ? max_steps : ~0ULL;
+    state.steps_taken = 0;
+    return run_steps(&state, 0, (int)count, NAN, (double *)(steps + count),
+                     result);
+}
@@ -0,0 +1,839 @@
+/**
+ * ========================================================================
+ *    LIBCALC - Precompiled Formula Libraries
+ * ========================================================================
+ *
+ * calc_library_write() compiles named formulas once and stores the result
+ * in a file; calc_library_open() maps that file read-only and
+ * calc_library_program() hands out programs whose tokens and text point
+ * into the mapping, so no formula is tokenized or parsed again and
+ * processes that open the same library share its pages.
+ *
+ * File layout (native byte order, all offsets from the start of the file):
+ *
+ *     LibraryHeader   magic, version, layout of this engine's Token,
+ *                     section offsets and a checksum of the header
+ *     LibraryEntry[]  one per formula, sorted by name
+ *     uint32_t[]      symbol table: string offsets of variable names
+ *     Token[]         RPN of every formula, as convert_to_rpn() made it;
+ *                     number values are held inline
+ *     char[]          formula names, variable names and the expression
+ *                     texts the exact and extended evaluators re-read
+ *                     literals from, each NUL-terminated
+ *
+ * Opening checks the header only, so it costs the same for any number of
+ * formulas. Each formula has its own checksum, which is verified together
+ * with the indexes and stack effect of its tokens when its program is
+ * made: a corrupt or hand-made file fails there instead of misleading the
+ * evaluators, which trust the parser's output.
+ */
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "calc_internal.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define LIBRARY_MAGIC "CALCLIB"              // First 8 bytes, with the NUL
+#define LIBRARY_VERSION 1                    // Bump when the layout changes
+#define LIBRARY_BYTE_ORDER 0x01020304u       // Reads differently if swapped
+#define CHECKSUM_SEED 0xcbf29ce484222325ULL  // FNV-1a offset basis
+#define CHECKSUM_PRIME 0x100000001b3ULL      // FNV-1a prime
+
+/**
+ * =======================================================================
+ *                            DATA STRUCTURES
+ * =======================================================================
+ */
+
+/**
+ * Start of a library file
+ */
+typedef struct {
+    char magic[8];            // LIBRARY_MAGIC
+    uint32_t version;         // LIBRARY_VERSION
+    uint32_t byte_order;      // LIBRARY_BYTE_ORDER as written
+    uint32_t token_size;      // sizeof(Token) of the writer
+    uint32_t token_types;     // Number of token types of the writer
+    uint32_t formula_count;   // Entries in the formula table
+    uint32_t variable_count;  // Entries in the symbol table
+    uint64_t file_size;       // Bytes in the whole file
+    uint64_t entries;         // Offset of the formula table
+    uint64_t variables;       // Offset of the symbol table
+    uint64_t tokens;          // Offset of the tokens (8-byte aligned)
+    uint64_t token_count;     // Tokens of all formulas
+    uint64_t strings;         // Offset of the strings
+    uint64_t string_size;     // Bytes of the strings
+    uint64_t checksum;        // Of this header, with this field zero
+} LibraryHeader;
+
+/**
+ * One formula of a library
+ */
+typedef struct {
+    uint64_t checksum;        // Of this entry (with this field zero), its
+                              // tokens, its symbol table entries and its
+                              // strings, which run from name to the end of
+                              // the text
+    uint32_t name;            // String offset of the formula name, followed
+                              // by the variable names
+    uint32_t text;            // String offset of the expression text
+    uint32_t text_size;       // Bytes of the text, including the NUL
+    uint32_t first_variable;  // Symbol table index of the first variable
+    uint32_t variable_count;  // Number of variables
+    uint32_t first_token;     // Index of the first token
+    uint32_t token_count;     // Number of tokens
+    uint32_t reserved;        // Zero
+} LibraryEntry;
+
+/**
+ * Open library - the mapping plus pointers to its sections
+ */
+struct CalcLibrary {
+    CalcAllocator allocator;      // Hooks that allocated this struct
+    const void *data;             // Mapped file
+    size_t size;                  // Bytes mapped
+    const LibraryEntry *entries;  // Formulas sorted by name
+    size_t count;                 // Number of formulas
+    const uint32_t *variables;    // Symbol table
+    size_t variable_count;        // Entries in the symbol table
+    const Token *tokens;          // Tokens of all formulas
+    size_t token_count;           // Number of tokens
+    const char *strings;          // Names and texts, ending with a NUL
+    size_t string_size;           // Bytes of the strings
+};
+
+/**
+ * =======================================================================
+ *                               HELPERS
+ * =======================================================================
+ */
+
+/**
+ * Continue a checksum over `size` bytes: FNV-1a taken 8 bytes at a time,
+ * with a shift that mixes high bits down. Every step is invertible, so a
+ * change confined to one word (any flipped bits) is always detected.
+ */
+static uint64_t checksum_update(uint64_t checksum, const void *data,
+                                size_t size) {
+    const unsigned char *bytes = data;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        checksum = (checksum ^ word) * CHECKSUM_PRIME;
+        checksum ^= checksum >> 29;
+    }
+    for (; i < size; i++) {
+        checksum = (checksum ^ bytes[i]) * CHECKSUM_PRIME;
+    }
+    return checksum;
+}
+
+/**
+ * Copy a token field by field into zeroed memory, so that the bytes
+ * written (and checksummed) do not depend on padding
+ */
+static void normalize_token(const Token *token, Token *out) {
+    memset(out, 0, sizeof(*out));
+    out->type = token->type;
+    out->variable = token->variable;
+    out->value = token->value;
+    out->operator = token->operator;
+    const char *end = memchr(token->function, '\0', sizeof(out->function));
+    size_t length = end ? (size_t)(end - token->function)
+                        : sizeof(out->function) - 1;
+    memcpy(out->function, token->function, length);
+    out->exact = token->exact;
+    out->source = token->source;
+    out->arguments = token->arguments;
+}
+
+/**
+ * Check that `count` items of `size` bytes at `offset` lie within a file
+ */
+static bool section_fits(uint64_t offset, uint64_t count, size_t size,
+                         size_t file_size) {
+    return offset <= file_size && count <= (file_size - offset) / size;
+}
+
+/**
+ * Checksum of a library entry over its spans in the file: the entry, its
+ * tokens, its symbol table entries and its strings
+ */
+static uint64_t entry_checksum(const LibraryEntry *entry, const Token *tokens,
+                               const uint32_t *variables, const char *strings) {
+    LibraryEntry copy = *entry;
+    copy.checksum = 0;
+    uint64_t checksum = checksum_update(CHECKSUM_SEED, &copy, sizeof(copy));
+    checksum = checksum_update(checksum, tokens,
+                               sizeof(Token) * entry->token_count);
+    checksum = checksum_update(checksum, variables,
+                               sizeof(uint32_t) * entry->variable_count);
+    return checksum_update(checksum, strings,
+                           entry->text + entry->text_size - entry->name);
+}
+
+/**
+ * Iterated expression being checked by tokens_valid()
+ */
+typedef struct {
+    int end;     // Index just past its last token
+    int values;  // Values of the enclosing expression before it
+} BodyFrame;
+
+/**
+ * Check the tokens of a formula the way the parser's output is shaped:
+ * every index in range, every operator and function with its operands,
+ * iterated expressions nested at most max_depth deep, and exactly one
+ * value left in the formula and in each iterated expression
+ * The nesting is tracked on a heap stack rather than by recursion, so a
+ * file nested arbitrarily deep cannot exhaust the thread's stack.
+ * @return: false if the evaluators cannot be given them
+ */
+static bool tokens_valid(CalcContext *context, const Token *tokens,
+                         int count, const LibraryEntry *entry) {
+    size_t depth_limit = context->options.limits.max_depth;
+    BodyFrame *frames = NULL;
+    size_t depth = 0, capacity = 0;
+    int values = 0;
+    bool valid = true;
+
+    for (int i = 0; valid && i < count; i++) {
+        const Token *token = &tokens[i];
+        int end = depth > 0 ? frames[depth - 1].end : count;
+        if (token->source >= entry->text_size) {
+            valid = false;
+            break;
+        }
+        switch (token->type) {
+            case TOK_NUMBER:
+                valid = !token->exact ||
+                        (token->value == trunc(token->value) &&
+                         fabs(token->value) <= 0x1p53);
+                values++;
+                break;
+            case TOK_VARIABLE:
+                valid = token->variable >= 0 &&
+                        (uint32_t)token->variable < entry->variable_count;
+                values++;
+                break;
+            case TOK_PREVIOUS:
+                valid = depth > 0;
+                values++;
+                break;
+            case TOK_OPERATOR:
+                valid = values >= 2;
+                values--;
+                break;
+            case TOK_FUNCTION:
+            case TOK_ROW:
+            case TOK_MATRIX:
+                // Each takes its arguments and leaves one value
+                valid = token->arguments >= 1 && token->arguments <= values;
+                if (valid && token->type == TOK_FUNCTION) {
+                    valid = memchr(token->function, '\0',
+                                   sizeof(token->function)) &&
+                            check_arity(context, token);
+                }
+                values -= token->arguments - 1;
+                break;
+            case TOK_BODY:
+                valid = token->arguments >= 1 && token->arguments < end - i &&
+                        !(depth_limit && depth >= depth_limit);
+                if (valid && depth == capacity) {
+                    size_t grown = capacity ? 2 * capacity : 16;
+                    BodyFrame *larger = calc_realloc(
+                        context, frames, sizeof(BodyFrame) * grown);
+                    valid = larger != NULL;
+                    if (larger) {
+                        frames = larger;
+                        capacity = grown;
+                    }
+                }
+                if (valid) {
+                    frames[depth].end = i + 1 + token->arguments;
+                    frames[depth].values = values;
+                    depth++;
+                    values = 0;
+                }
+                break;
+            default:
+                valid = false;  // Never in the parser's output
+                break;
+        }
+
+        // Close the iterated expressions that end after this token; each
+        // is one value of the expression around it
+        while (valid && depth > 0 && frames[depth - 1].end == i + 1) {
+            valid = values == 1;
+            values = frames[--depth].values + 1;
+        }
+    }
+
+    calc_free(context, frames);
+    return valid && values == 1;
+}
+
+/**
+ * =======================================================================
+ *                                WRITER
+ * =======================================================================
+ */
+
+static int compare_formulas(const void *left, const void *right) {
+    const CalcFormula *const *a = left;
+    const CalcFormula *const *b = right;
+    return strcmp((*a)->name, (*b)->name);
+}
+
+/**
+ * Compile every formula, sorted by name, into `programs`
+ * @return: false (with an error message) on a duplicate name or a formula
+ *          that does not compile
+ */
+static bool compile_formulas(CalcContext *context,
+                             const CalcFormula *const *sorted,
+                             CalcProgram **programs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const char *name = sorted[i]->name;
+        if (name[0] == '\0') {
+            snprintf(context->last_error, sizeof(context->last_error),
+                     "Formula names must not be empty");
+            return false;
+        }
+        if (i > 0 && strcmp(name, sorted[i - 1]->name) == 0) {
+            snprintf(context->last_error, sizeof(context->last_error),
+                     "Duplicate formula name: %.64s", name);
+            return false;
+        }
+        programs[i] = calc_compile(context, sorted[i]->expression,
+                                   sorted[i]->variables,
+                                   sorted[i]->variable_count);
+        if (!programs[i]) {
+            char message[CALC_ERROR_SIZE];
+            memcpy(message, context->last_error, sizeof(message));
+            snprintf(context->last_error, sizeof(context->last_error),
+                     "Formula '%.32s': %.80s", name, message);
+            return false;
+        }
+
+        // calc_compile() leaves some malformed input ("1+") to evaluation;
+        // a library only stores formulas that calc_library_program() takes
+        LibraryEntry shape = {0};
+        shape.text_size = (uint32_t)strlen(programs[i]->expression) + 1;
+        shape.variable_count = (uint32_t)sorted[i]->variable_count;
+        if (!tokens_valid(context, programs[i]->code.data,
+                          programs[i]->code.top + 1, &shape)) {
+            snprintf(context->last_error, sizeof(context->last_error),
+                     "Formula '%.32s' is not a complete expression", name);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Lay out a library of compiled formulas: the header and the entries,
+ * without checksums
+ * @return: false (with an error message) if it would not fit the format's
+ *          32-bit offsets
+ */
+static bool lay_out(CalcContext *context, LibraryHeader *header,
+                    LibraryEntry *entries, const CalcFormula *const *sorted,
+                    CalcProgram *const *programs, size_t count) {
+    uint64_t strings = 0, variables = 0, tokens = 0;
+    for (size_t i = 0; i < count; i++) {
+        const CalcFormula *formula = sorted[i];
+        LibraryEntry *entry = &entries[i];
+        memset(entry, 0, sizeof(*entry));
+        entry->name = (uint32_t)strings;
+        strings += strlen(formula->name) + 1;
+        for (size_t v = 0; v < formula->variable_count; v++) {
+            strings += strlen(formula->variables[v]) + 1;
+        }
+        entry->text = (uint32_t)strings;
+        entry->text_size = (uint32_t)strlen(programs[i]->expression) + 1;
+        strings += entry->text_size;
+        entry->first_variable = (uint32_t)variables;
+        entry->variable_count = (uint32_t)formula->variable_count;
+        variables += formula->variable_count;
+        entry->first_token = (uint32_t)tokens;
+        entry->token_count = (uint32_t)(programs[i]->code.top + 1);
+        tokens += entry->token_count;
+        if (strings > UINT32_MAX || variables > UINT32_MAX ||
+            tokens > UINT32_MAX) {
+            snprintf(context->last_error, sizeof(context->last_error),
+                     "Formula library too large");
+            return false;
+        }
+    }
+
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, LIBRARY_MAGIC, sizeof(LIBRARY_MAGIC));
+    header->version = LIBRARY_VERSION;
+    header->byte_order = LIBRARY_BYTE_ORDER;
+    header->token_size = sizeof(Token);
+    header->token_types = TOK_INVALID + 1;
+    header->formula_count = (uint32_t)count;
+    header->variable_count = (uint32_t)variables;
+    header->entries = sizeof(LibraryHeader);
+    header->variables = header->entries + sizeof(LibraryEntry) * count;
+    header->tokens = (header->variables + sizeof(uint32_t) * variables + 7) &
+                     ~(uint64_t)7;
+    header->token_count = tokens;
+    header->strings = header->tokens + sizeof(Token) * tokens;
+    header->string_size = strings;
+    header->file_size = header->strings + strings;
+    if ((size_t)header->file_size != header->file_size) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Formula library too large");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Fill the sections of a laid-out library image and checksum them
+ */
+static void fill_image(unsigned char *image, const LibraryHeader *layout,
+                       const LibraryEntry *layout_entries,
+                       const CalcFormula *const *sorted,
+                       CalcProgram *const *programs, size_t count) {
+    LibraryHeader *header = (LibraryHeader *)image;
+    LibraryEntry *entries = (LibraryEntry *)(image + layout->entries);
+    uint32_t *variables = (uint32_t *)(image + layout->variables);
+    Token *tokens = (Token *)(image + layout->tokens);
+    char *strings = (char *)(image + layout->strings);
+
+    for (size_t i = 0; i < count; i++) {
+        const CalcFormula *formula = sorted[i];
+        LibraryEntry *entry = &entries[i];
+        *entry = layout_entries[i];
+
+        char *text = strings + entry->name;
+        size_t length = strlen(formula->name) + 1;
+        memcpy(text, formula->name, length);
+        for (size_t v = 0; v < formula->variable_count; v++) {
+            variables[entry->first_variable + v] =
+                (uint32_t)(text + length - strings);
+            text += length;
+            length = strlen(formula->variables[v]) + 1;
+            memcpy(text, formula->variables[v], length);
+        }
+        memcpy(strings + entry->text, programs[i]->expression,
+               entry->text_size);
+        for (uint32_t t = 0; t < entry->token_count; t++) {
+            normalize_token(&programs[i]->code.data[t],
+                            &tokens[entry->first_token + t]);
+        }
+        entry->checksum = entry_checksum(entry, tokens + entry->first_token,
+                                         variables + entry->first_variable,
+                                         strings + entry->name);
+    }
+    *header = *layout;
+    header->checksum = checksum_update(CHECKSUM_SEED, header, sizeof(*header));
+}
+
+/**
+ * Flush the directory entry of `path` after a rename, so the new name
+ * survives a crash as well as the data (POSIX; a no-op elsewhere)
+ */
+static void sync_directory(CalcContext *context, const char *path) {
+#ifndef _WIN32
+    const char *slash = strrchr(path, '/');
+    size_t length = slash ? (size_t)(slash - path) + 1 : 1;
+    char *directory = calc_realloc(context, NULL, length + 1);
+    if (!directory) return;
+    memcpy(directory, slash ? path : ".", length);
+    directory[length] = '\0';
+    int fd = open(directory, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);  // Best effort: some file systems refuse directories
+        close(fd);
+    }
+    calc_free(context, directory);
+#else
+    (void)context;
+    (void)path;
+#endif
+}
+
+/**
+ * Write a file under a temporary name, flush it to disk and rename it
+ * over `path`, so processes that have the old file mapped keep reading
+ * intact pages and a crash leaves either the old or the new library,
+ * never a truncated one
+ * @return: false (with an error message) on failure
+ */
+static bool replace_file(CalcContext *context, const char *path,
+                         const void *data, size_t size) {
+    size_t length = strlen(path);
+    char *temporary = calc_realloc(context, NULL, length + 5);
+    if (!temporary) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Out of memory");
+        return false;
+    }
+    memcpy(temporary, path, length);
+    memcpy(temporary + length, ".tmp", 5);
+
+    FILE *file = fopen(temporary, "wb");
+    bool written =
+        file && fwrite(data, 1, size, file) == size && fflush(file) == 0;
+#ifdef _WIN32
+    written = written && _commit(_fileno(file)) == 0;
+#else
+    written = written && fsync(fileno(file)) == 0;
+#endif
+    if (file && fclose(file) != 0) written = false;
+#ifdef _WIN32
+    if (written) remove(path);  // rename() does not replace on Windows
+#endif
+    bool success = written && rename(temporary, path) == 0;
+    if (success) sync_directory(context, path);
+    if (!success) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Cannot write %.64s: %s", path, strerror(errno));
+        if (file) remove(temporary);
+    }
+    calc_free(context, temporary);
+    return success;
+}
+
+bool calc_library_write(CalcContext *context, const char *path,
+                        const CalcFormula *formulas, size_t count) {
+    context->last_error[0] = '\0';
+    if (count > UINT32_MAX) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Formula library too large");
+        return false;
+    }
+
+    // Sorted by name, so that calc_library_find() can bisect
+    size_t slots = count ? count : 1;
+    const CalcFormula **sorted =
+        calc_realloc(context, NULL, sizeof(*sorted) * slots);
+    CalcProgram **programs =
+        calc_realloc(context, NULL, sizeof(*programs) * slots);
+    LibraryEntry *entries =
+        calc_realloc(context, NULL, sizeof(*entries) * slots);
+    bool success = sorted && programs && entries;
+    if (success) {
+        for (size_t i = 0; i < count; i++) {
+            sorted[i] = &formulas[i];
+            programs[i] = NULL;
+        }
+        qsort(sorted, count, sizeof(*sorted), compare_formulas);
+    } else {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Out of memory");
+    }
+
+    LibraryHeader header;
+    success = success && compile_formulas(context, sorted, programs, count) &&
+              lay_out(context, &header, entries, sorted, programs, count);
+    if (success) {
+        unsigned char *image =
+            calc_realloc(context, NULL, (size_t)header.file_size);
+        if (image) {
+            memset(image, 0, (size_t)header.file_size);
+            fill_image(image, &header, entries, sorted, programs, count);
+            success = replace_file(context, path, image,
+                                   (size_t)header.file_size);
+            calc_free(context, image);
+        } else {
+            snprintf(context->last_error, sizeof(context->last_error),
+                     "Out of memory");
+            success = false;
+        }
+    }
+
+    if (sorted && programs && entries) {
+        for (size_t i = 0; i < count; i++) calc_program_free(programs[i]);
+    }
+    calc_free(context, sorted);
+    calc_free(context, programs);
+    calc_free(context, entries);
+    return success;
+}
+
+/**
+ * =======================================================================
+ *                                READER
+ * =======================================================================
+ */
+
+/**
+ * Map a whole file read-only and shared
+ * @return: the mapping, or NULL (with an error message)
+ */
+static const void *map_file(CalcContext *context, const char *path,
+                            size_t *size) {
+    char *error = context->last_error;
+    size_t error_size = sizeof(context->last_error);
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        snprintf(error, error_size, "Cannot open %.64s", path);
+        return NULL;
+    }
+    LARGE_INTEGER length;
+    if (!GetFileSizeEx(file, &length) ||
+        (unsigned long long)length.QuadPart < sizeof(LibraryHeader) ||
+        (unsigned long long)length.QuadPart > SIZE_MAX) {
+        CloseHandle(file);
+        snprintf(error, error_size, "Not a formula library: %.64s", path);
+        return NULL;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    void *data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)
+                         : NULL;
+    if (mapping) CloseHandle(mapping);  // The view keeps it alive
+    CloseHandle(file);
+    if (!data) {
+        snprintf(error, error_size, "Cannot map %.64s", path);
+        return NULL;
+    }
+    *size = (size_t)length.QuadPart;
+    return data;
+#else
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0) {
+        snprintf(error, error_size, "Cannot open %.64s: %s", path,
+                 strerror(errno));
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(descriptor, &info) != 0 ||
+        (unsigned long long)info.st_size < sizeof(LibraryHeader) ||
+        (unsigned long long)info.st_size > SIZE_MAX) {
+        close(descriptor);
+        snprintf(error, error_size, "Not a formula library: %.64s", path);
+        return NULL;
+    }
+    void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED,
+                      descriptor, 0);
+    close(descriptor);  // The mapping keeps the file open
+    if (data == MAP_FAILED) {
+        snprintf(error, error_size, "Cannot map %.64s: %s", path,
+                 strerror(errno));
+        return NULL;
+    }
+    *size = (size_t)info.st_size;
+    return data;
+#endif
+}
+
+static void unmap_file(const void *data, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(data);
+#else
+    munmap((void *)data, size);
+#endif
+}
+
+/**
+ * Check a library header against this engine and the file size
+ * @return: true if valid, false (with an error message) otherwise
+ */
+static bool check_header(CalcContext *context, const char *path,
+                         const LibraryHeader *header, size_t size) {
+    char *error = context->last_error;
+    size_t error_size = sizeof(context->last_error);
+    if (memcmp(header->magic, LIBRARY_MAGIC, sizeof(LIBRARY_MAGIC)) != 0) {
+        snprintf(error, error_size, "Not a formula library: %.64s", path);
+        return false;
+    }
+    if (header->version != LIBRARY_VERSION ||
+        header->byte_order != LIBRARY_BYTE_ORDER ||
+        header->token_size != sizeof(Token) ||
+        header->token_types != TOK_INVALID + 1) {
+        snprintf(error, error_size,
+                 "Formula library %.64s is from an incompatible engine "
+                 "version",
+                 path);
+        return false;
+    }
+
+    LibraryHeader copy = *header;
+    copy.checksum = 0;
+    if (checksum_update(CHECKSUM_SEED, &copy, sizeof(copy)) !=
+            header->checksum ||
+        header->file_size != size ||
+        !section_fits(header->entries, header->formula_count,
+                      sizeof(LibraryEntry), size) ||
+        !section_fits(header->variables, header->variable_count,
+                      sizeof(uint32_t), size) ||
+        !section_fits(header->tokens, header->token_count, sizeof(Token),
+                      size) ||
+        !section_fits(header->strings, header->string_size, 1, size) ||
+        header->entries % 8 != 0 || header->variables % 4 != 0 ||
+        header->tokens % 8 != 0 ||
+        (header->string_size == 0 && header->formula_count > 0) ||
+        (header->string_size > 0 &&
+         ((const char *)header)[header->strings + header->string_size - 1] !=
+             '\0')) {
+        snprintf(error, error_size, "Formula library %.64s is corrupt", path);
+        return false;
+    }
+    return true;
+}
+
+CalcLibrary *calc_library_open(CalcContext *context, const char *path) {
+    context->last_error[0] = '\0';
+    size_t size = 0;
+    const unsigned char *data = map_file(context, path, &size);
+    if (!data) return NULL;
+
+    const LibraryHeader *header = (const LibraryHeader *)data;
+    if (!check_header(context, path, header, size)) {
+        unmap_file(data, size);
+        return NULL;
+    }
+    CalcLibrary *library = calc_realloc(context, NULL, sizeof(CalcLibrary));
+    if (!library) {
+        unmap_file(data, size);
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Out of memory");
+        return NULL;
+    }
+    library->allocator = context->options.allocator;
+    library->data = data;
+    library->size = size;
+    library->entries = (const LibraryEntry *)(data + header->entries);
+    library->count = header->formula_count;
+    library->variables = (const uint32_t *)(data + header->variables);
+    library->variable_count = header->variable_count;
+    library->tokens = (const Token *)(data + header->tokens);
+    library->token_count = (size_t)header->token_count;
+    library->strings = (const char *)(data + header->strings);
+    library->string_size = (size_t)header->string_size;
+    return library;
+}
+
+void calc_library_close(CalcLibrary *library) {
+    if (!library) return;
+    unmap_file(library->data, library->size);
+    calc_allocator_free(&library->allocator, library);
+}
+
+/**
+ * String at an offset of the strings section; "" if out of range (the
+ * section ends with a NUL, so every offset in range is terminated)
+ */
+static const char *library_string(const CalcLibrary *library,
+                                  uint32_t offset) {
+    return offset < library->string_size ? library->strings + offset : "";
+}
+
+size_t calc_library_count(const CalcLibrary *library) {
+    return library->count;
+}
+
+const char *calc_library_name(const CalcLibrary *library, size_t index) {
+    if (index >= library->count) return NULL;
+    return library_string(library, library->entries[index].name);
+}
+
+const char *calc_library_variable(const CalcLibrary *library, size_t index,
+                                  size_t variable) {
+    if (index >= library->count) return NULL;
+    const LibraryEntry *entry = &library->entries[index];
+    if (variable >= entry->variable_count ||
+        (size_t)entry->first_variable + variable >= library->variable_count) {
+        return NULL;
+    }
+    return library_string(library,
+                          library->variables[entry->first_variable + variable]);
+}
+
+size_t calc_library_find(const CalcLibrary *library, const char *name) {
+    size_t low = 0, high = library->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        int order = strcmp(
+            name, library_string(library, library->entries[middle].name));
+        if (order == 0) return middle;
+        if (order < 0) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    return library->count;
+}
+
+CalcProgram *calc_library_program(CalcContext *context,
+                                  const CalcLibrary *library, size_t index) {
+    context->last_error[0] = '\0';
+    if (index >= library->count) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "No formula %zu in the library", index);
+        return NULL;
+    }
+
+    // Bounds first, so the checksum only reads inside the mapping
+    const LibraryEntry *entry = &library->entries[index];
+    const char *name = library_string(library, entry->name);
+    bool valid =
+        entry->token_count > 0 && entry->token_count <= INT_MAX &&
+        (uint64_t)entry->first_token + entry->token_count <=
+            library->token_count &&
+        (uint64_t)entry->first_variable + entry->variable_count <=
+            library->variable_count &&
+        entry->text_size > 0 && entry->name <= entry->text &&
+        (uint64_t)entry->text + entry->text_size <= library->string_size &&
+        library->strings[entry->text + entry->text_size - 1] == '\0';
+    const Token *tokens = library->tokens + (valid ? entry->first_token : 0);
+    valid = valid && entry_checksum(entry, tokens,
+                                    library->variables + entry->first_variable,
+                                    library->strings + entry->name) ==
+                         entry->checksum;
+
+    size_t token_limit = context->options.limits.max_tokens;
+    if (valid && token_limit && entry->token_count > token_limit) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Expression has too many tokens (limit %zu)", token_limit);
+        return NULL;
+    }
+    if (!valid ||
+        !tokens_valid(context, tokens, (int)entry->token_count, entry)) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Formula '%.64s' in the library is corrupt", name);
+        return NULL;
+    }
+
+    CalcProgram *program = calc_realloc(context, NULL, sizeof(CalcProgram));
+    if (!program) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Out of memory");
+        return NULL;
+    }
+    program->allocator = context->options.allocator;
+    program->code.data = (Token *)tokens;  // Read-only; never written
+    program->code.top = (int)entry->token_count - 1;
+    program->code.capacity = (int)entry->token_count;
+    program->expression = library->strings + entry->text;
+    return program;
+}
@@ -0,0 +1,916 @@
+/**
+ * ========================================================================
+ *    LIBCALC - Vector and Matrix Evaluation
+ * ========================================================================
+ *
+ * Matrix literals list rows separated by ';' and elements by ',': [1, 2;
+ * 3, 4] is a 2x2 matrix, [1, 2, 3] a row vector and [1; 2; 3] a column
+ * vector. Elements may be expressions or matrices themselves ([A, B] joins
+ * side by side, [A; B] stacks). + - / ^ and the bitwise operators work
+ * element by element (a number applies to every element), * between two
+ * matrices is the matrix product, functions such as sqrt or sin map over
+ * the elements, aggregates read every element of every argument, and dot,
+ * det, inv, solve and transpose do linear algebra. 1x1 results are plain
+ * numbers.
+ *
+ * Only expressions with a matrix literal or a linear algebra function are
+ * evaluated here, in double precision; all others keep the scalar
+ * evaluators. Elements live in one arena per context that is used as a
+ * stack: the elements of every value follow those of the value below it,
+ * so an operation writes its result over its first operand (or computes
+ * it above the operands and moves it down), stacking rows costs nothing,
+ * and repeated evaluations reuse the arena without allocating.
+ *
+ * The product keeps a PRODUCT_BLOCK_K x PRODUCT_BLOCK_N panel of the right
+ * operand in L2 while four rows of the result are updated from it
+ * together; its inner loops are unit-stride and vectorize at gcc -O3.
+ * Small products skip the blocking. det, inv and solve use Gaussian
+ * elimination with partial pivoting, whose row updates are unit-stride as
+ * well; 2x2 and 3x3 determinants are computed directly.
+ */
+
+#include "calc_internal.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PRODUCT_BLOCK_K 128  // Rows of the right operand per panel
+#define PRODUCT_BLOCK_N 256  // Columns of the right operand per panel
+#define PRODUCT_SMALL 4096   // Products with rows*inner*columns below this
+                             // are not blocked
+#define TRANSPOSE_BLOCK 32   // Tile edge of the blocked transpose
+#define DOT_LANES 8          // Independent partial sums of dot()
+
+/**
+ * =======================================================================
+ *                            DATA STRUCTURES
+ * =======================================================================
+ */
+
+/**
+ * Value on the matrix evaluation stack; 1x1 values are numbers, kept in
+ * `scalar` instead of the arena
+ */
+typedef struct {
+    size_t rows;     // 1 for numbers and row vectors
+    size_t columns;  // 1 for numbers and column vectors
+    size_t offset;   // First arena element (where it would be for numbers)
+    double scalar;   // Value of a number
+} MatrixValue;
+
+/**
+ * Matrix evaluation stack - values plus the arena elements they use
+ */
+typedef struct {
+    CalcContext *context;  // Owner of the arena and the error buffer
+    MatrixValue *values;   // Stack of values
+    int top;               // Index of the top value (-1 if empty)
+    size_t used;           // Arena elements in use by the values
+} MatrixStack;
+
+/**
+ * =======================================================================
+ *                            ARRAY KERNELS
+ * =======================================================================
+ */
+
+MatrixFunction matrix_function(const char *name) {
+    if (strcmp(name, "dot") == 0) return MATRIX_DOT;
+    if (strcmp(name, "det") == 0) return MATRIX_DET;
+    if (strcmp(name, "inv") == 0) return MATRIX_INV;
+    if (strcmp(name, "solve") == 0) return MATRIX_SOLVE;
+    if (strcmp(name, "transpose") == 0) return MATRIX_TRANSPOSE;
+    return MATRIX_NONE;
+}
+
+void matrix_multiply(const double *left, const double *right, double *result,
+                     size_t rows, size_t inner, size_t columns) {
+    // Small products: one dot product per result element
+    if (rows * inner * columns < PRODUCT_SMALL) {
+        for (size_t i = 0; i < rows; i++) {
+            for (size_t j = 0; j < columns; j++) {
+                double sum = 0.0;
+                for (size_t p = 0; p < inner; p++) {
+                    sum += left[i * inner + p] * right[p * columns + j];
+                }
+                result[i * columns + j] = sum;
+            }
+        }
+        return;
+    }
+
+    memset(result, 0, sizeof(double) * rows * columns);
+    for (size_t k0 = 0; k0 < inner; k0 += PRODUCT_BLOCK_K) {
+        size_t k1 = k0 + PRODUCT_BLOCK_K < inner ? k0 + PRODUCT_BLOCK_K : inner;
+        for (size_t j0 = 0; j0 < columns; j0 += PRODUCT_BLOCK_N) {
+            size_t width = j0 + PRODUCT_BLOCK_N < columns
+                               ? PRODUCT_BLOCK_N
+                               : columns - j0;
+
+            // Four result rows share every load of the panel
+            size_t i = 0;
+            for (; i + 4 <= rows; i += 4) {
+                double *c0 = result + i * columns + j0;
+                double *c1 = c0 + columns;
+                double *c2 = c1 + columns;
+                double *c3 = c2 + columns;
+                for (size_t p = k0; p < k1; p++) {
+                    const double *b = right + p * columns + j0;
+                    double a0 = left[i * inner + p];
+                    double a1 = left[(i + 1) * inner + p];
+                    double a2 = left[(i + 2) * inner + p];
+                    double a3 = left[(i + 3) * inner + p];
+                    for (size_t j = 0; j < width; j++) {
+                        double x = b[j];
+                        c0[j] += a0 * x;
+                        c1[j] += a1 * x;
+                        c2[j] += a2 * x;
+                        c3[j] += a3 * x;
+                    }
+                }
+            }
+            for (; i < rows; i++) {
+                double *c = result + i * columns + j0;
+                for (size_t p = k0; p < k1; p++) {
+                    const double *b = right + p * columns + j0;
+                    double a = left[i * inner + p];
+                    for (size_t j = 0; j < width; j++) c[j] += a * b[j];
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Transpose a rows x columns matrix into `result` tile by tile, so both
+ * sides are read and written in cache-sized pieces
+ */
+static void transpose(const double *matrix, double *result, size_t rows,
+                      size_t columns) {
+    for (size_t i0 = 0; i0 < rows; i0 += TRANSPOSE_BLOCK) {
+        size_t i1 = i0 + TRANSPOSE_BLOCK < rows ? i0 + TRANSPOSE_BLOCK : rows;
+        for (size_t j0 = 0; j0 < columns; j0 += TRANSPOSE_BLOCK) {
+            size_t j1 = j0 + TRANSPOSE_BLOCK < columns ? j0 + TRANSPOSE_BLOCK
+                                                       : columns;
+            for (size_t i = i0; i < i1; i++) {
+                for (size_t j = j0; j < j1; j++) {
+                    result[j * rows + i] = matrix[i * columns + j];
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Dot product in DOT_LANES independent partial sums
+ */
+static double dot_product(const double *left, const double *right,
+                          size_t count) {
+    double lanes[DOT_LANES] = {0.0};
+    size_t i = 0;
+    for (; i + DOT_LANES <= count; i += DOT_LANES) {
+        for (int lane = 0; lane < DOT_LANES; lane++) {
+            lanes[lane] += left[i + lane] * right[i + lane];
+        }
+    }
+    double sum = 0.0;
+    for (int lane = 0; lane < DOT_LANES; lane++) sum += lanes[lane];
+    for (; i < count; i++) sum += left[i] * right[i];
+    return sum;
+}
+
+/**
+ * Exchange two rows of a matrix `width` elements wide
+ */
+static void swap_rows(double *matrix, size_t width, size_t first,
+                      size_t second) {
+    double *a = matrix + first * width;
+    double *b = matrix + second * width;
+    for (size_t j = 0; j < width; j++) {
+        double swap = a[j];
+        a[j] = b[j];
+        b[j] = swap;
+    }
+}
+
+/**
+ * Reduce the n x n matrix `a` to upper triangular form by Gaussian
+ * elimination with partial pivoting, applying the same row operations to
+ * the n x width matrix `b` (if width > 0)
+ * @param determinant: receives the determinant of `a` (may be NULL)
+ * @return: false if a column has no nonzero pivot (`a` is singular)
+ */
+static bool eliminate(double *a, double *b, size_t n, size_t width,
+                      double *determinant) {
+    double product = 1.0;
+    for (size_t column = 0; column < n; column++) {
+        // Largest remaining entry of the column as the pivot
+        size_t pivot = column;
+        for (size_t row = column + 1; row < n; row++) {
+            if (fabs(a[row * n + column]) > fabs(a[pivot * n + column])) {
+                pivot = row;
+            }
+        }
+        if (a[pivot * n + column] == 0.0) {
+            if (determinant) *determinant = 0.0;
+            return false;
+        }
+        if (pivot != column) {
+            swap_rows(a, n, pivot, column);
+            if (width > 0) swap_rows(b, width, pivot, column);
+            product = -product;
+        }
+
+        const double *pivot_row = a + column * n;
+        const double *pivot_b = b + column * width;
+        product *= pivot_row[column];
+        for (size_t row = column + 1; row < n; row++) {
+            double *target = a + row * n;
+            double factor = target[column] / pivot_row[column];
+            if (factor == 0.0) continue;
+            target[column] = 0.0;
+            for (size_t j = column + 1; j < n; j++) {
+                target[j] -= factor * pivot_row[j];
+            }
+            double *target_b = b + row * width;
+            for (size_t j = 0; j < width; j++) {
+                target_b[j] -= factor * pivot_b[j];
+            }
+        }
+    }
+    if (determinant) *determinant = product;
+    return true;
+}
+
+/**
+ * Solve the upper triangular system left by eliminate() for all `width`
+ * columns of `b` at once, in place
+ */
+static void back_substitute(const double *a, double *b, size_t n,
+                            size_t width) {
+    for (size_t i = n; i-- > 0;) {
+        double *row = b + i * width;
+        for (size_t j = i + 1; j < n; j++) {
+            double factor = a[i * n + j];
+            if (factor == 0.0) continue;
+            const double *solved = b + j * width;
+            for (size_t q = 0; q < width; q++) row[q] -= factor * solved[q];
+        }
+        double pivot = a[i * n + i];
+        for (size_t q = 0; q < width; q++) row[q] /= pivot;
+    }
+}
+
+/**
+ * Check the pivots left by eliminate() against the rounding error of the
+ * elimination: a pivot within n ulps of the largest entry of the original
+ * matrix may be a rounded zero, so the system is treated as singular
+ */
+static bool pivots_significant(const double *a, size_t n, double largest) {
+    double threshold = (double)n * DBL_EPSILON * largest;
+    for (size_t i = 0; i < n; i++) {
+        if (!(fabs(a[i * n + i]) > threshold)) return false;
+    }
+    return true;
+}
+
+/**
+ * Largest magnitude among `count` elements
+ */
+static double largest_magnitude(const double *values, size_t count) {
+    double largest = 0.0;
+    for (size_t i = 0; i < count; i++) {
+        double magnitude = fabs(values[i]);
+        if (magnitude > largest) largest = magnitude;
+    }
+    return largest;
+}
+
+/**
+ * =======================================================================
+ *                        MATRIX EVALUATION STACK
+ * =======================================================================
+ */
+
+static bool is_number(const MatrixValue *value) {
+    return value->rows == 1 && value->columns == 1;
+}
+
+/**
+ * Elements of a value (its `scalar` for numbers); valid until the arena
+ * grows
+ */
+static double *elements(MatrixStack *stack, MatrixValue *value) {
+    return is_number(value) ? &value->scalar
+                            : stack->context->matrix_arena + value->offset;
+}
+
+/**
+ * Make room for `count` elements above those in use
+ * @return: the first of them, or NULL (with an error message)
+ */
+static double *reserve_above(MatrixStack *stack, size_t count) {
+    if (count > SIZE_MAX / sizeof(double) - stack->used) {
+        snprintf(stack->context->last_error,
+                 sizeof(stack->context->last_error), "Out of memory");
+        return NULL;
+    }
+    double *arena = reserve_matrix_arena(stack->context, stack->used + count);
+    return arena ? arena + stack->used : NULL;
+}
+
+/**
+ * Push a number
+ */
+static void push_number(MatrixStack *stack, double value) {
+    MatrixValue *pushed = &stack->values[++stack->top];
+    pushed->rows = 1;
+    pushed->columns = 1;
+    pushed->offset = stack->used;
+    pushed->scalar = value;
+}
+
+/**
+ * Replace the top `count` values with a number
+ */
+static void replace_with_number(MatrixStack *stack, int count, double value) {
+    stack->top -= count;
+    stack->used = stack->values[stack->top + 1].offset;
+    push_number(stack, value);
+}
+
+/**
+ * Replace the top `count` values with a rows x columns result whose
+ * elements start at arena index `source`, moving them down over the
+ * elements of the replaced values
+ */
+static void replace_with_matrix(MatrixStack *stack, int count, size_t rows,
+                                size_t columns, size_t source) {
+    double *arena = stack->context->matrix_arena;
+    if (rows * columns == 1) {
+        replace_with_number(stack, count, arena[source]);
+        return;
+    }
+    stack->top -= count - 1;
+    MatrixValue *result = &stack->values[stack->top];
+    if (source != result->offset) {
+        memmove(arena + result->offset, arena + source,
+                sizeof(double) * rows * columns);
+    }
+    result->rows = rows;
+    result->columns = columns;
+    stack->used = result->offset + rows * columns;
+}
+
+/**
+ * Report two operands whose shapes do not fit together
+ */
+static bool dimension_error(MatrixStack *stack, const char *what,
+                            const MatrixValue *left,
+                            const MatrixValue *right) {
+    snprintf(stack->context->last_error, sizeof(stack->context->last_error),
+             "Matrix dimensions do not match%s (%zux%zu and %zux%zu)", what,
+             left->rows, left->columns, right->rows, right->columns);
+    return false;
+}
+
+/**
+ * =======================================================================
+ *                      LITERALS AND OPERATORS
+ * =======================================================================
+ */
+
+/**
+ * Join the top `count` values side by side (one row of a literal); they
+ * must have the same number of rows
+ */
+static bool join_row(MatrixStack *stack, int count) {
+    MatrixValue *first = &stack->values[stack->top - count + 1];
+    size_t rows = first->rows;
+    size_t columns = 0;
+    for (int i = 0; i < count; i++) {
+        if (first[i].rows != rows) {
+            return dimension_error(stack, " in a row", &first[0], &first[i]);
+        }
+        columns += first[i].columns;
+    }
+    if (count == 1) return true;
+
+    size_t source = stack->used;
+    double *result = reserve_above(stack, rows * columns);
+    if (!result) return false;
+    for (size_t row = 0; row < rows; row++) {
+        for (int i = 0; i < count; i++) {
+            size_t width = first[i].columns;
+            memcpy(result, elements(stack, &first[i]) + row * width,
+                   sizeof(double) * width);
+            result += width;
+        }
+    }
+    replace_with_matrix(stack, count, rows, columns, source);
+    return true;
+}
+
+/**
+ * Stack the top `count` rows of a literal; they must have the same number
+ * of columns
+ */
+static bool stack_rows(MatrixStack *stack, int count) {
+    MatrixValue *first = &stack->values[stack->top - count + 1];
+    size_t columns = first->columns;
+    size_t rows = 0;
+    bool numbers = false;
+    for (int i = 0; i < count; i++) {
+        if (first[i].columns != columns) {
+            return dimension_error(stack, " between rows", &first[0],
+                                   &first[i]);
+        }
+        rows += first[i].rows;
+        numbers = numbers || is_number(&first[i]);
+    }
+
+    // Matrices lie one after another in the arena, already stacked
+    if (!numbers) {
+        first->rows = rows;
+        stack->top -= count - 1;
+        return true;
+    }
+
+    size_t source = stack->used;
+    double *result = reserve_above(stack, rows * columns);
+    if (!result) return false;
+    for (int i = 0; i < count; i++) {
+        size_t size = first[i].rows * columns;
+        memcpy(result, elements(stack, &first[i]), sizeof(double) * size);
+        result += size;
+    }
+    replace_with_matrix(stack, count, rows, columns, source);
+    return true;
+}
+
+/**
+ * + - and * with a number, element by element over count elements;
+ * `out` may be either operand
+ */
+static void elementwise_arithmetic(char op, const double *left,
+                                   bool left_number, const double *right,
+                                   bool right_number, double *out,
+                                   size_t count) {
+    double x = left[0];
+    double y = right[0];
+    switch (op) {
+        case '+':
+            if (left_number) {
+                for (size_t i = 0; i < count; i++) out[i] = x + right[i];
+            } else if (right_number) {
+                for (size_t i = 0; i < count; i++) out[i] = left[i] + y;
+            } else {
+                for (size_t i = 0; i < count; i++) out[i] = left[i] + right[i];
+            }
+            break;
+        case '-':
+            if (left_number) {
+                for (size_t i = 0; i < count; i++) out[i] = x - right[i];
+            } else if (right_number) {
+                for (size_t i = 0; i < count; i++) out[i] = left[i] - y;
+            } else {
+                for (size_t i = 0; i < count; i++) out[i] = left[i] - right[i];
+            }
+            break;
+        default:  // '*' with at least one number
+            if (left_number) {
+                for (size_t i = 0; i < count; i++) out[i] = x * right[i];
+            } else {
+                for (size_t i = 0; i < count; i++) out[i] = left[i] * y;
+            }
+            break;
+    }
+}
+
+/**
+ * Matrix product of the top two values
+ */
+static bool matrix_product(MatrixStack *stack) {
+    MatrixValue *left = &stack->values[stack->top - 1];
+    MatrixValue *right = &stack->values[stack->top];
+    if (left->columns != right->rows) {
+        return dimension_error(stack, " for product", left, right);
+    }
+    size_t rows = left->rows;
+    size_t columns = right->columns;
+    if (rows > SIZE_MAX / columns) {
+        snprintf(stack->context->last_error,
+                 sizeof(stack->context->last_error), "Out of memory");
+        return false;
+    }
+
+    size_t source = stack->used;
+    double *result = reserve_above(stack, rows * columns);
+    if (!result) return false;
+    matrix_multiply(elements(stack, left), elements(stack, right), result,
+                    rows, left->columns, columns);
+    replace_with_matrix(stack, 2, rows, columns, source);
+    return true;
+}
+
+/**
+ * Apply an operator to the top two values: the matrix product for * of
+ * two matrices, otherwise element by element
+ */
+static bool matrix_operator(MatrixStack *stack, char op) {
+    CalcContext *context = stack->context;
+    if (stack->top < 1) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Not enough operands for operator");
+        return false;
+    }
+    MatrixValue *left = &stack->values[stack->top - 1];
+    MatrixValue *right = &stack->values[stack->top];
+    bool left_number = is_number(left);
+    bool right_number = is_number(right);
+
+    if (left_number && right_number) {
+        double result;
+        if (!apply_scalar_operator(context, op, left->scalar, right->scalar,
+                                   &result)) {
+            return false;
+        }
+        replace_with_number(stack, 2, result);
+        return true;
+    }
+    if (op == '*' && !left_number && !right_number) {
+        return matrix_product(stack);
+    }
+    if (!left_number && !right_number &&
+        (left->rows != right->rows || left->columns != right->columns)) {
+        return dimension_error(stack, "", left, right);
+    }
+
+    // The result overwrites the matrix operand (the left one if both are),
+    // whose elements start where the left operand's would
+    const MatrixValue *shape = left_number ? right : left;
+    size_t rows = shape->rows;
+    size_t columns = shape->columns;
+    size_t count = rows * columns;
+    const double *a = elements(stack, left);
+    const double *b = elements(stack, right);
+    double *out = context->matrix_arena + left->offset;
+
+    if (op == '+' || op == '-' || op == '*') {
+        elementwise_arithmetic(op, a, left_number, b, right_number, out,
+                               count);
+    } else {
+        double x = a[0];
+        double y = b[0];
+        for (size_t i = 0; i < count; i++) {
+            if (!apply_scalar_operator(context, op, left_number ? x : a[i],
+                                       right_number ? y : b[i], &out[i])) {
+                return false;
+            }
+        }
+    }
+
+    stack->top--;
+    left->rows = rows;
+    left->columns = columns;
+    stack->used = left->offset + count;
+    return true;
+}
+
+/**
+ * =======================================================================
+ *                              FUNCTIONS
+ * =======================================================================
+ */
+
+/**
+ * Aggregate over every element of the top `count` values; percentile's
+ * first argument must be a number
+ */
+static bool matrix_aggregate(MatrixStack *stack, AggregateFunction function,
+                             int count) {
+    CalcContext *context = stack->context;
+    MatrixValue *first = &stack->values[stack->top - count + 1];
+    if (function == AGGREGATE_PERCENTILE && count > 0 && !is_number(first)) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Percentile must be a number");
+        return false;
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < count; i++) {
+        total += first[i].rows * first[i].columns;
+    }
+    double *values = reserve_number_scratch(context, total ? total : 1);
+    if (!values) return false;
+    size_t position = 0;
+    for (int i = 0; i < count; i++) {
+        size_t size = first[i].rows * first[i].columns;
+        memcpy(values + position, elements(stack, &first[i]),
+               sizeof(double) * size);
+        position += size;
+    }
+
+    double result;
+    if (!aggregate_values(context, function, values, total, &result)) {
+        return false;
+    }
+    replace_with_number(stack, count, result);
+    return true;
+}
+
+/**
+ * dot(u, v) of two vectors (rows or columns) with as many elements
+ */
+static bool matrix_dot(MatrixStack *stack) {
+    MatrixValue *left = &stack->values[stack->top - 1];
+    MatrixValue *right = &stack->values[stack->top];
+    if ((left->rows != 1 && left->columns != 1) ||
+        (right->rows != 1 && right->columns != 1)) {
+        snprintf(stack->context->last_error,
+                 sizeof(stack->context->last_error),
+                 "Function 'dot' needs vectors");
+        return false;
+    }
+    size_t count = left->rows * left->columns;
+    if (count != right->rows * right->columns) {
+        return dimension_error(stack, " for dot", left, right);
+    }
+    double result =
+        dot_product(elements(stack, left), elements(stack, right), count);
+    replace_with_number(stack, 2, result);
+    return true;
+}
+
+/**
+ * Report a matrix that needed to be square
+ */
+static bool require_square(MatrixStack *stack, const MatrixValue *value) {
+    if (value->rows == value->columns) return true;
+    snprintf(stack->context->last_error, sizeof(stack->context->last_error),
+             "Matrix is not square (%zux%zu)", value->rows, value->columns);
+    return false;
+}
+
+/**
+ * det(A) of a square matrix
+ */
+static bool matrix_determinant(MatrixStack *stack) {
+    MatrixValue *value = &stack->values[stack->top];
+    if (!require_square(stack, value)) return false;
+    size_t n = value->rows;
+    const double *a = elements(stack, value);
+
+    double determinant;
+    if (n == 1) {
+        determinant = a[0];
+    } else if (n == 2) {
+        determinant = a[0] * a[3] - a[1] * a[2];
+    } else if (n == 3) {
+        determinant = a[0] * (a[4] * a[8] - a[5] * a[7]) -
+                      a[1] * (a[3] * a[8] - a[5] * a[6]) +
+                      a[2] * (a[3] * a[7] - a[4] * a[6]);
+    } else {
+        double *copy = reserve_above(stack, n * n);
+        if (!copy) return false;
+        memcpy(copy, elements(stack, value), sizeof(double) * n * n);
+        eliminate(copy, NULL, n, 0, &determinant);
+    }
+    replace_with_number(stack, 1, determinant);
+    return true;
+}
+
+/**
+ * Report a matrix without an inverse
+ */
+static bool singular_error(MatrixStack *stack) {
+    snprintf(stack->context->last_error, sizeof(stack->context->last_error),
+             "Matrix is singular");
+    return false;
+}
+
+/**
+ * inv(A) of a square, nonsingular matrix
+ */
+static bool matrix_inverse(MatrixStack *stack) {
+    MatrixValue *value = &stack->values[stack->top];
+    if (!require_square(stack, value)) return false;
+    size_t n = value->rows;
+
+    // A copy of A, then the identity that becomes the inverse
+    size_t source = stack->used;
+    double *a = reserve_above(stack, 2 * n * n);
+    if (!a) return false;
+    double *b = a + n * n;
+    memcpy(a, elements(stack, value), sizeof(double) * n * n);
+    memset(b, 0, sizeof(double) * n * n);
+    for (size_t i = 0; i < n; i++) b[i * n + i] = 1.0;
+
+    double largest = largest_magnitude(a, n * n);
+    if (!eliminate(a, b, n, n, NULL) || !pivots_significant(a, n, largest)) {
+        return singular_error(stack);
+    }
+    back_substitute(a, b, n, n);
+    replace_with_matrix(stack, 1, n, n, source + n * n);
+    return true;
+}
+
+/**
+ * solve(A, B): X with A X = B for a square, nonsingular A and B with as
+ * many rows (or a row vector with as many elements, solved as a column)
+ */
+static bool matrix_solve(MatrixStack *stack) {
+    MatrixValue *matrix = &stack->values[stack->top - 1];
+    MatrixValue *right_side = &stack->values[stack->top];
+    if (!require_square(stack, matrix)) return false;
+    size_t n = matrix->rows;
+    size_t width;
+    if (right_side->rows == n) {
+        width = right_side->columns;
+    } else if (right_side->rows == 1 && right_side->columns == n) {
+        width = 1;  // Same elements as the column vector
+    } else {
+        return dimension_error(stack, " for solve", matrix, right_side);
+    }
+
+    size_t source = stack->used;
+    double *a = reserve_above(stack, n * n + n * width);
+    if (!a) return false;
+    double *b = a + n * n;
+    memcpy(a, elements(stack, matrix), sizeof(double) * n * n);
+    memcpy(b, elements(stack, right_side), sizeof(double) * n * width);
+
+    double largest = largest_magnitude(a, n * n);
+    if (!eliminate(a, b, n, width, NULL) ||
+        !pivots_significant(a, n, largest)) {
+        return singular_error(stack);
+    }
+    back_substitute(a, b, n, width);
+    replace_with_matrix(stack, 2, right_side->rows, right_side->columns,
+                        source + n * n);
+    return true;
+}
+
+/**
+ * transpose(A); vectors only change orientation
+ */
+static bool matrix_transpose(MatrixStack *stack) {
+    MatrixValue *value = &stack->values[stack->top];
+    size_t rows = value->rows;
+    size_t columns = value->columns;
+    if (rows == 1 || columns == 1) {
+        value->rows = columns;
+        value->columns = rows;
+        return true;
+    }
+
+    size_t source = stack->used;
+    double *result = reserve_above(stack, rows * columns);
+    if (!result) return false;
+    transpose(elements(stack, value), result, rows, columns);
+    replace_with_matrix(stack, 1, columns, rows, source);
+    return true;
+}
+
+/**
+ * Apply a function token to the values on top of the stack
+ */
+static bool matrix_call(MatrixStack *stack, const Token *token) {
+    CalcContext *context = stack->context;
+    if (stack->top < 0) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Function '%s' requires an argument", token->function);
+        return false;
+    }
+
+    AggregateFunction aggregate = aggregate_function(token->function);
+    if (aggregate != AGGREGATE_NONE) {
+        int count = token->arguments <= stack->top + 1 ? token->arguments : 0;
+        return matrix_aggregate(stack, aggregate, count);
+    }
+
+    MatrixFunction function = matrix_function(token->function);
+    if ((function == MATRIX_DOT || function == MATRIX_SOLVE) &&
+        stack->top < 1) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Function '%s' takes two arguments", token->function);
+        return false;
+    }
+    switch (function) {
+        case MATRIX_DOT:
+            return matrix_dot(stack);
+        case MATRIX_DET:
+            return matrix_determinant(stack);
+        case MATRIX_INV:
+            return matrix_inverse(stack);
+        case MATRIX_SOLVE:
+            return matrix_solve(stack);
+        case MATRIX_TRANSPOSE:
+            return matrix_transpose(stack);
+        default:
+            break;
+    }
+
+    // Everything else maps over the elements, in place
+    MatrixValue *value = &stack->values[stack->top];
+    double *values = elements(stack, value);
+    size_t count = value->rows * value->columns;
+    if (count > 1 && strcmp(token->function, "sin") == 0) {
+        calc_sin_degrees_batch(values, values, count);
+        return true;
+    }
+    if (count > 1 && strcmp(token->function, "cos") == 0) {
+        calc_cos_degrees_batch(values, values, count);
+        return true;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (!apply_scalar_function(context, token->function, values[i],
+                                   &values[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * =======================================================================
+ *                              EVALUATOR
+ * =======================================================================
+ */
+
+bool uses_matrices(const TokenStack *rpn_tokens) {
+    for (int i = 0; i <= rpn_tokens->top; i++) {
+        const Token *token = &rpn_tokens->data[i];
+        if (token->type == TOK_ROW || token->type == TOK_MATRIX ||
+            (token->type == TOK_FUNCTION &&
+             matrix_function(token->function) != MATRIX_NONE)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool evaluate_rpn_matrix(CalcContext *context, const TokenStack *rpn_tokens,
+                         CalcValue *result) {
+    MatrixStack stack;
+    stack.context = context;
+    stack.values = reserve_value_stack(
+        context, sizeof(MatrixValue) * (size_t)(rpn_tokens->top + 2));
+    if (!stack.values) return false;
+    stack.top = -1;
+    stack.used = 0;
+
+    for (int i = 0; i <= rpn_tokens->top; i++) {
+        const Token *token = &rpn_tokens->data[i];
+        bool success = true;
+
+        switch (token->type) {
+            case TOK_NUMBER:
+                push_number(&stack, token->value);
+                break;
+            case TOK_VARIABLE:
+                push_number(&stack,
+                            context->variable_values[token->variable]);
+                break;
+            case TOK_OPERATOR:
+                success = matrix_operator(&stack, token->operator);
+                break;
+            case TOK_FUNCTION:
+                success = matrix_call(&stack, token);
+                break;
+            case TOK_ROW:
+                success = join_row(&stack, token->arguments);
+                break;
+            case TOK_MATRIX:
+                success = stack_rows(&stack, token->arguments);
+                break;
+            default:
+                break;  // Ignore other token types
+        }
+        if (!success) return false;
+    }
+
+    // Should have exactly one value left on stack
+    if (stack.top != 0) {
+        snprintf(context->last_error, sizeof(context->last_error),
+                 "Invalid expression syntax");
+        return false;
+    }
+
+    const MatrixValue *value = &stack.values[0];
+    result->numerator = 0;
+    result->denominator = 1;
+    if (is_number(value)) {
+        result->type = CALC_VALUE_REAL;
+        result->real = value->scalar;
+        return true;
+    }
+    result->type = CALC_VALUE_MATRIX;
+    result->real = NAN;
+    context->matrix_rows = value->rows;  // Elements start the arena
+    context->matrix_columns = value->columns;
+    return true;
+}
@@ -0,0 +1,150 @@
+/**
+ * ========================================================================
+ *    LIBCALC - Hot-Path Instrumentation (Phase Counters and Histograms)
+ * ========================================================================
+ */
+
+#define _POSIX_C_SOURCE 199309L  // clock_gettime()
+
+#include "calc_perf.h"
+
+#ifdef CALC_ENABLE_PERF
+
+#include <stdatomic.h>
+#include <time.h>
+
+// Histogram layout: values below 2^SUB_BITS get exact buckets; above
+// that, every power of two is split into 2^SUB_BITS linear sub-buckets,
+// giving ~6% relative precision from 1 ns up to UINT64_MAX
+#define PERF_SUB_BITS 4
+#define PERF_SUB_BUCKETS (1 << PERF_SUB_BITS)
+#define PERF_BUCKETS ((64 - PERF_SUB_BITS + 1) * PERF_SUB_BUCKETS)
+
+/**
+ * Counters and latency histogram of one phase
+ */
+typedef struct {
+    atomic_uint_least64_t count;     // Samples recorded
+    atomic_uint_least64_t total_ns;  // Sum of all samples
+    atomic_uint_least64_t max_ns;    // Largest sample
+    atomic_uint_least64_t buckets[PERF_BUCKETS];  // Log-linear histogram
+} PerfPhaseStats;
+
+static PerfPhaseStats perf_stats[CALC_PERF_PHASE_COUNT];
+
+static const char *perf_phase_names[CALC_PERF_PHASE_COUNT] = {
+    "lex", "rpn", "eval", "format", "display"};
+
+/**
+ * Map a sample to its histogram bucket
+ */
+static int perf_bucket_index(uint64_t value) {
+    if (value < PERF_SUB_BUCKETS) return (int)value;
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - PERF_SUB_BITS;
+    return (shift + 1) * PERF_SUB_BUCKETS +
+           (int)((value >> shift) & (PERF_SUB_BUCKETS - 1));
+}
+
+/**
+ * Smallest value that falls into a bucket
+ */
+static uint64_t perf_bucket_value(int index) {
+    if (index < PERF_SUB_BUCKETS) return (uint64_t)index;
+    int shift = index / PERF_SUB_BUCKETS - 1;
+    uint64_t sub = (uint64_t)(index % PERF_SUB_BUCKETS);
+    return (PERF_SUB_BUCKETS + sub) << shift;
+}
+
+/**
+ * Value at a percentile (0-100) of a phase's histogram
+ */
+static uint64_t perf_percentile(PerfPhaseStats *stats, uint64_t count,
+                                double percentile) {
+    if (count == 0) return 0;
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)count);
+    if (rank >= count) rank = count - 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < PERF_BUCKETS; i++) {
+        seen += atomic_load_explicit(&stats->buckets[i], memory_order_relaxed);
+        if (seen > rank) return perf_bucket_value(i);
+    }
+    return atomic_load_explicit(&stats->max_ns, memory_order_relaxed);
+}
+
+uint64_t calc_perf_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void calc_perf_record(CalcPerfPhase phase, uint64_t nanoseconds) {
+    PerfPhaseStats *stats = &perf_stats[phase];
+    atomic_fetch_add_explicit(&stats->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->total_ns, nanoseconds,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->buckets[perf_bucket_index(nanoseconds)],
+                              1, memory_order_relaxed);
+
+    uint64_t max = atomic_load_explicit(&stats->max_ns, memory_order_relaxed);
+    while (nanoseconds > max &&
+           !atomic_compare_exchange_weak_explicit(&stats->max_ns, &max,
+                                                  nanoseconds,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+    }
+}
+
+void calc_perf_report(char *buffer, size_t size) {
+    size_t used = 0;
+    used += snprintf(buffer + used, size - used,
+                     "%-10s %10s %9s %9s %9s %9s %9s %9s\n", "phase (ns)",
+                     "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+
+    for (int phase = 0; phase < CALC_PERF_PHASE_COUNT && used < size;
+         phase++) {
+        PerfPhaseStats *stats = &perf_stats[phase];
+        uint64_t count =
+            atomic_load_explicit(&stats->count, memory_order_relaxed);
+        uint64_t total =
+            atomic_load_explicit(&stats->total_ns, memory_order_relaxed);
+        used += snprintf(
+            buffer + used, size - used,
+            "%-10s %10llu %9.0f %9llu %9llu %9llu %9llu %9llu\n",
+            perf_phase_names[phase], (unsigned long long)count,
+            count ? (double)total / (double)count : 0.0,
+            (unsigned long long)perf_percentile(stats, count, 50.0),
+            (unsigned long long)perf_percentile(stats, count, 90.0),
+            (unsigned long long)perf_percentile(stats, count, 99.0),
+            (unsigned long long)perf_percentile(stats, count, 99.9),
+            (unsigned long long)atomic_load_explicit(&stats->max_ns,
+                                                     memory_order_relaxed));
+    }
+}
+
+void calc_perf_dump(FILE *stream) {
+    char report[2048];
+    calc_perf_report(report, sizeof(report));
+    fputs(report, stream);
+    fflush(stream);
+}
+
+void calc_perf_reset(void) {
+    for (int phase = 0; phase < CALC_PERF_PHASE_COUNT; phase++) {
+        PerfPhaseStats *stats = &perf_stats[phase];
+        atomic_store_explicit(&stats->count, 0, memory_order_relaxed);
+        atomic_store_explicit(&stats->total_ns, 0, memory_order_relaxed);
+        atomic_store_explicit(&stats->max_ns, 0, memory_order_relaxed);
+        for (int i = 0; i < PERF_BUCKETS; i++) {
+            atomic_store_explicit(&stats->buckets[i], 0, memory_order_relaxed);
+        }
+    }
+}
+
+#else
+
+// ISO C forbids an empty translation unit
+typedef int calc_perf_disabled;
+
+#endif  // CALC_ENABLE_PERF
@@ -0,0 +1,88 @@
+/**
+ * ========================================================================
+ *    LIBCALC - Hot-Path Instrumentation (Phase Counters and Histograms)
+ * ========================================================================
+ *
+ * Per-phase counters and log-linear (HDR-style) latency histograms for
+ * lexing, RPN conversion, evaluation, result formatting and display
+ * updates. Instrumentation only exists when compiled with
+ * -DCALC_ENABLE_PERF; otherwise every CALC_PERF_* macro expands to
+ * nothing and the library contains no timing code at all.
+ *
+ * Recording is lock-free (relaxed atomics), so any thread may record.
+ */
+
+#ifndef LIBCALC_CALC_PERF_H
+#define LIBCALC_CALC_PERF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Instrumented phases, from button press to display update
+ */
+typedef enum {
+    CALC_PERF_LEX,      // get_next_token() calls of one expression
+    CALC_PERF_RPN,      // convert_to_rpn() excluding lexing
+    CALC_PERF_EVAL,     // RPN evaluation
+    CALC_PERF_FORMAT,   // Formatting the result for display
+    CALC_PERF_DISPLAY,  // update_display()
+    CALC_PERF_PHASE_COUNT
+} CalcPerfPhase;
+
+#ifdef CALC_ENABLE_PERF
+
+/**
+ * Monotonic timestamp in nanoseconds
+ */
+uint64_t calc_perf_now(void);
+
+/**
+ * Add one sample (in nanoseconds) to a phase
+ */
+void calc_perf_record(CalcPerfPhase phase, uint64_t nanoseconds);
+
+/**
+ * Format a table of count, mean and percentiles for every phase
+ */
+void calc_perf_report(char *buffer, size_t size);
+
+/**
+ * Write the report to a stream
+ */
+void calc_perf_dump(FILE *stream);
+
+/**
+ * Clear all counters and histograms
+ */
+void calc_perf_reset(void);
+
+#define CALC_PERF_BEGIN(start) uint64_t start = calc_perf_now()
+#define CALC_PERF_END(phase, start) \
+    calc_perf_record((phase), calc_perf_now() - (start))
+#define CALC_PERF_COUNTER(total) uint64_t total = 0
+#define CALC_PERF_ACCUMULATE(total, start) \
+    ((total) += calc_perf_now() - (start))
+#define CALC_PERF_RECORD(phase, nanoseconds) \
+    calc_perf_record((phase), (nanoseconds))
+
+#else
+
+#define CALC_PERF_BEGIN(start) ((void)0)
+#define CALC_PERF_END(phase, start) ((void)0)
+#define CALC_PERF_COUNTER(total) ((void)0)
+#define CALC_PERF_ACCUMULATE(total, start) ((void)0)
+#define CALC_PERF_RECORD(phase, nanoseconds) ((void)0)
+
+#endif  // CALC_ENABLE_PERF
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // LIBCALC_CALC_PERF_H
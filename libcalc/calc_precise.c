@@ -0,0 +1,1292 @@
+/**
+ * ========================================================================
+ *    LIBCALC - Precision Control (Error-Bounded double, Double-Double)
+ * ========================================================================
+ *
+ * CALC_PRECISION_AUTO evaluates in double and carries a bound on the
+ * absolute error of every value on the stack: the exact rounding error of
+ * +, - and * (error-free transformations), half an ulp for other
+ * operations, the libm error for functions, and first-order propagation of
+ * the operands' errors. When the bound of the result exceeds the tolerance
+ * (catastrophic cancellation, results that should be zero) or a domain
+ * check depends on digits double does not have, the expression is
+ * evaluated again in double-double.
+ *
+ * Double-double arithmetic follows the classic algorithms of Dekker, Knuth
+ * and the QD library. The extended pass bounds its error as well and
+ * reports values that are indistinguishable from zero as exactly zero.
+ */
+
+#include "calc_internal.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Ensure M_PI is defined for mathematical calculations
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+#ifndef M_LN10
+#define M_LN10 2.30258509299404568402
+#endif
+
+#define ROUNDING_UNIT (DBL_EPSILON / 2)    // Relative error of one rounding
+#define LIBM_ERROR (2 * DBL_EPSILON)       // Assumed libm error (2 ulp)
+#define DEGREE_SCALE (M_PI / 180.0)        // d(radians) / d(degrees)
+#define DEGREE_KERNEL_ERROR (2 * DBL_EPSILON)  // Relative, degree_sincos()
+#define PAIRWISE_ROUNDINGS 40.0  // Plus log2(n): roundings of an aggregate sum
+
+#define DD_ROUNDING_UNIT 1.2325951644078309e-32  // 2^-106
+#define DD_FUNCTION_ERROR 1e-30   // Bound for double-double functions
+#define DD_TAYLOR_EPSILON 1e-33   // Relative size of the last series term
+
+// Double-double constants (leading double plus its rounding error)
+static const DoubleDouble DD_PI_180 = {0.017453292519943295,
+                                       2.9486522708701687e-19};
+static const DoubleDouble DD_LN2 = {0.69314718055994529,
+                                    2.3190468138462996e-17};
+static const DoubleDouble DD_LN10 = {2.3025850929940459,
+                                     -2.1707562233822494e-16};
+
+/**
+ * Functions known to the evaluators
+ */
+typedef enum {
+    FUNCTION_SQRT,
+    FUNCTION_LOG,
+    FUNCTION_LN,
+    FUNCTION_SIN,
+    FUNCTION_COS,
+    FUNCTION_TAN,
+    FUNCTION_NOT,  // Bitwise not (~)
+    FUNCTION_UNKNOWN
+} MathFunction;
+
+/**
+ * Outcome of one evaluation step
+ */
+typedef enum {
+    STEP_OK,        // Value computed
+    STEP_ERROR,     // Definite error, message in context->last_error
+    STEP_UNDECIDED  // Domain check needs more precision than double
+} StepResult;
+
+/**
+ * =======================================================================
+ *                       ERROR-FREE TRANSFORMATIONS
+ * =======================================================================
+ */
+
+/**
+ * a + b = sum + *error exactly (Knuth's TwoSum)
+ */
+static inline double two_sum(double a, double b, double *error) {
+    double sum = a + b;
+    double b_virtual = sum - a;
+    *error = (a - (sum - b_virtual)) + (b - b_virtual);
+    return sum;
+}
+
+/**
+ * a + b = sum + *error exactly, provided |a| >= |b| (Dekker's FastTwoSum)
+ */
+static inline double quick_two_sum(double a, double b, double *error) {
+    double sum = a + b;
+    *error = b - (sum - a);
+    return sum;
+}
+
+#if !defined(FP_FAST_FMA) && !defined(__FMA__)
+/**
+ * Split a into two 26-bit halves, a = *high + *low (Veltkamp); values
+ * above 2^996 are scaled down first so 2^27 * a cannot overflow
+ */
+static inline void split(double a, double *high, double *low) {
+    bool scaled = fabs(a) > 6.69692879491417e+299;  // 2^996
+    if (scaled) a *= 3.7252902984619141e-09;        // 2^-28
+    double a_scaled = 134217729.0 * a;              // 2^27 + 1
+    *high = a_scaled - (a_scaled - a);
+    *low = a - *high;
+    if (scaled) {
+        *high *= 268435456.0;  // 2^28
+        *low *= 268435456.0;
+    }
+}
+#endif
+
+/**
+ * a * b = product + *error exactly (barring overflow and underflow)
+ */
+static inline double two_product(double a, double b, double *error) {
+    double product = a * b;
+#if defined(FP_FAST_FMA) || defined(__FMA__)
+    *error = fma(a, b, -product);
+#else
+    // Dekker's product of the 26-bit halves; near the overflow threshold
+    // a_hi * b_hi may round up to infinity, so the larger factor is
+    // scaled down by 2^-54 (exactly) and the error scaled back up
+    double scale = 1.0;
+    if (fabs(product) > 1.0715086071862673e+301 && isfinite(product)) {
+        if (fabs(a) >= fabs(b)) {
+            a *= 5.5511151231257827e-17;  // 2^-54
+        } else {
+            b *= 5.5511151231257827e-17;
+        }
+        scale = 18014398509481984.0;  // 2^54
+    }
+    double scaled_product = a * b;
+    double a_hi, a_lo, b_hi, b_lo;
+    split(a, &a_hi, &a_lo);
+    split(b, &b_hi, &b_lo);
+    *error = (((a_hi * b_hi - scaled_product) + a_hi * b_lo + a_lo * b_hi) +
+              a_lo * b_lo) *
+             scale;
+#endif
+    return product;
+}
+
+/**
+ * =======================================================================
+ *                        DOUBLE-DOUBLE ARITHMETIC
+ * =======================================================================
+ */
+
+static inline DoubleDouble dd_from(double value) {
+    DoubleDouble result = {value, 0.0};
+    return result;
+}
+
+static inline DoubleDouble dd_negate(DoubleDouble a) {
+    DoubleDouble result = {-a.hi, -a.lo};
+    return result;
+}
+
+static inline DoubleDouble dd_ldexp(DoubleDouble a, int exponent) {
+    DoubleDouble result = {ldexp(a.hi, exponent), ldexp(a.lo, exponent)};
+    return result;
+}
+
+static DoubleDouble dd_add(DoubleDouble a, DoubleDouble b) {
+    double high_error, low_error;
+    double high = two_sum(a.hi, b.hi, &high_error);
+    if (!isfinite(high)) return dd_from(high);  // Overflow (inf - inf: NaN)
+    double low = two_sum(a.lo, b.lo, &low_error);
+    high_error += low;
+    high = quick_two_sum(high, high_error, &high_error);
+    high_error += low_error;
+
+    DoubleDouble result;
+    result.hi = quick_two_sum(high, high_error, &result.lo);
+    return result;
+}
+
+static DoubleDouble dd_subtract(DoubleDouble a, DoubleDouble b) {
+    return dd_add(a, dd_negate(b));
+}
+
+static DoubleDouble dd_multiply(DoubleDouble a, DoubleDouble b) {
+    double error;
+    double product = two_product(a.hi, b.hi, &error);
+    if (!isfinite(product)) return dd_from(product);
+    error += a.hi * b.lo + a.lo * b.hi;
+
+    DoubleDouble result;
+    result.hi = quick_two_sum(product, error, &result.lo);
+    return result;
+}
+
+static DoubleDouble dd_multiply_double(DoubleDouble a, double b) {
+    double error;
+    double product = two_product(a.hi, b, &error);
+    if (!isfinite(product)) return dd_from(product);
+    error += a.lo * b;
+
+    DoubleDouble result;
+    result.hi = quick_two_sum(product, error, &result.lo);
+    return result;
+}
+
+/**
+ * Long division: three double quotients, each from the remainder left by
+ * the previous ones
+ */
+static DoubleDouble dd_divide(DoubleDouble a, DoubleDouble b) {
+    double q1 = a.hi / b.hi;
+    if (!isfinite(q1) || !isfinite(b.hi)) return dd_from(q1);
+    DoubleDouble remainder = dd_subtract(a, dd_multiply_double(b, q1));
+    double q2 = remainder.hi / b.hi;
+    remainder = dd_subtract(remainder, dd_multiply_double(b, q2));
+    double q3 = remainder.hi / b.hi;
+
+    DoubleDouble quotient;
+    quotient.hi = quick_two_sum(q1, q2, &quotient.lo);
+    return dd_add(quotient, dd_from(q3));
+}
+
+/**
+ * Square root by one Newton step from the double square root
+ */
+static DoubleDouble dd_sqrt(DoubleDouble a) {
+    if (a.hi <= 0.0) return dd_from(0.0);
+    if (isinf(a.hi)) return a;
+    double inverse = 1.0 / sqrt(a.hi);
+    double root = a.hi * inverse;
+    DoubleDouble residual =
+        dd_subtract(a, dd_multiply(dd_from(root), dd_from(root)));
+
+    DoubleDouble result;
+    result.hi = two_sum(root, residual.hi * inverse * 0.5, &result.lo);
+    return result;
+}
+
+/**
+ * Exponential: exp(a) = 2^k * exp(r) with r = (a - k ln 2) / 512; the
+ * series gives expm1(r), which is squared back up nine times
+ */
+static DoubleDouble dd_exp(DoubleDouble a) {
+    if (a.hi > 709.7) return dd_from(HUGE_VAL);
+    if (a.hi < -745.2) return dd_from(0.0);
+
+    double k = nearbyint(a.hi / DD_LN2.hi);
+    DoubleDouble r =
+        dd_ldexp(dd_subtract(a, dd_multiply_double(DD_LN2, k)), -9);
+
+    DoubleDouble sum = r;
+    DoubleDouble term = r;
+    for (int n = 2; fabs(term.hi) > DD_TAYLOR_EPSILON * fabs(sum.hi); n++) {
+        term = dd_divide(dd_multiply(term, r), dd_from(n));
+        sum = dd_add(sum, term);
+    }
+
+    // expm1(2x) = 2 expm1(x) + expm1(x)^2
+    for (int i = 0; i < 9; i++) {
+        sum = dd_add(dd_ldexp(sum, 1), dd_multiply(sum, sum));
+    }
+    return dd_ldexp(dd_add(sum, dd_from(1.0)), (int)k);
+}
+
+/**
+ * Natural logarithm of a positive value: one Newton step
+ * x += a * exp(-x) - 1 on the mantissa doubles the precision of log()
+ */
+static DoubleDouble dd_log(DoubleDouble a) {
+    if (isinf(a.hi)) return a;
+    int exponent;
+    frexp(a.hi, &exponent);
+    DoubleDouble mantissa = dd_ldexp(a, -exponent);
+
+    DoubleDouble x = dd_from(log(mantissa.hi));
+    x = dd_add(x, dd_multiply(mantissa, dd_exp(dd_negate(x))));
+    x = dd_subtract(x, dd_from(1.0));
+    return dd_add(x, dd_multiply_double(DD_LN2, exponent));
+}
+
+/**
+ * Integer power by binary exponentiation
+ */
+static DoubleDouble dd_power_integer(DoubleDouble base, long long exponent) {
+    unsigned long long remaining = exponent < 0
+                                       ? -(unsigned long long)exponent
+                                       : (unsigned long long)exponent;
+    DoubleDouble result = dd_from(1.0);
+    while (remaining) {
+        if (remaining & 1) result = dd_multiply(result, base);
+        remaining >>= 1;
+        if (remaining) base = dd_multiply(base, base);
+    }
+    return exponent < 0 ? dd_divide(dd_from(1.0), result) : result;
+}
+
+/**
+ * General power; a negative base requires an integer exponent
+ */
+static DoubleDouble dd_power(DoubleDouble base, DoubleDouble exponent) {
+    bool integer = exponent.lo == 0.0 && exponent.hi == nearbyint(exponent.hi);
+    if (integer && fabs(exponent.hi) <= 1024.0) {
+        return dd_power_integer(base, (long long)exponent.hi);
+    }
+    if (base.hi == 0.0) return dd_from(exponent.hi > 0 ? 0.0 : HUGE_VAL);
+
+    bool negative = base.hi < 0.0;
+    DoubleDouble magnitude = negative ? dd_negate(base) : base;
+    DoubleDouble result = dd_exp(dd_multiply(exponent, dd_log(magnitude)));
+    if (negative && fmod(exponent.hi, 2.0) != 0.0) result = dd_negate(result);
+    return result;
+}
+
+/**
+ * Sine and cosine of |t| <= pi/4 radians by Taylor series
+ */
+static void dd_sincos_taylor(DoubleDouble t, DoubleDouble *sine,
+                             DoubleDouble *cosine) {
+    DoubleDouble t_squared = dd_multiply(t, t);
+
+    DoubleDouble term = t;
+    *sine = t;
+    for (int n = 2; fabs(term.hi) > DD_TAYLOR_EPSILON * fabs(sine->hi);
+         n += 2) {
+        term = dd_divide(dd_multiply(term, t_squared),
+                         dd_from(-(double)(n * (n + 1))));
+        *sine = dd_add(*sine, term);
+    }
+
+    term = dd_from(1.0);
+    *cosine = term;
+    for (int n = 1; fabs(term.hi) > DD_TAYLOR_EPSILON; n += 2) {
+        term = dd_divide(dd_multiply(term, t_squared),
+                         dd_from(-(double)(n * (n + 1))));
+        *cosine = dd_add(*cosine, term);
+    }
+}
+
+/**
+ * Sine and cosine of an angle in degrees
+ * Reduction is exact: fmod(x, 360) is exact for both halves, and the
+ * remaining multiple of 90 degrees selects the quadrant, so multiples of
+ * 90 degrees give exact zeros
+ */
+static void dd_sincos_degrees(DoubleDouble degrees, DoubleDouble *sine,
+                              DoubleDouble *cosine) {
+    degrees = dd_add(dd_from(fmod(degrees.hi, 360.0)),
+                     dd_from(fmod(degrees.lo, 360.0)));
+    double quarter_turns = nearbyint(degrees.hi / 90.0);
+    DoubleDouble reduced = dd_subtract(degrees, dd_from(90.0 * quarter_turns));
+
+    DoubleDouble s, c;
+    dd_sincos_taylor(dd_multiply(reduced, DD_PI_180), &s, &c);
+
+    switch ((int)(quarter_turns - 4.0 * floor(quarter_turns / 4.0))) {
+        case 0:
+            *sine = s;
+            *cosine = c;
+            break;
+        case 1:
+            *sine = c;
+            *cosine = dd_negate(s);
+            break;
+        case 2:
+            *sine = dd_negate(s);
+            *cosine = dd_negate(c);
+            break;
+        default:
+            *sine = dd_negate(c);
+            *cosine = s;
+            break;
+    }
+}
+
+/**
+ * Convert a number literal to double-double, reading the same characters
+ * as get_next_token() (0x/0b/0o integers, or digits and dots, at most 63,
+ * optional '%')
+ */
+static DoubleDouble dd_parse_literal(const char *text) {
+    int radix = radix_prefix(text);
+    if (radix) {
+        DoubleDouble value = dd_from(0.0);
+        unsigned long long bits = 0;
+        bool wide = false;  // More than 64 bits
+        int digit;
+        for (const char *c = text + 2; (digit = radix_digit(*c, radix)) >= 0;
+             c++) {
+            value = dd_add(dd_multiply_double(value, radix), dd_from(digit));
+            wide = wide ||
+                   __builtin_mul_overflow(bits, (unsigned)radix, &bits) ||
+                   __builtin_add_overflow(bits, (unsigned)digit, &bits);
+        }
+        // Up to 64 bits the digits are two's complement, as in the lexer
+        if (!wide && bits >> 63) value = dd_add(value, dd_from(-0x1p64));
+        return value;
+    }
+
+    size_t length = 0;
+    while (length < 63 &&
+           ((text[length] >= '0' && text[length] <= '9') ||
+            text[length] == '.')) {
+        length++;
+    }
+
+    // Accumulate all digits as an integer, then scale by the decimals
+    DoubleDouble value = dd_from(0.0);
+    bool fraction = false;
+    int decimals = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] == '.') {
+            if (fraction) break;  // strtod() stops at a second dot too
+            fraction = true;
+            continue;
+        }
+        value = dd_add(dd_multiply_double(value, 10.0),
+                       dd_from(text[i] - '0'));
+        if (fraction) decimals++;
+    }
+    if (decimals > 0) {
+        value = dd_divide(value, dd_power_integer(dd_from(10.0), decimals));
+    }
+    if (text[length] == '%') value = dd_divide(value, dd_from(100.0));
+    return value;
+}
+
+/**
+ * =======================================================================
+ *                            SHARED HELPERS
+ * =======================================================================
+ */
+
+/**
+ * Map a function name to its identifier
+ */
+static MathFunction math_function(const char *name) {
+    if (strcmp(name, "sqrt") == 0) return FUNCTION_SQRT;
+    if (strcmp(name, "log") == 0) return FUNCTION_LOG;
+    if (strcmp(name, "ln") == 0) return FUNCTION_LN;
+    if (strcmp(name, "sin") == 0) return FUNCTION_SIN;
+    if (strcmp(name, "cos") == 0) return FUNCTION_COS;
+    if (strcmp(name, "tan") == 0) return FUNCTION_TAN;
+    if (strcmp(name, "not") == 0) return FUNCTION_NOT;
+    return FUNCTION_UNKNOWN;
+}
+
+/**
+ * Report a domain error and return STEP_ERROR
+ */
+static StepResult step_error(CalcContext *context, const char *message) {
+    snprintf(context->last_error, sizeof(context->last_error), "%s",
+             message);
+    return STEP_ERROR;
+}
+
+/**
+ * Rounding error of an integer result of a bitwise operator
+ */
+static double integer_rounding_error(double value) {
+    return fabs(value) < 9007199254740992.0 ? 0.0  // 2^53
+                                             : fabs(value) * ROUNDING_UNIT;
+}
+
+/**
+ * Whether a degree kernel result is exact: at multiples of `step` (30 for
+ * sin and cos, 45 for tan) the kernels return 0, 1/2 and 1 exactly
+ */
+static bool degree_result_exact(double degrees, double step, double value) {
+    double magnitude = fabs(value);
+    return fmod(degrees, step) == 0.0 &&
+           (magnitude == 0.0 || magnitude == 0.5 || magnitude == 1.0);
+}
+
+/**
+ * Bound on |sqrt(x) - sqrt(y)| over all y within `error` of x >= 0
+ */
+static double sqrt_propagated_error(double x, double error) {
+    if (x > error) return 2.0 * error / (sqrt(x + error) + sqrt(x - error));
+    return sqrt(x + error);
+}
+
+/**
+ * =======================================================================
+ *                     ERROR-BOUNDED DOUBLE EVALUATION
+ * =======================================================================
+ */
+
+/**
+ * Apply a binary operator to two bounded values (result replaces left)
+ */
+static StepResult bounded_operator(CalcContext *context, char op,
+                                   BoundedValue *left, BoundedValue right) {
+    double a = left->value, a_error = left->error;
+    double b = right.value, b_error = right.error;
+    double rounding;
+
+    switch (op) {
+        case '+':
+        case '-':
+            left->value = two_sum(a, op == '+' ? b : -b, &rounding);
+            left->error = a_error + b_error + fabs(rounding);
+            return STEP_OK;
+
+        case '*':
+            left->value = two_product(a, b, &rounding);
+            left->error = fabs(a) * b_error + fabs(b) * a_error +
+                          a_error * b_error + fabs(rounding);
+            return STEP_OK;
+
+        case '/': {
+            if (b == 0.0 && b_error == 0.0) {
+                return step_error(context, "Division by zero");
+            }
+            if (fabs(b) <= b_error) return STEP_UNDECIDED;
+
+            double quotient = a / b;
+            double product_error;
+            double product = two_product(quotient, b, &product_error);
+            bool exact = (a - product) - product_error == 0.0;
+
+            left->value = quotient;
+            left->error = (a_error + fabs(quotient) * b_error) /
+                              (fabs(b) - b_error) +
+                          (exact ? 0.0 : fabs(quotient) * ROUNDING_UNIT);
+            return STEP_OK;
+        }
+
+        case '^': {
+            if (a == 0.0 && a_error == 0.0) {
+                if (b < -b_error) {
+                    return step_error(context,
+                                      "Cannot raise zero to negative power");
+                }
+                if (fabs(b) <= b_error && b_error > 0.0) {
+                    return STEP_UNDECIDED;
+                }
+                left->value = pow(a, b);
+                left->error = 0.0;
+                return STEP_OK;
+            }
+            if (fabs(a) <= a_error) return STEP_UNDECIDED;
+
+            bool integer_exponent = b == nearbyint(b);
+            if (a < 0.0 && !(integer_exponent && b_error == 0.0)) {
+                if (fabs(b - nearbyint(b)) > b_error) {
+                    return step_error(
+                        context,
+                        "Cannot raise negative number to non-integer power");
+                }
+                return STEP_UNDECIDED;
+            }
+
+            left->value = pow(a, b);
+            if (a_error == 0.0 && b_error == 0.0 && a == nearbyint(a) &&
+                integer_exponent && b >= 0.0 &&
+                fabs(left->value) < 9007199254740992.0) {
+                // Integer powers below 2^53 are representable, and pow()
+                // returns representable results exactly
+                left->error = 0.0;
+                return STEP_OK;
+            }
+            double relative = LIBM_ERROR;
+            if (a_error > 0.0) relative += fabs(b) * a_error / fabs(a);
+            if (b_error > 0.0) relative += fabs(log(fabs(a))) * b_error;
+            left->error = fabs(left->value) * relative;
+            return STEP_OK;
+        }
+
+        case '&':
+        case '|':
+        case 'x':
+        case '<':
+        case '>':
+            // Integer operators need every bit of their operands
+            if (a_error > 0.0 || b_error > 0.0) return STEP_UNDECIDED;
+            if (!apply_bitwise_operator(context, op, a, b, &left->value)) {
+                return STEP_ERROR;
+            }
+            left->error = integer_rounding_error(left->value);
+            return STEP_OK;
+
+        default:
+            snprintf(context->last_error, sizeof(context->last_error),
+                     "Unknown operator: %c", op);
+            return STEP_ERROR;
+    }
+}
+
+/**
+ * Apply a function to a bounded value in place
+ */
+static StepResult bounded_function(CalcContext *context, const char *name,
+                                   BoundedValue *operand) {
+    double x = operand->value;
+    double x_error = operand->error;
+    MathFunction function = math_function(name);
+
+    switch (function) {
+        case FUNCTION_SQRT: {
+            if (x < -x_error) {
+                return step_error(context,
+                                  "Cannot take square root of negative "
+                                  "number");
+            }
+            if (x < 0.0) return STEP_UNDECIDED;
+
+            double root = sqrt(x);
+            double square_error;
+            double square = two_product(root, root, &square_error);
+            bool exact = (square - x) + square_error == 0.0;
+            operand->value = root;
+            operand->error = sqrt_propagated_error(x, x_error) +
+                             (exact ? 0.0 : root * ROUNDING_UNIT);
+            return STEP_OK;
+        }
+
+        case FUNCTION_LOG:
+        case FUNCTION_LN: {
+            bool base10 = function == FUNCTION_LOG;
+            if (x + x_error <= 0.0) {
+                return step_error(
+                    context,
+                    base10 ? "Logarithm undefined for zero or negative numbers"
+                           : "Natural log undefined for zero or negative "
+                             "numbers");
+            }
+            if (x - x_error <= 0.0) return STEP_UNDECIDED;
+
+            operand->value = base10 ? log10(x) : log(x);
+            operand->error = x_error / (x - x_error) / (base10 ? M_LN10 : 1.0) +
+                             fabs(operand->value) * LIBM_ERROR;
+            return STEP_OK;
+        }
+
+        case FUNCTION_SIN:
+        case FUNCTION_COS: {
+            double sine, cosine;
+            degree_sincos(x, &sine, &cosine);
+            operand->value = function == FUNCTION_SIN ? sine : cosine;
+            operand->error = DEGREE_SCALE * x_error +
+                             (degree_result_exact(x, 30.0, operand->value)
+                                  ? 0.0
+                                  : fabs(operand->value) * DEGREE_KERNEL_ERROR);
+            return STEP_OK;
+        }
+
+        case FUNCTION_TAN: {
+            // Tangent is undefined at odd multiples of 90 degrees
+            double distance = fabs(fmod(fabs(x), 180.0) - 90.0);
+            double value;
+            if (distance <= x_error || !degree_tan(x, &value)) {
+                if (x_error > 0.0) return STEP_UNDECIDED;
+                return step_error(context,
+                                  "Tangent undefined at 90° and odd "
+                                  "multiples");
+            }
+
+            // Quotient of two kernel results
+            double slope = 1.0 + value * value;
+            operand->value = value;
+            operand->error =
+                slope * DEGREE_SCALE * x_error +
+                (degree_result_exact(x, 45.0, value)
+                     ? 0.0
+                     : fabs(value) * (2 * DEGREE_KERNEL_ERROR + ROUNDING_UNIT));
+            return STEP_OK;
+        }
+
+        case FUNCTION_NOT:
+            if (x_error > 0.0) return STEP_UNDECIDED;
+            if (!apply_bitwise_operator(context, '~', x, 0.0,
+                                        &operand->value)) {
+                return STEP_ERROR;
+            }
+            operand->error = integer_rounding_error(operand->value);
+            return STEP_OK;
+
+        default:
+            snprintf(context->last_error, sizeof(context->last_error),
+                     "Unknown function: %s", name);
+            return STEP_ERROR;
+    }
+}
+
+/**
+ * Apply an aggregate to `count` bounded values (result replaces the first)
+ * The value is computed by the double kernels; its bound adds their
+ * rounding to the first-order effect of the arguments' errors.
+ */
+static StepResult bounded_aggregate(CalcContext *context,
+                                    AggregateFunction function,
+                                    BoundedValue *values, size_t count) {
+    double percentile = function == AGGREGATE_PERCENTILE && count > 0
+                            ? values[0].value
+                            : 0.0;
+    if (!aggregate_check(context, function, count, percentile)) {
+        return STEP_ERROR;
+    }
+    double percentile_error = 0.0;
+    if (function == AGGREGATE_PERCENTILE) {
+        percentile_error = values[0].error;
+        if (percentile < percentile_error ||
+            percentile + percentile_error > 100.0) {
+            return STEP_UNDECIDED;
+        }
+    }
+
+    // The kernels reorder their input, so they get a copy
+    double *scratch = reserve_number_scratch(context, count);
+    if (!scratch) return STEP_ERROR;
+    for (size_t i = 0; i < count; i++) scratch[i] = values[i].value;
+    AggregateFunction kernel =
+        function == AGGREGATE_STDDEV ? AGGREGATE_VAR : function;
+    double value;
+    if (!aggregate_values(context, kernel, scratch, count, &value)) {
+        return STEP_ERROR;
+    }
+
+    // Percentile's data follows p
+    const BoundedValue *data = values;
+    if (function == AGGREGATE_PERCENTILE) {
+        data++;
+        count--;
+    }
+
+    double n = (double)count;
+    double sum = 0.0, magnitude = 0.0;
+    double largest_error = 0.0, total_error = 0.0;
+    double minimum = data[0].value, maximum = data[0].value;
+    for (size_t i = 0; i < count; i++) {
+        sum += data[i].value;
+        magnitude += fabs(data[i].value);
+        total_error += data[i].error;
+        largest_error = fmax(largest_error, data[i].error);
+        minimum = fmin(minimum, data[i].value);
+        maximum = fmax(maximum, data[i].value);
+    }
+    double sum_rounding =
+        (log2(n) + PAIRWISE_ROUNDINGS) * ROUNDING_UNIT * magnitude;
+    double error;
+
+    switch (function) {
+        case AGGREGATE_MEAN:
+            error = (total_error + sum_rounding) / n +
+                    fabs(value) * ROUNDING_UNIT;
+            break;
+
+        case AGGREGATE_VAR:
+        case AGGREGATE_STDDEV: {
+            // d var / d x_i = 2 (x_i - mean) / (n - 1)
+            double mean = sum / n;
+            double propagated = 0.0, squared = 0.0;
+            for (size_t i = 0; i < count; i++) {
+                propagated += fabs(data[i].value - mean) * data[i].error;
+                squared += data[i].error * data[i].error;
+            }
+            double mean_error = sum_rounding / n;
+            double squares = value * (n - 1.0);
+            error = (2.0 * propagated + squared +
+                     (2.0 * (log2(n) + PAIRWISE_ROUNDINGS) + 4.0) *
+                         ROUNDING_UNIT * squares +
+                     n * mean_error * mean_error) /
+                    (n - 1.0);
+            if (function == AGGREGATE_STDDEV) {
+                double variance = value;
+                value = sqrt(variance);
+                error = sqrt_propagated_error(variance, error) +
+                        value * ROUNDING_UNIT;
+            }
+            break;
+        }
+
+        case AGGREGATE_MIN:
+        case AGGREGATE_MAX:
+            // Order statistics move no further than their arguments
+            error = largest_error;
+            break;
+
+        default: {
+            // Interpolating between neighbours rounds the rank, its
+            // fraction and the blend; p's error moves the rank itself
+            double spread = maximum - minimum;
+            double rank = (n - 1.0) * percentile / 100.0;
+            error = largest_error +
+                    percentile_error * spread * (n - 1.0) / 100.0 +
+                    (2.0 * rank + 3.0) * ROUNDING_UNIT * spread +
+                    2.0 * ROUNDING_UNIT * fabs(value);
+            break;
+        }
+    }
+
+    values[0].value = value;
+    values[0].error = error;
+    return STEP_OK;
+}
+
+bool evaluate_rpn_bounded(CalcContext *context, const TokenStack *rpn_tokens,
+                          double *result, bool *trusted) {
+    char *error = context->last_error;
+    size_t error_size = sizeof(context->last_error);
+
+    // The stack never holds more values than there are tokens
+    BoundedValue *stack = reserve_value_stack(
+        context, sizeof(BoundedValue) * (size_t)(rpn_tokens->top + 2));
+    if (!stack) return false;
+    int top = -1;
+    *trusted = true;
+
+    for (int i = 0; i <= rpn_tokens->top; i++) {
+        const Token *token = &rpn_tokens->data[i];
+        StepResult step = STEP_OK;
+
+        if (token->type == TOK_NUMBER) {
+            // strtod() (and the percent division) round at most twice
+            stack[++top].value = token->value;
+            stack[top].error =
+                token->exact ? 0.0 : fabs(token->value) * (2 * ROUNDING_UNIT);
+        } else if (token->type == TOK_VARIABLE) {
+            // Variable values are taken as exact
+            stack[++top].value = context->variable_values[token->variable];
+            stack[top].error = 0.0;
+        } else if (token->type == TOK_OPERATOR) {
+            if (top < 1) {
+                snprintf(error, error_size, "Not enough operands for operator");
+                return false;
+            }
+            top--;
+            step = bounded_operator(context, token->operator, &stack[top],
+                                    stack[top + 1]);
+        } else if (token->type == TOK_FUNCTION) {
+            if (top < 0) {
+                snprintf(error, error_size, "Function '%s' requires an argument",
+                         token->function);
+                return false;
+            }
+            AggregateFunction aggregate = aggregate_function(token->function);
+            if (aggregate != AGGREGATE_NONE) {
+                int count =
+                    token->arguments <= top + 1 ? token->arguments : 0;
+                top += 1 - count;
+                step = bounded_aggregate(context, aggregate, &stack[top],
+                                         (size_t)count);
+            } else {
+                step = bounded_function(context, token->function,
+                                        &stack[top]);
+            }
+        }
+
+        if (step == STEP_ERROR) return false;
+        if (step == STEP_UNDECIDED) {
+            *trusted = false;
+            return true;
+        }
+    }
+
+    // Should have exactly one number left on stack
+    if (top != 0) {
+        snprintf(error, error_size, "Invalid expression syntax");
+        return false;
+    }
+
+    // More precision does not help with overflow or NaN
+    *result = stack[0].value;
+    if (isfinite(*result) &&
+        !(stack[0].error <= context->options.tolerance * fabs(*result))) {
+        *trusted = false;
+    }
+    return true;
+}
+
+/**
+ * =======================================================================
+ *                     DOUBLE-DOUBLE (EXTENDED) EVALUATION
+ * =======================================================================
+ */
+
+/**
+ * The integer a precise value stands for: the nearest one, provided it is
+ * within the value's error bound
+ * @return: false if the value cannot be an integer
+ */
+static bool precise_integer(PreciseValue x, double *integer) {
+    double nearest = nearbyint(x.value.hi);
+    double residual = dd_subtract(x.value, dd_from(nearest)).hi;
+    double adjustment = nearbyint(residual);
+    if (fabs(residual - adjustment) > x.error) return false;
+    *integer = nearest + adjustment;
+    return true;
+}
+
+/**
+ * Apply a bitwise operator to precise values (result replaces left)
+ */
+static StepResult precise_bitwise(CalcContext *context, char op,
+                                  PreciseValue *left, PreciseValue right) {
+    double a, b = 0.0, value;
+    if (!precise_integer(*left, &a) ||
+        (op != '~' && !precise_integer(right, &b))) {
+        return step_error(context, "Bitwise operators need integer operands");
+    }
+    if (!apply_bitwise_operator(context, op, a, b, &value)) return STEP_ERROR;
+    left->value = dd_from(value);
+    left->error = integer_rounding_error(value);
+    return STEP_OK;
+}
+
+/**
+ * Apply a binary operator to two precise values (result replaces left)
+ */
+static StepResult precise_operator(CalcContext *context, char op,
+                                   PreciseValue *left, PreciseValue right) {
+    DoubleDouble a = left->value, b = right.value;
+    double a_error = left->error, b_error = right.error;
+
+    switch (op) {
+        case '+':
+        case '-':
+            left->value = op == '+' ? dd_add(a, b) : dd_subtract(a, b);
+            left->error = a_error + b_error +
+                          fabs(left->value.hi) * (4 * DD_ROUNDING_UNIT);
+            return STEP_OK;
+
+        case '*':
+            left->value = dd_multiply(a, b);
+            left->error = fabs(a.hi) * b_error + fabs(b.hi) * a_error +
+                          a_error * b_error +
+                          fabs(left->value.hi) * (8 * DD_ROUNDING_UNIT);
+            return STEP_OK;
+
+        case '/':
+            // A divisor within its error of zero may well be zero
+            if (fabs(b.hi) <= b_error) {
+                return step_error(context, "Division by zero");
+            }
+            left->value = dd_divide(a, b);
+            left->error = (a_error + fabs(left->value.hi) * b_error) /
+                              (fabs(b.hi) - b_error) +
+                          fabs(left->value.hi) * (16 * DD_ROUNDING_UNIT);
+            return STEP_OK;
+
+        case '^': {
+            if (fabs(a.hi) <= a_error) {
+                if (b.hi < 0.0) {
+                    return step_error(context,
+                                      "Cannot raise zero to negative power");
+                }
+                left->value = dd_from(b.hi == 0.0 ? 1.0 : 0.0);
+                left->error =
+                    a_error > 0.0 && b.hi > 0.0 ? pow(a_error, b.hi) : 0.0;
+                return STEP_OK;
+            }
+            if (a.hi < 0.0) {
+                // Exponents within their error of an integer are integers
+                DoubleDouble nearest = dd_from(nearbyint(b.hi));
+                if (fabs(dd_subtract(b, nearest).hi) > b_error) {
+                    return step_error(
+                        context,
+                        "Cannot raise negative number to non-integer power");
+                }
+                b = nearest;
+                b_error = 0.0;
+            }
+
+            double log_magnitude = fabs(log(fabs(a.hi)));
+            left->value = dd_power(a, b);
+            double relative =
+                DD_FUNCTION_ERROR * (1.0 + fabs(b.hi) * log_magnitude);
+            if (a_error > 0.0) relative += fabs(b.hi) * a_error / fabs(a.hi);
+            if (b_error > 0.0) relative += log_magnitude * b_error;
+            left->error = fabs(left->value.hi) * relative;
+            return STEP_OK;
+        }
+
+        case '&':
+        case '|':
+        case 'x':
+        case '<':
+        case '>':
+            return precise_bitwise(context, op, left, right);
+
+        default:
+            snprintf(context->last_error, sizeof(context->last_error),
+                     "Unknown operator: %c", op);
+            return STEP_ERROR;
+    }
+}
+
+/**
+ * Apply a function to a precise value in place
+ */
+static StepResult precise_function(CalcContext *context, const char *name,
+                                   PreciseValue *operand) {
+    DoubleDouble x = operand->value;
+    double x_error = operand->error;
+    MathFunction function = math_function(name);
+
+    switch (function) {
+        case FUNCTION_SQRT:
+            if (x.hi < -x_error) {
+                return step_error(context,
+                                  "Cannot take square root of negative "
+                                  "number");
+            }
+            if (x.hi <= 0.0) {
+                // Within its error of zero
+                operand->value = dd_from(0.0);
+                operand->error = sqrt(x.hi + x_error);
+                return STEP_OK;
+            }
+            operand->value = dd_sqrt(x);
+            operand->error = sqrt_propagated_error(x.hi, x_error) +
+                             fabs(operand->value.hi) * (8 * DD_ROUNDING_UNIT);
+            return STEP_OK;
+
+        case FUNCTION_LOG:
+        case FUNCTION_LN: {
+            bool base10 = function == FUNCTION_LOG;
+            if (x.hi <= x_error) {
+                return step_error(
+                    context,
+                    base10 ? "Logarithm undefined for zero or negative numbers"
+                           : "Natural log undefined for zero or negative "
+                             "numbers");
+            }
+            DoubleDouble value = dd_log(x);
+            if (base10) value = dd_divide(value, DD_LN10);
+            operand->value = value;
+            operand->error =
+                x_error / (x.hi - x_error) / (base10 ? M_LN10 : 1.0) +
+                (fabs(value.hi) + 1.0) * DD_FUNCTION_ERROR;
+            return STEP_OK;
+        }
+
+        case FUNCTION_SIN:
+        case FUNCTION_COS: {
+            DoubleDouble sine, cosine;
+            dd_sincos_degrees(x, &sine, &cosine);
+            operand->value = function == FUNCTION_SIN ? sine : cosine;
+            operand->error = DEGREE_SCALE * x_error + DD_FUNCTION_ERROR;
+            return STEP_OK;
+        }
+
+        case FUNCTION_TAN: {
+            DoubleDouble sine, cosine;
+            dd_sincos_degrees(x, &sine, &cosine);
+            double cosine_error = DEGREE_SCALE * x_error + DD_FUNCTION_ERROR;
+            if (fabs(cosine.hi) <= cosine_error) {
+                return step_error(context,
+                                  "Tangent undefined at 90° and odd "
+                                  "multiples");
+            }
+            DoubleDouble value = dd_divide(sine, cosine);
+            operand->value = value;
+            operand->error = (1.0 + value.hi * value.hi) *
+                             (DEGREE_SCALE * x_error + DD_FUNCTION_ERROR);
+            return STEP_OK;
+        }
+
+        case FUNCTION_NOT:
+            return precise_bitwise(context, '~', operand, *operand);
+
+        default:
+            snprintf(context->last_error, sizeof(context->last_error),
+                     "Unknown function: %s", name);
+            return STEP_ERROR;
+    }
+}
+
+/**
+ * Order of precise values by their double-double value
+ */
+static int compare_precise(const void *a, const void *b) {
+    DoubleDouble x = ((const PreciseValue *)a)->value;
+    DoubleDouble y = ((const PreciseValue *)b)->value;
+    if (x.hi != y.hi) return x.hi < y.hi ? -1 : 1;
+    return (x.lo > y.lo) - (x.lo < y.lo);
+}
+
+/**
+ * Apply an aggregate to `count` precise values (result replaces the
+ * first); the values are reordered
+ * Sums are sequential double-double sums, whose rounding grows with n
+ * but from 2^-106; order statistics sort the values.
+ */
+static StepResult precise_aggregate(CalcContext *context,
+                                    AggregateFunction function,
+                                    PreciseValue *values, size_t count) {
+    double percentile = function == AGGREGATE_PERCENTILE && count > 0
+                            ? values[0].value.hi
+                            : 0.0;
+    if (!aggregate_check(context, function, count, percentile)) {
+        return STEP_ERROR;
+    }
+
+    // Percentile's data follows p
+    PreciseValue *data = values;
+    DoubleDouble p = values[0].value;
+    double percentile_error = values[0].error;
+    if (function == AGGREGATE_PERCENTILE) {
+        data++;
+        count--;
+    }
+
+    double n = (double)count;
+    DoubleDouble sum = dd_from(0.0);
+    double magnitude = 0.0, largest_error = 0.0, total_error = 0.0;
+    DoubleDouble minimum = data[0].value, maximum = data[0].value;
+    for (size_t i = 0; i < count; i++) {
+        DoubleDouble x = data[i].value;
+        sum = dd_add(sum, x);
+        magnitude += fabs(x.hi);
+        total_error += data[i].error;
+        largest_error = fmax(largest_error, data[i].error);
+        if (isnan(x.hi)) minimum = maximum = x;
+        if (x.hi < minimum.hi || (x.hi == minimum.hi && x.lo < minimum.lo)) {
+            minimum = x;
+        }
+        if (x.hi > maximum.hi || (x.hi == maximum.hi && x.lo > maximum.lo)) {
+            maximum = x;
+        }
+    }
+    double sum_rounding = (n + 2.0) * 4 * DD_ROUNDING_UNIT * magnitude;
+
+    DoubleDouble value;
+    double error;
+    switch (function) {
+        case AGGREGATE_MEAN:
+            value = dd_divide(sum, dd_from(n));
+            error = (total_error + sum_rounding) / n +
+                    fabs(value.hi) * (16 * DD_ROUNDING_UNIT);
+            break;
+
+        case AGGREGATE_VAR:
+        case AGGREGATE_STDDEV: {
+            // For any center c, sum (x - c)^2 exceeds the sum about the
+            // exact mean by n (mean - c)^2
+            DoubleDouble mean = dd_divide(sum, dd_from(n));
+            double mean_error =
+                sum_rounding / n + fabs(mean.hi) * (16 * DD_ROUNDING_UNIT);
+            DoubleDouble squares = dd_from(0.0);
+            double propagated = 0.0, squared = 0.0;
+            for (size_t i = 0; i < count; i++) {
+                DoubleDouble d = dd_subtract(data[i].value, mean);
+                squares = dd_add(squares, dd_multiply(d, d));
+                propagated += fabs(d.hi) * data[i].error;
+                squared += data[i].error * data[i].error;
+            }
+            value = dd_divide(squares, dd_from(n - 1.0));
+            error = (2.0 * propagated + squared +
+                     (n + 4.0) * 16 * DD_ROUNDING_UNIT * fabs(squares.hi) +
+                     n * mean_error * mean_error) /
+                    (n - 1.0);
+            if (function == AGGREGATE_STDDEV) {
+                double variance = value.hi;
+                value = variance > 0.0 ? dd_sqrt(value) : dd_from(0.0);
+                error = sqrt_propagated_error(fmax(variance, 0.0), error) +
+                        fabs(value.hi) * (8 * DD_ROUNDING_UNIT);
+            }
+            break;
+        }
+
+        case AGGREGATE_MIN:
+        case AGGREGATE_MAX:
+            value = function == AGGREGATE_MIN ? minimum : maximum;
+            error = largest_error;
+            break;
+
+        default: {
+            if (isnan(minimum.hi)) {
+                value = minimum;
+                error = 0.0;
+                break;
+            }
+            qsort(data, count, sizeof(PreciseValue), compare_precise);
+
+            // rank = (n - 1) p / 100 = below + fraction
+            DoubleDouble rank =
+                function == AGGREGATE_MEDIAN
+                    ? dd_from((n - 1.0) / 2.0)
+                    : dd_divide(dd_multiply_double(p, n - 1.0),
+                                dd_from(100.0));
+            double below = floor(rank.hi);
+            if (rank.hi == below && rank.lo < 0.0) below -= 1.0;
+            if (below < 0.0) below = 0.0;
+            if (below > n - 1.0) below = n - 1.0;
+            DoubleDouble fraction = dd_subtract(rank, dd_from(below));
+            size_t index = (size_t)below;
+            value = data[index].value;
+            if (index + 1 < count && fraction.hi > 0.0) {
+                DoubleDouble gap =
+                    dd_subtract(data[index + 1].value, data[index].value);
+                value = dd_add(value, dd_multiply(fraction, gap));
+            }
+            double spread = dd_subtract(maximum, minimum).hi;
+            error = largest_error +
+                    percentile_error * spread * (n - 1.0) / 100.0 +
+                    16 * DD_ROUNDING_UNIT *
+                        (fabs(value.hi) + (rank.hi + 1.0) * spread);
+            break;
+        }
+    }
+
+    values[0].value = value;
+    values[0].error = error;
+    return STEP_OK;
+}
+
+bool evaluate_rpn_precise(CalcContext *context, const char *expression,
+                          const TokenStack *rpn_tokens, double *result) {
+    char *error = context->last_error;
+    size_t error_size = sizeof(context->last_error);
+
+    PreciseValue *stack = reserve_value_stack(
+        context, sizeof(PreciseValue) * (size_t)(rpn_tokens->top + 2));
+    if (!stack) return false;
+    int top = -1;
+
+    for (int i = 0; i <= rpn_tokens->top; i++) {
+        const Token *token = &rpn_tokens->data[i];
+        StepResult step = STEP_OK;
+
+        if (token->type == TOK_NUMBER) {
+            PreciseValue *value = &stack[++top];
+            if (token->exact) {
+                value->value = dd_from(token->value);
+                value->error = 0.0;
+            } else {
+                value->value = dd_parse_literal(expression + token->source);
+                value->error =
+                    fabs(value->value.hi) * (8 * DD_ROUNDING_UNIT);
+            }
+        } else if (token->type == TOK_VARIABLE) {
+            stack[++top].value =
+                dd_from(context->variable_values[token->variable]);
+            stack[top].error = 0.0;
+        } else if (token->type == TOK_OPERATOR) {
+            if (top < 1) {
+                snprintf(error, error_size, "Not enough operands for operator");
+                return false;
+            }
+            top--;
+            step = precise_operator(context, token->operator, &stack[top],
+                                    stack[top + 1]);
+        } else if (token->type == TOK_FUNCTION) {
+            if (top < 0) {
+                snprintf(error, error_size, "Function '%s' requires an argument",
+                         token->function);
+                return false;
+            }
+            AggregateFunction aggregate = aggregate_function(token->function);
+            if (aggregate != AGGREGATE_NONE) {
+                int count =
+                    token->arguments <= top + 1 ? token->arguments : 0;
+                top += 1 - count;
+                step = precise_aggregate(context, aggregate, &stack[top],
+                                         (size_t)count);
+            } else {
+                step = precise_function(context, token->function,
+                                        &stack[top]);
+            }
+        }
+
+        if (step == STEP_ERROR) return false;
+        // Overflow and NaN have no error bound; like double, let them
+        // propagate instead of turning into zero or a domain error
+        if (top >= 0 && !isfinite(stack[top].value.hi)) {
+            stack[top].error = 0.0;
+        }
+    }
+
+    // Should have exactly one number left on stack
+    if (top != 0) {
+        snprintf(error, error_size, "Invalid expression syntax");
+        return false;
+    }
+
+    // A value no larger than its error bound has no correct digit left;
+    // it is the rounding residue of an exact zero (e.g. 0.1 + 0.2 - 0.3)
+    DoubleDouble value = stack[0].value;
+    if (!isfinite(value.hi)) {
+        *result = value.hi;  // The low part of an overflow is meaningless
+    } else {
+        *result = fabs(value.hi) <= stack[0].error ? 0.0 : value.hi + value.lo;
+    }
+    return true;
+}
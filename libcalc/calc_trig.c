@@ -0,0 +1,215 @@
+/**
+ * ========================================================================
+ *    LIBCALC - Degree Trigonometry (Exact Argument Reduction)
+ * ========================================================================
+ *
+ * sin, cos and tan take degrees. Converting to radians first rounds the
+ * argument (180 degrees becomes a double slightly below pi, so sin(180)
+ * is 1.2e-16 instead of 0). These kernels instead reduce in degrees,
+ * where the reduction is exact: first modulo 360, then to the nearest
+ * multiple of 90, which leaves an angle of at most 45 degrees (one
+ * octant either side of an axis). Only that small remainder is converted
+ * to radians and fed to short minimax polynomials.
+ *
+ * Multiples of 90 therefore give exact zeros and ones, multiples of 30
+ * and 45 give the correctly rounded 1/2, sqrt(3)/2 and sqrt(1/2), and
+ * tan is undefined exactly at odd multiples of 90. The kernels have a
+ * branch-free form, so the batch functions below vectorize (gcc -O3).
+ */
+
+#include "calc_internal.h"
+
+#include <math.h>
+#include <string.h>
+
+#define ROUNDING_MAGIC 0x1.8p52     // (x + MAGIC) - MAGIC rounds x to integer
+#define REDUCTION_LIMIT 0x1p52      // Larger arguments reduce with fmod()
+#define DEGREE_HI 0x1.1df46a2529d39p-6  // pi/180, leading double
+#define DEGREE_LO 0x1.5c1d8becdd291p-62  // pi/180 - DEGREE_HI
+#define SQRT_HALF 0.7071067811865476     // sin(45), correctly rounded
+#define SQRT3_HALF 0.8660254037844386    // cos(30), correctly rounded
+#define BATCH_BLOCK 256                  // Angles per batch block
+
+// Minimax polynomial coefficients for |t| <= pi/4 (from fdlibm's
+// __kernel_sin and __kernel_cos), errors below 2^-58
+#define SIN_S1 -1.66666666666666324348e-01
+#define SIN_S2 8.33333333332248946124e-03
+#define SIN_S3 -1.98412698298579493134e-04
+#define SIN_S4 2.75573137070700676789e-06
+#define SIN_S5 -2.50507602534068634195e-08
+#define SIN_S6 1.58969099521155010221e-10
+#define COS_C1 4.16666666666666019037e-02
+#define COS_C2 -1.38888888888741095749e-03
+#define COS_C3 2.48015872894767294178e-05
+#define COS_C4 -2.75573143513906633035e-07
+#define COS_C5 2.08757232129817482790e-09
+#define COS_C6 -1.13596475577881948265e-11
+
+/**
+ * =======================================================================
+ *                              KERNELS
+ * =======================================================================
+ */
+
+/**
+ * Round to the nearest integer (ties to even) for |x| < 2^51
+ * Plain arithmetic, unlike nearbyint(), vectorizes without SSE4.1.
+ */
+static inline double round_integer(double x) {
+    return (x + ROUNDING_MAGIC) - ROUNDING_MAGIC;
+}
+
+/**
+ * Reduce degrees to [-180, 180] (a rounding either way may leave a value
+ * just outside); exact, since 360 * turns needs at most 50 bits and the
+ * difference is a multiple of the argument's ulp
+ */
+static inline double reduce_turns(double degrees) {
+    double turns = round_integer(degrees * (1.0 / 360.0));
+    return degrees - turns * 360.0;
+}
+
+/**
+ * Sine and cosine of an angle already reduced to about [-180, 180]
+ * @param branch_free: constant; true in the batch loops, which must not
+ *                     branch, false where a predictable branch is cheaper
+ */
+static inline void sincos_reduced(double degrees, bool branch_free,
+                                  double *sine, double *cosine) {
+    // Nearest multiple of 90 leaves |rest| <= 45, again exactly
+    double quadrant = round_integer(degrees * (1.0 / 90.0));
+    double rest = degrees - quadrant * 90.0;
+
+    double t = rest * DEGREE_HI + rest * DEGREE_LO;
+    double t2 = t * t;
+    double t4 = t2 * t2;
+    double s = t + t * t2 *
+                       (SIN_S1 + t2 * SIN_S2 +
+                        t4 * (SIN_S3 + t2 * SIN_S4 +
+                              t4 * (SIN_S5 + t2 * SIN_S6)));
+    double c = 1.0 - 0.5 * t2 +
+               t4 * (COS_C1 + t2 * COS_C2 +
+                     t4 * (COS_C3 + t2 * COS_C4 +
+                           t4 * (COS_C5 + t2 * COS_C6)));
+
+    // Special angles; rest = 0 is already exact (s = 0, c = 1). The
+    // comparisons are 0.0/1.0 factors rather than selects, which gcc only
+    // vectorizes with -fno-trapping-math
+    double magnitude = fabs(rest);
+    if (branch_free || magnitude == 30.0 || magnitude == 45.0) {
+        double is_30 = magnitude == 30.0;
+        double is_45 = magnitude == 45.0;
+        double keep = 1.0 - is_30 - is_45;
+        s = keep * s + is_30 * copysign(0.5, rest) +
+            is_45 * copysign(SQRT_HALF, rest);
+        c = keep * c + is_30 * SQRT3_HALF + is_45 * SQRT_HALF;
+    }
+
+    // Angle addition with cos and sin of 90 * quadrant, which are exact
+    // polynomials for the integer quadrant in [-2, 2] (one is 0, the
+    // other +-1); adding 0.0 turns -0 into +0
+    double axis_cosine = 1.0 - fabs(quadrant);
+    double axis_sine = quadrant * (2.0 - fabs(quadrant));
+    *sine = s * axis_cosine + c * axis_sine + 0.0;
+    *cosine = c * axis_cosine - s * axis_sine + 0.0;
+}
+
+void degree_sincos(double degrees, double *sine, double *cosine) {
+    // fmod() is exact too, just slower; it also turns inf into NaN
+    double reduced = fabs(degrees) < REDUCTION_LIMIT ? degrees
+                                                     : fmod(degrees, 360.0);
+    sincos_reduced(reduce_turns(reduced), false, sine, cosine);
+}
+
+bool degree_tan(double degrees, double *result) {
+    double sine, cosine;
+    degree_sincos(degrees, &sine, &cosine);
+    // The cosine is exactly zero at, and only at, odd multiples of 90
+    if (cosine == 0.0) return false;
+    *result = sine / cosine + 0.0;  // tan(180) is +0, not -0
+    return true;
+}
+
+/**
+ * =======================================================================
+ *                         PUBLIC LIBRARY API
+ * =======================================================================
+ */
+
+/**
+ * Which results a batch loop stores
+ */
+typedef enum { BATCH_SIN, BATCH_COS, BATCH_TAN } BatchFunction;
+
+/**
+ * Evaluate a kernel over an array, one block at a time
+ * The first loop over a block is branch-free and vectorizes; arguments
+ * too large (or not finite) for the arithmetic reduction are redone one
+ * by one from a copy of the block, so results may overwrite degrees.
+ */
+static void degree_batch(BatchFunction function, const double *degrees,
+                         double *results, size_t count) {
+    double block[BATCH_BLOCK];
+    for (size_t start = 0; start < count; start += BATCH_BLOCK) {
+        size_t length = count - start < BATCH_BLOCK ? count - start
+                                                    : BATCH_BLOCK;
+        memcpy(block, degrees + start, length * sizeof(double));
+        double *out = results + start;
+
+        // One loop per function keeps every loop free of branches
+        switch (function) {
+            case BATCH_SIN:
+                for (size_t i = 0; i < length; i++) {
+                    double sine, cosine;
+                    sincos_reduced(reduce_turns(block[i]), true, &sine,
+                                   &cosine);
+                    out[i] = sine;
+                }
+                break;
+            case BATCH_COS:
+                for (size_t i = 0; i < length; i++) {
+                    double sine, cosine;
+                    sincos_reduced(reduce_turns(block[i]), true, &sine,
+                                   &cosine);
+                    out[i] = cosine;
+                }
+                break;
+            case BATCH_TAN:
+                for (size_t i = 0; i < length; i++) {
+                    double sine, cosine;
+                    sincos_reduced(reduce_turns(block[i]), true, &sine,
+                                   &cosine);
+                    // Only an exactly zero cosine makes the quotient
+                    // infinite, and inf - inf turns that into NaN
+                    double tangent = sine / cosine;
+                    out[i] = tangent + (tangent - tangent);
+                }
+                break;
+        }
+
+        for (size_t i = 0; i < length; i++) {
+            if (fabs(block[i]) < REDUCTION_LIMIT) continue;
+            double sine, cosine, tangent;
+            degree_sincos(block[i], &sine, &cosine);
+            out[i] = function == BATCH_SIN   ? sine
+                     : function == BATCH_COS ? cosine
+                     : degree_tan(block[i], &tangent) ? tangent
+                                                       : NAN;
+        }
+    }
+}
+
+void calc_sin_degrees_batch(const double *degrees, double *results,
+                            size_t count) {
+    degree_batch(BATCH_SIN, degrees, results, count);
+}
+
+void calc_cos_degrees_batch(const double *degrees, double *results,
+                            size_t count) {
+    degree_batch(BATCH_COS, degrees, results, count);
+}
+
+void calc_tan_degrees_batch(const double *degrees, double *results,
+                            size_t count) {
+    degree_batch(BATCH_TAN, degrees, results, count);
+}
@@ -2,20 +2,29 @@
  * ========================================================================
  *    C GUI CALCULATOR - Scientific Calculator with Expression Parsing
  * ========================================================================
+ *
+ * GTK front end and headless modes. Expression parsing and evaluation live
+ * in the GTK-independent engine library (libcalc/).
  */
 
+#include <errno.h>
 #include <gtk/gtk.h>
-#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-// Ensure M_PI is defined for mathematical calculations
-#ifndef M_PI
-#define M_PI 3.14159265358979323846
+#ifdef G_OS_UNIX
+#include <signal.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 #endif
 
+#include "libcalc/calc.h"
+#include "libcalc/calc_perf.h"
+
 /**
  * =======================================================================
  *                            DATA STRUCTURES
@@ -23,722 +32,2405 @@
  */
 
 /**
- * Main calculator state - holds GUI widgets and current input
+ * Append-only calculation history with an in-memory n-gram index
+ *
+ * Records are stored one per line as "expression\tresult\n". The log that
+ * existed at startup is memory-mapped and split into records lazily from an
+ * idle handler, so opening a large history costs a single mmap. Records
+ * appended during this session live in `session_data`. Offsets below
+ * `mapped_length` point into the mapping, larger ones into `session_data`.
  */
 typedef struct {
-    GtkWidget *entry;      // Display entry widget
-    GString *input;        // Current input string buffer
-    char last_error[128];  // Last error message
-    bool just_evaluated;   // Flag to clear display on next number input
-} CalculatorState;
+    GMappedFile *mapped;      // Read-only mapping of the log at startup
+    const char *mapped_data;  // Start of the mapped bytes (NULL if empty)
+    gsize mapped_length;      // Number of mapped bytes
+    GString *session_data;    // Records appended during this session
+    FILE *append_stream;      // Log file opened for appending
+    GArray *record_offsets;   // Offset (guint64) of every indexed record
+    guint64 indexed_bytes;    // Bytes of the log already indexed
+    GHashTable *ngram_index;  // n-gram key -> GArray of record ids
+    guint index_source;       // Idle source building the index (0 if done)
+    void (*indexed)(gpointer data);  // Told once the index is complete
+    gpointer indexed_data;           // Passed unchanged to `indexed`
+} HistoryLog;
 
 /**
- * Token types for mathematical expressions
+ * Node of the input rope - leaves hold text, inner nodes join two ropes
+ * Nodes never change once built, so versions of the input (undo and redo
+ * snapshots) share every node they have in common; they are reference
+ * counted and freed with the last version using them.
  */
-typedef enum {
-    TOK_NUMBER,    // Numeric values (integers, decimals, percentages)
-    TOK_OPERATOR,  // Mathematical operators (+, -, *, /, ^)
-    TOK_LPAREN,    // Left parenthesis (
-    TOK_RPAREN,    // Right parenthesis )
-    TOK_FUNCTION,  // Mathematical functions (sin, cos, sqrt, etc.)
-    TOK_END,       // End of expression
-    TOK_INVALID    // Invalid/unrecognized token
-} TokenType;
+typedef struct RopeNode {
+    struct RopeNode *left;   // First part (NULL for leaves)
+    struct RopeNode *right;  // Second part (NULL for leaves)
+    gsize bytes;             // Bytes of text under this node
+    gsize chars;             // UTF-8 characters under this node
+    guint height;            // 0 for leaves; AVL balanced above
+    guint references;        // Parents and versions holding the node
+    char text[];             // Leaves: their UTF-8 text, without a NUL
+} RopeNode;
 
 /**
- * Individual token in a mathematical expression
+ * One edit of the input as its listener sees it: `removed` characters at
+ * `position` were replaced with `inserted`; a cursor move alone removes
+ * and inserts nothing
  */
 typedef struct {
-    TokenType type;    // Type of this token
-    double value;      // Numeric value (for TOK_NUMBER)
-    char operator;     // Operator character (for TOK_OPERATOR)
-    char function[8];  // Function name (for TOK_FUNCTION)
-} Token;
+    gsize position;        // First changed character
+    gsize removed;         // Characters removed there
+    const char *inserted;  // Text inserted in their place
+    gsize inserted_bytes;  // Bytes of that text
+    gsize cursor;          // Cursor position (in characters) afterwards
+} InputChange;
+
+/**
+ * Listener of an InputBuffer, called after each change
+ */
+typedef void (*InputChangeFunc)(const InputChange *change, gpointer data);
 
 /**
- * Lexical analyzer state - tracks position in input string
+ * Earlier (undo) or later (redo) version of the input, and the range in
+ * which it differs from the version it is restored over
  */
 typedef struct {
-    const char *input;  // Input expression string
-    size_t position;    // Current parsing position
-} Lexer;
+    RopeNode *text;   // Contents of that version
+    gsize cursor;     // Cursor of that version
+    gsize position;   // First character that differs
+    gsize replaced;   // Characters of the current version that differ
+    gsize restored;   // Characters of `text` that take their place
+} InputSnapshot;
 
 /**
- * Dynamic stack for Token objects
+ * Editable input with a cursor, kept in a persistent rope
+ * Edits anywhere take O(log n) time and memory, and every edit keeps the
+ * previous version as an undo snapshot that shares all unchanged nodes.
  */
 typedef struct {
-    Token *data;   // Array of tokens
-    int top;       // Index of top element (-1 if empty)
-    int capacity;  // Current capacity of array
-} TokenStack;
+    RopeNode *text;           // Current contents (NULL when empty)
+    gsize cursor;             // Cursor position in characters
+    GQueue undo;              // InputSnapshot list, newest first
+    GQueue redo;              // InputSnapshot list, next first
+    GString *flat;            // Contents as one string, built on demand
+    bool flat_valid;          // Whether `flat` matches the contents
+    InputChangeFunc changed;  // Told of every change (may be NULL)
+    gpointer changed_data;    // Passed unchanged to `changed`
+} InputBuffer;
 
 /**
- * Dynamic stack for numeric values
+ * Main calculator state - holds GUI widgets and current input
  */
 typedef struct {
-    double *data;  // Array of doubles
-    int top;       // Index of top element (-1 if empty)
-    int capacity;  // Current capacity of array
-} NumberStack;
+    GtkWidget *entry;           // Display entry widget
+    GtkWidget *panel_box;       // Container the secondary panels join
+    guint panels_source;        // Idle source building them (0 if done)
+    InputBuffer *input;         // Current input and its undo history
+    bool display_shows_input;   // Display holds the input, not a message
+    bool syncing_display;       // Input changes are being applied to it
+    CalcContext *calc;          // Evaluation engine context
+    bool just_evaluated;        // Flag to clear display on next number input
+    GThread *evaluation;        // Worker evaluating "=" (NULL if none)
+    guint evaluation_notice;    // Timeout announcing it (0 if none)
+    HistoryLog *history;        // Persistent calculation history
+    GtkWidget *history_panel;   // Container of the history search panel
+    GtkWidget *history_search;  // Search entry of the history panel
+    GtkWidget *history_list;    // List box showing matching records
+    bool history_partial;       // List made before the index was complete
+    GtkWidget *programmer_panel;  // Hex digits and bitwise operators (Ctrl+P)
+    int display_base;             // Result base in programmer mode
+    GtkWidget *matrix_panel;      // Matrix literals and functions (Ctrl+M)
+#ifdef CALC_ENABLE_PERF
+    GtkWidget *stats_panel;  // Hidden latency statistics panel (Ctrl+D)
+    GtkWidget *stats_label;  // Report text of the statistics panel
+    guint stats_source;      // Timeout refreshing the panel (0 if hidden)
+#endif
+} CalculatorState;
+
+/**
+ * Append the last result of a context, a vector or matrix, in the literal
+ * syntax ("[1,2;3,4]") with `digits` significant digits per element
+ */
+static void append_matrix(GString *output, const CalcContext *calc,
+                          int digits) {
+    size_t rows, columns;
+    const double *elements = calc_last_matrix(calc, &rows, &columns);
+    g_string_append_c(output, '[');
+    for (size_t i = 0; i < rows; i++) {
+        for (size_t j = 0; j < columns; j++) {
+            const char *separator = j > 0 ? "," : i > 0 ? ";" : "";
+            g_string_append_printf(output, "%s%.*g", separator, digits,
+                                   elements[i * columns + j]);
+        }
+    }
+    g_string_append_c(output, ']');
+}
 
 /**
  * =======================================================================
- *                            UTILITY FUNCTIONS
+ *                   PERSISTENT CALCULATION HISTORY
  * =======================================================================
  */
 
+#define HISTORY_SEARCH_LIMIT 50   // Maximum records listed in the panel
+#define HISTORY_INDEX_BATCH 4096  // Records indexed per idle callback
+#define HISTORY_SCAN_LIMIT 65536  // Unindexed bytes one search may scan
+
+/**
+ * Default location of the history log inside the user data directory
+ */
+static char *history_default_path(void) {
+    char *directory =
+        g_build_filename(g_get_user_data_dir(), "c-gui-calculator", NULL);
+    g_mkdir_with_parents(directory, 0700);
+    char *path = g_build_filename(directory, "history.log", NULL);
+    g_free(directory);
+    return path;
+}
+
+/**
+ * Resolve a log offset to bytes in either the mapping or the session buffer
+ * @param available: receives the number of bytes readable from the result
+ */
+static const char *history_data_at(HistoryLog *log, guint64 offset,
+                                   gsize *available) {
+    if (offset < log->mapped_length) {
+        *available = log->mapped_length - offset;
+        return log->mapped_data + offset;
+    }
+    offset -= log->mapped_length;
+    *available = log->session_data->len - offset;
+    return log->session_data->str + offset;
+}
+
+/**
+ * Locate the expression and result of the record starting at an offset
+ * Returns false if the record is incomplete (no terminating newline)
+ */
+static bool history_record_at(HistoryLog *log, guint64 offset,
+                              const char **expression, gsize *expression_len,
+                              const char **result, gsize *result_len) {
+    gsize available = 0;
+    const char *start = history_data_at(log, offset, &available);
+    const char *newline = memchr(start, '\n', available);
+    if (!newline) return false;
+
+    const char *tab = memchr(start, '\t', newline - start);
+    *expression = start;
+    *expression_len = tab ? (gsize)(tab - start) : (gsize)(newline - start);
+    *result = tab ? tab + 1 : newline;
+    *result_len = tab ? (gsize)(newline - tab - 1) : 0;
+    return true;
+}
+
 /**
- * Clear error buffer by setting first character to null terminator
+ * Pack an n-gram (n = 1 to 3) into a hash key, tagging it with its length
  */
-static void clear_error(char *error_buffer, size_t error_size) {
-    if (error_buffer && error_size > 0) {
-        error_buffer[0] = '\0';
+static guint32 history_ngram_key(const char *text, gsize n) {
+    guint32 key = (guint32)n << 24;
+    for (gsize i = 0; i < n; i++) {
+        key |= (guint32)(unsigned char)text[i] << (8 * (n - 1 - i));
     }
+    return key;
 }
 
 /**
- * Check if character is valid for function names (lowercase letters)
+ * Free a posting list stored in the n-gram index
  */
-static bool is_function_char(char c) { return (c >= 'a' && c <= 'z'); }
+static void history_postings_free(gpointer postings) {
+    g_array_free((GArray *)postings, TRUE);
+}
 
 /**
- * Skip whitespace characters in input
+ * Add every byte, bigram and trigram of an expression to the index
+ * Posting lists stay sorted because record ids are assigned in log order
  */
-static void skip_whitespace(Lexer *lexer) {
-    while (lexer->input[lexer->position] != '\0' &&
-           (lexer->input[lexer->position] == ' ' ||
-            lexer->input[lexer->position] == '\t')) {
-        lexer->position++;
+static void history_index_expression(HistoryLog *log, guint32 record_id,
+                                     const char *expression, gsize length) {
+    for (gsize n = 1; n <= 3; n++) {
+        for (gsize i = 0; i + n <= length; i++) {
+            gpointer key =
+                GUINT_TO_POINTER(history_ngram_key(expression + i, n));
+            GArray *postings = g_hash_table_lookup(log->ngram_index, key);
+            if (!postings) {
+                postings = g_array_sized_new(FALSE, FALSE, sizeof(guint32), 4);
+                g_hash_table_insert(log->ngram_index, key, postings);
+            }
+            // Skip repeated n-grams within the same expression
+            if (postings->len == 0 ||
+                g_array_index(postings, guint32, postings->len - 1) !=
+                    record_id) {
+                g_array_append_val(postings, record_id);
+            }
+        }
     }
 }
 
 /**
- * Check if operator is right-associative
- * Only exponentiation (^) is right-associative: 2^3^2 = 2^(3^2) = 512, not
- * (2^3)^2 = 64
+ * Index the next unindexed record of the log
+ * Returns false once everything written so far has been indexed
  */
-static bool is_right_associative(char op) { return op == '^'; }
+static bool history_index_next_record(HistoryLog *log) {
+    guint64 total = log->mapped_length + log->session_data->len;
+    if (log->indexed_bytes >= total) return false;
+
+    const char *expression, *result;
+    gsize expression_len, result_len;
+    if (!history_record_at(log, log->indexed_bytes, &expression,
+                           &expression_len, &result, &result_len)) {
+        // A torn write at the end of the old log: skip the partial record
+        if (log->indexed_bytes < log->mapped_length) {
+            log->indexed_bytes = log->mapped_length;
+            return true;
+        }
+        return false;
+    }
+
+    guint32 record_id = log->record_offsets->len;
+    g_array_append_val(log->record_offsets, log->indexed_bytes);
+    history_index_expression(log, record_id, expression, expression_len);
+
+    // Record length: expression, optional tab and result, newline
+    log->indexed_bytes += (result + result_len + 1) - expression;
+    return true;
+}
+
+/**
+ * Idle handler that indexes the startup log in small batches, then tells
+ * the `indexed` callback so that searches made meanwhile can be repeated
+ */
+static gboolean history_index_step(gpointer user_data) {
+    HistoryLog *log = (HistoryLog *)user_data;
+    for (int i = 0; i < HISTORY_INDEX_BATCH; i++) {
+        if (!history_index_next_record(log)) {
+            log->index_source = 0;
+            if (log->indexed) log->indexed(log->indexed_data);
+            return G_SOURCE_REMOVE;
+        }
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Open (or create) the history log and schedule background indexing
+ * Only maps the existing file; no record is read until the index runs
+ */
+static HistoryLog *history_open(const char *path) {
+    HistoryLog *log = (HistoryLog *)calloc(1, sizeof(HistoryLog));
+    if (!log) return NULL;
+
+    log->mapped = g_mapped_file_new(path, FALSE, NULL);
+    if (log->mapped) {
+        log->mapped_data = g_mapped_file_get_contents(log->mapped);
+        log->mapped_length = g_mapped_file_get_length(log->mapped);
+    }
+    log->session_data = g_string_new("");
+    log->record_offsets = g_array_new(FALSE, FALSE, sizeof(guint64));
+    log->ngram_index = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                             NULL, history_postings_free);
+
+    log->append_stream = fopen(path, "ab");
+    if (log->append_stream && log->mapped_length > 0 &&
+        log->mapped_data[log->mapped_length - 1] != '\n') {
+        // Terminate a torn record so new records start on their own line
+        fputc('\n', log->append_stream);
+    }
+
+    log->index_source =
+        g_idle_add_full(G_PRIORITY_LOW, history_index_step, log, NULL);
+    return log;
+}
+
+/**
+ * Flush and release the history log
+ */
+static void history_close(HistoryLog *log) {
+    if (!log) return;
+    if (log->index_source) g_source_remove(log->index_source);
+    if (log->append_stream) fclose(log->append_stream);
+    if (log->mapped) g_mapped_file_unref(log->mapped);
+    g_hash_table_destroy(log->ngram_index);
+    g_array_free(log->record_offsets, TRUE);
+    g_string_free(log->session_data, TRUE);
+    free(log);
+}
+
+/**
+ * Append an evaluated expression and its displayed result to the log
+ */
+static void history_append(HistoryLog *log, const char *expression,
+                           const char *result) {
+    if (!log || expression[0] == '\0' || strpbrk(expression, "\t\n")) return;
+
+    if (log->append_stream) {
+        fprintf(log->append_stream, "%s\t%s\n", expression, result);
+        fflush(log->append_stream);
+    }
+    g_string_append_printf(log->session_data, "%s\t%s\n", expression, result);
+
+    // Index immediately unless the background indexer is still catching up
+    if (!log->index_source) {
+        while (history_index_next_record(log)) {
+        }
+    }
+}
+
+/**
+ * Check whether the expression of a record contains the query
+ */
+static bool history_record_matches(HistoryLog *log, guint64 offset,
+                                   const char *query, gsize query_len) {
+    const char *expression, *result;
+    gsize expression_len, result_len;
+    if (!history_record_at(log, offset, &expression, &expression_len, &result,
+                           &result_len)) {
+        return false;
+    }
+    if (query_len == 0) return true;
+    if (expression_len < query_len) return false;
+    for (gsize i = 0; i + query_len <= expression_len; i++) {
+        if (memcmp(expression + i, query, query_len) == 0) return true;
+    }
+    return false;
+}
+
+/**
+ * Binary search a sorted posting list for a record id
+ */
+static bool history_postings_contain(GArray *postings, guint32 record_id) {
+    guint low = 0, high = postings->len;
+    while (low < high) {
+        guint middle = low + (high - low) / 2;
+        guint32 value = g_array_index(postings, guint32, middle);
+        if (value == record_id) return true;
+        if (value < record_id) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return false;
+}
+
+/**
+ * Scan the unindexed records in [from, to) of the log from the newest
+ * backwards, stopping once `budget` bytes have been scanned
+ * Records never span the end of the mapping, so [from, to) lies inside one
+ * segment; a partial record at its end is skipped like the indexer does.
+ * @return: false if the budget ran out before `from` was reached
+ */
+static bool history_scan_tail(HistoryLog *log, guint64 from, guint64 to,
+                              const char *query, gsize query_len,
+                              guint64 *matches, guint *count, guint limit,
+                              gsize *budget) {
+    if (from >= to) return true;
+    gsize available = 0;
+    const char *base = history_data_at(log, from, &available);
+    gsize end = to - from;
+    while (end > 0 && base[end - 1] != '\n') end--;
+
+    while (end > 0 && *count < limit) {
+        gsize start = end - 1;
+        while (start > 0 && base[start - 1] != '\n') start--;
+        if (end - start > *budget) return false;
+        *budget -= end - start;
+        if (history_record_matches(log, from + start, query, query_len)) {
+            matches[(*count)++] = from + start;
+        }
+        end = start;
+    }
+    return true;
+}
+
+/**
+ * Find records whose expression contains the query, newest first
+ * Indexed records are found by intersecting the posting lists of the
+ * query's n-grams. Records not yet indexed (while the startup log is being
+ * indexed) are scanned directly, newest first and at most
+ * HISTORY_SCAN_LIMIT bytes of them, so a keystroke never scans the log.
+ * @param matches: receives record offsets
+ * @param limit: capacity of matches
+ * @param complete: set to false if unindexed records were left unscanned;
+ *                  the search should be repeated from the `indexed` callback
+ * @return: number of matches written
+ */
+static guint history_search(HistoryLog *log, const char *query,
+                            guint64 *matches, guint limit, bool *complete) {
+    *complete = true;
+    if (!log || limit == 0) return 0;
+    gsize query_len = strlen(query);
+    guint count = 0;
+
+    // Records appended this session are newer than the whole mapping
+    gsize budget = HISTORY_SCAN_LIMIT;
+    guint64 total = log->mapped_length + log->session_data->len;
+    guint64 session_start = MAX(log->indexed_bytes, log->mapped_length);
+    if (!history_scan_tail(log, session_start, total, query, query_len,
+                           matches, &count, limit, &budget) ||
+        !history_scan_tail(log, log->indexed_bytes, log->mapped_length, query,
+                           query_len, matches, &count, limit, &budget)) {
+        *complete = false;
+    }
+    if (count == limit) return count;
+
+    // Collect posting lists for every n-gram of the query (trigrams when
+    // possible, otherwise the single bigram or byte); the shortest drives
+    // the scan
+    GPtrArray *lists = g_ptr_array_new();
+    gsize n = MIN(query_len, 3);
+    for (gsize i = 0; n > 0 && i + n <= query_len; i++) {
+        GArray *postings = g_hash_table_lookup(
+            log->ngram_index,
+            GUINT_TO_POINTER(history_ngram_key(query + i, n)));
+        if (!postings) {
+            g_ptr_array_free(lists, TRUE);
+            return count;  // An n-gram never seen: no indexed match
+        }
+        g_ptr_array_add(lists, postings);
+    }
+
+    GArray *driver = NULL;
+    for (guint i = 0; i < lists->len; i++) {
+        GArray *postings = g_ptr_array_index(lists, i);
+        if (!driver || postings->len < driver->len) driver = postings;
+    }
+
+    guint record_count = driver ? driver->len : log->record_offsets->len;
+    for (guint i = record_count; i > 0 && count < limit; i--) {
+        guint32 record_id =
+            driver ? g_array_index(driver, guint32, i - 1) : i - 1;
+
+        bool candidate = true;
+        for (guint j = 0; j < lists->len && candidate; j++) {
+            GArray *postings = g_ptr_array_index(lists, j);
+            if (postings != driver) {
+                candidate = history_postings_contain(postings, record_id);
+            }
+        }
+
+        guint64 offset =
+            g_array_index(log->record_offsets, guint64, record_id);
+        if (candidate &&
+            history_record_matches(log, offset, query, query_len)) {
+            matches[count++] = offset;
+        }
+    }
+
+    g_ptr_array_free(lists, TRUE);
+    return count;
+}
 
 /**
  * =======================================================================
- *             MATHEMATICAL FUNCTIONS WITH DOMAIN VALIDATION
+ *                        EDITABLE INPUT BUFFER
  * =======================================================================
+ *
+ * The input is a rope: an AVL-balanced tree whose leaves hold up to
+ * ROPE_LEAF_BYTES of text. Inserting or deleting anywhere splits and
+ * joins O(log n) nodes, and since nodes are never modified, an undo
+ * snapshot is just the old root. Listeners are told the exact range of
+ * every change, so the display applies small edits instead of taking the
+ * whole text again; the engine still parses whole expressions, so the
+ * text is flattened only when it is evaluated.
  */
 
+#define ROPE_LEAF_BYTES 128   // Largest leaf; small neighbours are merged
+#define INPUT_UNDO_LIMIT 256  // Undo snapshots kept per input
+
 /**
- * Convert degrees to radians for trigonometric functions
- * Makes trig functions user-friendly by accepting degrees
+ * Sizes of a rope that may be empty (NULL)
  */
-static inline double deg2rad(double degrees) { return degrees * M_PI / 180.0; }
+static gsize rope_chars(const RopeNode *node) {
+    return node ? node->chars : 0;
+}
+
+static guint rope_height(const RopeNode *node) {
+    return node ? node->height : 0;
+}
 
 /**
- * Safe division - checks for division by zero
- * @param a: dividend
- * @param b: divisor
- * @param out: result pointer
- * @param err: error message buffer
- * @param es: error buffer size
- * @return: true if successful, false if error
+ * Take and drop references; a node is freed with its last reference
  */
-static bool safe_divide(double a, double b, double *out, char *err, size_t es) {
-    if (fabs(b) < 1e-15) {  // More precise zero check
-        snprintf(err, es, "Division by zero");
-        return false;
+static RopeNode *rope_ref(RopeNode *node) {
+    if (node) node->references++;
+    return node;
+}
+
+static void rope_unref(RopeNode *node) {
+    if (!node || --node->references > 0) return;
+    rope_unref(node->left);
+    rope_unref(node->right);
+    g_free(node);
+}
+
+/**
+ * New leaf of `bytes` bytes (`chars` characters); the caller fills it in
+ */
+static RopeNode *rope_leaf(gsize bytes, gsize chars) {
+    RopeNode *leaf = g_malloc(sizeof(RopeNode) + bytes);
+    leaf->left = leaf->right = NULL;
+    leaf->bytes = bytes;
+    leaf->chars = chars;
+    leaf->height = 0;
+    leaf->references = 1;
+    return leaf;
+}
+
+/**
+ * Inner node over two non-empty ropes, taking over their references
+ */
+static RopeNode *rope_node(RopeNode *left, RopeNode *right) {
+    RopeNode *node = g_new(RopeNode, 1);
+    node->left = left;
+    node->right = right;
+    node->bytes = left->bytes + right->bytes;
+    node->chars = left->chars + right->chars;
+    node->height = MAX(left->height, right->height) + 1;
+    node->references = 1;
+    return node;
+}
+
+/**
+ * Inner node over two ropes whose heights differ by at most two, rotated
+ * back into AVL balance
+ */
+static RopeNode *rope_balance(RopeNode *left, RopeNode *right) {
+    if (rope_height(left) > rope_height(right) + 1) {
+        RopeNode *outer = rope_ref(left->left);
+        RopeNode *inner = rope_ref(left->right);
+        rope_unref(left);
+        if (rope_height(outer) >= rope_height(inner)) {
+            return rope_node(outer, rope_node(inner, right));
+        }
+        RopeNode *inner_left = rope_ref(inner->left);
+        RopeNode *inner_right = rope_ref(inner->right);
+        rope_unref(inner);
+        return rope_node(rope_node(outer, inner_left),
+                         rope_node(inner_right, right));
+    }
+    if (rope_height(right) > rope_height(left) + 1) {
+        RopeNode *outer = rope_ref(right->right);
+        RopeNode *inner = rope_ref(right->left);
+        rope_unref(right);
+        if (rope_height(outer) >= rope_height(inner)) {
+            return rope_node(rope_node(left, inner), outer);
+        }
+        RopeNode *inner_left = rope_ref(inner->left);
+        RopeNode *inner_right = rope_ref(inner->right);
+        rope_unref(inner);
+        return rope_node(rope_node(left, inner_left),
+                         rope_node(inner_right, outer));
+    }
+    return rope_node(left, right);
+}
+
+/**
+ * Concatenate two ropes (either may be NULL), taking over their references
+ * Only the path along which the shorter rope is attached is rebuilt, and
+ * two small leaves that meet become one, so typing keeps leaves full.
+ */
+static RopeNode *rope_join(RopeNode *left, RopeNode *right) {
+    if (!left) return right;
+    if (!right) return left;
+    if (left->height == 0 && right->height == 0 &&
+        left->bytes + right->bytes <= ROPE_LEAF_BYTES) {
+        RopeNode *leaf = rope_leaf(left->bytes + right->bytes,
+                                   left->chars + right->chars);
+        memcpy(leaf->text, left->text, left->bytes);
+        memcpy(leaf->text + left->bytes, right->text, right->bytes);
+        rope_unref(left);
+        rope_unref(right);
+        return leaf;
+    }
+    if (left->height > right->height + 1) {
+        RopeNode *outer = rope_ref(left->left);
+        RopeNode *inner = rope_ref(left->right);
+        rope_unref(left);
+        return rope_balance(outer, rope_join(inner, right));
+    }
+    if (right->height > left->height + 1) {
+        RopeNode *outer = rope_ref(right->right);
+        RopeNode *inner = rope_ref(right->left);
+        rope_unref(right);
+        return rope_balance(rope_join(left, inner), outer);
+    }
+    return rope_node(left, right);
+}
+
+/**
+ * Split a rope before character `index` into two new references; the
+ * rope itself is only borrowed
+ */
+static void rope_split(RopeNode *node, gsize index, RopeNode **left,
+                       RopeNode **right) {
+    if (!node || index == 0) {
+        *left = NULL;
+        *right = rope_ref(node);
+    } else if (index >= node->chars) {
+        *left = rope_ref(node);
+        *right = NULL;
+    } else if (node->height == 0) {
+        gsize offset = g_utf8_offset_to_pointer(node->text, index) - node->text;
+        *left = rope_leaf(offset, index);
+        memcpy((*left)->text, node->text, offset);
+        *right = rope_leaf(node->bytes - offset, node->chars - index);
+        memcpy((*right)->text, node->text + offset, node->bytes - offset);
+    } else if (index <= node->left->chars) {
+        RopeNode *rest;
+        rope_split(node->left, index, left, &rest);
+        *right = rope_join(rest, rope_ref(node->right));
+    } else {
+        RopeNode *rest;
+        rope_split(node->right, index - node->left->chars, &rest, right);
+        *left = rope_join(rope_ref(node->left), rest);
+    }
+}
+
+/**
+ * Balanced rope over a copy of valid UTF-8 text (NULL when empty)
+ */
+static RopeNode *rope_build(const char *text, gsize bytes) {
+    if (bytes <= ROPE_LEAF_BYTES) {
+        if (bytes == 0) return NULL;
+        RopeNode *leaf = rope_leaf(bytes, g_utf8_strlen(text, bytes));
+        memcpy(leaf->text, text, bytes);
+        return leaf;
     }
-    *out = a / b;
+    gsize middle = bytes / 2;
+    while ((text[middle] & 0xC0) == 0x80) middle--;  // Not inside a character
+    return rope_join(rope_build(text, middle),
+                     rope_build(text + middle, bytes - middle));
+}
+
+/**
+ * Copy the text of a rope to `out`
+ * @return: the end of the copied text
+ */
+static char *rope_copy(const RopeNode *node, char *out) {
+    if (!node) return out;
+    if (node->height == 0) {
+        memcpy(out, node->text, node->bytes);
+        return out + node->bytes;
+    }
+    return rope_copy(node->right, rope_copy(node->left, out));
+}
+
+/**
+ * Copy `count` characters of a rope, starting at `position`, to a string
+ */
+static void rope_copy_range(RopeNode *node, gsize position, gsize count,
+                            GString *out) {
+    RopeNode *before, *rest, *range, *after;
+    rope_split(node, position, &before, &rest);
+    rope_split(rest, count, &range, &after);
+    g_string_set_size(out, range ? range->bytes : 0);
+    rope_copy(range, out->str);
+    rope_unref(before);
+    rope_unref(rest);
+    rope_unref(range);
+    rope_unref(after);
+}
+
+static void input_snapshot_free(gpointer data) {
+    InputSnapshot *snapshot = data;
+    rope_unref(snapshot->text);
+    g_free(snapshot);
+}
+
+/**
+ * Empty input; `changed` is told of every later change
+ */
+static InputBuffer *input_buffer_new(InputChangeFunc changed, gpointer data) {
+    InputBuffer *buffer = g_new0(InputBuffer, 1);
+    g_queue_init(&buffer->undo);
+    g_queue_init(&buffer->redo);
+    buffer->flat = g_string_new("");
+    buffer->flat_valid = true;
+    buffer->changed = changed;
+    buffer->changed_data = data;
+    return buffer;
+}
+
+static void input_buffer_free(InputBuffer *buffer) {
+    rope_unref(buffer->text);
+    g_queue_clear_full(&buffer->undo, input_snapshot_free);
+    g_queue_clear_full(&buffer->redo, input_snapshot_free);
+    g_string_free(buffer->flat, TRUE);
+    g_free(buffer);
+}
+
+/**
+ * Contents as a NUL-terminated string, valid until the next change
+ * Built from the rope when it is first needed after a change.
+ */
+static const char *input_buffer_text(InputBuffer *buffer) {
+    if (!buffer->flat_valid) {
+        g_string_set_size(buffer->flat, buffer->text ? buffer->text->bytes : 0);
+        rope_copy(buffer->text, buffer->flat->str);
+        buffer->flat_valid = true;
+    }
+    return buffer->flat->str;
+}
+
+static gsize input_buffer_length(const InputBuffer *buffer) {
+    return rope_chars(buffer->text);
+}
+
+static void input_buffer_notify(InputBuffer *buffer, gsize position,
+                                gsize removed, const char *inserted,
+                                gsize inserted_bytes) {
+    InputChange change = {position, removed, inserted, inserted_bytes,
+                          buffer->cursor};
+    if (buffer->changed) buffer->changed(&change, buffer->changed_data);
+}
+
+/**
+ * Replace `removed` characters at `position` with UTF-8 text and put the
+ * cursor after it; the previous contents become an undo snapshot
+ */
+static void input_buffer_replace(InputBuffer *buffer, gsize position,
+                                 gsize removed, const char *text) {
+    gsize length = input_buffer_length(buffer);
+    gsize bytes = strlen(text);
+    position = MIN(position, length);
+    removed = MIN(removed, length - position);
+    if ((removed == 0 && bytes == 0) || !g_utf8_validate(text, bytes, NULL)) {
+        return;
+    }
+
+    RopeNode *before, *rest, *old, *after;
+    rope_split(buffer->text, position, &before, &rest);
+    rope_split(rest, removed, &old, &after);
+    rope_unref(rest);
+    rope_unref(old);
+    RopeNode *inserted = rope_build(text, bytes);
+    gsize inserted_chars = rope_chars(inserted);
+
+    InputSnapshot *snapshot = g_new(InputSnapshot, 1);
+    snapshot->text = buffer->text;  // Takes over the reference
+    snapshot->cursor = buffer->cursor;
+    snapshot->position = position;
+    snapshot->replaced = inserted_chars;
+    snapshot->restored = removed;
+    g_queue_push_head(&buffer->undo, snapshot);
+    if (g_queue_get_length(&buffer->undo) > INPUT_UNDO_LIMIT) {
+        input_snapshot_free(g_queue_pop_tail(&buffer->undo));
+    }
+    g_queue_clear_full(&buffer->redo, input_snapshot_free);
+
+    buffer->text = rope_join(rope_join(before, inserted), after);
+    buffer->cursor = position + inserted_chars;
+    buffer->flat_valid = false;
+    input_buffer_notify(buffer, position, removed, text, bytes);
+}
+
+/**
+ * Insert text at the cursor
+ */
+static void input_buffer_insert(InputBuffer *buffer, const char *text) {
+    input_buffer_replace(buffer, buffer->cursor, 0, text);
+}
+
+/**
+ * Replace the whole input, leaving the cursor at its end
+ */
+static void input_buffer_set(InputBuffer *buffer, const char *text) {
+    input_buffer_replace(buffer, 0, input_buffer_length(buffer), text);
+}
+
+/**
+ * Delete the character before (Backspace) or after (Delete) the cursor
+ */
+static void input_buffer_delete(InputBuffer *buffer, bool before) {
+    if (before && buffer->cursor > 0) {
+        input_buffer_replace(buffer, buffer->cursor - 1, 1, "");
+    } else if (!before) {
+        input_buffer_replace(buffer, buffer->cursor, 1, "");
+    }
+}
+
+/**
+ * Move the cursor, clamped to the input
+ */
+static void input_buffer_move(InputBuffer *buffer, gsize cursor) {
+    buffer->cursor = MIN(cursor, input_buffer_length(buffer));
+    input_buffer_notify(buffer, buffer->cursor, 0, "", 0);
+}
+
+/**
+ * Restore the newest snapshot of `from` and push the current version onto
+ * `to`, so that undo and redo are the same operation in two directions
+ * @return: false if `from` is empty
+ */
+static bool input_buffer_restore(InputBuffer *buffer, GQueue *from,
+                                 GQueue *to) {
+    InputSnapshot *snapshot = g_queue_pop_head(from);
+    if (!snapshot) return false;
+
+    InputSnapshot *current = g_new(InputSnapshot, 1);
+    current->text = buffer->text;
+    current->cursor = buffer->cursor;
+    current->position = snapshot->position;
+    current->replaced = snapshot->restored;
+    current->restored = snapshot->replaced;
+    g_queue_push_head(to, current);
+
+    buffer->text = snapshot->text;
+    buffer->cursor = snapshot->cursor;
+    buffer->flat_valid = false;
+
+    GString *restored = g_string_new("");
+    rope_copy_range(buffer->text, snapshot->position, snapshot->restored,
+                    restored);
+    input_buffer_notify(buffer, snapshot->position, snapshot->replaced,
+                        restored->str, restored->len);
+    g_string_free(restored, TRUE);
+    g_free(snapshot);
     return true;
 }
 
+static bool input_buffer_undo(InputBuffer *buffer) {
+    return input_buffer_restore(buffer, &buffer->undo, &buffer->redo);
+}
+
+static bool input_buffer_redo(InputBuffer *buffer) {
+    return input_buffer_restore(buffer, &buffer->redo, &buffer->undo);
+}
+
 /**
- * Safe power function - handles edge cases
- * - 0^negative = undefined (division by zero)
- * - negative^non-integer = complex number (not supported)
+ * =======================================================================
+ *              LOCAL EVALUATION SERVICE (UNIX DOMAIN SOCKET)
+ * =======================================================================
+ *
+ * Protocol: clients send one expression per line. For every line, in
+ * order, the service answers "= <result>\n" or "! <error message>\n".
+ * Clients may pipeline any number of lines; every read is processed as one
+ * batch whose lines are split into chunks and evaluated on a shared worker
+ * pool, then answered with a single write.
  */
-static bool safe_power(double base, double exponent, double *out, char *err,
-                       size_t es) {
-    // Check for 0^negative
-    if (fabs(base) < 1e-15 && exponent < 0) {
-        snprintf(err, es, "Cannot raise zero to negative power");
-        return false;
+
+#ifdef G_OS_UNIX
+
+#define SERVICE_READ_SIZE 65536   // Bytes requested per read()
+#define SERVICE_MAX_LINE 4096     // Longest accepted expression
+#define SERVICE_CHUNK_LINES 512   // Lines evaluated per worker job
+
+/**
+ * Per-thread evaluation context - owned by one worker or connection thread
+ */
+typedef struct {
+    CalcContext *calc;                  // Engine context of this thread
+    char expression[SERVICE_MAX_LINE];  // NUL-terminated request line
+} ServiceContext;
+
+/**
+ * Lines received by one read, answered together
+ */
+typedef struct {
+    const char **lines;  // Start of each request line
+    guint *lengths;      // Length of each line (without newline)
+    guint count;         // Number of lines in the batch
+    GMutex lock;         // Protects pending
+    GCond finished;      // Signalled when the last chunk completes
+    gint pending;        // Chunks still being evaluated
+} ServiceBatch;
+
+/**
+ * Contiguous slice of a batch evaluated by one worker
+ */
+typedef struct {
+    ServiceBatch *batch;  // Batch the lines belong to
+    guint first;          // Index of the first line
+    guint count;          // Number of lines
+    GString *output;      // Responses for these lines, in order
+} ServiceChunk;
+
+/**
+ * Release a thread's evaluation context when the thread exits
+ */
+static void service_context_free(gpointer data) {
+    ServiceContext *context = (ServiceContext *)data;
+    calc_context_free(context->calc);
+    free(context);
+}
+
+static GPrivate service_context_key = G_PRIVATE_INIT(service_context_free);
+static GThreadPool *service_pool = NULL;
+
+// Sockets of the open connections, so shutdown can close them and wait
+static GMutex service_lock;
+static GCond service_closed;  // Signalled when a connection ends
+static GArray *service_clients = NULL;
+
+/**
+ * Get (or lazily create) the evaluation context of the calling thread
+ */
+static ServiceContext *service_thread_context(void) {
+    ServiceContext *context = g_private_get(&service_context_key);
+    if (!context) {
+        context = (ServiceContext *)calloc(1, sizeof(ServiceContext));
+        if (!context || !(context->calc = calc_context_new(NULL))) {
+            g_error("Failed to allocate evaluation context");
+        }
+        g_private_set(&service_context_key, context);
     }
+    return context;
+}
 
-    // Check for negative base with non-integer exponent
-    if (base < 0 && fabs(exponent - round(exponent)) > 1e-12) {
-        snprintf(err, es, "Cannot raise negative number to non-integer power");
-        return false;
+/**
+ * Evaluate one request line and append its response line
+ */
+static void service_evaluate_line(ServiceContext *context, const char *line,
+                                  guint length, GString *output) {
+    if (length >= sizeof(context->expression)) {
+        g_string_append(output, "! Expression too long\n");
+        return;
     }
+    memcpy(context->expression, line, length);
+    context->expression[length] = '\0';
+
+    CalcValue result;
+    if (calc_evaluate_value(context->calc, context->expression, &result)) {
+        // Exact integers keep every digit; everything else round-trips
+        if (result.type == CALC_VALUE_INTEGER) {
+            g_string_append_printf(output, "= %lld\n", result.numerator);
+        } else if (result.type == CALC_VALUE_MATRIX) {
+            g_string_append(output, "= ");
+            append_matrix(output, context->calc, 17);
+            g_string_append_c(output, '\n');
+        } else {
+            g_string_append_printf(output, "= %.17g\n", result.real);
+        }
+    } else {
+        g_string_append_printf(output, "! %s\n",
+                               calc_last_error(context->calc));
+    }
+}
+
+/**
+ * Evaluate every line of a chunk with the calling thread's context
+ */
+static void service_evaluate_chunk(ServiceChunk *chunk) {
+    ServiceContext *context = service_thread_context();
+    ServiceBatch *batch = chunk->batch;
+    for (guint i = chunk->first; i < chunk->first + chunk->count; i++) {
+        service_evaluate_line(context, batch->lines[i], batch->lengths[i],
+                              chunk->output);
+    }
+}
+
+/**
+ * Worker pool entry point - evaluates a chunk and signals its batch
+ */
+static void service_worker(gpointer data, gpointer user_data) {
+    ServiceChunk *chunk = (ServiceChunk *)data;
+    service_evaluate_chunk(chunk);
+
+    ServiceBatch *batch = chunk->batch;
+    g_mutex_lock(&batch->lock);
+    if (--batch->pending == 0) g_cond_signal(&batch->finished);
+    g_mutex_unlock(&batch->lock);
+}
 
-    *out = pow(base, exponent);
+/**
+ * Evaluate a batch and append all responses to output in request order
+ * Small batches are evaluated on the calling thread to avoid handoffs
+ */
+static void service_evaluate_batch(ServiceBatch *batch, GString *output) {
+    guint chunk_count =
+        (batch->count + SERVICE_CHUNK_LINES - 1) / SERVICE_CHUNK_LINES;
+    if (chunk_count <= 1) {
+        ServiceChunk chunk = {batch, 0, batch->count, output};
+        service_evaluate_chunk(&chunk);
+        return;
+    }
+
+    ServiceChunk *chunks = g_new0(ServiceChunk, chunk_count);
+    g_mutex_init(&batch->lock);
+    g_cond_init(&batch->finished);
+    batch->pending = chunk_count - 1;
+
+    for (guint i = 0; i < chunk_count; i++) {
+        chunks[i].batch = batch;
+        chunks[i].first = i * SERVICE_CHUNK_LINES;
+        chunks[i].count =
+            MIN(SERVICE_CHUNK_LINES, batch->count - chunks[i].first);
+        chunks[i].output =
+            i == 0 ? output : g_string_sized_new(chunks[i].count * 24);
+        if (i > 0) g_thread_pool_push(service_pool, &chunks[i], NULL);
+    }
+
+    // The connection thread takes the first chunk itself
+    service_evaluate_chunk(&chunks[0]);
+
+    g_mutex_lock(&batch->lock);
+    while (batch->pending > 0) g_cond_wait(&batch->finished, &batch->lock);
+    g_mutex_unlock(&batch->lock);
+
+    for (guint i = 1; i < chunk_count; i++) {
+        g_string_append_len(output, chunks[i].output->str,
+                            chunks[i].output->len);
+        g_string_free(chunks[i].output, TRUE);
+    }
+    g_mutex_clear(&batch->lock);
+    g_cond_clear(&batch->finished);
+    g_free(chunks);
+}
+
+/**
+ * Write a whole buffer to a socket, retrying on partial writes
+ */
+static bool service_write_all(int fd, const char *data, gsize length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
     return true;
 }
 
 /**
- * Safe square root - checks for negative input
+ * Serve one client connection until it disconnects
  */
-static bool safe_sqrt(double x, double *out, char *err, size_t es) {
-    if (x < -1e-15) {  // Allow tiny negative due to floating point errors
-        snprintf(err, es, "Cannot take square root of negative number");
-        return false;
+static gpointer service_connection(gpointer data) {
+    int fd = GPOINTER_TO_INT(data);
+    GString *pending = g_string_sized_new(SERVICE_READ_SIZE);
+    GString *output = g_string_sized_new(SERVICE_READ_SIZE);
+    GArray *lines = g_array_new(FALSE, FALSE, sizeof(const char *));
+    GArray *lengths = g_array_new(FALSE, FALSE, sizeof(guint));
+
+    for (;;) {
+        // Read straight into the tail of the pending buffer
+        gsize old_length = pending->len;
+        g_string_set_size(pending, old_length + SERVICE_READ_SIZE);
+        ssize_t received = read(fd, pending->str + old_length,
+                                SERVICE_READ_SIZE);
+        if (received < 0 && errno == EINTR) {
+            g_string_set_size(pending, old_length);
+            continue;
+        }
+        if (received <= 0) break;
+        g_string_set_size(pending, old_length + received);
+
+        // Split every complete line of the buffer into the batch
+        g_array_set_size(lines, 0);
+        g_array_set_size(lengths, 0);
+        gsize consumed = 0;
+        for (;;) {
+            const char *start = pending->str + consumed;
+            const char *newline =
+                memchr(start, '\n', pending->len - consumed);
+            if (!newline) break;
+            guint length = newline - start;
+            if (length > 0 && start[length - 1] == '\r') length--;
+            g_array_append_val(lines, start);
+            g_array_append_val(lengths, length);
+            consumed += (newline - start) + 1;
+        }
+
+        if (lines->len > 0) {
+            ServiceBatch batch = {0};
+            batch.lines = (const char **)lines->data;
+            batch.lengths = (guint *)lengths->data;
+            batch.count = lines->len;
+
+            g_string_set_size(output, 0);
+            service_evaluate_batch(&batch, output);
+            if (!service_write_all(fd, output->str, output->len)) break;
+            g_string_erase(pending, 0, consumed);
+        }
+
+        if (pending->len > SERVICE_MAX_LINE) {
+            // No newline within the longest accepted line: give up
+            service_write_all(fd, "! Expression too long\n", 22);
+            break;
+        }
+    }
+
+    // Closed under the lock, so shutdown never sees a reused descriptor
+    g_mutex_lock(&service_lock);
+    for (guint i = 0; i < service_clients->len; i++) {
+        if (g_array_index(service_clients, int, i) == fd) {
+            g_array_remove_index_fast(service_clients, i);
+            break;
+        }
+    }
+    close(fd);
+    g_cond_signal(&service_closed);
+    g_mutex_unlock(&service_lock);
+
+    g_array_free(lines, TRUE);
+    g_array_free(lengths, TRUE);
+    g_string_free(pending, TRUE);
+    g_string_free(output, TRUE);
+    return NULL;
+}
+
+static volatile sig_atomic_t service_stop_requested = 0;
+static volatile sig_atomic_t service_dump_requested = 0;
+
+/**
+ * Record a shutdown (SIGINT/SIGTERM) or statistics dump (SIGUSR1) request;
+ * the accept loop acts on it outside signal context
+ */
+static void service_handle_signal(int signal_number) {
+    if (signal_number == SIGUSR1) {
+        service_dump_requested = 1;
+    } else {
+        service_stop_requested = 1;
+    }
+}
+
+/**
+ * Install the service signal handlers and block those signals in every
+ * thread created afterwards, so only pselect() in the accept loop sees them
+ * @param wait_mask: receives the mask to use while waiting for clients
+ */
+static void service_install_signals(sigset_t *wait_mask) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &action, NULL);  // Report client hangups as errors
+
+    action.sa_handler = service_handle_signal;  // No SA_RESTART
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGUSR1, &action, NULL);
+
+    sigset_t blocked;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTERM);
+    sigaddset(&blocked, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &blocked, wait_mask);
+}
+
+/**
+ * Run the evaluation service on a Unix domain socket until SIGINT/SIGTERM
+ * @param socket_path: filesystem path of the listening socket
+ * @param workers: size of the worker pool (0 = number of processors)
+ * @return: process exit status
+ */
+static int run_evaluation_service(const char *socket_path, int workers) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        g_printerr("Socket path too long: %s\n", socket_path);
+        return 1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        g_printerr("socket: %s\n", strerror(errno));
+        return 1;
+    }
+    unlink(socket_path);  // Replace a stale socket from an earlier run
+    if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        listen(listen_fd, SOMAXCONN) < 0) {
+        g_printerr("Cannot listen on %s: %s\n", socket_path, strerror(errno));
+        close(listen_fd);
+        return 1;
+    }
+
+    // Signals must be blocked before the pool starts its threads
+    sigset_t wait_mask;
+    service_install_signals(&wait_mask);
+
+    if (workers <= 0) workers = (int)g_get_num_processors();
+    service_clients = g_array_new(FALSE, FALSE, sizeof(int));
+    service_pool =
+        g_thread_pool_new(service_worker, NULL, workers, TRUE, NULL);
+    g_print("Serving evaluations on %s with %d workers\n", socket_path,
+            workers);
+
+    int status = 0;
+    while (!service_stop_requested) {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(listen_fd, &readable);
+
+        // Signals are only delivered while waiting here
+        if (pselect(listen_fd + 1, &readable, NULL, NULL, NULL, &wait_mask) <
+            0) {
+            if (errno != EINTR) {
+                g_printerr("pselect: %s\n", strerror(errno));
+                status = 1;
+                break;
+            }
+            if (service_dump_requested) {
+                service_dump_requested = 0;
+#ifdef CALC_ENABLE_PERF
+                calc_perf_dump(stderr);
+#endif
+            }
+            continue;
+        }
+
+        int client_fd = accept(listen_fd, NULL, NULL);
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            g_printerr("accept: %s\n", strerror(errno));
+            status = 1;
+            break;
+        }
+        g_mutex_lock(&service_lock);
+        g_array_append_val(service_clients, client_fd);
+        g_mutex_unlock(&service_lock);
+        g_thread_unref(g_thread_new("calc-connection", service_connection,
+                                    GINT_TO_POINTER(client_fd)));
+    }
+
+    close(listen_fd);
+    unlink(socket_path);
+
+    // End the open connections (a batch being evaluated still completes),
+    // then the workers they may be using
+    g_mutex_lock(&service_lock);
+    for (guint i = 0; i < service_clients->len; i++) {
+        shutdown(g_array_index(service_clients, int, i), SHUT_RDWR);
+    }
+    while (service_clients->len > 0) {
+        g_cond_wait(&service_closed, &service_lock);
+    }
+    g_mutex_unlock(&service_lock);
+    g_thread_pool_free(service_pool, FALSE, TRUE);
+    service_pool = NULL;
+    g_array_free(service_clients, TRUE);
+    service_clients = NULL;
+#ifdef CALC_ENABLE_PERF
+    calc_perf_dump(stderr);
+#endif
+    return status;
+}
+
+#else
+
+static int run_evaluation_service(const char *socket_path, int workers) {
+    g_printerr("The evaluation service requires Unix domain sockets\n");
+    return 1;
+}
+
+#endif  // G_OS_UNIX
+
+/**
+ * =======================================================================
+ *                   STREAMING CSV COLUMN EVALUATION
+ * =======================================================================
+ *
+ * calculator --csv EXPRESSION FILE evaluates one formula for every row of
+ * a CSV file whose first row names the columns, e.g. "price*qty*(1+tax)".
+ * Every row is written to stdout with the result appended as a new last
+ * column ("result" in the header; errors are quoted messages). The
+ * expression is compiled once with the column names as variables. Rows
+ * are read in fixed-size blocks whose chunks are evaluated on a worker
+ * pool and written in input order, so memory use does not depend on the
+ * size of the file.
+ */
+
+#define CSV_READ_SIZE (1 << 20)  // Bytes read per block
+#define CSV_MAX_ROW (1 << 20)    // Longest accepted row
+#define CSV_CHUNK_ROWS 1024      // Rows evaluated per worker job
+
+/**
+ * Compiled formula and the columns it reads - shared by all workers
+ */
+typedef struct {
+    CalcProgram *program;  // Expression compiled with the column names
+    char **names;          // Column names from the header
+    bool *used;            // Whether the program reads each column
+    guint column_count;    // Number of columns in the header
+    guint parsed_columns;  // Columns up to the last one the program reads
+} CsvFormula;
+
+/**
+ * Complete rows of one block, answered together
+ */
+typedef struct {
+    const CsvFormula *formula;  // Formula applied to every row
+    const char **rows;          // Start of each row
+    guint *lengths;             // Length of each row (without newline)
+    guint count;                // Number of rows in the block
+    GMutex lock;                // Protects pending
+    GCond finished;             // Signalled when the last chunk completes
+    gint pending;               // Chunks still being evaluated
+} CsvBatch;
+
+/**
+ * Contiguous slice of a block evaluated by one worker
+ */
+typedef struct {
+    CsvBatch *batch;  // Block the rows belong to
+    guint first;      // Index of the first row
+    guint count;      // Number of rows
+    GString *output;  // Output rows, in order
+} CsvChunk;
+
+/**
+ * Release a thread's evaluation context when the thread exits
+ */
+static void csv_context_free(gpointer data) {
+    calc_context_free((CalcContext *)data);
+}
+
+static GPrivate csv_context_key = G_PRIVATE_INIT(csv_context_free);
+
+/**
+ * Get (or lazily create) the evaluation context of the calling thread
+ */
+static CalcContext *csv_thread_context(void) {
+    CalcContext *context = g_private_get(&csv_context_key);
+    if (!context) {
+        if (!(context = calc_context_new(NULL))) {
+            g_error("Failed to allocate evaluation context");
+        }
+        g_private_set(&csv_context_key, context);
     }
-    *out = sqrt(fabs(x));  // Use abs to handle tiny negatives
+    return context;
+}
+
+/**
+ * Read the next field of a row, removing quotes ("a, ""b""" is a, "b")
+ * Fields are never truncated; only the row length is limited.
+ * @param position: offset of the field, advanced past its separator
+ * @param field: receives the text (reused between calls to save
+ *               allocations)
+ * @return: false if the row has no more fields
+ */
+static bool csv_next_field(const char *row, guint length, guint *position,
+                           GString *field) {
+    if (*position > length) return false;
+
+    guint i = *position;
+    g_string_truncate(field, 0);
+    if (i == length || row[i] != '"') {
+        // Unquoted: everything up to the next comma
+        const char *comma = memchr(row + i, ',', length - i);
+        guint end = comma ? (guint)(comma - row) : length;
+        g_string_append_len(field, row + i, end - i);
+        *position = end + 1;
+        return true;
+    }
+
+    bool quoted = true;
+    for (i++; i < length; i++) {
+        char c = row[i];
+        if (quoted && c == '"') {
+            if (i + 1 < length && row[i + 1] == '"') {
+                i++;  // Escaped quote
+            } else {
+                quoted = false;
+                continue;
+            }
+        } else if (!quoted && c == ',') {
+            break;
+        }
+        g_string_append_c(field, c);
+    }
+    *position = i + 1;  // Past the comma, or past the end
     return true;
 }
 
 /**
- * Safe base-10 logarithm - checks domain (x > 0)
+ * Parse a whole field as a number (surrounding spaces allowed)
+ */
+static bool csv_parse_number(const char *field, double *value) {
+    while (*field == ' ' || *field == '\t') field++;
+    char *end;
+    *value = g_ascii_strtod(field, &end);
+    if (end == field) return false;
+    while (*end == ' ' || *end == '\t') end++;
+    return *end == '\0';
+}
+
+/**
+ * Evaluate one row and append it with its result column
+ * @param field: scratch buffer for the fields
  */
-static bool safe_log10(double x, double *out, char *err, size_t es) {
-    if (x <= 1e-15) {
-        snprintf(err, es, "Logarithm undefined for zero or negative numbers");
+static void csv_evaluate_row(CalcContext *context, const CsvFormula *formula,
+                             double *values, GString *field, const char *row,
+                             guint length, GString *output) {
+    g_string_append_len(output, row, length);
+
+    // Only the columns the formula reads are converted
+    guint position = 0;
+    for (guint column = 0; column < formula->parsed_columns; column++) {
+        bool present = csv_next_field(row, length, &position, field);
+        if (!formula->used[column]) continue;
+        if (!present || !csv_parse_number(field->str, &values[column])) {
+            g_string_append_printf(output, ",\"Column '%s' is not a number\"\n",
+                                   formula->names[column]);
+            return;
+        }
+    }
+
+    CalcValue result;
+    if (calc_program_evaluate(context, formula->program, values, &result)) {
+        // Exact integers keep every digit; everything else round-trips
+        if (result.type == CALC_VALUE_INTEGER) {
+            g_string_append_printf(output, ",%lld\n", result.numerator);
+        } else if (result.type == CALC_VALUE_MATRIX) {
+            g_string_append(output, ",\"");  // Quoted: it contains commas
+            append_matrix(output, context, 17);
+            g_string_append(output, "\"\n");
+        } else {
+            g_string_append_printf(output, ",%.17g\n", result.real);
+        }
+    } else {
+        g_string_append_printf(output, ",\"%s\"\n", calc_last_error(context));
+    }
+}
+
+/**
+ * Evaluate every row of a chunk with the calling thread's context
+ */
+static void csv_evaluate_chunk(CsvChunk *chunk) {
+    CalcContext *context = csv_thread_context();
+    CsvBatch *batch = chunk->batch;
+    double *values = g_new0(double, batch->formula->column_count + 1);
+    GString *field = g_string_sized_new(64);
+    for (guint i = chunk->first; i < chunk->first + chunk->count; i++) {
+        csv_evaluate_row(context, batch->formula, values, field,
+                         batch->rows[i], batch->lengths[i], chunk->output);
+    }
+    g_string_free(field, TRUE);
+    g_free(values);
+}
+
+/**
+ * Worker pool entry point - evaluates a chunk and signals its batch
+ */
+static void csv_worker(gpointer data, gpointer user_data) {
+    CsvChunk *chunk = (CsvChunk *)data;
+    csv_evaluate_chunk(chunk);
+
+    CsvBatch *batch = chunk->batch;
+    g_mutex_lock(&batch->lock);
+    if (--batch->pending == 0) g_cond_signal(&batch->finished);
+    g_mutex_unlock(&batch->lock);
+}
+
+/**
+ * Evaluate a block and append all output rows in input order
+ * The calling thread takes the first chunk itself.
+ */
+static void csv_evaluate_batch(GThreadPool *pool, CsvBatch *batch,
+                               GString *output) {
+    guint chunk_count = (batch->count + CSV_CHUNK_ROWS - 1) / CSV_CHUNK_ROWS;
+    CsvChunk *chunks = g_new0(CsvChunk, chunk_count);
+    g_mutex_init(&batch->lock);
+    g_cond_init(&batch->finished);
+    batch->pending = chunk_count - 1;
+
+    for (guint i = 0; i < chunk_count; i++) {
+        chunks[i].batch = batch;
+        chunks[i].first = i * CSV_CHUNK_ROWS;
+        chunks[i].count = MIN(CSV_CHUNK_ROWS, batch->count - chunks[i].first);
+        chunks[i].output =
+            i == 0 ? output : g_string_sized_new(chunks[i].count * 48);
+        if (i > 0) g_thread_pool_push(pool, &chunks[i], NULL);
+    }
+    csv_evaluate_chunk(&chunks[0]);
+
+    g_mutex_lock(&batch->lock);
+    while (batch->pending > 0) g_cond_wait(&batch->finished, &batch->lock);
+    g_mutex_unlock(&batch->lock);
+
+    for (guint i = 1; i < chunk_count; i++) {
+        g_string_append_len(output, chunks[i].output->str,
+                            chunks[i].output->len);
+        g_string_free(chunks[i].output, TRUE);
+    }
+    g_mutex_clear(&batch->lock);
+    g_cond_clear(&batch->finished);
+    g_free(chunks);
+}
+
+/**
+ * Length of the first complete row of a buffer, including its newline;
+ * newlines inside quoted fields do not end a row
+ * @return: 0 if the buffer holds no complete row
+ */
+static gsize csv_row_end(const char *data, gsize length) {
+    bool quoted = false;
+    for (gsize i = 0; i < length; i++) {
+        if (data[i] == '"') {
+            quoted = !quoted;
+        } else if (data[i] == '\n' && !quoted) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Read the header row and compile the expression with its column names
+ * @return: false (with a message on stderr) on error
+ */
+static bool csv_compile_formula(CsvFormula *formula, const char *expression,
+                                const char *header, guint length) {
+    GPtrArray *names = g_ptr_array_new();
+    GString *field = g_string_new(NULL);
+    guint position = 0;
+    while (csv_next_field(header, length, &position, field)) {
+        g_ptr_array_add(names, g_strstrip(g_strdup(field->str)));
+    }
+    g_string_free(field, TRUE);
+    formula->column_count = names->len;
+    g_ptr_array_add(names, NULL);
+    formula->names = (char **)g_ptr_array_free(names, FALSE);
+
+    CalcContext *context = calc_context_new(NULL);
+    if (!context) {
+        g_printerr("Failed to create evaluation context\n");
+        return false;
+    }
+    formula->program =
+        calc_compile(context, expression, (const char *const *)formula->names,
+                     formula->column_count);
+    if (!formula->program) {
+        g_printerr("%s: %s\n", expression, calc_last_error(context));
+        calc_context_free(context);
         return false;
     }
-    *out = log10(x);
+    calc_context_free(context);
+
+    formula->used = g_new0(bool, formula->column_count + 1);
+    for (guint i = 0; i < formula->column_count; i++) {
+        formula->used[i] = calc_program_uses(formula->program, i);
+        if (formula->used[i]) formula->parsed_columns = i + 1;
+    }
     return true;
 }
 
 /**
- * Safe natural logarithm - checks domain (x > 0)
+ * Stream a CSV file through a formula
+ * @param path: input file, or "-" for stdin
+ * @param workers: size of the worker pool (0 = number of processors)
+ * @return: process exit status
+ */
+static int run_csv_evaluation(const char *expression, const char *path,
+                              int workers) {
+    FILE *input = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (!input) {
+        g_printerr("Cannot open %s: %s\n", path, g_strerror(errno));
+        return 1;
+    }
+
+    if (workers <= 0) workers = (int)g_get_num_processors();
+    GThreadPool *pool =
+        g_thread_pool_new(csv_worker, NULL, workers, TRUE, NULL);
+    CsvFormula formula = {0};
+    GString *pending = g_string_sized_new(CSV_READ_SIZE);
+    GString *output = g_string_sized_new(CSV_READ_SIZE);
+    GArray *rows = g_array_new(FALSE, FALSE, sizeof(const char *));
+    GArray *lengths = g_array_new(FALSE, FALSE, sizeof(guint));
+    bool have_header = false;
+    bool at_end = false;
+    int status = 0;
+
+    while (!at_end && status == 0) {
+        // Read straight into the tail of the pending buffer
+        gsize old_length = pending->len;
+        g_string_set_size(pending, old_length + CSV_READ_SIZE);
+        gsize received =
+            fread(pending->str + old_length, 1, CSV_READ_SIZE, input);
+        g_string_set_size(pending, old_length + received);
+        if (received == 0) {
+            if (ferror(input)) {
+                g_printerr("Cannot read %s: %s\n", path, g_strerror(errno));
+                status = 1;
+                break;
+            }
+            // A last row without a newline still counts
+            at_end = true;
+            if (pending->len > 0) g_string_append_c(pending, '\n');
+        }
+
+        // Split every complete row of the buffer into the batch
+        g_array_set_size(rows, 0);
+        g_array_set_size(lengths, 0);
+        gsize consumed = 0;
+        gsize row_length;
+        while ((row_length = csv_row_end(pending->str + consumed,
+                                         pending->len - consumed)) > 0) {
+            const char *start = pending->str + consumed;
+            guint length = row_length - 1;
+            if (length > 0 && start[length - 1] == '\r') length--;
+            consumed += row_length;
+
+            if (!have_header) {
+                if (!csv_compile_formula(&formula, expression, start,
+                                         length)) {
+                    status = 1;
+                    break;
+                }
+                have_header = true;
+                fwrite(start, 1, length, stdout);
+                fputs(",result\n", stdout);
+                continue;
+            }
+            g_array_append_val(rows, start);
+            g_array_append_val(lengths, length);
+        }
+
+        if (rows->len > 0) {
+            CsvBatch batch = {0};
+            batch.formula = &formula;
+            batch.rows = (const char **)rows->data;
+            batch.lengths = (guint *)lengths->data;
+            batch.count = rows->len;
+
+            g_string_set_size(output, 0);
+            csv_evaluate_batch(pool, &batch, output);
+            fwrite(output->str, 1, output->len, stdout);
+        }
+        g_string_erase(pending, 0, consumed);
+
+        if (pending->len > CSV_MAX_ROW) {
+            g_printerr("Row longer than %d bytes\n", CSV_MAX_ROW);
+            status = 1;
+        } else if (at_end && pending->len > 0) {
+            g_printerr("Unterminated quoted field at end of %s\n", path);
+            status = 1;
+        }
+    }
+
+    g_thread_pool_free(pool, FALSE, TRUE);
+    if (input != stdin) fclose(input);
+    if (fflush(stdout) != 0) status = 1;
+    calc_program_free(formula.program);
+    g_strfreev(formula.names);
+    g_free(formula.used);
+    g_array_free(rows, TRUE);
+    g_array_free(lengths, TRUE);
+    g_string_free(pending, TRUE);
+    g_string_free(output, TRUE);
+    return status;
+}
+
+/**
+ * =======================================================================
+ *                 STREAMING STATISTICS OVER DATA FILES
+ * =======================================================================
+ *
+ * calculator --stats FILE prints the count, mean, variance, standard
+ * deviation, extremes and approximate percentiles of the numbers in a
+ * file: text separated by whitespace, commas or semicolons, or raw
+ * native-endian doubles with --binary. The file is read once in blocks
+ * and fed to a CalcStats, so memory use stays fixed however many values
+ * it holds (the percentile sketch needs at most 4 MiB).
  */
-static bool safe_ln(double x, double *out, char *err, size_t es) {
-    if (x <= 1e-15) {
-        snprintf(err, es, "Natural log undefined for zero or negative numbers");
-        return false;
-    }
-    *out = log(x);
-    return true;
-}
+
+#define STATS_READ_SIZE (1 << 20)   // Bytes read per block
+#define STATS_BATCH 65536           // Values handed to the library at once
+#define STATS_MAX_NUMBER (1 << 20)  // Longest accepted number, as CSV rows
 
 /**
- * Safe tangent function in degrees - checks for undefined values
- * Tangent is undefined at odd multiples of 90° (π/2 radians)
+ * Check whether a character separates numbers
  */
-static bool safe_tan_degrees(double degrees, double *out, char *err,
-                             size_t es) {
-    // Check if input is close to odd multiple of 90°
-    double mod = fmod(fabs(degrees), 180.0);
-    if (fabs(mod - 90.0) < 1e-10) {
-        snprintf(err, es, "Tangent undefined at 90° and odd multiples");
-        return false;
-    }
-    *out = tan(deg2rad(degrees));
-    return true;
+static bool stats_is_separator(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == ',' ||
+           c == ';';
 }
 
 /**
- * =======================================================================
- *      EXPRESSION PARSER - TOKENIZER AND SHUNTING YARD ALGORITHM
- * =======================================================================
+ * Parse the numbers of a text block into `values`, stopping before a
+ * number the block may cut off unless the input ends with it
+ * Numbers are parsed in place, so their length is not limited here.
+ * @param data: the block, followed by a NUL or a separator
+ * @param consumed: receives the bytes parsed, or the offset of an invalid
+ *                  number
+ * @return: false if a number is invalid
  */
+static bool stats_parse_text(const char *data, gsize length, bool at_end,
+                             GArray *values, gsize *consumed) {
+    gsize position = 0;
+    for (;;) {
+        while (position < length && stats_is_separator(data[position])) {
+            position++;
+        }
+        gsize end = position;
+        while (end < length && !stats_is_separator(data[end])) end++;
+        if (end == position || (end == length && !at_end)) break;
+
+        // strtod() cannot read past the number: separators end it
+        char *number_end;
+        double value = g_ascii_strtod(data + position, &number_end);
+        if (number_end != data + end) {
+            *consumed = position;
+            return false;
+        }
+        g_array_append_val(values, value);
+        position = end;
+    }
+    *consumed = position;
+    return true;
+}
 
 /**
- * Initialize a token with default values
+ * Print the statistics of everything read
  */
-static void init_token(Token *token) {
-    token->type = TOK_END;
-    token->value = 0.0;
-    token->operator = 0;
-    token->function[0] = '\0';
+static void stats_print(const CalcStats *stats) {
+    static const double percentiles[] = {1, 5, 25, 50, 75, 95, 99};
+    CalcSummary summary;
+    calc_stats_summary(stats, &summary);
+    printf("count     %llu\n", summary.count);
+    if (summary.nan_count > 0) printf("nan       %llu\n", summary.nan_count);
+    printf("mean      %.17g\n", summary.mean);
+    printf("variance  %.17g\n", summary.variance);
+    printf("stddev    %.17g\n", summary.stddev);
+    printf("min       %.17g\n", summary.min);
+    printf("max       %.17g\n", summary.max);
+    for (gsize i = 0; i < G_N_ELEMENTS(percentiles); i++) {
+        printf("p%-8g ~%.6g\n", percentiles[i],
+               calc_stats_quantile(stats, percentiles[i]));
+    }
 }
 
 /**
- * Extract next token from input string
- * Handles numbers, operators, parentheses, and function names
+ * Stream a data file through running statistics
+ * @param path: input file, or "-" for stdin
+ * @param binary: the file holds raw doubles instead of text
+ * @return: process exit status
  */
-static Token get_next_token(Lexer *lexer) {
-    skip_whitespace(lexer);
-    Token token;
-    init_token(&token);
-
-    char current = lexer->input[lexer->position];
-
-    // End of input
-    if (current == '\0') {
-        token.type = TOK_END;
-        return token;
+static int run_stats(const char *path, bool binary) {
+    FILE *input = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (!input) {
+        g_printerr("Cannot open %s: %s\n", path, g_strerror(errno));
+        return 1;
     }
 
-    // Parse numbers (including decimals and percentages)
-    if ((current >= '0' && current <= '9') || current == '.') {
-        char buffer[64];
-        size_t buf_index = 0;
-
-        // Extract all digits and decimal points
-        while (lexer->input[lexer->position] != '\0' &&
-               ((lexer->input[lexer->position] >= '0' &&
-                 lexer->input[lexer->position] <= '9') ||
-                lexer->input[lexer->position] == '.') &&
-               buf_index < sizeof(buffer) - 1) {
-            buffer[buf_index++] = lexer->input[lexer->position++];
+    CalcStats *stats = calc_stats_new(NULL, true);
+    if (!stats) g_error("Failed to allocate statistics");
+    GString *pending = g_string_sized_new(STATS_READ_SIZE);
+    GArray *values =
+        g_array_sized_new(FALSE, FALSE, sizeof(double), STATS_BATCH);
+    guint64 offset = 0;  // Position of pending->str in the input
+    bool at_end = false;
+    int status = 0;
+
+    while (!at_end && status == 0) {
+        gsize old_length = pending->len;
+        g_string_set_size(pending, old_length + STATS_READ_SIZE);
+        gsize received =
+            fread(pending->str + old_length, 1, STATS_READ_SIZE, input);
+        g_string_set_size(pending, old_length + received);
+        if (received == 0) {
+            if (ferror(input)) {
+                g_printerr("Cannot read %s: %s\n", path, g_strerror(errno));
+                status = 1;
+                break;
+            }
+            at_end = true;
         }
-        buffer[buf_index] = '\0';
-
-        token.type = TOK_NUMBER;
-        token.value = strtod(buffer, NULL);
 
-        // Handle percentage suffix
-        if (lexer->input[lexer->position] != '\0' &&
-            lexer->input[lexer->position] == '%') {
-            token.value /= 100.0;
-            lexer->position++;
+        // Whole values only; a partial one waits for the next block
+        gsize consumed;
+        if (binary) {
+            consumed = pending->len - pending->len % sizeof(double);
+            g_array_set_size(values, consumed / sizeof(double));
+            memcpy(values->data, pending->str, consumed);
+            if (at_end && consumed < pending->len) {
+                g_printerr("%s ends with a partial value\n", path);
+                status = 1;
+            }
+        } else if (!stats_parse_text(pending->str, pending->len, at_end,
+                                     values, &consumed)) {
+            g_printerr("Invalid number at byte %" G_GUINT64_FORMAT
+                       " of %s\n",
+                       offset + consumed, path);
+            status = 1;
         }
-        return token;
-    }
 
-    // Parse function names (lowercase letters only)
-    if (is_function_char(current)) {
-        char buffer[8];
-        size_t buf_index = 0;
-
-        while (lexer->input[lexer->position] != '\0' &&
-               is_function_char(lexer->input[lexer->position]) &&
-               buf_index < sizeof(buffer) - 1) {
-            buffer[buf_index++] = lexer->input[lexer->position++];
+        if (!calc_stats_add(stats, (const double *)values->data,
+                            values->len)) {
+            g_error("Failed to allocate statistics");
+        }
+        g_array_set_size(values, 0);
+        g_string_erase(pending, 0, consumed);
+        offset += consumed;
+
+        if (!binary && pending->len > STATS_MAX_NUMBER) {
+            g_printerr("Number longer than %d bytes at byte %" G_GUINT64_FORMAT
+                       " of %s\n",
+                       STATS_MAX_NUMBER, offset, path);
+            status = 1;
         }
-        buffer[buf_index] = '\0';
-
-        token.type = TOK_FUNCTION;
-        strncpy(token.function, buffer, sizeof(token.function) - 1);
-        token.function[sizeof(token.function) - 1] =
-            '\0';  // Ensure null termination
-        return token;
-    }
-
-    // Parse operators and parentheses
-    lexer->position++;
-    switch (current) {
-        case '+':
-        case '-':
-        case '*':
-        case '/':
-        case '^':
-            token.type = TOK_OPERATOR;
-            token.operator = current;
-            return token;
-        case '(':
-            token.type = TOK_LPAREN;
-            return token;
-        case ')':
-            token.type = TOK_RPAREN;
-            return token;
-        default:
-            token.type = TOK_INVALID;
-            return token;
-    }
-}
-
-/**
- * Get operator precedence for correct evaluation order
- * Higher numbers = higher precedence
- */
-static int get_precedence(char op) {
-    switch (op) {
-        case '^':
-            return 4;  // Exponentiation (highest)
-        case '*':
-        case '/':
-            return 3;  // Multiplication and division
-        case '+':
-        case '-':
-            return 2;  // Addition and subtraction
-        default:
-            return 0;  // Unknown operator
     }
+
+    if (status == 0) stats_print(stats);
+    if (input != stdin) fclose(input);
+    if (fflush(stdout) != 0) status = 1;
+    calc_stats_free(stats);
+    g_array_free(values, TRUE);
+    g_string_free(pending, TRUE);
+    return status;
 }
 
 /**
  * =======================================================================
- *                 DYNAMIC STACKS FOR EXPRESSION PARSING
+ *             GUI EVENT HANDLERS AND INTERFACE FUNCTIONS
  * =======================================================================
  */
 
 /**
- * Initialize a token stack
+ * Show a message (or "0" after clearing) in the display instead of the
+ * input; the next change of the input brings the input back
  */
-static void token_stack_init(TokenStack *stack) {
-    stack->data = NULL;
-    stack->top = -1;
-    stack->capacity = 0;
+static void update_display(CalculatorState *state, const char *text) {
+    CALC_PERF_BEGIN(display_start);
+    gtk_entry_set_text(GTK_ENTRY(state->entry), text);
+    state->display_shows_input = false;
+    CALC_PERF_END(CALC_PERF_DISPLAY, display_start);
 }
 
 /**
- * Initialize a number stack
+ * Input listener - applies just the changed range to the display, or the
+ * whole input if the display shows a message, and places its cursor
  */
-static void number_stack_init(NumberStack *stack) {
-    stack->data = NULL;
-    stack->top = -1;
-    stack->capacity = 0;
+static void on_input_changed(const InputChange *change, gpointer user_data) {
+    CalculatorState *state = (CalculatorState *)user_data;
+    GtkEditable *display = GTK_EDITABLE(state->entry);
+    CALC_PERF_BEGIN(display_start);
+    state->syncing_display = true;
+    if (state->display_shows_input) {
+        if (change->removed > 0) {
+            gint end = (gint)(change->position + change->removed);
+            gtk_editable_delete_text(display, (gint)change->position, end);
+        }
+        if (change->inserted_bytes > 0) {
+            gint position = (gint)change->position;
+            gtk_editable_insert_text(display, change->inserted,
+                                     (gint)change->inserted_bytes, &position);
+        }
+    } else {
+        gtk_entry_set_text(GTK_ENTRY(state->entry),
+                           input_buffer_text(state->input));
+        state->display_shows_input = true;
+    }
+    gtk_editable_set_position(display, (gint)change->cursor);
+    state->syncing_display = false;
+    CALC_PERF_END(CALC_PERF_DISPLAY, display_start);
 }
 
 /**
- * Push a token onto the stack
+ * Display cursor handler - clicking into the input moves its cursor, so
+ * the next button inserts there
  */
-static void token_stack_push(TokenStack *stack, Token value) {
-    // Expand capacity if needed
-    if (stack->top + 1 == stack->capacity) {
-        stack->capacity = stack->capacity ? stack->capacity * 2 : 16;
-        stack->data = realloc(stack->data, sizeof(Token) * stack->capacity);
-    }
-    stack->data[++stack->top] = value;
+static void on_display_cursor_moved(GObject *entry, GParamSpec *spec,
+                                    gpointer user_data) {
+    CalculatorState *state = (CalculatorState *)user_data;
+    if (state->syncing_display || !state->display_shows_input) return;
+    gint position = gtk_editable_get_position(GTK_EDITABLE(entry));
+    if ((gsize)position == state->input->cursor) return;
+    state->just_evaluated = false;  // Editing a result continues it
+    input_buffer_move(state->input, (gsize)position);
 }
 
 /**
- * Push a number onto the stack
+ * Rebuild the history list from the current search query
  */
-static void number_stack_push(NumberStack *stack, double value) {
-    // Expand capacity if needed
-    if (stack->top + 1 == stack->capacity) {
-        stack->capacity = stack->capacity ? stack->capacity * 2 : 16;
-        stack->data = realloc(stack->data, sizeof(double) * stack->capacity);
+static void refresh_history_list(CalculatorState *state) {
+    GList *rows = gtk_container_get_children(GTK_CONTAINER(state->history_list));
+    for (GList *row = rows; row != NULL; row = row->next) {
+        gtk_widget_destroy(GTK_WIDGET(row->data));
+    }
+    g_list_free(rows);
+
+    const char *query = gtk_entry_get_text(GTK_ENTRY(state->history_search));
+    guint64 matches[HISTORY_SEARCH_LIMIT];
+    bool complete;
+    guint count = history_search(state->history, query, matches,
+                                 HISTORY_SEARCH_LIMIT, &complete);
+    state->history_partial = !complete;
+
+    for (guint i = 0; i < count; i++) {
+        const char *expression, *result;
+        gsize expression_len, result_len;
+        if (!history_record_at(state->history, matches[i], &expression,
+                               &expression_len, &result, &result_len)) {
+            continue;
+        }
+
+        char *text = g_strdup_printf("%.*s = %.*s", (int)expression_len,
+                                     expression, (int)result_len, result);
+        GtkWidget *label = gtk_label_new(text);
+        g_free(text);
+        gtk_label_set_xalign(GTK_LABEL(label), 0.0);
+        gtk_label_set_ellipsize(GTK_LABEL(label), PANGO_ELLIPSIZE_START);
+        // Keep the expression so activating the row can recall it
+        g_object_set_data_full(G_OBJECT(label), "expression",
+                               g_strndup(expression, expression_len), g_free);
+        gtk_list_box_insert(GTK_LIST_BOX(state->history_list), label, -1);
     }
-    stack->data[++stack->top] = value;
+    gtk_widget_show_all(state->history_list);
 }
 
 /**
- * Pop a token from the stack
+ * Called once the startup log is indexed: list the records a search made
+ * meanwhile may have left out
  */
-static Token token_stack_pop(TokenStack *stack) {
-    return stack->data[stack->top--];
+static void on_history_indexed(gpointer user_data) {
+    CalculatorState *state = (CalculatorState *)user_data;
+    if (state->history_partial &&
+        gtk_widget_get_visible(state->history_panel)) {
+        refresh_history_list(state);
+    }
 }
 
 /**
- * Pop a number from the stack
+ * Recall the expression of an activated history row into the input
  */
-static double number_stack_pop(NumberStack *stack) {
-    return stack->data[stack->top--];
+static void on_history_row_activated(GtkListBox *box, GtkListBoxRow *row,
+                                     gpointer user_data) {
+    CalculatorState *state = (CalculatorState *)user_data;
+    GtkWidget *label = gtk_bin_get_child(GTK_BIN(row));
+    const char *expression = g_object_get_data(G_OBJECT(label), "expression");
+    if (!expression || state->evaluation) return;
+
+    input_buffer_set(state->input, expression);
+    state->just_evaluated = false;
 }
 
 /**
- * Peek at the top token of the stack without removing it
+ * Search entry handlers - refresh on every change, recall top row on Enter
  */
-static Token token_stack_peek(TokenStack *stack) {
-    return stack->data[stack->top];
+static void on_history_search_changed(GtkSearchEntry *entry,
+                                      gpointer user_data) {
+    refresh_history_list((CalculatorState *)user_data);
 }
 
-/**
- * Check if token stack is empty
- */
-static bool token_stack_empty(TokenStack *stack) { return stack->top < 0; }
+static void on_history_search_activate(GtkEntry *entry, gpointer user_data) {
+    CalculatorState *state = (CalculatorState *)user_data;
+    GtkListBoxRow *first =
+        gtk_list_box_get_row_at_index(GTK_LIST_BOX(state->history_list), 0);
+    if (first) {
+        on_history_row_activated(GTK_LIST_BOX(state->history_list), first,
+                                 state);
+    }
+}
 
 /**
- * Check if number stack is empty
+ * Build the history panel (search entry above a scrollable list of past
+ * calculations), hidden; does nothing once it exists
  */
-static bool number_stack_empty(NumberStack *stack) { return stack->top < 0; }
+static void build_history_panel(CalculatorState *state) {
+    if (state->history_panel) return;
+    state->history_panel = gtk_box_new(GTK_ORIENTATION_VERTICAL, 6);
+    gtk_box_pack_start(GTK_BOX(state->panel_box), state->history_panel, FALSE,
+                       FALSE, 0);
+
+    state->history_search = gtk_search_entry_new();
+    g_signal_connect(state->history_search, "search-changed",
+                     G_CALLBACK(on_history_search_changed), state);
+    g_signal_connect(state->history_search, "activate",
+                     G_CALLBACK(on_history_search_activate), state);
+    gtk_box_pack_start(GTK_BOX(state->history_panel), state->history_search,
+                       FALSE, FALSE, 0);
+
+    GtkWidget *history_scroller = gtk_scrolled_window_new(NULL, NULL);
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(history_scroller),
+                                   GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+    gtk_widget_set_size_request(history_scroller, -1, 160);
+    gtk_box_pack_start(GTK_BOX(state->history_panel), history_scroller, TRUE,
+                       TRUE, 0);
+
+    state->history_list = gtk_list_box_new();
+    gtk_list_box_set_activate_on_single_click(
+        GTK_LIST_BOX(state->history_list), TRUE);
+    g_signal_connect(state->history_list, "row-activated",
+                     G_CALLBACK(on_history_row_activated), state);
+    gtk_container_add(GTK_CONTAINER(history_scroller), state->history_list);
+
+    gtk_widget_show_all(state->history_panel);
+    gtk_widget_hide(state->history_panel);
+}
 
 /**
- * Free memory used by stacks
+ * Show or hide the history panel (Ctrl+H)
  */
-static void free_stacks(TokenStack *op_stack, TokenStack *output,
-                        NumberStack *numbers) {
-    if (op_stack && op_stack->data) free(op_stack->data);
-    if (output && output->data) free(output->data);
-    if (numbers && numbers->data) free(numbers->data);
+static void toggle_history_panel(CalculatorState *state) {
+    build_history_panel(state);
+    if (gtk_widget_get_visible(state->history_panel)) {
+        gtk_widget_hide(state->history_panel);
+        return;
+    }
+    refresh_history_list(state);
+    gtk_widget_show(state->history_panel);
+    gtk_widget_grab_focus(state->history_search);
 }
 
 /**
- * Convert infix expression to Reverse Polish Notation (RPN) using Shunting Yard
- * algorithm This allows proper operator precedence and parentheses handling
- *
- * Example: "3 + 4 * 2" becomes "3 4 2 * +" which evaluates to 11, not 14
+ * Format a result as the input that replaces the expression: exact
+ * integers with every digit (in the selected base in programmer mode),
+ * matrices as literals, anything else with "%g"
  */
-static bool convert_to_rpn(const char *expression, TokenStack *output,
-                           char *error, size_t error_size) {
-    Lexer lexer = {expression, 0};
-    TokenStack operator_stack;
-    token_stack_init(&operator_stack);
-    token_stack_init(output);
-
-    Token previous_token;
-    init_token(&previous_token);
-    previous_token.type = TOK_INVALID;
-
-    bool success = true;
-
-    while (success) {
-        Token current_token = get_next_token(&lexer);
-
-        // Check for invalid tokens
-        if (current_token.type == TOK_INVALID) {
-            snprintf(error, error_size, "Invalid character in expression");
-            success = false;
-            break;
-        }
-
-        // End of expression
-        if (current_token.type == TOK_END) break;
-
-        // Numbers go directly to output
-        if (current_token.type == TOK_NUMBER) {
-            token_stack_push(output, current_token);
-            previous_token = current_token;
-            continue;
-        }
-
-        // Functions go to operator stack
-        if (current_token.type == TOK_FUNCTION) {
-            token_stack_push(&operator_stack, current_token);
-            previous_token = current_token;
-            continue;
-        }
-
-        // Handle operators
-        if (current_token.type == TOK_OPERATOR) {
-            // Handle unary minus: if minus appears at start or after
-            // operator/parenthesis/function
-            if (current_token.operator == '-' &&
-                (previous_token.type == TOK_INVALID ||
-                 previous_token.type == TOK_OPERATOR ||
-                 previous_token.type == TOK_LPAREN ||
-                 previous_token.type == TOK_FUNCTION)) {
-                // Convert unary minus to binary subtraction: -x becomes 0-x
-                Token zero;
-                init_token(&zero);
-                zero.type = TOK_NUMBER;
-                zero.value = 0.0;
-                token_stack_push(output, zero);
-            }
-
-            // Process operators according to precedence rules
-            while (!token_stack_empty(&operator_stack)) {
-                Token top = token_stack_peek(&operator_stack);
-                if (top.type == TOK_OPERATOR &&
-                    ((get_precedence(top.operator) >
-                      get_precedence(current_token.operator)) ||
-                     (get_precedence(top.operator) ==
-                          get_precedence(current_token.operator) &&
-                      !is_right_associative(current_token.operator)))) {
-                    token_stack_push(output, token_stack_pop(&operator_stack));
-                } else if (top.type == TOK_FUNCTION) {
-                    token_stack_push(output, token_stack_pop(&operator_stack));
-                } else {
-                    break;
-                }
-            }
+static void format_result(CalculatorState *state, const CalcValue *value,
+                          GString *output) {
+    if (value->type == CALC_VALUE_MATRIX) {
+        g_string_set_size(output, 0);
+        append_matrix(output, state->calc, 6);  // Digits of "%g"
+        return;
+    }
 
-            token_stack_push(&operator_stack, current_token);
-            previous_token = current_token;
-            continue;
-        }
+    char text[80];
+    int base = state->programmer_panel &&
+                       gtk_widget_get_visible(state->programmer_panel)
+                   ? state->display_base
+                   : 10;
+    if ((value->type == CALC_VALUE_INTEGER || base != 10) &&
+        calc_format_integer(value, base, text, sizeof(text))) {
+        g_string_assign(output, text);
+    } else {
+        g_string_printf(output, "%g", value->real);
+    }
+}
 
-        // Left parenthesis
-        if (current_token.type == TOK_LPAREN) {
-            token_stack_push(&operator_stack, current_token);
-            previous_token = current_token;
-            continue;
-        }
+/**
+ * Base selector handler - redisplay the current result in the new base
+ */
+static void on_base_changed(GtkComboBox *combo, gpointer user_data) {
+    CalculatorState *state = (CalculatorState *)user_data;
+    static const int bases[] = {10, 16, 8, 2};
+    int active = gtk_combo_box_get_active(combo);
+    if (active < 0) return;
+    state->display_base = bases[active];
+
+    // Results are written back in a form the engine parses again (a
+    // running evaluation shows its result in the new base anyway)
+    CalcValue value;
+    if (!state->evaluation && state->just_evaluated &&
+        input_buffer_length(state->input) > 0 &&
+        calc_evaluate_value(state->calc, input_buffer_text(state->input),
+                            &value)) {
+        GString *text = g_string_new("");
+        format_result(state, &value, text);
+        input_buffer_set(state->input, text->str);
+        g_string_free(text, TRUE);
+    }
+}
 
-        // Right parenthesis - pop until matching left parenthesis
-        if (current_token.type == TOK_RPAREN) {
-            bool found_left_paren = false;
-            while (!token_stack_empty(&operator_stack)) {
-                Token top = token_stack_pop(&operator_stack);
-                if (top.type == TOK_LPAREN) {
-                    found_left_paren = true;
-                    break;
-                }
-                token_stack_push(output, top);
-            }
-            if (!found_left_paren) {
-                snprintf(error, error_size, "Mismatched parentheses");
-                success = false;
-                break;
-            }
+/**
+ * Panel button handler - inserts the button's text at the cursor; hex
+ * digits, radix prefixes, brackets and functions start a new input after
+ * a result, operators and separators continue it
+ */
+static void on_insert_button_clicked(GtkWidget *widget, gpointer user_data) {
+    CalculatorState *state = (CalculatorState *)user_data;
+    const char *text = g_object_get_data(G_OBJECT(widget), "insert");
+    if (state->evaluation) return;  // The input waits for the result
 
-            // If there's a function on top of stack after closing parenthesis,
-            // apply it
-            if (!token_stack_empty(&operator_stack) &&
-                token_stack_peek(&operator_stack).type == TOK_FUNCTION) {
-                token_stack_push(output, token_stack_pop(&operator_stack));
-            }
-            previous_token = current_token;
-            continue;
+    if (state->just_evaluated) {
+        if (!GPOINTER_TO_INT(g_object_get_data(G_OBJECT(widget), "operator"))) {
+            input_buffer_set(state->input, "");
         }
+        state->just_evaluated = false;
     }
+    input_buffer_insert(state->input, text);
+}
 
-    // Pop remaining operators from stack
-    while (success && !token_stack_empty(&operator_stack)) {
-        Token top = token_stack_pop(&operator_stack);
-        if (top.type == TOK_LPAREN || top.type == TOK_RPAREN) {
-            snprintf(error, error_size, "Mismatched parentheses");
-            success = false;
-            break;
-        }
-        token_stack_push(output, top);
+/**
+ * Build the programmer panel (hex digits, radix prefixes, bitwise
+ * operators and the result base), hidden; does nothing once it exists
+ */
+static void build_programmer_panel(CalculatorState *state) {
+    if (state->programmer_panel) return;
+    state->programmer_panel = gtk_grid_new();
+    gtk_grid_set_row_spacing(GTK_GRID(state->programmer_panel), 8);
+    gtk_grid_set_column_spacing(GTK_GRID(state->programmer_panel), 8);
+    gtk_grid_set_row_homogeneous(GTK_GRID(state->programmer_panel), TRUE);
+    gtk_grid_set_column_homogeneous(GTK_GRID(state->programmer_panel), TRUE);
+    gtk_box_pack_start(GTK_BOX(state->panel_box), state->programmer_panel,
+                       FALSE, FALSE, 0);
+
+    // Label, inserted text and whether the button continues a result
+    static const struct {
+        const char *label;
+        const char *insert;
+        bool is_operator;
+    } programmer_buttons[15] = {
+        // Row 0: Hex digits (own handler, so "C" does not clear)
+        {"A", "A", false}, {"B", "B", false}, {"C", "C", false},
+        {"D", "D", false}, {"E", "E", false}, {"F", "F", false},
+        // Row 1: Radix prefixes, bitwise not and shifts
+        {"0x", "0x", false}, {"0b", "0b", false}, {"0o", "0o", false},
+        {"~", "~", false}, {"<<", "<<", true}, {">>", ">>", true},
+        // Row 2: Bitwise and, or, exclusive or
+        {"&", "&", true}, {"|", "|", true}, {"xor", " xor ", true}};
+
+    for (int i = 0; i < 15; i++) {
+        GtkWidget *button =
+            gtk_button_new_with_label(programmer_buttons[i].label);
+        g_object_set_data(G_OBJECT(button), "insert",
+                          (gpointer)programmer_buttons[i].insert);
+        g_object_set_data(G_OBJECT(button), "operator",
+                          GINT_TO_POINTER(programmer_buttons[i].is_operator));
+        g_signal_connect(button, "clicked",
+                         G_CALLBACK(on_insert_button_clicked), state);
+        gtk_widget_set_size_request(button, 50, 36);
+        gtk_grid_attach(GTK_GRID(state->programmer_panel), button, i % 6,
+                        i / 6, 1, 1);
     }
 
-    // Clean up operator stack
-    if (operator_stack.data) {
-        free(operator_stack.data);
+    // Result base selector fills the rest of row 2
+    GtkWidget *base_selector = gtk_combo_box_text_new();
+    static const char *base_names[] = {"DEC", "HEX", "OCT", "BIN"};
+    for (int i = 0; i < 4; i++) {
+        gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(base_selector),
+                                       base_names[i]);
     }
+    state->display_base = 10;
+    gtk_combo_box_set_active(GTK_COMBO_BOX(base_selector), 0);
+    g_signal_connect(base_selector, "changed", G_CALLBACK(on_base_changed),
+                     state);
+    gtk_grid_attach(GTK_GRID(state->programmer_panel), base_selector, 3, 2, 3,
+                    1);
 
-    return success;
+    gtk_widget_show_all(state->programmer_panel);
+    gtk_widget_hide(state->programmer_panel);
 }
 
 /**
- * Apply mathematical operator to two operands
- * Pops two numbers from stack, applies operation, pushes result back
+ * Show or hide the programmer panel (Ctrl+P); results are shown in
+ * decimal while it is hidden
  */
-static bool apply_operator(char op, NumberStack *numbers, char *error,
-                           size_t error_size) {
-    // Need at least two operands for binary operators
-    if (numbers->top < 1) {
-        snprintf(error, error_size, "Not enough operands for operator");
-        return false;
-    }
-
-    // Pop operands (note: order matters for non-commutative operations)
-    double right = number_stack_pop(numbers);  // Second operand
-    double left = number_stack_pop(numbers);   // First operand
-    double result = 0.0;
-    bool success = true;
-
-    switch (op) {
-        case '+':
-            result = left + right;
-            break;
-        case '-':
-            result = left - right;
-            break;
-        case '*':
-            result = left * right;
-            break;
-        case '/':
-            success = safe_divide(left, right, &result, error, error_size);
-            break;
-        case '^':
-            success = safe_power(left, right, &result, error, error_size);
-            break;
-        default:
-            snprintf(error, error_size, "Unknown operator: %c", op);
-            return false;
-    }
+static void toggle_programmer_panel(CalculatorState *state) {
+    build_programmer_panel(state);
+    gtk_widget_set_visible(state->programmer_panel,
+                           !gtk_widget_get_visible(state->programmer_panel));
+}
 
-    if (success) {
-        number_stack_push(numbers, result);
+/**
+ * Build the matrix panel (literal brackets and separators, linear algebra
+ * functions), hidden; does nothing once it exists
+ */
+static void build_matrix_panel(CalculatorState *state) {
+    if (state->matrix_panel) return;
+    state->matrix_panel = gtk_grid_new();
+    gtk_grid_set_row_spacing(GTK_GRID(state->matrix_panel), 8);
+    gtk_grid_set_column_spacing(GTK_GRID(state->matrix_panel), 8);
+    gtk_grid_set_row_homogeneous(GTK_GRID(state->matrix_panel), TRUE);
+    gtk_grid_set_column_homogeneous(GTK_GRID(state->matrix_panel), TRUE);
+    gtk_box_pack_start(GTK_BOX(state->panel_box), state->matrix_panel, FALSE,
+                       FALSE, 0);
+
+    // Label, inserted text and whether the button continues a result
+    static const struct {
+        const char *label;
+        const char *insert;
+        bool is_operator;
+    } matrix_buttons[9] = {
+        // Row 0: Brackets, element and row separators, dot product
+        {"[", "[", false}, {"]", "]", true}, {",", ",", true},
+        {";", ";", true}, {"dot", "dot(", false},
+        // Row 1: Determinant, inverse, linear system, transpose (wide)
+        {"det", "det(", false}, {"inv", "inv(", false},
+        {"solve", "solve(", false}, {"transpose", "transpose(", false}};
+
+    for (int i = 0; i < 9; i++) {
+        GtkWidget *button = gtk_button_new_with_label(matrix_buttons[i].label);
+        g_object_set_data(G_OBJECT(button), "insert",
+                          (gpointer)matrix_buttons[i].insert);
+        g_object_set_data(G_OBJECT(button), "operator",
+                          GINT_TO_POINTER(matrix_buttons[i].is_operator));
+        g_signal_connect(button, "clicked",
+                         G_CALLBACK(on_insert_button_clicked), state);
+        gtk_widget_set_size_request(button, 50, 36);
+        gtk_grid_attach(GTK_GRID(state->matrix_panel), button, i % 5, i / 5,
+                        i == 8 ? 2 : 1, 1);
     }
 
-    return success;
+    gtk_widget_show_all(state->matrix_panel);
+    gtk_widget_hide(state->matrix_panel);
 }
 
 /**
- * Apply mathematical function to one operand
- * Pops one number from stack, applies function, pushes result back
+ * Show or hide the matrix panel (Ctrl+M)
  */
-static bool apply_function(const char *function_name, NumberStack *numbers,
-                           char *error, size_t error_size) {
-    // Need at least one operand for functions
-    if (numbers->top < 0) {
-        snprintf(error, error_size, "Function '%s' requires an argument",
-                 function_name);
-        return false;
-    }
+static void toggle_matrix_panel(CalculatorState *state) {
+    build_matrix_panel(state);
+    gtk_widget_set_visible(state->matrix_panel,
+                           !gtk_widget_get_visible(state->matrix_panel));
+}
 
-    double operand = number_stack_pop(numbers);
-    double result = 0.0;
-    bool success = true;
-
-    // Apply the appropriate mathematical function
-    if (strcmp(function_name, "sqrt") == 0) {
-        success = safe_sqrt(operand, &result, error, error_size);
-    } else if (strcmp(function_name, "log") == 0) {
-        success = safe_log10(operand, &result, error, error_size);
-    } else if (strcmp(function_name, "ln") == 0) {
-        success = safe_ln(operand, &result, error, error_size);
-    } else if (strcmp(function_name, "sin") == 0) {
-        result = sin(deg2rad(operand));  // Convert degrees to radians
-    } else if (strcmp(function_name, "cos") == 0) {
-        result = cos(deg2rad(operand));  // Convert degrees to radians
-    } else if (strcmp(function_name, "tan") == 0) {
-        success = safe_tan_degrees(operand, &result, error, error_size);
-    } else {
-        snprintf(error, error_size, "Unknown function: %s", function_name);
-        return false;
-    }
+#ifdef CALC_ENABLE_PERF
 
-    if (success) {
-        number_stack_push(numbers, result);
-    }
+#define STATS_REFRESH_MS 500  // Refresh interval of the statistics panel
 
-    return success;
+/**
+ * Redraw the statistics panel with the current latency report
+ */
+static gboolean refresh_stats_panel(gpointer user_data) {
+    CalculatorState *state = (CalculatorState *)user_data;
+    char report[2048];
+    calc_perf_report(report, sizeof(report));
+    gtk_label_set_text(GTK_LABEL(state->stats_label), report);
+    return G_SOURCE_CONTINUE;
 }
 
 /**
- * Main expression evaluator - converts to RPN then evaluates
- * @param expression: Mathematical expression string
- * @param success: Output parameter indicating if evaluation succeeded
- * @param error_buffer: Buffer for error messages
- * @param error_size: Size of error buffer
- * @return: Computed result, or 0 if error occurred
+ * Build the statistics panel (per-phase latency report), hidden; does
+ * nothing once it exists
  */
-static double evaluate_expression(const char *expression, bool *success,
-                                  char *error_buffer, size_t error_size) {
-    TokenStack rpn_tokens;
-    token_stack_init(&rpn_tokens);
-    clear_error(error_buffer, error_size);
+static void build_stats_panel(CalculatorState *state) {
+    if (state->stats_panel) return;
+    state->stats_panel = gtk_frame_new("Latency");
+    gtk_box_pack_start(GTK_BOX(state->panel_box), state->stats_panel, FALSE,
+                       FALSE, 0);
+    state->stats_label = gtk_label_new("");
+    gtk_label_set_selectable(GTK_LABEL(state->stats_label), TRUE);
+    gtk_label_set_xalign(GTK_LABEL(state->stats_label), 0.0);
+    gtk_style_context_add_class(
+        gtk_widget_get_style_context(state->stats_label), "latency");
+    gtk_container_add(GTK_CONTAINER(state->stats_panel), state->stats_label);
+
+    gtk_widget_show_all(state->stats_panel);
+    gtk_widget_hide(state->stats_panel);
+}
 
-    // Convert infix expression to RPN
-    bool conversion_success =
-        convert_to_rpn(expression, &rpn_tokens, error_buffer, error_size);
-    if (!conversion_success) {
-        *success = false;
-        if (rpn_tokens.data) free(rpn_tokens.data);
-        return 0.0;
+/**
+ * Show or hide the statistics panel (Ctrl+D); it only refreshes while
+ * visible
+ */
+static void toggle_stats_panel(CalculatorState *state) {
+    build_stats_panel(state);
+    if (gtk_widget_get_visible(state->stats_panel)) {
+        gtk_widget_hide(state->stats_panel);
+        g_source_remove(state->stats_source);
+        state->stats_source = 0;
+        return;
     }
+    refresh_stats_panel(state);
+    gtk_widget_show(state->stats_panel);
+    state->stats_source =
+        g_timeout_add(STATS_REFRESH_MS, refresh_stats_panel, state);
+}
+
+#endif  // CALC_ENABLE_PERF
+
+/**
+ * =======================================================================
+ *                          BACKGROUND EVALUATION
+ * =======================================================================
+ *
+ * "=" evaluates on a worker thread, so an iterate() or fixpoint() that
+ * runs up to its step limit leaves the window responsive. The context is
+ * the worker's until the outcome is back on the main loop; meanwhile the
+ * input cannot change, and C or Escape cancel the evaluation.
+ */
 
-    // Evaluate RPN expression
-    NumberStack evaluation_stack;
-    number_stack_init(&evaluation_stack);
+#define EVALUATION_NOTICE_MS 250  // Delay before "Evaluating..." is shown
 
-    for (int i = 0; i <= rpn_tokens.top; i++) {
-        Token token = rpn_tokens.data[i];
+/**
+ * An evaluation handed to the worker thread, and its outcome
+ */
+typedef struct {
+    CalculatorState *state;
+    char *expression;  // Copy of the input being evaluated
+    CalcValue result;  // Value when `success` is set
+    bool success;      // Whether the evaluation succeeded
+} Evaluation;
 
-        if (token.type == TOK_NUMBER) {
-            number_stack_push(&evaluation_stack, token.value);
-        } else if (token.type == TOK_OPERATOR) {
-            if (!apply_operator(token.operator, &evaluation_stack, error_buffer,
-                                error_size)) {
-                conversion_success = false;
-                break;
-            }
-        } else if (token.type == TOK_FUNCTION) {
-            if (!apply_function(token.function, &evaluation_stack, error_buffer,
-                                error_size)) {
-                conversion_success = false;
-                break;
-            }
-        }
-        // Ignore other token types
+/**
+ * Tell a user waiting for a slow evaluation how to cancel it
+ */
+static gboolean show_evaluation_notice(gpointer user_data) {
+    CalculatorState *state = (CalculatorState *)user_data;
+    state->evaluation_notice = 0;
+    update_display(state, "Evaluating... (Esc to cancel)");
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Wait for the worker and take back the context
+ * @return: the evaluation it finished
+ */
+static Evaluation *join_evaluation(CalculatorState *state) {
+    Evaluation *evaluation = g_thread_join(state->evaluation);
+    state->evaluation = NULL;
+    if (state->evaluation_notice) {
+        g_source_remove(state->evaluation_notice);
+        state->evaluation_notice = 0;
     }
+    return evaluation;
+}
 
-    double final_result = 0.0;
-    if (conversion_success) {
-        // Should have exactly one number left on stack
-        if (evaluation_stack.top != 0) {
-            snprintf(error_buffer, error_size, "Invalid expression syntax");
-            conversion_success = false;
-        } else {
-            final_result = number_stack_pop(&evaluation_stack);
+/**
+ * Show the outcome of a finished evaluation (idle handler queued by the
+ * worker): a result replaces the input and is recorded in the history
+ */
+static gboolean finish_evaluation(gpointer user_data) {
+    Evaluation *evaluation = (Evaluation *)user_data;
+    CalculatorState *state = evaluation->state;
+    join_evaluation(state);
+
+    if (evaluation->success) {
+        // Display result (undo brings the expression back) and prepare
+        // for next calculation
+        GString *text = g_string_new("");
+        CALC_PERF_BEGIN(format_start);
+        format_result(state, &evaluation->result, text);
+        CALC_PERF_END(CALC_PERF_FORMAT, format_start);
+        input_buffer_set(state->input, text->str);
+        state->just_evaluated = true;  // Flag to clear on next number input
+
+        history_append(state->history, evaluation->expression, text->str);
+        g_string_free(text, TRUE);
+        if (state->history_panel &&
+            gtk_widget_get_visible(state->history_panel)) {
+            refresh_history_list(state);
         }
+    } else {
+        // Display error message ("Evaluation cancelled" after C or Escape)
+        update_display(state, calc_last_error(state->calc));
+        state->just_evaluated = true;
     }
 
-    // Clean up memory
-    if (rpn_tokens.data) free(rpn_tokens.data);
-    if (evaluation_stack.data) free(evaluation_stack.data);
+    g_free(evaluation->expression);
+    g_free(evaluation);
+    return G_SOURCE_REMOVE;
+}
 
-    *success = conversion_success;
-    return final_result;
+/**
+ * Worker thread - evaluate, then return the outcome to the main loop
+ */
+static gpointer evaluation_thread(gpointer user_data) {
+    Evaluation *evaluation = (Evaluation *)user_data;
+    evaluation->success =
+        calc_evaluate_value(evaluation->state->calc, evaluation->expression,
+                            &evaluation->result);
+    g_idle_add(finish_evaluation, evaluation);
+    return evaluation;
 }
 
 /**
- * =======================================================================
- *             GUI EVENT HANDLERS AND INTERFACE FUNCTIONS
- * =======================================================================
+ * Start evaluating the input on a worker thread
  */
+static void start_evaluation(CalculatorState *state) {
+    Evaluation *evaluation = g_new0(Evaluation, 1);
+    evaluation->state = state;
+    evaluation->expression = g_strdup(input_buffer_text(state->input));
+    state->evaluation_notice =
+        g_timeout_add(EVALUATION_NOTICE_MS, show_evaluation_notice, state);
+    state->evaluation =
+        g_thread_new("calc-evaluation", evaluation_thread, evaluation);
+}
 
 /**
- * Update the calculator display with new text
+ * Cancel a running evaluation and drop its outcome (window destruction)
  */
-static void update_display(CalculatorState *state, const char *text) {
-    gtk_entry_set_text(GTK_ENTRY(state->entry), text);
+static void abandon_evaluation(CalculatorState *state) {
+    if (!state->evaluation) return;
+    calc_cancel(state->calc);
+    Evaluation *evaluation = join_evaluation(state);
+    g_source_remove_by_user_data(evaluation);  // The queued finish
+    g_free(evaluation->expression);
+    g_free(evaluation);
 }
 
 /**
@@ -748,32 +2440,23 @@ static void on_button_clicked(GtkWidget *widget, gpointer user_data) {
     CalculatorState *state = (CalculatorState *)user_data;
     const gchar *button_label = gtk_button_get_label(GTK_BUTTON(widget));
 
+    // While an evaluation runs, C cancels it and other buttons do nothing
+    if (state->evaluation) {
+        if (strcmp(button_label, "C") == 0) calc_cancel(state->calc);
+        return;
+    }
+
     // Clear button - reset calculator state
     if (strcmp(button_label, "C") == 0) {
-        g_string_set_size(state->input, 0);
-        clear_error(state->last_error, sizeof(state->last_error));
+        input_buffer_set(state->input, "");
         state->just_evaluated = false;
         update_display(state, "0");
         return;
     }
 
-    // Equals button - evaluate current expression
+    // Equals button - evaluate current expression on a worker thread
     if (strcmp(button_label, "=") == 0) {
-        bool evaluation_success = false;
-        double result =
-            evaluate_expression(state->input->str, &evaluation_success,
-                                state->last_error, sizeof(state->last_error));
-
-        if (evaluation_success) {
-            // Display result and prepare for next calculation
-            g_string_printf(state->input, "%g", result);
-            update_display(state, state->input->str);
-            state->just_evaluated = true;  // Flag to clear on next number input
-        } else {
-            // Display error message
-            update_display(state, state->last_error);
-            state->just_evaluated = true;
-        }
+        start_evaluation(state);
         return;
     }
 
@@ -783,10 +2466,10 @@ static void on_button_clicked(GtkWidget *widget, gpointer user_data) {
         bool should_clear =
             (button_label[0] >= '0' && button_label[0] <= '9') ||  // Digit
             strcmp(button_label, ".") == 0 ||   // Decimal point
-            is_function_char(button_label[0]);  // Function
+            (button_label[0] >= 'a' && button_label[0] <= 'z');  // Function
 
         if (should_clear) {
-            g_string_set_size(state->input, 0);
+            input_buffer_set(state->input, "");
             state->just_evaluated = false;
         } else if (strchr("+-*/^()%", button_label[0]) != NULL) {
             // If user enters an operator, keep the result and continue
@@ -795,34 +2478,30 @@ static void on_button_clicked(GtkWidget *widget, gpointer user_data) {
         }
     }
 
-    // Handle specific button types
+    // Handle specific button types; text goes in at the cursor, and the
+    // input's listener updates the display
     if (strcmp(button_label, "sqrt") == 0) {
-        g_string_append(state->input, "sqrt(");
+        input_buffer_insert(state->input, "sqrt(");
     } else if (strcmp(button_label, "log") == 0) {
-        g_string_append(state->input, "log(");
+        input_buffer_insert(state->input, "log(");
     } else if (strcmp(button_label, "ln") == 0) {
-        g_string_append(state->input, "ln(");
+        input_buffer_insert(state->input, "ln(");
     } else if (strcmp(button_label, "sin") == 0) {
-        g_string_append(state->input, "sin(");
+        input_buffer_insert(state->input, "sin(");
     } else if (strcmp(button_label, "cos") == 0) {
-        g_string_append(state->input, "cos(");
+        input_buffer_insert(state->input, "cos(");
     } else if (strcmp(button_label, "tan") == 0) {
-        g_string_append(state->input, "tan(");
+        input_buffer_insert(state->input, "tan(");
     } else if (strcmp(button_label, "^") == 0) {
-        g_string_append(state->input, "^");
+        input_buffer_insert(state->input, "^");
     } else if (strcmp(button_label, "⌫") == 0) {
-        // Backspace - remove last character
-        if (state->input->len > 0) {
-            g_string_truncate(state->input, state->input->len - 1);
-        }
+        // Backspace - remove the character before the cursor
+        input_buffer_delete(state->input, true);
     } else {
-        // For all other buttons (digits, operators, parentheses), append
+        // For all other buttons (digits, operators, parentheses), insert
         // directly
-        g_string_append(state->input, button_label);
+        input_buffer_insert(state->input, button_label);
     }
-
-    // Update display with current input
-    update_display(state, state->input->str);
 }
 
 /**
@@ -833,6 +2512,55 @@ static gboolean on_key_press(GtkWidget *widget, GdkEventKey *event,
     CalculatorState *state = (CalculatorState *)user_data;
     guint key = event->keyval;
 
+    // Ctrl+H - toggle the history panel
+    if ((event->state & GDK_CONTROL_MASK) &&
+        (key == GDK_KEY_h || key == GDK_KEY_H)) {
+        toggle_history_panel(state);
+        return TRUE;  // Event handled
+    }
+
+    // Ctrl+P - toggle programmer mode
+    if ((event->state & GDK_CONTROL_MASK) &&
+        (key == GDK_KEY_p || key == GDK_KEY_P)) {
+        toggle_programmer_panel(state);
+        return TRUE;
+    }
+
+    // Ctrl+M - toggle the matrix panel
+    if ((event->state & GDK_CONTROL_MASK) &&
+        (key == GDK_KEY_m || key == GDK_KEY_M)) {
+        toggle_matrix_panel(state);
+        return TRUE;
+    }
+
+#ifdef CALC_ENABLE_PERF
+    // Ctrl+D - toggle the latency statistics panel
+    if ((event->state & GDK_CONTROL_MASK) &&
+        (key == GDK_KEY_d || key == GDK_KEY_D)) {
+        toggle_stats_panel(state);
+        return TRUE;
+    }
+#endif
+
+    // Escape cancels a running evaluation
+    if (state->evaluation && key == GDK_KEY_Escape) {
+        calc_cancel(state->calc);
+        return TRUE;
+    }
+
+    // While searching, keys belong to the search entry (Escape closes it)
+    if (state->history_search &&
+        gtk_widget_has_focus(state->history_search)) {
+        if (key == GDK_KEY_Escape) {
+            gtk_widget_hide(state->history_panel);
+            return TRUE;
+        }
+        return FALSE;
+    }
+
+    // The input waits for the result of a running evaluation
+    if (state->evaluation) return TRUE;
+
     // Enter key - same as equals button
     if (key == GDK_KEY_Return || key == GDK_KEY_KP_Enter) {
         // Create temporary button to reuse existing equals logic
@@ -843,25 +2571,45 @@ static gboolean on_key_press(GtkWidget *widget, GdkEventKey *event,
         return TRUE;  // Event handled
     }
 
-    // Backspace key - same as backspace button
-    if (key == GDK_KEY_BackSpace) {
-        if (state->input->len > 0) {
-            g_string_truncate(state->input, state->input->len - 1);
-        }
-        update_display(state, state->input->str);
+    // Backspace and Delete keys - remove the character before or after
+    // the cursor
+    if (key == GDK_KEY_BackSpace || key == GDK_KEY_Delete) {
+        input_buffer_delete(state->input, key == GDK_KEY_BackSpace);
         return TRUE;  // Event handled
     }
 
-    return FALSE;  // Let default handler process other keys
-}
+    // Ctrl+Z - undo the last edit; Ctrl+Y or Ctrl+Shift+Z - redo it
+    if ((event->state & GDK_CONTROL_MASK) &&
+        (key == GDK_KEY_z || key == GDK_KEY_Z || key == GDK_KEY_y ||
+         key == GDK_KEY_Y)) {
+        bool redo = key == GDK_KEY_y || key == GDK_KEY_Y ||
+                    (event->state & GDK_SHIFT_MASK);
+        bool restored = redo ? input_buffer_redo(state->input)
+                             : input_buffer_undo(state->input);
+        if (restored) state->just_evaluated = false;
+        return TRUE;
+    }
 
-/**
- * Create a button with label and connect to click handler
- */
-static GtkWidget *create_button(const char *label, CalculatorState *state) {
-    GtkWidget *button = gtk_button_new_with_label(label);
-    g_signal_connect(button, "clicked", G_CALLBACK(on_button_clicked), state);
-    return button;
+    // Arrow, Home and End keys - move the cursor; editing a result
+    // continues it instead of starting a new input
+    if (key == GDK_KEY_Left || key == GDK_KEY_Right || key == GDK_KEY_Home ||
+        key == GDK_KEY_End) {
+        gsize cursor = state->input->cursor;
+        if (key == GDK_KEY_Left) {
+            cursor = cursor > 0 ? cursor - 1 : 0;
+        } else if (key == GDK_KEY_Right) {
+            cursor++;
+        } else if (key == GDK_KEY_Home) {
+            cursor = 0;
+        } else {
+            cursor = input_buffer_length(state->input);
+        }
+        state->just_evaluated = false;
+        input_buffer_move(state->input, cursor);
+        return TRUE;
+    }
+
+    return FALSE;  // Let default handler process other keys
 }
 
 /**
@@ -870,9 +2618,21 @@ static GtkWidget *create_button(const char *label, CalculatorState *state) {
 static void on_window_destroy(GtkWidget *widget, gpointer user_data) {
     CalculatorState *state = (CalculatorState *)user_data;
     if (state) {
+        // The display is destroyed after this; keep it from reporting to
+        // the freed state
+        g_signal_handlers_disconnect_by_func(state->entry,
+                                             on_display_cursor_moved, state);
         if (state->input) {
-            g_string_free(state->input, TRUE);
+            input_buffer_free(state->input);
         }
+        if (state->panels_source) g_source_remove(state->panels_source);
+        abandon_evaluation(state);
+        history_close(state->history);
+        calc_context_free(state->calc);
+#ifdef CALC_ENABLE_PERF
+        if (state->stats_source) g_source_remove(state->stats_source);
+        calc_perf_dump(stderr);
+#endif
         free(state);
     }
 }
@@ -881,111 +2641,107 @@ static void on_window_destroy(GtkWidget *widget, gpointer user_data) {
  * =======================================================================
  *                      USER INTERFACE CONSTRUCTION
  * =======================================================================
+ *
+ * The main window (ui/calculator.ui) and the style sheet are compiled into
+ * the binary as a GResource, so startup reads no files, parses the style
+ * sheet once for the whole screen and shows only what the first frame
+ * needs. The programmer, matrix, history and latency panels are built
+ * after it.
  */
 
+#define UI_RESOURCE_PATH "/com/example/c-gui-calculator/"
+
+static gint64 startup_begin_time = 0;  // Monotonic time when main() began
+static bool startup_report = false;    // --startup-time: print it and quit
+
 /**
- * Build the complete calculator user interface
- * Creates window, display, button grids, and connects all event handlers
+ * Build all secondary panels (idle handler scheduled after the first
+ * frame); the shortcuts build theirs on demand if pressed earlier
  */
-static void build_user_interface(GtkApplication *app, CalculatorState *state) {
-    // Create and set title, size, and position of the main window
-    GtkWidget *window = gtk_application_window_new(app);
-    gtk_window_set_title(GTK_WINDOW(window), "C GUI Scientific Calculator");
-    gtk_window_set_default_size(GTK_WINDOW(window), 380, 550);
-    gtk_window_set_position(GTK_WINDOW(window), GTK_WIN_POS_CENTER);
-    gtk_window_set_resizable(GTK_WINDOW(window),
-                             FALSE);  // Fixed size for clean layout
-    g_signal_connect(window, "destroy", G_CALLBACK(on_window_destroy), state);
-
-    // Create main vertical container to hold widgets (display, buttons,
-    // etc.)
-    GtkWidget *main_container = gtk_box_new(GTK_ORIENTATION_VERTICAL, 10);
-    gtk_container_set_border_width(GTK_CONTAINER(main_container), 15);
-    gtk_container_add(GTK_CONTAINER(window), main_container);
-
-    // Create display (entry) to shows current input and results
-    state->entry = gtk_entry_new();
-    gtk_entry_set_alignment(GTK_ENTRY(state->entry), 1.0);  // Right-align
-    gtk_editable_set_editable(GTK_EDITABLE(state->entry),
-                              FALSE);  // Read-only
-    gtk_entry_set_text(GTK_ENTRY(state->entry), "0");
-    gtk_widget_set_size_request(state->entry, -1,
-                                50);  // Set minimum height
-    gtk_box_pack_start(GTK_BOX(main_container), state->entry, FALSE, FALSE, 0);
-
-    // Apply CSS styling for larger, more readable font
-    GtkCssProvider *css_provider = gtk_css_provider_new();
-    gtk_css_provider_load_from_data(
-        css_provider,
-        "entry { font-size: 24px; font-weight: bold; padding: 8px; }", -1,
-        NULL);
-    GtkStyleContext *entry_context = gtk_widget_get_style_context(state->entry);
-    gtk_style_context_add_provider(entry_context,
-                                   GTK_STYLE_PROVIDER(css_provider),
-                                   GTK_STYLE_PROVIDER_PRIORITY_USER);
-    g_object_unref(css_provider);
+static gboolean build_secondary_panels(gpointer user_data) {
+    CalculatorState *state = (CalculatorState *)user_data;
+    state->panels_source = 0;
+    build_programmer_panel(state);
+    build_matrix_panel(state);
+    build_history_panel(state);
+#ifdef CALC_ENABLE_PERF
+    build_stats_panel(state);
+#endif
+    return G_SOURCE_REMOVE;
+}
 
-    // Create main button grid (numbers, basic operators, equals)
-    GtkWidget *main_grid = gtk_grid_new();
-    gtk_grid_set_row_spacing(GTK_GRID(main_grid), 8);
-    gtk_grid_set_column_spacing(GTK_GRID(main_grid), 8);
-    // Equal row heights & column widths for the buttons
-    gtk_grid_set_row_homogeneous(GTK_GRID(main_grid), TRUE);
-    gtk_grid_set_column_homogeneous(GTK_GRID(main_grid), TRUE);
-    gtk_box_pack_start(GTK_BOX(main_container), main_grid, TRUE, TRUE, 0);
-
-    // Define button layout: 5 rows x 4 columns
-    const char *main_button_layout[5][4] = {
-        {"C", "(", ")", "/"},  // Row 0: Clear, parentheses, divide
-        {"7", "8", "9", "*"},  // Row 1: Numbers 7-9, multiply
-        {"4", "5", "6", "-"},  // Row 2: Numbers 4-6, subtract
-        {"1", "2", "3", "+"},  // Row 3: Numbers 1-3, add
-        {"0", ".", "^", "="}   // Row 4: Zero, decimal, power, equals
-    };
-
-    // Create and place main buttons
-    for (int row = 0; row < 5; row++) {
-        for (int col = 0; col < 4; col++) {
-            GtkWidget *button =
-                create_button(main_button_layout[row][col], state);
-            gtk_widget_set_size_request(button, 70,
-                                        50);  // Consistent button size
-            gtk_grid_attach(GTK_GRID(main_grid), button, col, row, 1, 1);
-        }
-    }
+/**
+ * Close the window once the startup time is reported (--startup-time)
+ */
+static gboolean close_after_startup(gpointer user_data) {
+    gtk_widget_destroy(GTK_WIDGET(user_data));
+    return G_SOURCE_REMOVE;
+}
 
-    // Create scientific function grid (functions like sin, cos, sqrt, etc.)
-    GtkWidget *function_grid = gtk_grid_new();
-    gtk_grid_set_row_spacing(GTK_GRID(function_grid), 8);
-    gtk_grid_set_column_spacing(GTK_GRID(function_grid), 8);
-    gtk_grid_set_row_homogeneous(GTK_GRID(function_grid), TRUE);
-    gtk_grid_set_column_homogeneous(GTK_GRID(function_grid), TRUE);
-    gtk_box_pack_start(GTK_BOX(main_container), function_grid, FALSE, FALSE, 0);
-
-    // Define scientific function button layout: 2 rows x 4 columns
-    const char *function_button_layout[2][4] = {
-        // Row 0: Square root, log base 10, natural log, backspace
-        {"sqrt", "log", "ln", "⌫"},
-        // Row 1: Trigonometric functions, percentage
-        {"sin", "cos", "tan", "%"}};
-
-    // Create and place function buttons
-    for (int row = 0; row < 2; row++) {
-        for (int col = 0; col < 4; col++) {
-            GtkWidget *button =
-                create_button(function_button_layout[row][col], state);
-            gtk_widget_set_size_request(button, 70, 40);
-            gtk_grid_attach(GTK_GRID(function_grid), button, col, row, 1, 1);
-        }
+/**
+ * First draw of the window - the first frame is complete: report the
+ * startup time, then build what the frame did not need
+ */
+static gboolean on_first_frame(GtkWidget *window, cairo_t *cr,
+                               gpointer user_data) {
+    CalculatorState *state = (CalculatorState *)user_data;
+    g_signal_handlers_disconnect_by_func(window, on_first_frame, user_data);
+
+    double elapsed_ms = (g_get_monotonic_time() - startup_begin_time) / 1e3;
+    g_debug("First frame %.1f ms after startup", elapsed_ms);
+    if (startup_report) {
+        printf("startup %.1f ms\n", elapsed_ms);
+        g_idle_add(close_after_startup, window);
+        return FALSE;
     }
 
-    // Enable keyboard shortcuts for the entire window
-    gtk_widget_set_can_focus(window, TRUE);
-    g_signal_connect(window, "key-press-event", G_CALLBACK(on_key_press),
-                     state);
+    state->panels_source = g_idle_add_full(
+        G_PRIORITY_LOW, build_secondary_panels, state, NULL);
+    return FALSE;  // Let the window draw normally
+}
+
+/**
+ * Install the application style sheet for every widget on the screen
+ */
+static void load_application_css(void) {
+    GtkCssProvider *css_provider = gtk_css_provider_new();
+    gtk_css_provider_load_from_resource(css_provider,
+                                        UI_RESOURCE_PATH "calculator.css");
+    gtk_style_context_add_provider_for_screen(
+        gdk_screen_get_default(), GTK_STYLE_PROVIDER(css_provider),
+        GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
+    g_object_unref(css_provider);
+}
 
-    // Show all widgets
-    gtk_widget_show_all(window);
+/**
+ * Build the main calculator window from its compiled-in description and
+ * connect its handlers; the secondary panels follow after the first frame
+ */
+static void build_user_interface(GtkApplication *app, CalculatorState *state) {
+    GtkBuilder *builder = gtk_builder_new();
+    gtk_builder_add_callback_symbols(
+        builder, "on_button_clicked", G_CALLBACK(on_button_clicked),
+        "on_key_press", G_CALLBACK(on_key_press), "on_window_destroy",
+        G_CALLBACK(on_window_destroy), NULL);
+
+    GError *error = NULL;
+    if (!gtk_builder_add_from_resource(builder, UI_RESOURCE_PATH "calculator.ui",
+                                       &error)) {
+        g_error("Failed to load the user interface: %s", error->message);
+    }
+    gtk_builder_connect_signals(builder, state);
+
+    GtkWidget *window = GTK_WIDGET(gtk_builder_get_object(builder, "window"));
+    state->entry = GTK_WIDGET(gtk_builder_get_object(builder, "display"));
+    g_signal_connect(state->entry, "notify::cursor-position",
+                     G_CALLBACK(on_display_cursor_moved), state);
+    state->panel_box =
+        GTK_WIDGET(gtk_builder_get_object(builder, "main_container"));
+    gtk_window_set_application(GTK_WINDOW(window), app);
+    g_object_unref(builder);  // The window keeps its widgets alive
+
+    g_signal_connect_after(window, "draw", G_CALLBACK(on_first_frame), state);
+    gtk_widget_show(window);
 }
 
 /**
@@ -1009,11 +2765,25 @@ static void on_application_activate(GtkApplication *app, gpointer user_data) {
         return;
     }
 
-    state->input = g_string_new("");
+    state->input = input_buffer_new(on_input_changed, state);
     state->just_evaluated = false;
-    clear_error(state->last_error, sizeof(state->last_error));
+    state->calc = calc_context_new(NULL);
+    if (!state->calc) {
+        g_error("Failed to create evaluation context");
+        return;
+    }
+
+    // Open the persistent history (maps the log, indexes it when idle)
+    char *history_path = history_default_path();
+    state->history = history_open(history_path);
+    g_free(history_path);
+    if (state->history) {
+        state->history->indexed = on_history_indexed;
+        state->history->indexed_data = state;
+    }
 
     // Build and show the user interface
+    load_application_css();
     build_user_interface(app, state);
 }
 
@@ -1022,6 +2792,39 @@ static void on_application_activate(GtkApplication *app, gpointer user_data) {
  * Creates GTK application and runs main event loop
  */
 int main(int argc, char **argv) {
+    startup_begin_time = g_get_monotonic_time();
+
+    // Headless evaluation service: calculator --serve SOCKET [--workers N]
+    if (argc >= 3 && strcmp(argv[1], "--serve") == 0) {
+        int workers = 0;
+        if (argc >= 5 && strcmp(argv[3], "--workers") == 0) {
+            workers = atoi(argv[4]);
+        }
+        return run_evaluation_service(argv[2], workers);
+    }
+
+    // CSV column evaluation: calculator --csv EXPRESSION FILE [--workers N]
+    if (argc >= 4 && strcmp(argv[1], "--csv") == 0) {
+        int workers = 0;
+        if (argc >= 6 && strcmp(argv[4], "--workers") == 0) {
+            workers = atoi(argv[5]);
+        }
+        return run_csv_evaluation(argv[2], argv[3], workers);
+    }
+
+    // Statistics of a data file: calculator --stats FILE [--binary]
+    if (argc >= 3 && strcmp(argv[1], "--stats") == 0) {
+        bool binary = argc >= 4 && strcmp(argv[3], "--binary") == 0;
+        return run_stats(argv[2], binary);
+    }
+
+    // Startup benchmark: calculator --startup-time prints the time from
+    // here to the first frame of the window and quits
+    if (argc >= 2 && strcmp(argv[1], "--startup-time") == 0) {
+        startup_report = true;
+        argc = 1;  // Not an option GApplication knows
+    }
+
     // Create GTK application with unique identifier
     GtkApplication *app = gtk_application_new("com.example.c-gui-calculator",
                                               G_APPLICATION_DEFAULT_FLAGS);
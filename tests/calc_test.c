@@ -0,0 +1,900 @@
+/**
+ * ========================================================================
+ *    LIBCALC TESTS - Behavioral Checks of the Public Engine API
+ * ========================================================================
+ *
+ * Every feature of the engine has a test function below that evaluates
+ * expressions through the public API and checks the value, its exactness
+ * or the error message a user would see. Failures are printed with their
+ * line and the run continues, so one run lists every broken behavior.
+ *
+ * Usage:
+ *     calc_test            # exit status 1 if any check failed
+ */
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../libcalc/calc.h"
+
+/**
+ * =======================================================================
+ *                          CHECK HELPERS
+ * =======================================================================
+ */
+
+static int check_count = 0;    // Checks run so far
+static int failure_count = 0;  // Checks that failed
+
+/**
+ * Record a check; print the failure (with the line of the check) if the
+ * condition does not hold
+ */
+#define CHECK(condition, ...)                                   \
+    do {                                                        \
+        check_count++;                                          \
+        if (!(condition)) {                                     \
+            failure_count++;                                    \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__);     \
+            fprintf(stderr, __VA_ARGS__);                       \
+            fputc('\n', stderr);                                \
+        }                                                       \
+    } while (0)
+
+/**
+ * Whether two doubles agree to a relative (or, near zero, absolute)
+ * tolerance; infinities must match exactly
+ */
+static bool close_to(double actual, double expected, double tolerance) {
+    if (isinf(expected) || isinf(actual)) return actual == expected;
+    double scale = fmax(1.0, fabs(expected));
+    return fabs(actual - expected) <= tolerance * scale;
+}
+
+/**
+ * Check that an expression evaluates to a value (to 1e-12)
+ */
+#define EXPECT_VALUE(context, expression, expected)                         \
+    do {                                                                    \
+        double value_ = NAN;                                                \
+        bool ok_ = calc_evaluate(context, expression, &value_);             \
+        CHECK(ok_ && close_to(value_, expected, 1e-12),                     \
+              "%s = %.17g (%s), expected %.17g", expression, value_,        \
+              ok_ ? "ok" : calc_last_error(context), (double)(expected));   \
+    } while (0)
+
+/**
+ * Check that an expression evaluates to an exact fraction (an integer
+ * when the denominator is 1)
+ */
+#define EXPECT_EXACT(context, expression, numerator_, denominator_)         \
+    do {                                                                    \
+        CalcValue value_;                                                   \
+        bool ok_ = calc_evaluate_value(context, expression, &value_);       \
+        CalcValueType type_ =                                               \
+            denominator_ == 1 ? CALC_VALUE_INTEGER : CALC_VALUE_RATIONAL;   \
+        CHECK(ok_ && value_.type == type_ &&                                \
+                  value_.numerator == numerator_ &&                         \
+                  value_.denominator == denominator_,                       \
+              "%s = %lld/%lld (type %d, %s), expected %lld/%lld",           \
+              expression, ok_ ? value_.numerator : 0,                       \
+              ok_ ? value_.denominator : 0, ok_ ? (int)value_.type : -1,    \
+              ok_ ? "ok" : calc_last_error(context),                        \
+              (long long)(numerator_), (long long)(denominator_));          \
+    } while (0)
+
+/**
+ * Check that an expression fails with an error message that starts with
+ * `message`
+ */
+#define EXPECT_ERROR(context, expression, message)                          \
+    do {                                                                    \
+        double value_;                                                      \
+        bool ok_ = calc_evaluate(context, expression, &value_);             \
+        CHECK(!ok_ && strncmp(calc_last_error(context), message,            \
+                              strlen(message)) == 0,                        \
+              "%s: got \"%s\", expected error \"%s\"", expression,          \
+              ok_ ? "success" : calc_last_error(context), message);         \
+    } while (0)
+
+/**
+ * Check that an expression evaluates to a matrix with the given elements
+ */
+static void expect_matrix(CalcContext *context, int line,
+                          const char *expression, size_t rows,
+                          size_t columns, const double *elements) {
+    CalcValue value;
+    bool ok = calc_evaluate_value(context, expression, &value);
+    size_t actual_rows = 0, actual_columns = 0;
+    const double *actual =
+        ok ? calc_last_matrix(context, &actual_rows, &actual_columns) : NULL;
+    bool equal = ok && value.type == CALC_VALUE_MATRIX && actual &&
+                 actual_rows == rows && actual_columns == columns;
+    for (size_t i = 0; equal && i < rows * columns; i++) {
+        equal = close_to(actual[i], elements[i], 1e-12);
+    }
+    check_count++;
+    if (!equal) {
+        failure_count++;
+        fprintf(stderr, "%s:%d: %s: got %s %zux%zu, expected %zux%zu\n",
+                __FILE__, line, expression,
+                ok ? "matrix" : calc_last_error(context), actual_rows,
+                actual_columns, rows, columns);
+    }
+}
+
+#define EXPECT_MATRIX(context, expression, rows, columns, ...)       \
+    expect_matrix(context, __LINE__, expression, rows, columns,      \
+                  (const double[]){__VA_ARGS__})
+
+/**
+ * Context with the default options except for its precision
+ */
+static CalcContext *context_with_precision(CalcPrecision precision) {
+    CalcOptions options;
+    calc_options_init(&options);
+    options.precision = precision;
+    CalcContext *context = calc_context_new(&options);
+    if (!context) {
+        fprintf(stderr, "Failed to create evaluation context\n");
+        exit(2);
+    }
+    return context;
+}
+
+/**
+ * Allocation hooks that remember the blocks they made, so that a block
+ * resized or freed by the wrong allocator is counted instead of corrupting
+ * the heap
+ */
+typedef struct {
+    void *blocks[256];       // Blocks made by the hooks and not yet freed
+    size_t count;            // Entries of `blocks` in use
+    size_t foreign;          // Blocks resized or freed but not made here
+    size_t realloc_of_null;  // realloc_fn calls that made a new block
+} HookBlocks;
+
+static void hook_remember(HookBlocks *hooks, void *pointer) {
+    if (pointer && hooks->count < sizeof(hooks->blocks) / sizeof(void *)) {
+        hooks->blocks[hooks->count++] = pointer;
+    }
+}
+
+static bool hook_forget(HookBlocks *hooks, void *pointer) {
+    for (size_t i = 0; i < hooks->count; i++) {
+        if (hooks->blocks[i] == pointer) {
+            hooks->blocks[i] = hooks->blocks[--hooks->count];
+            return true;
+        }
+    }
+    hooks->foreign++;
+    return false;
+}
+
+static void *hook_malloc(size_t size, void *user_data) {
+    void *pointer = malloc(size);
+    hook_remember(user_data, pointer);
+    return pointer;
+}
+
+static void *hook_realloc(void *pointer, size_t size, void *user_data) {
+    HookBlocks *hooks = user_data;
+    if (pointer) {
+        hook_forget(hooks, pointer);
+    } else {
+        hooks->realloc_of_null++;
+    }
+    void *resized = realloc(pointer, size);
+    hook_remember(hooks, resized ? resized : pointer);
+    return resized;
+}
+
+static void hook_free(void *pointer, void *user_data) {
+    // A foreign block came from libc; leaving it is safer than freeing it
+    if (pointer && hook_forget(user_data, pointer)) free(pointer);
+}
+
+/**
+ * =======================================================================
+ *                                TESTS
+ * =======================================================================
+ */
+
+/**
+ * Operator precedence, functions and the messages of invalid input
+ */
+static void test_arithmetic(void) {
+    CalcContext *context = calc_context_new(NULL);
+    EXPECT_VALUE(context, "2 + 3 * 4", 14);
+    EXPECT_VALUE(context, "(2 + 3) * 4", 20);
+    EXPECT_VALUE(context, "15 / 3 + 2", 7);
+    EXPECT_VALUE(context, "2^3^2", 512);
+    EXPECT_VALUE(context, "-(3+2)", -5);
+    EXPECT_VALUE(context, "(-2)^3", -8);
+    EXPECT_VALUE(context, "50%", 0.5);
+    EXPECT_VALUE(context, "sqrt(16)", 4);
+    EXPECT_VALUE(context, "log(100)", 2);
+    EXPECT_VALUE(context, "sqrt(2)", 1.4142135623730951);
+    EXPECT_VALUE(context, "(5 + 3) * sqrt(16) / 2", 16);
+
+    EXPECT_ERROR(context, "1/0", "Division by zero");
+    EXPECT_ERROR(context, "sqrt(-4)",
+                 "Cannot take square root of negative number");
+    EXPECT_ERROR(context, "1+", "");
+    EXPECT_ERROR(context, "(1+2", "");
+    CHECK(calc_last_error(context)[0] != '\0',
+          "a syntax error has an empty message");
+
+    // A context stays usable after an error
+    EXPECT_VALUE(context, "1+1", 2);
+    CHECK(calc_last_error(context)[0] == '\0',
+          "error \"%s\" kept after a success", calc_last_error(context));
+    calc_context_free(context);
+}
+
+/**
+ * Allocation hooks: incomplete sets are refused, and every block is made,
+ * resized and freed by the hooks
+ */
+static void test_allocator(void) {
+    HookBlocks hooks = {0};
+    CalcOptions options;
+    calc_options_init(&options);
+    options.allocator.malloc_fn = hook_malloc;
+    options.allocator.free_fn = hook_free;
+    options.allocator.user_data = &hooks;
+    CHECK(!calc_context_new(&options), "malloc_fn and free_fn accepted");
+    CHECK(!calc_stats_new(&options.allocator, true),
+          "statistics with malloc_fn and free_fn");
+
+    for (int with_malloc = 0; with_malloc < 2; with_malloc++) {
+        memset(&hooks, 0, sizeof(hooks));
+        options.allocator.malloc_fn = with_malloc ? hook_malloc : NULL;
+        options.allocator.realloc_fn = hook_realloc;
+        CalcContext *context = calc_context_new(&options);
+        CHECK(context != NULL, "context with complete hooks refused");
+        if (!context) continue;
+        EXPECT_VALUE(context, "sqrt(2)^2 - 2 + mean(1, 2, 3)", 2);
+        EXPECT_VALUE(context, "det([1, 2; 3, 4])", -2);
+        EXPECT_VALUE(context, "iterate(x+1, 0, 3)", 3);
+        const char *names[] = {"x"};
+        CalcProgram *program = calc_compile(context, "x*x", names, 1);
+        CalcValue result;
+        CHECK(program && calc_program_evaluate(context, program,
+                                               (const double[]){3},
+                                               &result) &&
+                  result.real == 9,
+              "compiled x*x with hooks");
+        calc_program_free(program);
+        CalcStats *stats = calc_stats_new(&options.allocator, true);
+        CHECK(stats && calc_stats_add(stats, (const double[]){1, 2}, 2),
+              "statistics with hooks");
+        calc_stats_free(stats);
+        calc_context_free(context);
+
+        CHECK(hooks.count == 0 && hooks.foreign == 0,
+              "%zu blocks left, %zu foreign blocks (malloc_fn %s)",
+              hooks.count, hooks.foreign, with_malloc ? "set" : "NULL");
+        CHECK(with_malloc ? hooks.realloc_of_null == 0
+                          : hooks.realloc_of_null > 0,
+              "%zu new blocks from realloc_fn (malloc_fn %s)",
+              hooks.realloc_of_null, with_malloc ? "set" : "NULL");
+    }
+}
+
+/**
+ * Exact integer and rational results, and the precision that produced
+ * them
+ */
+static void test_exact(void) {
+    CalcContext *context = calc_context_new(NULL);
+    EXPECT_EXACT(context, "0.1 + 0.2 - 0.3", 0, 1);
+    EXPECT_EXACT(context, "1/3 + 1/6", 1, 2);
+    EXPECT_EXACT(context, "mean(1, 2, 4)", 7, 3);
+    EXPECT_EXACT(context, "var(2, 4, 4, 4, 5, 5, 7, 9)", 32, 7);
+    EXPECT_EXACT(context, "2^62", 4611686018427387904LL, 1);
+    EXPECT_EXACT(context, "-7/21", -1, 3);
+    EXPECT_EXACT(context, "sin(30)", 1, 2);
+    CHECK(calc_last_precision(context) == CALC_PRECISION_EXACT,
+          "sin(30) not exact");
+
+    // Literals are exact up to the 64-bit limits, whatever their length
+    EXPECT_EXACT(context, "9223372036854775807", 9223372036854775807LL, 1);
+    EXPECT_EXACT(context, "1000000000000000001*3", 3000000000000000003LL,
+                 1);
+    EXPECT_EXACT(context, "12345678901234567.5", 24691357802469135LL, 2);
+    EXPECT_EXACT(context, "0.000000000000000001", 1, 1000000000000000000LL);
+
+    // Overflowing the 64-bit rationals falls back to floating point
+    CalcValue value;
+    CHECK(calc_evaluate_value(context, "2^64", &value) &&
+              value.type == CALC_VALUE_REAL && value.real == 0x1p64,
+          "2^64 did not fall back to floating point");
+    CHECK(calc_evaluate_value(context, "9223372036854775808", &value) &&
+              value.type == CALC_VALUE_REAL && value.real == 0x1p63,
+          "2^63 as a literal did not fall back to floating point");
+
+    CalcContext *exact = context_with_precision(CALC_PRECISION_EXACT);
+    EXPECT_EXACT(exact, "3/4 * 4/9", 1, 3);
+    CHECK(!calc_evaluate_value(exact, "sqrt(2)", &value),
+          "sqrt(2) evaluated exactly");
+    calc_context_free(exact);
+    calc_context_free(context);
+}
+
+/**
+ * Radix literals, bitwise operators and formatting in other bases
+ */
+static void test_programmer(void) {
+    CalcContext *context = calc_context_new(NULL);
+    EXPECT_EXACT(context, "0xFF & 0x0F", 15, 1);
+    EXPECT_EXACT(context, "0b1010 | 0b0101", 15, 1);
+    EXPECT_EXACT(context, "0o17 xor 5", 10, 1);
+    EXPECT_EXACT(context, "1 << 40", 1099511627776LL, 1);
+    EXPECT_EXACT(context, "~0", -1, 1);
+    EXPECT_EXACT(context, "-9 >> 1", -5, 1);
+    EXPECT_EXACT(context, "1 | 2 xor 3 & 4 << 1", 3, 1);
+    EXPECT_ERROR(context, "1.5 & 1", "");
+
+    // Full-width masks: operands and literals are 64-bit two's complement
+    EXPECT_EXACT(context, "0xFFFFFFFFFFFFFFFF & 0xFF", 255, 1);
+    EXPECT_EXACT(context, "0x8000000000000000 | 1", -9223372036854775807LL,
+                 1);
+    EXPECT_EXACT(context, "0xFFFFFFFFFFFFFFFF", -1, 1);
+    EXPECT_EXACT(context, "~0 & 0xFFFF", 65535, 1);
+    EXPECT_ERROR(context, "2^64 & 1", "Bitwise operand exceeds 64 bits");
+    CalcContext *plain = context_with_precision(CALC_PRECISION_DOUBLE);
+    EXPECT_VALUE(plain, "0xFFFFFFFFFFFFFFFF & 0xFF", 255);
+    EXPECT_VALUE(plain, "2^63 + 2^62 | 0", -0x1p62);
+    calc_context_free(plain);
+    CalcContext *extended = context_with_precision(CALC_PRECISION_EXTENDED);
+    EXPECT_VALUE(extended, "0xFFFFFFFFFFFFFFFF + 0.5", -0.5);
+    calc_context_free(extended);
+
+    struct {
+        long long value;
+        int base;
+        const char *text;
+    } formats[] = {
+        {255, 16, "0xFF"},
+        {10, 2, "0b1010"},
+        {15, 8, "0o17"},
+        {-42, 10, "-42"},
+        {-1, 16, "0xFFFFFFFFFFFFFFFF"},
+        {-2, 8, "0o1777777777777777777776"},
+        {-9223372036854775807LL - 1, 16, "0x8000000000000000"},
+    };
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        CalcValue value = {CALC_VALUE_INTEGER, (double)formats[i].value,
+                           formats[i].value, 1};
+        char buffer[80];
+        bool ok = calc_format_integer(&value, formats[i].base, buffer,
+                                      sizeof(buffer));
+        CHECK(ok && strcmp(buffer, formats[i].text) == 0,
+              "%lld in base %d: \"%s\", expected \"%s\"", formats[i].value,
+              formats[i].base, ok ? buffer : "(failed)", formats[i].text);
+
+        // The text parses back to the same value
+        CalcValue parsed;
+        CHECK(ok && calc_evaluate_value(context, buffer, &parsed) &&
+                  parsed.numerator == formats[i].value,
+              "\"%s\" does not parse back to %lld", buffer,
+              formats[i].value);
+    }
+    CalcValue fraction = {CALC_VALUE_RATIONAL, 0.5, 1, 2};
+    char buffer[80];
+    CHECK(!calc_format_integer(&fraction, 16, buffer, sizeof(buffer)),
+          "1/2 formatted as an integer");
+    calc_context_free(context);
+}
+
+/**
+ * Degree trig kernels: exact values at special angles, undefined tangents
+ * and batch functions that agree with the expressions
+ */
+static void test_trig(void) {
+    CalcContext *context = calc_context_new(NULL);
+    EXPECT_VALUE(context, "sin(180)", 0);
+    EXPECT_VALUE(context, "cos(90)", 0);
+    EXPECT_VALUE(context, "cos(60)", 0.5);
+    EXPECT_VALUE(context, "tan(45)", 1);
+    EXPECT_VALUE(context, "sin(-3630)", -0.5);
+    EXPECT_VALUE(context, "2 * sin(30) + cos(60)", 1.5);
+    EXPECT_ERROR(context, "tan(90)", "");
+
+    double degrees[] = {0, 30, 45, 90, 135, 180, 270, 1e6 + 0.25, -720.5};
+    size_t count = sizeof(degrees) / sizeof(degrees[0]);
+    double sines[9], cosines[9], tangents[9];
+    calc_sin_degrees_batch(degrees, sines, count);
+    calc_cos_degrees_batch(degrees, cosines, count);
+    calc_tan_degrees_batch(degrees, tangents, count);
+    for (size_t i = 0; i < count; i++) {
+        char expression[64];
+        double value;
+        snprintf(expression, sizeof(expression), "sin(%.17g)", degrees[i]);
+        CHECK(calc_evaluate(context, expression, &value) &&
+                  value == sines[i],
+              "batch sin(%g) = %.17g differs from %s", degrees[i], sines[i],
+              expression);
+        snprintf(expression, sizeof(expression), "cos(%.17g)", degrees[i]);
+        CHECK(calc_evaluate(context, expression, &value) &&
+                  value == cosines[i],
+              "batch cos(%g) = %.17g differs from %s", degrees[i],
+              cosines[i], expression);
+    }
+    CHECK(isnan(tangents[3]) && isnan(tangents[6]),
+          "tan of 90 and 270 degrees is not NaN");
+    CHECK(tangents[2] == 1.0 && tangents[4] == -1.0,
+          "tan(45) = %.17g, tan(135) = %.17g", tangents[2], tangents[4]);
+    calc_context_free(context);
+}
+
+/**
+ * Expression size limits reject oversized input with a message
+ */
+static void test_limits(void) {
+    CalcContext *context = calc_context_new(NULL);
+    size_t depth = 300;
+    char *nested = malloc(2 * depth + 2);
+    memset(nested, '(', depth);
+    nested[depth] = '1';
+    memset(nested + depth + 1, ')', depth);
+    nested[2 * depth + 1] = '\0';
+    EXPECT_ERROR(context, nested, "Expression nested too deeply");
+    free(nested);
+
+    CalcOptions options;
+    calc_options_init(&options);
+    options.limits.max_length = 16;
+    options.limits.max_tokens = 8;
+    options.limits.max_steps = 1000;
+    CalcContext *limited = calc_context_new(&options);
+    EXPECT_ERROR(limited, "1+1+1+1+1+1+1+1+1+1", "Expression too long");
+    EXPECT_ERROR(limited, "1+1+1+1+1", "Expression has too many tokens");
+    EXPECT_VALUE(limited, "1+1+1+1", 4);
+    calc_context_free(limited);
+
+    calc_options_init(&options);
+    options.limits.max_steps = 1000;
+    limited = calc_context_new(&options);
+    EXPECT_VALUE(limited, "iterate(x+1, 0, 1000)", 1000);
+    EXPECT_ERROR(limited, "iterate(x+1, 0, 1001)", "");
+    calc_context_free(limited);
+    calc_context_free(context);
+}
+
+/**
+ * Compiled programs with variables
+ */
+static void test_compile(void) {
+    CalcContext *context = calc_context_new(NULL);
+    const char *names[] = {"price", "qty", "tax", "unused"};
+    CalcProgram *program =
+        calc_compile(context, "price*qty*(1+tax)", names, 4);
+    CHECK(program != NULL, "compile failed: %s", calc_last_error(context));
+    if (program) {
+        CHECK(calc_program_uses(program, 0) && calc_program_uses(program, 2),
+              "used variables not reported");
+        CHECK(!calc_program_uses(program, 3), "unused variable reported");
+
+        double values[] = {2.5, 4, 0.5, 0};
+        CalcValue result;
+        CHECK(calc_program_evaluate(context, program, values, &result) &&
+                  result.real == 15.0,
+              "price*qty*(1+tax) = %.17g", result.real);
+        calc_program_free(program);
+    }
+
+    CHECK(!calc_compile(context, "price*missing", names, 4),
+          "unknown variable compiled");
+
+    // Columns may start with a built-in name; only whole names are built in
+    const char *columns[] = {"cos_theta", "xor_flag", "sinA", "log2"};
+    double row[] = {0.5, 6, 3, 4};
+    const struct {
+        const char *formula;
+        double expected;
+    } prefixed[] = {
+        {"cos_theta*2", 1},
+        {"xor_flag xor 3", 5},
+        {"sinA+sin(0)", 3},
+        {"log2*3", 12},
+        {"cos(0)+log2", 5},
+    };
+    for (size_t i = 0; i < sizeof(prefixed) / sizeof(prefixed[0]); i++) {
+        CalcValue value = {0};
+        program = calc_compile(context, prefixed[i].formula, columns, 4);
+        CHECK(program && calc_program_evaluate(context, program, row,
+                                               &value) &&
+                  close_to(value.real, prefixed[i].expected, 1e-12),
+              "%s = %.17g (%s)", prefixed[i].formula, value.real,
+              calc_last_error(context));
+        calc_program_free(program);
+    }
+
+    // Incomplete formulas compile but fail when evaluated
+    double values[] = {1, 2, 3, 4};
+    CalcValue result;
+    program = calc_compile(context, "price*", names, 4);
+    CHECK(!program || !calc_program_evaluate(context, program, values,
+                                             &result),
+          "incomplete formula evaluated");
+    calc_program_free(program);
+    calc_context_free(context);
+}
+
+/**
+ * Formula libraries: write, map, look up, evaluate and detect damage
+ */
+static void test_library(void) {
+    CalcContext *context = calc_context_new(NULL);
+    const char *directory = getenv("TMPDIR");
+    char path[512];
+    snprintf(path, sizeof(path), "%s/calc_test.lib",
+             directory ? directory : "/tmp");
+
+    const char *variables[] = {"a", "b"};
+    CalcFormula formulas[] = {
+        {"total", "a*b", variables, 2},
+        {"area", "3*a^2", variables, 1},
+        {"third", "1/3", NULL, 0},
+    };
+    CHECK(calc_library_write(context, path, formulas, 3),
+          "write failed: %s", calc_last_error(context));
+
+    CalcLibrary *library = calc_library_open(context, path);
+    CHECK(library != NULL, "open failed: %s", calc_last_error(context));
+    if (library) {
+        CHECK(calc_library_count(library) == 3, "count %zu",
+              calc_library_count(library));
+        CHECK(strcmp(calc_library_name(library, 0), "area") == 0,
+              "formulas not in name order");
+        CHECK(calc_library_find(library, "missing") == 3,
+              "missing formula found");
+
+        size_t index = calc_library_find(library, "total");
+        CHECK(strcmp(calc_library_variable(library, index, 1), "b") == 0 &&
+                  calc_library_variable(library, index, 2) == NULL,
+              "variables of total");
+        CalcProgram *program = calc_library_program(context, library, index);
+        double values[] = {6, 7};
+        CalcValue result;
+        CHECK(program && calc_program_evaluate(context, program, values,
+                                               &result) &&
+                  result.type == CALC_VALUE_INTEGER && result.numerator == 42,
+              "total(6, 7) from the library");
+        calc_program_free(program);
+
+        program = calc_library_program(
+            context, library, calc_library_find(library, "third"));
+        CHECK(program && calc_program_evaluate(context, program, NULL,
+                                               &result) &&
+                  result.type == CALC_VALUE_RATIONAL &&
+                  result.numerator == 1 && result.denominator == 3,
+              "third from the library");
+        calc_program_free(program);
+        calc_library_close(library);
+    }
+
+    // A formula that does not compile names itself and writes nothing new
+    CalcFormula broken[] = {{"bad", "1+", NULL, 0}};
+    CHECK(!calc_library_write(context, path, broken, 1) &&
+              strstr(calc_last_error(context), "bad") != NULL,
+          "broken formula: \"%s\"", calc_last_error(context));
+
+    // Damage to a formula is found when its program is taken
+    FILE *file = fopen(path, "r+b");
+    if (file) {
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, size - 1, SEEK_SET);
+        int last = fgetc(file);
+        fseek(file, size - 1, SEEK_SET);
+        fputc(last ^ 0x20, file);
+        fclose(file);
+    }
+    library = calc_library_open(context, path);
+    bool rejected = !library;
+    for (size_t i = 0; library && i < calc_library_count(library); i++) {
+        CalcProgram *program = calc_library_program(context, library, i);
+        if (!program) rejected = true;
+        calc_program_free(program);
+    }
+    CHECK(rejected && strstr(calc_last_error(context), "corrupt") != NULL,
+          "damaged library accepted (\"%s\")", calc_last_error(context));
+    calc_library_close(library);
+    remove(path);
+
+    CHECK(!calc_library_open(context, path), "missing library opened");
+
+    // Iterated expressions are checked against the depth limit of the
+    // context that takes the program
+    CalcFormula nested[] = {{"nested", "iterate(iterate(x+1, x, 2), 0, 3)",
+                             NULL, 0}};
+    CHECK(calc_library_write(context, path, nested, 1),
+          "write failed: %s", calc_last_error(context));
+    library = calc_library_open(context, path);
+    if (library) {
+        CalcProgram *program = calc_library_program(context, library, 0);
+        CalcValue result;
+        CHECK(program &&
+                  calc_program_evaluate(context, program, NULL, &result) &&
+                  result.real == 6,
+              "nested iteration from the library");
+        calc_program_free(program);
+
+        CalcOptions options;
+        calc_options_init(&options);
+        options.limits.max_depth = 1;
+        CalcContext *shallow = calc_context_new(&options);
+        program = calc_library_program(shallow, library, 0);
+        CHECK(!program, "nesting beyond the depth limit accepted");
+        calc_program_free(program);
+        calc_context_free(shallow);
+        calc_library_close(library);
+    }
+
+    // Without a depth limit, nesting is checked without recursion
+    CalcOptions options;
+    calc_options_init(&options);
+    options.limits.max_depth = 0;
+    options.limits.max_length = 0;
+    options.limits.max_tokens = 0;
+    options.limits.max_memory = 0;
+    CalcContext *unlimited = calc_context_new(&options);
+    size_t levels = 200000;
+    char *deep = malloc(levels * 15 + 2);
+    if (unlimited && deep) {
+        char *end = deep;
+        for (size_t i = 0; i < levels; i++) end += sprintf(end, "iterate(");
+        *end++ = 'x';
+        for (size_t i = 0; i < levels; i++) end += sprintf(end, ", 0, 1)");
+        CalcFormula formula[] = {{"deep", deep, NULL, 0}};
+        CHECK(calc_library_write(unlimited, path, formula, 1),
+              "deep write failed: %s", calc_last_error(unlimited));
+        library = calc_library_open(unlimited, path);
+        CalcProgram *program =
+            library ? calc_library_program(unlimited, library, 0) : NULL;
+        CHECK(program != NULL, "deep formula rejected: %s",
+              calc_last_error(unlimited));
+        calc_program_free(program);
+        calc_library_close(library);
+    }
+    free(deep);
+    calc_context_free(unlimited);
+    remove(path);
+    calc_context_free(context);
+}
+
+/**
+ * Vector and matrix expressions
+ */
+static void test_matrix(void) {
+    CalcContext *context = calc_context_new(NULL);
+    EXPECT_MATRIX(context, "[1, 2; 3, 4] * [5; 6]", 2, 1, 17, 39);
+    EXPECT_MATRIX(context, "[1, 2; 3, 4] + 10", 2, 2, 11, 12, 13, 14);
+    EXPECT_MATRIX(context, "sqrt([4, 9, 16])", 1, 3, 2, 3, 4);
+    EXPECT_MATRIX(context, "inv([1, 2; 3, 4])", 2, 2, -2, 1, 1.5, -0.5);
+    EXPECT_MATRIX(context, "solve([2, 1; 1, 3], [3; 5])", 2, 1, 0.8, 1.4);
+    EXPECT_MATRIX(context, "transpose([1, 2, 3])", 3, 1, 1, 2, 3);
+    EXPECT_MATRIX(context, "[[1; 2], [3; 4]]", 2, 2, 1, 3, 2, 4);
+    EXPECT_VALUE(context, "[1, 2] * [3; 4]", 11);
+    EXPECT_VALUE(context, "dot([1, 2, 3], [4, 5, 6])", 32);
+    EXPECT_VALUE(context, "det([1, 2; 3, 4])", -2);
+    EXPECT_VALUE(context, "mean([1, 2; 3, 4])", 2.5);
+
+    EXPECT_ERROR(context, "[1, 2; 3]",
+                 "Matrix dimensions do not match between rows");
+    EXPECT_ERROR(context, "[1, 2] * [3, 4]",
+                 "Matrix dimensions do not match for product");
+    EXPECT_ERROR(context, "det([1, 2, 3])", "Matrix is not square");
+    EXPECT_ERROR(context, "inv([1, 2; 2, 4])", "Matrix is singular");
+    EXPECT_ERROR(context, "[]", "Empty matrix");
+
+    // A product large enough for the blocked kernel: every element of the
+    // square of a 40x40 matrix of ones is 40
+    char matrix[4096];
+    size_t length = 0;
+    for (int i = 0; i < 40; i++) {
+        for (int j = 0; j < 40; j++) {
+            length += snprintf(matrix + length, sizeof(matrix) - length,
+                               "%s1", j > 0 ? "," : i > 0 ? ";" : "");
+        }
+    }
+    char expression[8400];
+    snprintf(expression, sizeof(expression), "mean([%s] * [%s])", matrix,
+             matrix);
+    EXPECT_VALUE(context, expression, 40);
+    calc_context_free(context);
+}
+
+/**
+ * iterate, fixpoint and fixsteps
+ */
+static void test_iterate(void) {
+    CalcContext *context = calc_context_new(NULL);
+    EXPECT_VALUE(context, "iterate(x * 1.05, 100, 10)", 100 * pow(1.05, 10));
+    EXPECT_VALUE(context, "fixpoint((x + 2/x) / 2, 1)", sqrt(2.0));
+    EXPECT_VALUE(context, "fixsteps((x + 2/x) / 2, 1)", 6);
+    EXPECT_VALUE(context, "fixpoint(x/2, 1, 0.1)", 0.0625);
+    EXPECT_VALUE(context, "iterate(iterate(x*2, x, 2), 1, 3)", 64);
+    EXPECT_VALUE(context, "iterate(x+1, 5, 0)", 5);
+
+    EXPECT_ERROR(context, "iterate(x+1, 0, 2.5)",
+                 "Iteration count must be a non-negative integer");
+    EXPECT_ERROR(context, "fixpoint(2*x, 1)", "Iteration diverged");
+    EXPECT_ERROR(context, "fixpoint(x, 1, -1)",
+                 "Tolerance must be a non-negative number");
+    calc_context_free(context);
+}
+
+/**
+ * Aggregate functions and streaming statistics
+ */
+static void test_statistics(void) {
+    CalcContext *context = calc_context_new(NULL);
+    EXPECT_VALUE(context, "stddev(1, 2, 3, 4)", sqrt(5.0 / 3.0));
+    EXPECT_VALUE(context, "min(3, -1, 2)", -1);
+    EXPECT_VALUE(context, "max(3, -1, 2)", 3);
+    EXPECT_EXACT(context, "median(0.3, 0.1, 0.2, 0.4)", 1, 4);
+    EXPECT_VALUE(context, "percentile(90, 1, 2, 3, 4, 5)", 4.6);
+    calc_context_free(context);
+
+    // Values 1..100000 added in uneven pieces, half of them through a merge
+    enum { COUNT = 100000 };
+    double *values = malloc(sizeof(double) * COUNT);
+    for (int i = 0; i < COUNT; i++) values[i] = i + 1;
+    CalcStats *stats = calc_stats_new(NULL, true);
+    CalcStats *other = calc_stats_new(NULL, true);
+    CHECK(calc_stats_add(stats, values, 12345) &&
+              calc_stats_add(stats, values + 12345, COUNT / 2 - 12345) &&
+              calc_stats_add(other, values + COUNT / 2, COUNT / 2) &&
+              calc_stats_merge(stats, other),
+          "adding values failed");
+    double nan_value = NAN;
+    calc_stats_add(stats, &nan_value, 1);
+
+    CalcSummary summary;
+    calc_stats_summary(stats, &summary);
+    double n = COUNT;
+    CHECK(summary.count == COUNT && summary.nan_count == 1,
+          "count %llu, nan %llu", summary.count, summary.nan_count);
+    CHECK(close_to(summary.mean, (n + 1) / 2, 1e-14), "mean %.17g",
+          summary.mean);
+    CHECK(close_to(summary.variance, n * (n + 1) / 12, 1e-12),
+          "variance %.17g", summary.variance);
+    CHECK(summary.min == 1 && summary.max == n, "extremes %g, %g",
+          summary.min, summary.max);
+    CHECK(calc_stats_quantile(stats, 0) == 1 &&
+              calc_stats_quantile(stats, 100) == n,
+          "p0 and p100 are not the extremes");
+    double percentiles[] = {1, 25, 50, 90, 99.9};
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]);
+         i++) {
+        double expected = percentiles[i] / 100 * n;
+        double estimate = calc_stats_quantile(stats, percentiles[i]);
+        CHECK(fabs(estimate - expected) <= 0.005 * expected + 1,
+              "p%g = %.17g, expected about %g", percentiles[i], estimate,
+              expected);
+    }
+    calc_stats_free(other);
+    calc_stats_free(stats);
+    free(values);
+
+    CalcStats *plain = calc_stats_new(NULL, false);
+    calc_stats_add(plain, (const double[]){1, 2}, 2);
+    CHECK(isnan(calc_stats_quantile(plain, 50)),
+          "quantile without a sketch is not NaN");
+    calc_stats_summary(plain, &summary);
+    CHECK(summary.mean == 1.5 && summary.variance == 0.5,
+          "mean %g, variance %g", summary.mean, summary.variance);
+    calc_stats_free(plain);
+
+    // Zeros are reported as zero, not as the midpoint of their bucket
+    CalcStats *zeros = calc_stats_new(NULL, true);
+    calc_stats_add(zeros, (const double[]){-5, -1, 0, 0, -0.0, 1, 5}, 7);
+    CHECK(calc_stats_quantile(zeros, 50) == 0.0 &&
+              calc_stats_quantile(zeros, 75) == 0.0,
+          "p50 of zeros = %g, p75 = %g", calc_stats_quantile(zeros, 50),
+          calc_stats_quantile(zeros, 75));
+    CHECK(close_to(calc_stats_quantile(zeros, 90), 1, 0.01) &&
+              close_to(calc_stats_quantile(zeros, 20), -1, 0.01),
+          "p90 = %g, p20 = %g", calc_stats_quantile(zeros, 90),
+          calc_stats_quantile(zeros, 20));
+    calc_stats_free(zeros);
+}
+
+/**
+ * Results that lose their digits in double are recomputed in extended
+ * precision
+ */
+static void test_precision(void) {
+    CalcContext *context = context_with_precision(CALC_PRECISION_AUTO);
+    EXPECT_VALUE(context, "sqrt(2)^2 - 2", 0);
+    CHECK(calc_last_precision(context) == CALC_PRECISION_EXTENDED,
+          "cancellation trusted to double");
+    EXPECT_VALUE(context, "sqrt(16) + 1", 5);
+    CHECK(calc_last_precision(context) == CALC_PRECISION_DOUBLE,
+          "sqrt(16) + 1 re-evaluated");
+    calc_context_free(context);
+
+    CalcContext *extended = context_with_precision(CALC_PRECISION_EXTENDED);
+    double value;
+    CHECK(calc_evaluate(extended, "(1 + 1/10^20) - 1", &value) &&
+              fabs(value - 1e-20) < 1e-30,
+          "(1 + 1/10^20) - 1 = %.17g", value);
+    calc_context_free(extended);
+
+    CalcContext *plain = context_with_precision(CALC_PRECISION_DOUBLE);
+    EXPECT_VALUE(plain, "0.1 + 0.2", 0.30000000000000004);
+    calc_context_free(plain);
+
+    // Overflow is infinite in every precision, never NaN or zero
+    static const char *const overflows[] = {
+        "2^1024", "10^400", "2^1023*2", "2^1000*2^1000", "2^1023+2^1023",
+        "sqrt(2^1023*2)",
+    };
+    static const CalcPrecision precisions[] = {
+        CALC_PRECISION_AUTO, CALC_PRECISION_DOUBLE, CALC_PRECISION_EXTENDED,
+    };
+    for (size_t p = 0; p < sizeof(precisions) / sizeof(precisions[0]); p++) {
+        context = context_with_precision(precisions[p]);
+        for (size_t i = 0; i < sizeof(overflows) / sizeof(overflows[0]);
+             i++) {
+            CHECK(calc_evaluate(context, overflows[i], &value) &&
+                      isinf(value) && value > 0,
+                  "precision %d: %s = %g", (int)precisions[p], overflows[i],
+                  value);
+        }
+        CHECK(calc_evaluate(context, "-(2^1024)", &value) && isinf(value) &&
+                  value < 0,
+              "precision %d: -(2^1024) = %g", (int)precisions[p], value);
+        CHECK(calc_evaluate(context, "1/(2^1024)", &value) && value == 0.0,
+              "precision %d: 1/(2^1024) = %g", (int)precisions[p], value);
+
+        // Products just below the threshold stay finite
+        CHECK(calc_evaluate(context, "2^1023*1.9999999999999998", &value) &&
+                  value == DBL_MAX,
+              "precision %d: largest double = %.17g", (int)precisions[p],
+              value);
+        calc_context_free(context);
+    }
+}
+
+/**
+ * =======================================================================
+ *                                MAIN
+ * =======================================================================
+ */
+
+int main(void) {
+    static const struct {
+        const char *name;
+        void (*run)(void);
+    } tests[] = {
+        {"arithmetic", test_arithmetic},
+        {"allocator", test_allocator},
+        {"exact", test_exact},
+        {"programmer", test_programmer},
+        {"trig", test_trig},
+        {"limits", test_limits},
+        {"compile", test_compile},
+        {"library", test_library},
+        {"matrix", test_matrix},
+        {"iterate", test_iterate},
+        {"statistics", test_statistics},
+        {"precision", test_precision},
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        int failures_before = failure_count;
+        tests[i].run();
+        fprintf(stderr, "%-12s %s\n", tests[i].name,
+                failure_count == failures_before ? "ok" : "FAILED");
+    }
+    fprintf(stderr, "%d of %d checks failed\n", failure_count, check_count);
+    return failure_count > 0 ? 1 : 0;
+}
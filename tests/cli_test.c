@@ -0,0 +1,664 @@
+/**
+ * ========================================================================
+ *    CALCULATOR TESTS - Behavioral Checks of the Helpers in main.c
+ * ========================================================================
+ *
+ * The history log, the editable input buffer, the evaluation service and
+ * the CSV and statistics modes live in main.c as static functions, so
+ * this file includes main.c itself (with its main() renamed) and checks
+ * those functions directly. Nothing here opens a window; GTK is only
+ * needed to compile. Failures are printed with their line and the run
+ * continues, like tests/calc_test.c.
+ *
+ * Usage:
+ *     cli_test             # exit status 1 if any check failed
+ */
+
+#define main calculator_main
+#include "../main.c"
+#undef main
+
+#include <math.h>
+
+#ifdef G_OS_UNIX
+#include <poll.h>
+#endif
+
+/**
+ * =======================================================================
+ *                          CHECK HELPERS
+ * =======================================================================
+ */
+
+static int check_count = 0;    // Checks run so far
+static int failure_count = 0;  // Checks that failed
+
+/**
+ * Record a check; print the failure (with the line of the check) if the
+ * condition does not hold
+ */
+#define CHECK(condition, ...)                                   \
+    do {                                                        \
+        check_count++;                                          \
+        if (!(condition)) {                                     \
+            failure_count++;                                    \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__);     \
+            fprintf(stderr, __VA_ARGS__);                       \
+            fputc('\n', stderr);                                \
+        }                                                       \
+    } while (0)
+
+/**
+ * A number literal of `digits` significant digits: "0.000...0001" with
+ * the 1 in place `digits`, so the value is 10^-digits
+ */
+static GString *long_fraction(guint digits) {
+    GString *text = g_string_new("0.");
+    for (guint i = 1; i < digits; i++) g_string_append_c(text, '0');
+    g_string_append_c(text, '1');
+    return text;
+}
+
+/**
+ * =======================================================================
+ *                                TESTS
+ * =======================================================================
+ */
+
+/**
+ * Search a history log and join the matching expressions with spaces,
+ * newest first
+ */
+static GString *history_found(HistoryLog *log, const char *query,
+                              guint limit, bool *complete) {
+    guint64 matches[HISTORY_SEARCH_LIMIT];
+    guint count = history_search(log, query, matches, limit, complete);
+    GString *found = g_string_new(NULL);
+    for (guint i = 0; i < count; i++) {
+        const char *expression, *result;
+        gsize expression_len, result_len;
+        if (history_record_at(log, matches[i], &expression, &expression_len,
+                              &result, &result_len)) {
+            if (i > 0) g_string_append_c(found, ' ');
+            g_string_append_len(found, expression, expression_len);
+        }
+    }
+    return found;
+}
+
+/**
+ * Check that a search finds exactly the expressions in `expected`
+ */
+#define EXPECT_FOUND(log, query, expected)                                  \
+    do {                                                                    \
+        bool complete_;                                                     \
+        GString *found_ =                                                   \
+            history_found(log, query, HISTORY_SEARCH_LIMIT, &complete_);    \
+        CHECK(complete_ && strcmp(found_->str, expected) == 0,              \
+              "search '%s' found '%s', expected '%s'", query, found_->str,  \
+              expected);                                                    \
+        g_string_free(found_, TRUE);                                        \
+    } while (0)
+
+static void note_indexed(gpointer data) { *(bool *)data = true; }
+
+/**
+ * Write `text` as the whole history log at `path`
+ */
+static void write_history(const char *path, const char *text) {
+    FILE *file = fopen(path, "wb");
+    if (!file) return;
+    fputs(text, file);
+    fclose(file);
+}
+
+/**
+ * Run the background indexer of a log to the end
+ * @return: whether it told the `indexed` callback
+ */
+static bool index_history(HistoryLog *log) {
+    bool indexed = false;
+    log->indexed = note_indexed;
+    log->indexed_data = &indexed;
+    while (history_index_step(log) == G_SOURCE_CONTINUE) {
+    }
+    log->indexed = NULL;
+    return indexed && log->index_source == 0;
+}
+
+/**
+ * History search: the scan before the index is built, n-gram lookups
+ * after, records appended this session, a torn last record and a log too
+ * large to scan at once
+ */
+static void test_history_search(void) {
+    const char *directory = getenv("TMPDIR");
+    char path[512];
+    snprintf(path, sizeof(path), "%s/cli_test_history.log",
+             directory ? directory : "/tmp");
+
+    // The last record of the old log was torn by a crash
+    write_history(path,
+                  "sin(30)\t0.5\n2+2\t4\nsqrt(16)\t4\nsin(90)*2\t2\n"
+                  "1+1\t2\n3+4");
+    HistoryLog *log = history_open(path);
+    CHECK(log && log->index_source != 0, "history not opened");
+    if (!log) return;
+
+    // Not indexed yet: the records are scanned, newest first
+    EXPECT_FOUND(log, "sin", "sin(90)*2 sin(30)");
+    CHECK(index_history(log), "indexer did not finish");
+    CHECK(log->record_offsets->len == 5, "%u records indexed",
+          log->record_offsets->len);
+
+    // Trigrams, a bigram, a single byte and the empty query
+    EXPECT_FOUND(log, "sin", "sin(90)*2 sin(30)");
+    EXPECT_FOUND(log, "qrt(1", "sqrt(16)");
+    EXPECT_FOUND(log, "(3", "sin(30)");
+    EXPECT_FOUND(log, "+", "1+1 2+2");
+    EXPECT_FOUND(log, "", "1+1 sin(90)*2 sqrt(16) 2+2 sin(30)");
+    EXPECT_FOUND(log, "cos", "");
+    EXPECT_FOUND(log, "3+4", "");
+
+    // Appended records are indexed at once; both trigrams of "+2+3" occur
+    // in "+2+1*2+3" without the query itself
+    history_append(log, "7+2+1*2+3", "12");
+    history_append(log, "1+2+3", "6");
+    history_append(log, "1\t2", "bad");  // Would break the log format
+    EXPECT_FOUND(log, "+2+3", "1+2+3");
+    EXPECT_FOUND(log, "*2", "7+2+1*2+3 sin(90)*2");
+    CHECK(log->record_offsets->len == 7, "%u records after appending",
+          log->record_offsets->len);
+
+    bool complete;
+    GString *found = history_found(log, "", 2, &complete);
+    CHECK(strcmp(found->str, "1+2+3 7+2+1*2+3") == 0,
+          "limited search found '%s'", found->str);
+    g_string_free(found, TRUE);
+    history_close(log);
+
+    // The torn record was terminated on open, so it is read back with the
+    // records appended after it
+    log = history_open(path);
+    CHECK(log && index_history(log), "history not reopened");
+    if (log) {
+        CHECK(log->record_offsets->len == 8, "%u records after reopening",
+              log->record_offsets->len);
+        EXPECT_FOUND(log, "+2+3", "1+2+3");
+        EXPECT_FOUND(log, "+", "1+2+3 7+2+1*2+3 3+4 1+1 2+2");
+        history_close(log);
+    }
+
+    // In a log larger than one search may scan, the oldest record is only
+    // found once the indexer has reached it
+    GString *large = g_string_new("cos(0)\t1\n");
+    for (guint i = 0; large->len <= 2 * HISTORY_SCAN_LIMIT; i++) {
+        g_string_append_printf(large, "%u*%u\t%u\n", i, i, i * i);
+    }
+    write_history(path, large->str);
+    g_string_free(large, TRUE);
+    log = history_open(path);
+    if (log) {
+        found = history_found(log, "cos", HISTORY_SEARCH_LIMIT, &complete);
+        CHECK(!complete && found->len == 0,
+              "unindexed log scanned whole ('%s')", found->str);
+        g_string_free(found, TRUE);
+        CHECK(index_history(log), "indexer did not finish");
+        EXPECT_FOUND(log, "cos", "cos(0)");
+        history_close(log);
+    }
+    remove(path);
+}
+
+/**
+ * Check the shape of a rope: AVL balance, sizes that add up and leaves
+ * no larger than ROPE_LEAF_BYTES
+ */
+static bool rope_valid(const RopeNode *node) {
+    if (!node) return true;
+    if (node->height == 0) {
+        return node->bytes > 0 && node->bytes <= ROPE_LEAF_BYTES &&
+               (gsize)g_utf8_strlen(node->text, node->bytes) == node->chars;
+    }
+    guint left = rope_height(node->left), right = rope_height(node->right);
+    return node->left && node->right &&
+           MAX(left, right) - MIN(left, right) <= 1 &&
+           node->height == MAX(left, right) + 1 &&
+           node->bytes == node->left->bytes + node->right->bytes &&
+           node->chars == node->left->chars + node->right->chars &&
+           rope_valid(node->left) && rope_valid(node->right);
+}
+
+/**
+ * Input listener that replays every change on a flat copy of the text,
+ * the way the display follows the buffer
+ */
+static void mirror_change(const InputChange *change, gpointer data) {
+    GString *mirror = data;
+    const char *start = g_utf8_offset_to_pointer(mirror->str,
+                                                 change->position);
+    const char *end = g_utf8_offset_to_pointer(start, change->removed);
+    gsize offset = start - mirror->str;
+    g_string_erase(mirror, offset, end - start);
+    g_string_insert_len(mirror, offset, change->inserted,
+                        change->inserted_bytes);
+}
+
+/**
+ * Editing: insertions and deletions anywhere, UTF-8 text, cursor moves
+ * and the changes told to the listener
+ */
+static void test_input_edits(void) {
+    GString *mirror = g_string_new("");
+    GString *expected = g_string_new("");
+    InputBuffer *buffer = input_buffer_new(mirror_change, mirror);
+
+    input_buffer_insert(buffer, "sin(30)");
+    input_buffer_move(buffer, 4);
+    input_buffer_insert(buffer, "√π+");
+    CHECK(strcmp(input_buffer_text(buffer), "sin(√π+30)") == 0 &&
+              buffer->cursor == 7 && input_buffer_length(buffer) == 10,
+          "insert at cursor: '%s', cursor %zu", input_buffer_text(buffer),
+          buffer->cursor);
+    input_buffer_delete(buffer, true);
+    input_buffer_delete(buffer, false);
+    CHECK(strcmp(input_buffer_text(buffer), "sin(√π0)") == 0 &&
+              buffer->cursor == 6,
+          "backspace and delete: '%s', cursor %zu",
+          input_buffer_text(buffer), buffer->cursor);
+    input_buffer_insert(buffer, "\xff");  // Invalid UTF-8 is ignored
+    CHECK(strcmp(input_buffer_text(buffer), "sin(√π0)") == 0,
+          "invalid UTF-8 inserted");
+
+    // Many random edits against a flat model of the text
+    static const char *const pieces[] = {"1", "+", "sin(", "π", "23.5", "é",
+                                         "[1, 2; 3, 4]", "0123456789abcdef"
+                                         "0123456789abcdef0123456789abcdef"
+                                         "0123456789abcdef0123456789abcdef"
+                                         "0123456789abcdef0123456789abcdef"
+                                         "0123456789abcdef0123456789abcdef"};
+    input_buffer_set(buffer, "");
+    guint32 seed = 12345;
+    bool consistent = true;
+    for (int i = 0; i < 5000 && consistent; i++) {
+        seed = seed * 1103515245u + 12345u;
+        guint choice = (seed >> 8) % 10;
+        gsize length = input_buffer_length(buffer);
+        gsize position = length ? (seed >> 12) % (length + 1) : 0;
+        input_buffer_move(buffer, position);
+        if (choice < 6) {
+            const char *piece = pieces[(seed >> 4) % G_N_ELEMENTS(pieces)];
+            input_buffer_insert(buffer, piece);
+            gsize offset =
+                g_utf8_offset_to_pointer(expected->str, position) -
+                expected->str;
+            g_string_insert(expected, offset, piece);
+        } else if (length > 0) {
+            bool before = choice < 8;
+            if (before ? position > 0 : position < length) {
+                gsize at = before ? position - 1 : position;
+                const char *start =
+                    g_utf8_offset_to_pointer(expected->str, at);
+                g_string_erase(expected, start - expected->str,
+                               g_utf8_next_char(start) - start);
+            }
+            input_buffer_delete(buffer, before);
+        }
+        consistent = strcmp(input_buffer_text(buffer), expected->str) == 0 &&
+                     strcmp(mirror->str, expected->str) == 0 &&
+                     input_buffer_length(buffer) ==
+                         (gsize)g_utf8_strlen(expected->str, -1) &&
+                     (i % 250 != 0 || rope_valid(buffer->text));
+    }
+    CHECK(consistent, "random edits diverged from the model");
+    CHECK(rope_valid(buffer->text), "rope out of shape after edits");
+
+    input_buffer_free(buffer);
+    g_string_free(expected, TRUE);
+    g_string_free(mirror, TRUE);
+}
+
+/**
+ * Undo and redo: versions, cursors, the listener and the undo limit
+ */
+static void test_input_undo(void) {
+    GString *mirror = g_string_new("");
+    InputBuffer *buffer = input_buffer_new(mirror_change, mirror);
+    CHECK(!input_buffer_undo(buffer) && !input_buffer_redo(buffer),
+          "undo or redo of nothing");
+
+    input_buffer_insert(buffer, "12");
+    input_buffer_insert(buffer, "+π");
+    input_buffer_move(buffer, 1);
+    input_buffer_delete(buffer, true);
+    CHECK(strcmp(input_buffer_text(buffer), "2+π") == 0, "edits: '%s'",
+          input_buffer_text(buffer));
+
+    CHECK(input_buffer_undo(buffer) &&
+              strcmp(input_buffer_text(buffer), "12+π") == 0 &&
+              strcmp(mirror->str, "12+π") == 0 && buffer->cursor == 1,
+          "undo: '%s' (display '%s'), cursor %zu", input_buffer_text(buffer),
+          mirror->str, buffer->cursor);
+    CHECK(input_buffer_undo(buffer) &&
+              strcmp(input_buffer_text(buffer), "12") == 0,
+          "second undo: '%s'", input_buffer_text(buffer));
+    CHECK(input_buffer_redo(buffer) &&
+              strcmp(input_buffer_text(buffer), "12+π") == 0 &&
+              strcmp(mirror->str, "12+π") == 0,
+          "redo: '%s'", input_buffer_text(buffer));
+
+    // A new edit drops what could have been redone
+    input_buffer_move(buffer, 4);
+    input_buffer_insert(buffer, "1");
+    CHECK(!input_buffer_redo(buffer) &&
+              strcmp(input_buffer_text(buffer), "12+π1") == 0,
+          "redo after a new edit: '%s'", input_buffer_text(buffer));
+
+    // Only INPUT_UNDO_LIMIT versions are kept
+    input_buffer_set(buffer, "");
+    for (int i = 0; i < INPUT_UNDO_LIMIT + 50; i++) {
+        input_buffer_insert(buffer, "7");
+    }
+    int undone = 0;
+    while (input_buffer_undo(buffer)) undone++;
+    CHECK(undone == INPUT_UNDO_LIMIT &&
+              input_buffer_length(buffer) == 50 &&
+              strcmp(mirror->str, input_buffer_text(buffer)) == 0,
+          "%d undos left %zu characters", undone,
+          input_buffer_length(buffer));
+    int redone = 0;
+    while (input_buffer_redo(buffer)) redone++;
+    CHECK(redone == INPUT_UNDO_LIMIT &&
+              input_buffer_length(buffer) == INPUT_UNDO_LIMIT + 50 &&
+              rope_valid(buffer->text),
+          "%d redos gave %zu characters", redone,
+          input_buffer_length(buffer));
+
+    input_buffer_free(buffer);
+    g_string_free(mirror, TRUE);
+}
+
+#ifdef G_OS_UNIX
+
+/**
+ * Answers of the evaluation service to single lines: exact integers,
+ * round-tripping doubles, matrices, errors and overlong lines
+ */
+static void test_service_lines(void) {
+    ServiceContext *context = service_thread_context();
+    static const struct {
+        const char *line;
+        const char *answer;
+    } cases[] = {
+        {"2+2", "= 4\n"},
+        {"2^53+1", "= 9007199254740993\n"},
+        {"1/4", "= 0.25\n"},
+        {"1/3", "= 0.33333333333333331\n"},
+        {"[1,2;3,4]*2", "= [2,4;6,8]\n"},
+        {"1/0", "! Division by zero\n"},
+        {"((2+3)", "! Mismatched parentheses\n"},
+    };
+    GString *output = g_string_new(NULL);
+    for (gsize i = 0; i < G_N_ELEMENTS(cases); i++) {
+        g_string_truncate(output, 0);
+        service_evaluate_line(context, cases[i].line,
+                              (guint)strlen(cases[i].line), output);
+        CHECK(strcmp(output->str, cases[i].answer) == 0, "%s -> %s",
+              cases[i].line, output->str);
+    }
+
+    // The line itself need not be terminated
+    g_string_truncate(output, 0);
+    service_evaluate_line(context, "3*3+1", 3, output);
+    CHECK(strcmp(output->str, "= 9\n") == 0, "prefix line -> %s",
+          output->str);
+
+    GString *line = g_string_new(NULL);
+    while (line->len < SERVICE_MAX_LINE) g_string_append(line, "1+");
+    g_string_append_c(line, '1');
+    g_string_truncate(output, 0);
+    service_evaluate_line(context, line->str, (guint)line->len, output);
+    CHECK(strcmp(output->str, "! Expression too long\n") == 0,
+          "long line -> %s", output->str);
+    g_string_free(line, TRUE);
+    g_string_free(output, TRUE);
+}
+
+/**
+ * Pipelined requests over one connection: answers come back in request
+ * order, whether a batch is split across the worker pool or a line
+ * across two reads, and CR LF line ends are accepted
+ */
+static void test_service_connection(void) {
+    service_pool = g_thread_pool_new(service_worker, NULL, 4, TRUE, NULL);
+    service_clients = g_array_new(FALSE, FALSE, sizeof(int));
+
+    // More than SERVICE_READ_SIZE bytes, so reads end inside a line, and
+    // more than SERVICE_CHUNK_LINES lines per read, so batches are split
+    GString *requests = g_string_new(NULL);
+    GString *expected = g_string_new(NULL);
+    for (guint i = 0; requests->len <= 2 * SERVICE_READ_SIZE; i++) {
+        if (i % 1000 == 999) {
+            g_string_append(requests, "1/0\r\n");
+            g_string_append(expected, "! Division by zero\n");
+        } else {
+            g_string_append_printf(requests, "%u+1\n", i);
+            g_string_append_printf(expected, "= %u\n", i + 1);
+        }
+    }
+
+    int sockets[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0,
+          "socketpair: %s", strerror(errno));
+    g_mutex_lock(&service_lock);
+    g_array_append_val(service_clients, sockets[1]);
+    g_mutex_unlock(&service_lock);
+    GThread *server = g_thread_new("calc-connection", service_connection,
+                                   GINT_TO_POINTER(sockets[1]));
+
+    // Answers are read while the requests are sent, so neither side can
+    // fill the socket buffer and wait for the other
+    GString *answers = g_string_new(NULL);
+    gsize sent = 0;
+    bool writing = true;
+    for (;;) {
+        struct pollfd poll_fd = {sockets[0], POLLIN, 0};
+        if (writing) poll_fd.events |= POLLOUT;
+        if (poll(&poll_fd, 1, -1) < 0 && errno != EINTR) break;
+        if (writing && (poll_fd.revents & POLLOUT)) {
+            ssize_t written = write(sockets[0], requests->str + sent,
+                                    MIN(requests->len - sent, 4096));
+            if (written > 0) sent += (gsize)written;
+            if (sent == requests->len) {
+                shutdown(sockets[0], SHUT_WR);
+                writing = false;
+            }
+        }
+        if (poll_fd.revents & (POLLIN | POLLHUP)) {
+            char buffer[4096];
+            ssize_t received = read(sockets[0], buffer, sizeof(buffer));
+            if (received <= 0) break;
+            g_string_append_len(answers, buffer, (gsize)received);
+        }
+    }
+    g_thread_join(server);
+    close(sockets[0]);
+
+    CHECK(answers->len == expected->len &&
+              strcmp(answers->str, expected->str) == 0,
+          "%zu bytes of answers, expected %zu", answers->len, expected->len);
+    CHECK(service_clients->len == 0, "connection still registered");
+
+    g_string_free(answers, TRUE);
+    g_string_free(expected, TRUE);
+    g_string_free(requests, TRUE);
+    g_array_free(service_clients, TRUE);
+    service_clients = NULL;
+    g_thread_pool_free(service_pool, FALSE, TRUE);
+    service_pool = NULL;
+}
+
+#endif  // G_OS_UNIX
+
+/**
+ * Field splitting: quotes, empty fields and fields of any length
+ */
+static void test_csv_fields(void) {
+    static const char row[] = "a,\"b, \"\"c\"\"\",,d";
+    static const char *const expected[] = {"a", "b, \"c\"", "", "d"};
+    GString *field = g_string_new(NULL);
+    guint position = 0;
+    for (gsize i = 0; i < G_N_ELEMENTS(expected); i++) {
+        CHECK(csv_next_field(row, sizeof(row) - 1, &position, field) &&
+                  strcmp(field->str, expected[i]) == 0,
+              "field %zu = '%s', expected '%s'", i, field->str, expected[i]);
+    }
+    CHECK(!csv_next_field(row, sizeof(row) - 1, &position, field),
+          "field after the last one");
+
+    // Longer than any fixed buffer: read whole, never truncated
+    GString *number = long_fraction(300);
+    g_string_append(number, ",2");
+    position = 0;
+    CHECK(csv_next_field(number->str, number->len, &position, field) &&
+              field->len == number->len - 2,
+          "long field read as %zu bytes", field->len);
+    CHECK(csv_next_field(number->str, number->len, &position, field) &&
+              strcmp(field->str, "2") == 0,
+          "field after a long one = '%s'", field->str);
+    g_string_free(number, TRUE);
+    g_string_free(field, TRUE);
+}
+
+/**
+ * Whole rows: results, error messages and long numeric fields
+ */
+static void test_csv_rows(void) {
+    static const char header[] = "item, price ,qty";
+    CsvFormula formula = {0};
+    CHECK(csv_compile_formula(&formula, "price*qty", header,
+                              sizeof(header) - 1),
+          "formula did not compile");
+    if (!formula.program) return;
+    CHECK(formula.column_count == 3 && strcmp(formula.names[1], "price") == 0,
+          "header read as %u columns", formula.column_count);
+
+    static const struct {
+        const char *row;
+        const char *output;
+    } cases[] = {
+        {"pens,2.5,4", "pens,2.5,4,10\n"},
+        {"\"a, b\",1.5,2", "\"a, b\",1.5,2,3\n"},
+        {"x,abc,2", "x,abc,2,\"Column 'price' is not a number\"\n"},
+        {"x,3", "x,3,\"Column 'qty' is not a number\"\n"},
+    };
+    CalcContext *context = calc_context_new(NULL);
+    double values[4];
+    GString *field = g_string_new(NULL);
+    GString *output = g_string_new(NULL);
+    for (gsize i = 0; i < G_N_ELEMENTS(cases); i++) {
+        g_string_truncate(output, 0);
+        csv_evaluate_row(context, &formula, values, field, cases[i].row,
+                         strlen(cases[i].row), output);
+        CHECK(strcmp(output->str, cases[i].output) == 0, "%s -> %s",
+              cases[i].row, output->str);
+    }
+
+    // A price with 100 digits is the number it spells, not a prefix
+    GString *row = g_string_new("x,");
+    GString *price = long_fraction(100);
+    g_string_append_printf(row, "%s,1", price->str);
+    g_string_truncate(output, 0);
+    csv_evaluate_row(context, &formula, values, field, row->str, row->len,
+                     output);
+    CHECK(values[1] == 1e-100, "100-digit field parsed as %.17g", values[1]);
+
+    // A field that is invalid only after its first 63 bytes is rejected
+    // whole rather than cut to a valid prefix
+    g_string_printf(row, "x,%sx,1", price->str);
+    g_string_truncate(output, 0);
+    csv_evaluate_row(context, &formula, values, field, row->str, row->len,
+                     output);
+    CHECK(g_str_has_suffix(output->str,
+                           ",\"Column 'price' is not a number\"\n"),
+          "invalid long field gave %s", output->str + row->len);
+
+    g_string_free(price, TRUE);
+    g_string_free(row, TRUE);
+    g_string_free(output, TRUE);
+    g_string_free(field, TRUE);
+    calc_context_free(context);
+    calc_program_free(formula.program);
+    g_strfreev(formula.names);
+    g_free(formula.used);
+}
+
+/**
+ * Text blocks of the statistics mode: separators, cut-off numbers at the
+ * end of a block, invalid numbers and long numbers
+ */
+static void test_stats_text(void) {
+    GArray *values = g_array_new(FALSE, FALSE, sizeof(double));
+    gsize consumed;
+
+    static const char block[] = "1, 2;3\t-4.5\n  12";
+    CHECK(stats_parse_text(block, sizeof(block) - 1, false, values,
+                           &consumed) &&
+              values->len == 4 && consumed == sizeof(block) - 3,
+          "block parsed %u values, %zu bytes", values->len, consumed);
+    g_array_set_size(values, 0);
+    CHECK(stats_parse_text(block, sizeof(block) - 1, true, values,
+                           &consumed) &&
+              values->len == 5 && g_array_index(values, double, 4) == 12,
+          "final block parsed %u values", values->len);
+    g_array_set_size(values, 0);
+
+    static const char invalid[] = "1 2x 3";
+    CHECK(!stats_parse_text(invalid, sizeof(invalid) - 1, true, values,
+                            &consumed) &&
+              consumed == 2,
+          "invalid number reported at byte %zu", consumed);
+    g_array_set_size(values, 0);
+
+    GString *number = long_fraction(300);
+    CHECK(stats_parse_text(number->str, number->len, true, values,
+                           &consumed) &&
+              values->len == 1 && g_array_index(values, double, 0) == 1e-300,
+          "300-digit number parsed as %.17g",
+          values->len ? g_array_index(values, double, 0) : NAN);
+    g_string_free(number, TRUE);
+    g_array_free(values, TRUE);
+}
+
+/**
+ * =======================================================================
+ *                                MAIN
+ * =======================================================================
+ */
+
+int main(void) {
+    static const struct {
+        const char *name;
+        void (*run)(void);
+    } tests[] = {
+        {"history", test_history_search},
+        {"input edits", test_input_edits},
+        {"input undo", test_input_undo},
+#ifdef G_OS_UNIX
+        {"service line", test_service_lines},
+        {"service conn", test_service_connection},
+#endif
+        {"csv fields", test_csv_fields},
+        {"csv rows", test_csv_rows},
+        {"stats text", test_stats_text},
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        int failures_before = failure_count;
+        tests[i].run();
+        fprintf(stderr, "%-12s %s\n", tests[i].name,
+                failure_count == failures_before ? "ok" : "FAILED");
+    }
+    fprintf(stderr, "%d of %d checks failed\n", failure_count, check_count);
+    return failure_count > 0 ? 1 : 0;
+}